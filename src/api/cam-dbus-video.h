@@ -151,6 +151,50 @@ dbus_glib_marshal_cam_video_BOOLEAN__BOXED_POINTER_POINTER (GClosure     *closur
   g_value_set_boolean (return_value, v_return);
 }
 
+/* NONE:BOXED,POINTER */
+extern void dbus_glib_marshal_cam_video_VOID__BOXED_POINTER (GClosure     *closure,
+                                                             GValue       *return_value,
+                                                             guint         n_param_values,
+                                                             const GValue *param_values,
+                                                             gpointer      invocation_hint,
+                                                             gpointer      marshal_data);
+void
+dbus_glib_marshal_cam_video_VOID__BOXED_POINTER (GClosure     *closure,
+                                                 GValue       *return_value G_GNUC_UNUSED,
+                                                 guint         n_param_values,
+                                                 const GValue *param_values,
+                                                 gpointer      invocation_hint G_GNUC_UNUSED,
+                                                 gpointer      marshal_data)
+{
+  typedef void (*GMarshalFunc_VOID__BOXED_POINTER) (gpointer     data1,
+                                                    gpointer     arg_1,
+                                                    gpointer     arg_2,
+                                                    gpointer     data2);
+  GMarshalFunc_VOID__BOXED_POINTER callback;
+  GCClosure *cc = (GCClosure*) closure;
+  gpointer data1, data2;
+
+  g_return_if_fail (n_param_values == 3);
+
+  if (G_CCLOSURE_SWAP_DATA (closure))
+    {
+      data1 = closure->data;
+      data2 = g_value_peek_pointer (param_values + 0);
+    }
+  else
+    {
+      data1 = g_value_peek_pointer (param_values + 0);
+      data2 = closure->data;
+    }
+  callback = (GMarshalFunc_VOID__BOXED_POINTER) (marshal_data ? marshal_data : cc->callback);
+
+  callback (data1,
+            g_marshal_value_peek_boxed (param_values + 1),
+            g_marshal_value_peek_pointer (param_values + 2),
+            data2);
+}
+#define dbus_glib_marshal_cam_video_NONE__BOXED_POINTER	dbus_glib_marshal_cam_video_VOID__BOXED_POINTER
+
 G_END_DECLS
 
 #endif /* __dbus_glib_marshal_cam_video_MARSHAL_H__ */
@@ -171,12 +215,14 @@ static const DBusGMethodInfo dbus_glib_cam_video_methods[] = {
   { (GCallback) cam_video_stop, dbus_glib_marshal_cam_video_BOOLEAN__POINTER_POINTER, 702 },
   { (GCallback) cam_video_reset, dbus_glib_marshal_cam_video_BOOLEAN__POINTER_POINTER, 755 },
   { (GCallback) cam_video_overlay, dbus_glib_marshal_cam_video_BOOLEAN__BOXED_POINTER_POINTER, 809 },
+  { (GCallback) cam_video_thumbnail, dbus_glib_marshal_cam_video_BOOLEAN__BOXED_POINTER_POINTER, 882 },
+  { (GCallback) cam_video_grabframe, dbus_glib_marshal_cam_video_NONE__BOXED_POINTER, 951 },
 };
 
 const DBusGObjectInfo dbus_glib_cam_video_object_info = {  1,
   dbus_glib_cam_video_methods,
-  14,
-"ca.krontech.chronos.video\0get\0S\0names\0I\0as\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0set\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0describe\0S\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0status\0S\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0flush\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0configure\0S\0args\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0playback\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0livedisplay\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0recordfile\0S\0settings\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0liverecord\0S\0settings\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0pause\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0stop\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0reset\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0overlay\0S\0settings\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0\0",
+  16,
+"ca.krontech.chronos.video\0get\0S\0names\0I\0as\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0set\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0describe\0S\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0status\0S\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0flush\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0configure\0S\0args\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0playback\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0livedisplay\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0recordfile\0S\0settings\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0liverecord\0S\0settings\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0pause\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0stop\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0reset\0S\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0overlay\0S\0settings\0I\0a{sv}\0status\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0thumbnail\0S\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0ca.krontech.chronos.video\0grabframe\0A\0args\0I\0a{sv}\0data\0O\0F\0N\0a{sv}\0\0\0",
 "ca.krontech.chronos.video\0sof\0ca.krontech.chronos.video\0eof\0ca.krontech.chronos.video\0segment\0ca.krontech.chronos.video\0update\0\0",
 "\0"
 };
@@ -0,0 +1,243 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+
+#include "fpga-sensor.h"
+#include "image-stats.h"
+#include "auto-exposure.h"
+
+/* Frame period of the simulated sensor, allowing exposures up to 10ms. */
+#define AETEST_PERIOD_NSEC  10000000ULL
+
+/*
+ * Closed loop test of the auto exposure controller against a simulated
+ * image sensor. The scene is lit by a sequence of abrupt changes in light,
+ * and after each one the controller must settle onto the target (or onto
+ * the limits of the exposure range) within a bounded number of frames and
+ * without hunting back and forth.
+ */
+static const double aetest_lights[] = {
+    1.0,    /* Overcast daylight. */
+    8.0,    /* The sun comes out. */
+    0.5,    /* Back under a cloud. */
+    0.02,   /* Indoors, beyond the reach of the longest exposure. */
+    50.0,   /* Straight into bright sunlight. */
+    2.0,
+};
+
+/* Render the reflectance of a test scene: a mid grey subject under a white sky, over a dark foreground. */
+static void
+aetest_fill_scene(uint8_t *scene, unsigned int width, unsigned int height)
+{
+    unsigned int x, y;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint8_t r;
+            if (y < height / 4) r = 250;
+            else if (y > (height * 3) / 4) r = 12 + (x * 24) / width;
+            else r = 30 + ((x / 16 + y / 16) & 1) * 40;
+            *scene++ = r;
+        }
+    }
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Test the auto exposure loop against a simulated image sensor.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  frame resolution to simulate (default: 640x480)\n");
+    printf("  -n, --frames NUM      frames allowed to settle after each change in light (default: 20)\n");
+    printf("  -d, --damping VAL     fraction of the error left uncorrected by each update (default: 0.5)\n");
+    printf("  -t, --target LUMA     mean luma to aim for (default: 118)\n");
+    printf("  -v, --verbose         print the exposure of every frame\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long width = 640;
+    unsigned long height = 480;
+    unsigned long frames = 20;
+    int verbose = 0;
+    const char *shortopts = "r:n:d:t:vh";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"frames",      required_argument,  NULL, 'n'},
+        {"damping",     required_argument,  NULL, 'd'},
+        {"target",      required_argument,  NULL, 't'},
+        {"verbose",     no_argument,        NULL, 'v'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct auto_exposure ae;
+    struct image_sensor *sensor;
+    struct image_geometry g;
+    struct image_constraints c;
+    struct image_window meter;
+    struct image_stats stats;
+    unsigned long long tmax;
+    uint8_t *scene, *luma;
+    void *scratch;
+    unsigned int i;
+    int failed = 0;
+    char *end;
+    int opt;
+
+    auto_exposure_init(&ae);
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (opt) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') ||
+                    (width < 16) || (height < 16)) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                frames = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !frames) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'd':
+                ae.damping = strtod(optarg, &end);
+                if ((*end != '\0') || (ae.damping < 0) || (ae.damping >= 1)) {
+                    fprintf(stderr, "Invalid damping: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 't':
+                ae.target = strtod(optarg, &end);
+                if ((*end != '\0') || (ae.target < 1) || (ae.target > 254)) {
+                    fprintf(stderr, "Invalid target: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    sensor = sim_sensor_init(width, height);
+    scene = malloc(width * height);
+    luma = malloc(width * height);
+    scratch = malloc(IMAGE_STATS_SCRATCH(width, height));
+    if (!sensor || !scene || !luma || !scratch) {
+        fprintf(stderr, "Failed to allocate frame: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    aetest_fill_scene(scene, width, height);
+
+    g.hres = width;
+    g.vres = height;
+    g.hoffset = 0;
+    g.voffset = 0;
+    image_sensor_get_constraints(sensor, &g, &c);
+    image_sensor_set_period(sensor, &g, AETEST_PERIOD_NSEC);
+    tmax = image_sensor_max_exposure(&c, AETEST_PERIOD_NSEC);
+
+    /* Meter the centre of the frame, leaving out most of the sky. */
+    meter.x = width / 4;
+    meter.y = height / 5;
+    meter.width = width / 2;
+    meter.height = (height * 3) / 5;
+
+    for (i = 0; i < sizeof(aetest_lights) / sizeof(aetest_lights[0]); i++) {
+        unsigned long n, settled = 0, reversals = 0;
+        int direction = 0;
+        double mean = 0;
+
+        for (n = 0; n < frames; n++) {
+            unsigned long long exposure = sim_sensor_exposure(sensor);
+            unsigned long long next;
+            unsigned long long sum = 0, count = 0;
+            unsigned int bin;
+
+            sim_sensor_render(sensor, luma, scene, aetest_lights[i]);
+            image_stats(&stats, luma, width, height, width, 1, &meter, scratch);
+            for (bin = 0; bin < IMAGE_STATS_BINS; bin++) {
+                sum += (unsigned long long)stats.meter[bin] * bin;
+                count += stats.meter[bin];
+            }
+            mean = count ? (double)sum / count : 0;
+
+            next = auto_exposure_update(&ae, stats.meter, exposure, c.t_min_exposure, tmax);
+            image_sensor_set_exposure(sensor, &g, next);
+            next = sim_sensor_exposure(sensor);
+
+            /* Count every change of direction as a sign of hunting. */
+            if (next != exposure) {
+                int d = (next > exposure) ? 1 : -1;
+                if (direction && (d != direction)) reversals++;
+                direction = d;
+                settled = 0;
+            }
+            else if (!settled) {
+                settled = n + 1;
+            }
+
+            if (verbose) {
+                printf("\tframe %lu: exposure=%lluus mean=%.1f error=%+.2f\n",
+                       n, exposure / 1000, mean, ae.error);
+            }
+        }
+
+        printf("light %.2f: exposure=%lluus mean=%.1f error=%+.2f settled=%lu reversals=%lu\n",
+               aetest_lights[i], sim_sensor_exposure(sensor) / 1000, mean, ae.error, settled, reversals);
+        if (!settled || (reversals > 1)) {
+            printf("\tFAILED: the exposure did not settle\n");
+            failed = 1;
+        }
+        /* Unless pinned at a limit of the exposure range, the luma must reach the target. */
+        else if ((sim_sensor_exposure(sensor) > c.t_min_exposure) && (sim_sensor_exposure(sensor) < tmax) &&
+                 (fabs(ae.error) > (ae.tolerance * 2))) {
+            printf("\tFAILED: the exposure settled away from the target\n");
+            failed = 1;
+        }
+    }
+
+    free(scratch);
+    free(luma);
+    free(scene);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
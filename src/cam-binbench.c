@@ -0,0 +1,238 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bayer-bin.h"
+#include "demosaic.h"
+#include "utils.h"
+
+/*
+ * Benchmark and correctness check for the Bayer binning kernels. Frames of
+ * random 12-bit samples are packed the same way as video memory and binned
+ * down to half resolution by both the optimized and reference
+ * implementations, which must agree exactly for every Bayer pattern. A flat
+ * field of known color must also bin to exactly that color. For comparison,
+ * the time to demosaic the same frame at full resolution is also reported.
+ */
+/* Pack a frame of 12-bit samples the same way as video memory. */
+static void
+bench_pack(uint8_t *packed, const uint16_t *samples, unsigned long npixels)
+{
+    unsigned long i;
+    for (i = 0; i < npixels; i += 2) {
+        *packed++ = samples[i] & 0xff;
+        *packed++ = (samples[i] >> 8) | ((samples[i + 1] & 0x0f) << 4);
+        *packed++ = samples[i + 1] >> 4;
+    }
+}
+
+/* Bin a packed frame, returning the elapsed time in microseconds. */
+static unsigned long long
+bench_bin(uint16_t *out, const uint8_t *packed, unsigned long width, unsigned long height,
+          int luma, unsigned int cfa, const uint16_t *wbal, int ref)
+{
+    unsigned long long start = clock_usec(CLOCK_MONOTONIC);
+    unsigned long rowbytes = (width * 3) / 2;
+    unsigned long y;
+
+    for (y = 0; y < height; y += 2) {
+        const uint8_t *r0 = packed + y * rowbytes;
+        const uint8_t *r1 = r0 + rowbytes;
+        if (luma && ref) bayer_bin_luma_ref(out, r0, r1, width / 2);
+        else if (luma) bayer_bin_luma(out, r0, r1, width / 2);
+        else if (ref) bayer_bin_rgb_ref(out, r0, r1, width / 2, cfa, wbal);
+        else bayer_bin_rgb(out, r0, r1, width / 2, cfa, wbal);
+        out += (width / 2) * (luma ? 1 : 3);
+    }
+    return clock_usec(CLOCK_MONOTONIC) - start;
+}
+
+/* Bin a flat field of known color with unity gains, returning the number of wrong pixels. */
+static unsigned long
+bench_flat(uint16_t *samples, uint8_t *packed, uint16_t *out, unsigned long width, unsigned long height, unsigned int cfa)
+{
+    const uint16_t unity[3] = {4096, 4096, 4096};
+    const uint16_t color[3] = {1000, 2000, 3000};
+    unsigned long errors = 0;
+    unsigned long x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            unsigned int xred = ((x & 1) == (cfa & 1));
+            unsigned int yred = ((y & 1) == ((cfa >> 1) & 1));
+            unsigned int chan = (xred && yred) ? 0 : (!xred && !yred) ? 2 : 1;
+            /* Split green by one code, which the average should undo. */
+            samples[y * width + x] = color[chan] + ((chan == 1) ? (yred ? 1 : -1) : 0);
+        }
+    }
+    bench_pack(packed, samples, width * height);
+    bench_bin(out, packed, width, height, 0, cfa, unity, 0);
+    for (x = 0; x < (width / 2) * (height / 2); x++) {
+        if ((out[x * 3] != color[0]) || (out[x * 3 + 1] != color[1]) || (out[x * 3 + 2] != color[2])) errors++;
+    }
+    return errors;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Benchmark and verify 2x2 binning of packed Bayer frames.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  frame resolution to bin (default: 1280x1024)\n");
+    printf("  -n, --count NUM       number of frames to bin (default: 10)\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long width = 1280;
+    unsigned long height = 1024;
+    unsigned long count = 10;
+    const char *shortopts = "r:n:h";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"count",       required_argument,  NULL, 'n'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    const char *cfanames[] = {"rggb", "grbg", "gbrg", "bggr"};
+    const uint16_t wbal[3] = {7250, 4096, 6100};
+    struct demosaic_params params = {
+        .method = DEMOSAIC_BILINEAR,
+        .cfa = DEMOSAIC_CFA_GRBG,
+        .bits = 12,
+        .matrix = {4096, 0, 0, 0, 4096, 0, 0, 0, 4096},
+    };
+    unsigned long long start, cpu, elapsed;
+    uint16_t *samples, *ref, *out, *rgb;
+    uint8_t *packed;
+    void *scratch;
+    unsigned long npixels, i;
+    unsigned int cfa;
+    int failed = 0;
+    char *end;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') ||
+                    (width < 4) || (height < 4) || (width & 1) || (height & 1)) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                count = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !count) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* Leave an odd number of cells on each row to exercise the leftovers. */
+    width += 14;
+    npixels = width * height;
+    samples = malloc(npixels * sizeof(uint16_t));
+    packed = malloc((npixels * 3) / 2);
+    ref = malloc((npixels / 4) * 3 * sizeof(uint16_t));
+    out = malloc((npixels / 4) * 3 * sizeof(uint16_t));
+    rgb = malloc(npixels * 3 * sizeof(uint16_t));
+    scratch = malloc(DEMOSAIC_SCRATCH(width));
+    if (!samples || !packed || !ref || !out || !rgb || !scratch) {
+        fprintf(stderr, "Failed to allocate frame: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    for (i = 0; i < npixels; i++) {
+        samples[i] = rand() & 0xfff;
+    }
+    bench_pack(packed, samples, npixels);
+
+    for (cfa = DEMOSAIC_CFA_RGGB; cfa <= DEMOSAIC_CFA_BGGR + 1; cfa++) {
+        int luma = (cfa > DEMOSAIC_CFA_BGGR);
+        unsigned long nout = (npixels / 4) * (luma ? 1 : 3);
+        unsigned long long reftime;
+        size_t mismatch = 0;
+
+        reftime = bench_bin(ref, packed, width, height, luma, cfa, wbal, 1);
+        elapsed = 0;
+        cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID);
+        for (i = 0; i < count; i++) {
+            elapsed += bench_bin(out, packed, width, height, luma, cfa, wbal, 0);
+        }
+        cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+        for (i = 0; i < nout; i++) {
+            if (out[i] != ref[i]) mismatch++;
+        }
+        printf("%s: %lux%lu\n", luma ? "luma" : cfanames[cfa], width, height);
+        printf("\treference:   %llu us/frame\n", reftime);
+        printf("\toptimized:   %llu us/frame (%llu us cpu)\n", elapsed / count, cpu / count);
+        printf("\tmismatches:  %zu\n", mismatch);
+        if (mismatch) failed = 1;
+    }
+
+    /* Known colors, which leaves a flat field in the frame, but the demosaic is only being timed. */
+    for (cfa = DEMOSAIC_CFA_RGGB; cfa <= DEMOSAIC_CFA_BGGR; cfa++) {
+        unsigned long errors = bench_flat(samples, packed, out, width, height, cfa);
+        if (errors) {
+            fprintf(stderr, "%s: %lu wrong pixels binning a flat field\n", cfanames[cfa], errors);
+            failed = 1;
+        }
+    }
+
+    /* The full-resolution demosaic which binning replaces for previews. */
+    start = clock_usec(CLOCK_MONOTONIC);
+    for (i = 0; i < count; i++) {
+        demosaic(rgb, samples, width, height, &params, scratch);
+    }
+    start = clock_usec(CLOCK_MONOTONIC) - start;
+    printf("demosaic: %lux%lu\n", width, height);
+    printf("\toptimized:   %llu us/frame\n", start / count);
+
+    free(scratch);
+    free(rgb);
+    free(out);
+    free(ref);
+    free(packed);
+    free(samples);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,474 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "calibrate.h"
+#include "crc32c.h"
+#include "demosaic.h"
+#include "fpga.h"
+#include "recovery.h"
+#include "utils.h"
+
+/*
+ * Convert an archive of raw video memory, dumped by cam-recover --dump, into
+ * the same DNG or TIFF frames that cam-recover would have written on the
+ * camera. The parts of the archive are mapped read-only and shared by a pool of worker
+ * threads, each of which takes the next frame to unpack, calibrate and
+ * write out, so the conversion scales with the cores of the host. Each
+ * frame is checked against its CRC-32C from the camera before conversion,
+ * and frames that are corrupt, or that failed readout verification on the
+ * camera, are still converted, but reported.
+ */
+#define CONVERT_MAX_JOBS    64
+
+struct convert_part {
+    void                    *map;
+    size_t                  size;
+    const uint8_t           *frames;
+};
+
+struct convert_state {
+    const struct recovery_archive *archive;
+    struct convert_part     *parts;
+    unsigned long           nparts;
+    const struct recovery_archive_frame *table;
+    const char              *outdir;
+    int                     tiff;
+    struct calibration      cal;
+    struct demosaic_params  params;
+    uint8_t                 header[RECOVERY_HEADER_SIZE];
+
+    pthread_mutex_t         mutex;
+    unsigned long           nframes;
+    unsigned long           next;
+    unsigned long           done;
+    unsigned long           errors;
+    unsigned long           corrupt;
+};
+
+/* Write out an I/O vector in full, picking up after any short writes. */
+static int
+convert_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt) {
+        ssize_t ret = writev(fd, iov, iovcnt);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (iovcnt && ((size_t)ret >= iov->iov_len)) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+/* Map a part of the archive, returning zero on success. */
+static int
+convert_map_part(const char *filename, struct convert_part *part)
+{
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &st) < 0)) {
+        fprintf(stderr, "Failed to open archive \'%s\': %s\n", filename, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    part->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (part->map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map archive \'%s\': %s\n", filename, strerror(errno));
+        part->map = NULL;
+        return -1;
+    }
+    part->size = st.st_size;
+    part->frames = part->map;
+    madvise(part->map, part->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+/* Find the packed pixels of a frame, in whichever part of the archive holds it. */
+static const uint8_t *
+convert_frame_data(struct convert_state *state, unsigned long index)
+{
+    const struct recovery_archive *archive = state->archive;
+    const struct convert_part *part = &state->parts[index / archive->part_frames];
+    return part->frames + (size_t)(index % archive->part_frames) * archive->frame_size;
+}
+
+/* Check a frame against its checksum and flags from the frame table. */
+static int
+convert_check_frame(struct convert_state *state, unsigned long index)
+{
+    const struct recovery_archive *archive = state->archive;
+    const struct recovery_archive_frame *entry = &state->table[index];
+    uint32_t crc = crc32c(0, convert_frame_data(state, index), archive->frame_size);
+
+    if (crc != entry->crc32c) {
+        fprintf(stderr, "Frame %lu is corrupt (CRC-32C %08x, expected %08lx)\n",
+                (unsigned long)entry->frameno, crc, (unsigned long)entry->crc32c);
+        return -1;
+    }
+    if (entry->flags & RECOVERY_FRAME_BADREAD) {
+        fprintf(stderr, "Frame %lu failed readout verification on the camera\n", (unsigned long)entry->frameno);
+        return -1;
+    }
+    return 0;
+}
+
+/* Unpack, calibrate and write out one frame, exactly as cam-recover would have. */
+static int
+convert_frame(struct convert_state *state, unsigned long index, uint16_t *pixels, uint16_t *rgb, void *scratch)
+{
+    const struct recovery_archive *archive = state->archive;
+    const uint8_t *raw = convert_frame_data(state, index);
+    size_t npix = (size_t)archive->hres * archive->vres;
+    char filename[PATH_MAX];
+    struct iovec iov[2];
+    int fd;
+
+    calibrate_unpack(pixels, raw, &state->cal, 0, archive->vres);
+    iov[1].iov_base = pixels;
+    iov[1].iov_len = npix * sizeof(uint16_t);
+    if (state->tiff && rgb) {
+        demosaic(rgb, pixels, archive->hres, archive->vres, &state->params, scratch);
+        iov[1].iov_base = rgb;
+        iov[1].iov_len = npix * sizeof(uint16_t) * 3;
+    }
+    else if (state->tiff) {
+        /* Scale greyscale up to the full 16-bit range. */
+        size_t i;
+        for (i = 0; i < npix; i++) {
+            pixels[i] <<= (16 - SENSOR_DATA_WIDTH);
+        }
+    }
+    iov[0].iov_base = state->header;
+    iov[0].iov_len = sizeof(state->header);
+
+    snprintf(filename, sizeof(filename), state->tiff ? "%s/frame_%06lu.tiff" : "%s/frame_%06lu.dng",
+             state->outdir, (unsigned long)state->table[index].frameno);
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create file \'%s\': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    if ((convert_writev(fd, iov, 2) < 0) || (close(fd) != 0)) {
+        fprintf(stderr, "Failed to write frame \'%s\': %s\n", filename, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void *
+convert_thread(void *arg)
+{
+    struct convert_state *state = arg;
+    size_t npix = (size_t)state->archive->hres * state->archive->vres;
+    int color = state->tiff && (state->archive->flags & RECOVERY_FLAG_COLOR);
+    uint16_t *pixels = malloc(npix * sizeof(uint16_t));
+    uint16_t *rgb = color ? malloc(npix * sizeof(uint16_t) * 3) : NULL;
+    void *scratch = color ? malloc(DEMOSAIC_SCRATCH(state->archive->hres)) : NULL;
+
+    if (!pixels || (color && (!rgb || !scratch))) {
+        fprintf(stderr, "Failed to allocate frame memory: %s\n", strerror(errno));
+        pthread_mutex_lock(&state->mutex);
+        state->errors++;
+        pthread_mutex_unlock(&state->mutex);
+        goto done;
+    }
+
+    for (;;) {
+        unsigned long index;
+        int ret, bad;
+
+        pthread_mutex_lock(&state->mutex);
+        index = state->next++;
+        pthread_mutex_unlock(&state->mutex);
+        if (index >= state->nframes) break;
+
+        bad = convert_check_frame(state, index);
+        ret = convert_frame(state, index, pixels, rgb, scratch);
+
+        pthread_mutex_lock(&state->mutex);
+        if (bad < 0) state->corrupt++;
+        if (ret < 0) state->errors++;
+        else state->done++;
+        pthread_mutex_unlock(&state->mutex);
+    }
+
+done:
+    free(scratch);
+    free(rgb);
+    free(pixels);
+    return NULL;
+}
+
+/* Unpack the calibration data, padding the column arrays for the SIMD kernels. */
+static int
+convert_load_caldata(struct convert_state *state)
+{
+    const struct recovery_archive *archive = state->archive;
+    const uint8_t *src = (const uint8_t *)archive + archive->cal_offset;
+    size_t hres = archive->hres;
+    size_t npix = hres * archive->vres;
+    size_t ncols = CALIBRATE_ALIGN(hres);
+    int16_t *cols = calloc(ncols * 3, sizeof(int16_t));
+    int16_t *fpn = calloc(CALIBRATE_ALIGN(npix) + 16, sizeof(int16_t));
+
+    if (!cols || !fpn) {
+        fprintf(stderr, "Failed to allocate calibration data: %s\n", strerror(errno));
+        free(cols);
+        free(fpn);
+        return -1;
+    }
+    memcpy(cols, src, hres * sizeof(int16_t));
+    memcpy(cols + ncols, src + hres * sizeof(int16_t), hres * sizeof(int16_t));
+    memcpy(cols + ncols * 2, src + hres * sizeof(int16_t) * 2, hres * sizeof(int16_t));
+
+    state->cal.npoints = (archive->flags & RECOVERY_FLAG_3POINT) ? 3 : 2;
+    state->cal.hres = hres;
+    state->cal.gain = (uint16_t *)cols;
+    state->cal.offset = cols + ncols;
+    state->cal.curve = cols + ncols * 2;
+    if (crc32c(0, src + hres * sizeof(int16_t) * 3, archive->frame_size) != archive->fpn_crc32c) {
+        fprintf(stderr, "Warning: FPN frame is corrupt, calibration may be inaccurate\n");
+    }
+    calibrate_unpack_fpn(fpn, src + hres * sizeof(int16_t) * 3, npix, state->cal.npoints);
+    state->cal.fpn = fpn;
+    return 0;
+}
+
+/* List the video segments, in the same format as cam-recover. */
+static int
+convert_write_segments(const struct recovery_archive *archive, const char *outdir)
+{
+    const struct recovery_archive_segment *segtab;
+    char filename[PATH_MAX];
+    uint32_t i;
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), "%s/segments.txt", outdir);
+    fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to create file %s (%s)\n", filename, strerror(errno));
+        return -1;
+    }
+    segtab = (const struct recovery_archive_segment *)((const uint8_t *)archive + archive->seg_offset);
+    fprintf(fp, "Video Segments:\n");
+    for (i = 0; i < archive->nsegments; i++) {
+        fprintf(fp, "Segment %3lu: start=0x%08lx offset=%lu length=%lu\n",
+                (unsigned long)segtab[i].segno, (unsigned long)segtab[i].start,
+                (unsigned long)segtab[i].offset, (unsigned long)segtab[i].nframes);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options] ARCHIVE DIR\n\n", argv[0]);
+    printf("Convert an archive of raw video memory, as dumped by cam-recover --dump,\n");
+    printf("into a sequence of calibrated DNG or TIFF images in DIR. The rest of the\n");
+    printf("parts of the archive are read from alongside it, as ARCHIVE.1, ARCHIVE.2...\n\n");
+
+    printf("options:\n");
+    printf("  -t, --tiff        demosaic frames and save them as 16-bit RGB TIFF instead of DNG\n");
+    printf("  -j, --jobs NUM    convert NUM frames in parallel (default: one per CPU)\n");
+    printf("  --help            display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    const char *shortopts = "htj:";
+    const struct option options[] = {
+        {"tiff",    no_argument,        NULL, 't'},
+        {"jobs",    required_argument,  NULL, 'j'},
+        {"help",    no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct convert_state state;
+    const struct recovery_archive *archive;
+    pthread_t threads[CONVERT_MAX_JOBS];
+    long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long long start;
+    char filename[PATH_MAX];
+    unsigned long p;
+    long nframes;
+    char *end;
+    int c, i;
+
+    memset(&state, 0, sizeof(state));
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 't':
+                state.tiff = 1;
+                break;
+
+            case 'j':
+                njobs = strtol(optarg, &end, 10);
+                if ((*end != '\0') || (njobs <= 0)) {
+                    fprintf(stderr, "Invalid job count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if ((argc - optind) != 2) {
+        usage(argc, argv);
+        return EXIT_FAILURE;
+    }
+    if (njobs <= 0) njobs = 1;
+    if (njobs > CONVERT_MAX_JOBS) njobs = CONVERT_MAX_JOBS;
+    state.outdir = argv[optind + 1];
+
+    /* Map the first part of the archive and make sure it's sane. */
+    state.parts = calloc(1, sizeof(struct convert_part));
+    if (!state.parts || (convert_map_part(argv[optind], &state.parts[0]) < 0)) {
+        return EXIT_FAILURE;
+    }
+    archive = state.parts[0].map;
+    nframes = archive ? recovery_archive_check(archive, state.parts[0].size) : -1;
+    if (nframes < 0) {
+        fprintf(stderr, "Invalid archive \'%s\'\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    printf("Archive: %ux%u %s, %u segments, %u frames\n", archive->hres, archive->vres,
+            (archive->flags & RECOVERY_FLAG_COLOR) ? "color" : "mono", archive->nsegments, archive->nframes);
+    state.parts[0].frames += archive->data_offset;
+    state.nparts = 1;
+
+    /* Map the rest of the parts, for as long as the frames before them were all there. */
+    p = (archive->nframes + archive->part_frames - 1) / archive->part_frames;
+    if (p > 1) {
+        struct convert_part *parts = realloc(state.parts, p * sizeof(struct convert_part));
+        if (!parts) {
+            fprintf(stderr, "Failed to allocate archive parts: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        memset(parts + 1, 0, (p - 1) * sizeof(struct convert_part));
+        state.parts = parts;
+    }
+    while ((state.nparts < p) && ((unsigned long)nframes == (state.nparts * archive->part_frames))) {
+        struct convert_part *part = &state.parts[state.nparts];
+        unsigned long count;
+
+        recovery_archive_part(filename, sizeof(filename), argv[optind], state.nparts);
+        if (convert_map_part(filename, part) < 0) break;
+        state.nparts++;
+
+        count = part->size / archive->frame_size;
+        if (count > archive->part_frames) count = archive->part_frames;
+        if (count > (archive->nframes - nframes)) count = archive->nframes - nframes;
+        nframes += count;
+    }
+    if ((unsigned long)nframes < archive->nframes) {
+        fprintf(stderr, "Archive is truncated, only %ld frames can be converted\n", nframes);
+    }
+
+    state.archive = archive;
+    state.table = (const struct recovery_archive_frame *)((const uint8_t *)archive + archive->table_offset);
+    state.nframes = nframes;
+    if (convert_load_caldata(&state) < 0) {
+        return EXIT_FAILURE;
+    }
+    recovery_build_header(state.header, archive->hres, archive->vres, archive->flags, archive->wbal, state.tiff);
+    state.params.method = DEMOSAIC_EDGE;
+    state.params.cfa = DEMOSAIC_CFA_GRBG;
+    state.params.bits = SENSOR_DATA_WIDTH;
+    demosaic_matrix(&state.params, archive->ccm, archive->wbal);
+
+    if ((mkdir(state.outdir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) && (errno != EEXIST)) {
+        fprintf(stderr, "Unable to create directory %s (%s)\n", state.outdir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (convert_write_segments(archive, state.outdir) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    /* Convert the frames. */
+    start = clock_usec(CLOCK_MONOTONIC);
+    pthread_mutex_init(&state.mutex, NULL);
+    for (i = 0; i < njobs; i++) {
+        if (pthread_create(&threads[i], NULL, convert_thread, &state) != 0) {
+            fprintf(stderr, "Failed to start conversion thread: %s\n", strerror(errno));
+            break;
+        }
+    }
+    if (i == 0) {
+        return EXIT_FAILURE;
+    }
+    while (i > 0) {
+        pthread_join(threads[--i], NULL);
+    }
+    start = clock_usec(CLOCK_MONOTONIC) - start;
+    pthread_mutex_destroy(&state.mutex);
+
+    printf("Converted %lu frames in %.2f s (%.1f fps) using %ld jobs\n", state.done,
+            start / 1000000.0, start ? (state.done * 1000000.0) / start : 0.0, njobs);
+    if (state.errors) {
+        fprintf(stderr, "Failed to convert %lu frames\n", state.errors);
+    }
+    if (state.corrupt) {
+        fprintf(stderr, "Converted %lu frames that failed verification\n", state.corrupt);
+    }
+    if (((unsigned long)nframes < archive->nframes) || state.corrupt) {
+        state.errors++;
+    }
+    free((void *)state.cal.fpn);
+    free((void *)state.cal.gain);
+    for (p = 0; p < state.nparts; p++) {
+        if (state.parts[p].map) munmap(state.parts[p].map, state.parts[p].size);
+    }
+    free(state.parts);
+    return state.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "demosaic.h"
+#include "utils.h"
+
+/* Minimum acceptable quality against the synthetic scene. */
+#define BENCH_MIN_PSNR  30.0
+
+/*
+ * Benchmark and correctness check for the demosaic kernels. A synthetic
+ * 12-bit RGB scene is sampled through a Bayer filter, and then demosaiced
+ * by both the optimized and reference implementations. The two must agree
+ * exactly, and the result must be a reasonable reconstruction of the scene.
+ */
+/* Render smooth color gradients overlaid with a sharp-edged disc, both of which the demosaic should preserve. */
+static void
+bench_fill_scene(uint16_t *rgb, unsigned int width, unsigned int height)
+{
+    unsigned int x, y;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            int dx = (int)x - (int)width / 2;
+            int dy = (int)y - (int)height / 2;
+            unsigned int r = (x * 4095) / width;
+            unsigned int g = (y * 4095) / height;
+            unsigned int b = 4095 - ((x + y) * 4095) / (width + height);
+            if ((dx * dx + dy * dy) < (int)(height * height / 16)) {
+                r = 3500; g = 3000; b = 400;
+            }
+            *rgb++ = r;
+            *rgb++ = g;
+            *rgb++ = b;
+        }
+    }
+}
+
+/* Sample the scene through a Bayer filter. */
+static void
+bench_mosaic(uint16_t *bayer, const uint16_t *rgb, unsigned int width, unsigned int height, unsigned int cfa)
+{
+    unsigned int x, y;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            unsigned int xred = ((x & 1) == (cfa & 1));
+            unsigned int yred = ((y & 1) == ((cfa >> 1) & 1));
+            unsigned int chan = (xred && yred) ? 0 : (!xred && !yred) ? 2 : 1;
+            bayer[y * width + x] = rgb[(y * width + x) * 3 + chan];
+        }
+    }
+}
+
+/* Peak signal to noise ratio of a 16-bit image, ignoring a border where the edge handling dominates. */
+static double
+bench_psnr(const uint16_t *a, const uint16_t *b, unsigned int width, unsigned int height, unsigned int border)
+{
+    double sse = 0;
+    unsigned long n = 0;
+    unsigned int x, y, c;
+
+    for (y = border; y < (height - border); y++) {
+        for (x = border; x < (width - border); x++) {
+            for (c = 0; c < 3; c++) {
+                double diff = (double)a[(y * width + x) * 3 + c] - (double)b[(y * width + x) * 3 + c];
+                sse += diff * diff;
+                n++;
+            }
+        }
+    }
+    if (sse == 0) return INFINITY;
+    return 10.0 * log10((65535.0 * 65535.0) / (sse / n));
+}
+
+/* Write 16-bit RGB as a binary PPM, which is big-endian. */
+static int
+bench_write_ppm(const char *filename, const uint16_t *rgb, unsigned int width, unsigned int height)
+{
+    FILE *fp = fopen(filename, "wb");
+    size_t i;
+
+    if (!fp) {
+        fprintf(stderr, "Failed to create \'%s\': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "P6\n%u %u\n65535\n", width, height);
+    for (i = 0; i < (size_t)width * height * 3; i++) {
+        fputc(rgb[i] >> 8, fp);
+        fputc(rgb[i] & 0xff, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Benchmark and verify demosaicing of synthetic Bayer frames.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  frame resolution to demosaic (default: 1280x1024)\n");
+    printf("  -n, --count NUM       number of frames to demosaic (default: 10)\n");
+    printf("  -m, --method NAME     demosaic method, bilinear or edge (default: both)\n");
+    printf("  -o, --output FILE     write the last demosaiced frame to FILE as a PPM\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long width = 1280;
+    unsigned long height = 1024;
+    unsigned long count = 10;
+    int method = -1;
+    const char *output = NULL;
+    const char *shortopts = "r:n:m:o:h";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"count",       required_argument,  NULL, 'n'},
+        {"method",      required_argument,  NULL, 'm'},
+        {"output",      required_argument,  NULL, 'o'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    const char *names[] = {"bilinear", "edge"};
+    struct demosaic_params params = {
+        .cfa = DEMOSAIC_CFA_GRBG,
+        .bits = 12,
+        .matrix = {4096, 0, 0, 0, 4096, 0, 0, 0, 4096},
+    };
+    uint16_t *scene, *bayer, *ref, *rgb;
+    void *scratch;
+    unsigned int m;
+    unsigned long i;
+    int failed = 0;
+    char *end;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') ||
+                    (width < 4) || (height < 4) || (width & 1)) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                count = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !count) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'm':
+                if (strcasecmp(optarg, "bilinear") == 0) method = DEMOSAIC_BILINEAR;
+                else if (strcasecmp(optarg, "edge") == 0) method = DEMOSAIC_EDGE;
+                else {
+                    fprintf(stderr, "Invalid method: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    scene = malloc(width * height * 3 * sizeof(uint16_t));
+    bayer = malloc(width * height * sizeof(uint16_t));
+    ref = malloc(width * height * 3 * sizeof(uint16_t));
+    rgb = malloc(width * height * 3 * sizeof(uint16_t));
+    scratch = malloc(DEMOSAIC_SCRATCH(width));
+    if (!scene || !bayer || !ref || !rgb || !scratch) {
+        fprintf(stderr, "Failed to allocate frame: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    bench_fill_scene(scene, width, height);
+    bench_mosaic(bayer, scene, width, height, params.cfa);
+
+    /* Compare against the scene scaled to 16 bits, the same as the demosaic output. */
+    for (i = 0; i < (width * height * 3); i++) {
+        scene[i] <<= 4;
+    }
+
+    for (m = DEMOSAIC_BILINEAR; m <= DEMOSAIC_EDGE; m++) {
+        unsigned long long start, cpu, reftime;
+        double psnr;
+        size_t mismatch = 0;
+
+        if ((method >= 0) && (m != (unsigned int)method)) continue;
+        params.method = m;
+
+        start = clock_usec(CLOCK_MONOTONIC);
+        demosaic_ref(ref, bayer, width, height, &params);
+        reftime = clock_usec(CLOCK_MONOTONIC) - start;
+
+        start = clock_usec(CLOCK_MONOTONIC);
+        cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID);
+        for (i = 0; i < count; i++) {
+            demosaic(rgb, bayer, width, height, &params, scratch);
+        }
+        cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+        start = clock_usec(CLOCK_MONOTONIC) - start;
+
+        for (i = 0; i < (width * height * 3); i++) {
+            if (rgb[i] != ref[i]) mismatch++;
+        }
+        psnr = bench_psnr(rgb, scene, width, height, 2);
+
+        printf("%s: %lux%lu\n", names[m], width, height);
+        printf("\treference:   %llu us/frame\n", reftime);
+        printf("\toptimized:   %llu us/frame (%llu us cpu)\n", start / count, cpu / count);
+        printf("\tmismatches:  %zu\n", mismatch);
+        printf("\tPSNR:        %.2f dB\n", psnr);
+        if (mismatch || (psnr < BENCH_MIN_PSNR)) {
+            failed = 1;
+        }
+        if (output) {
+            bench_write_ppm(output, rgb, width, height);
+        }
+    }
+
+    free(scratch);
+    free(rgb);
+    free(ref);
+    free(bayer);
+    free(scene);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
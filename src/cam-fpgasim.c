@@ -0,0 +1,364 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "fpga.h"
+
+/*
+ * Create and capture simulated FPGA state for the FPGA_SIM_ENV backend. The
+ * dump command saves the registers and video RAM of a live camera, and the
+ * create command builds a synthetic recording for testing on a host. Either
+ * way, the tools can then be pointed at the result by setting FPGA_SIM_ENV
+ * to the directory.
+ */
+#define SIM_FRAME_ALIGN     64      /* Frames start on a VRAM burst, in words. */
+#define SIM_DUMP_CHUNK      32768   /* Words per readout when dumping video RAM. */
+
+static int
+sim_write_file(const char *dir, const char *name, const void *data, size_t len)
+{
+    char filename[PATH_MAX];
+    const uint8_t *p = data;
+    int fd;
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create file \'%s\': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to write file \'%s\': %s\n", filename, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    close(fd);
+    return 0;
+}
+
+/*===============================================
+ * Synthetic Recordings
+ *===============================================
+ */
+/* A test pattern of diagonal ramps, with a bar that steps across with each frame. */
+static unsigned int
+sim_pattern(unsigned int x, unsigned int y, unsigned long frameno, unsigned int hres)
+{
+    unsigned int bar = (frameno * 16) % hres;
+    if ((x >= bar) && (x < bar + 16)) return 0xfff;
+    return ((x + y) * 4) & 0xfff;
+}
+
+/* Pack a frame into the 12-bit format of video RAM, as unpacked by calibrate_unpack(). */
+static void
+sim_pack_frame(uint8_t *dest, unsigned int hres, unsigned int vres, unsigned long frameno)
+{
+    unsigned int x, y;
+    for (y = 0; y < vres; y++) {
+        for (x = 0; x < hres; x += 2) {
+            unsigned int a = sim_pattern(x, y, frameno, hres);
+            unsigned int b = sim_pattern(x + 1, y, frameno, hres);
+            *dest++ = a & 0xff;
+            *dest++ = (a >> 8) | ((b & 0x0f) << 4);
+            *dest++ = b >> 4;
+        }
+    }
+}
+
+static int
+sim_create(const char *dir, unsigned int hres, unsigned int vres, unsigned int nframes, unsigned int nsegs, int color)
+{
+    uint8_t *regs = calloc(1, FPGA_SIM_REG_SIZE);
+    struct fpga fpga;
+    uint32_t framesz = ((hres * vres * 3) / 2 + FPGA_FRAME_WORD_SIZE - 1) / FPGA_FRAME_WORD_SIZE;
+    size_t vramsize;
+    uint8_t *vram;
+    unsigned int i, seg;
+    int ret;
+
+    if (!regs) {
+        fprintf(stderr, "Memory allocation failed: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(&fpga, 0, sizeof(fpga));
+    fpga.reg = (volatile uint16_t *)regs;
+    fpga_setup(&fpga);
+
+    /* Lay out memory as FPN, three live display frames, and then the recording region. */
+    framesz = (framesz + SIM_FRAME_ALIGN - 1) & ~(SIM_FRAME_ALIGN - 1);
+    fpga.seq->frame_size = framesz;
+    fpga.seq->live_addr[0] = framesz * 1;
+    fpga.seq->live_addr[1] = framesz * 2;
+    fpga.seq->live_addr[2] = framesz * 3;
+    fpga.seq->region_start = framesz * 4;
+    fpga.seq->region_stop = fpga.seq->region_start + framesz * nframes * nsegs;
+    fpga.seq->status = SEQ_STATUS_FIFO_EMPTY;
+    fpga.display->fpn_address = 0;
+    fpga.display->frame_address = fpga.seq->live_addr[0];
+    fpga.display->h_res = hres;
+    fpga.display->v_res = vres;
+    fpga.display->control = color ? DISPLAY_CTL_COLOR_MODE : 0;
+    fpga.display->gainctl = 0;
+    for (i = 0; i < 3; i++) {
+        fpga.display->wbal[i] = 4096;
+        fpga.display->ccm_red[i] = (i == 0) ? 4096 : 0;
+        fpga.display->ccm_green[i] = (i == 1) ? 4096 : 0;
+        fpga.display->ccm_blue[i] = (i == 2) ? 4096 : 0;
+    }
+    for (i = 0; i < hres; i++) {
+        fpga.reg[FPGA_COL_GAIN_BASE / sizeof(uint16_t) + i] = 4096;
+    }
+    fpga.vram->identifier = VRAM_IDENTIFIER;
+    fpga.segments->identifier = SEGMENT_IDENTIFIER;
+
+    /* One segment table entry for each contiguous recording. */
+    for (seg = 0; seg < nsegs; seg++) {
+        struct fpga_segment_entry entry;
+        entry.start = fpga.seq->region_start + seg * nframes * framesz;
+        entry.end = entry.start + (nframes - 1) * framesz;
+        entry.last = entry.end;
+        entry.data = seg & SEGMENT_DATA_BLOCKNO;
+        memcpy((void *)&fpga.segments->data[seg % 128], &entry, sizeof(entry));
+        fpga.seq->last_addr = entry.last;
+    }
+    fpga.segments->blockno = nsegs;
+
+    /* A blank FPN frame and live frames, followed by the test pattern. */
+    vramsize = (size_t)fpga.seq->region_stop * FPGA_FRAME_WORD_SIZE;
+    vram = calloc(1, vramsize);
+    if (!vram) {
+        fprintf(stderr, "Failed to allocate %zu bytes of video RAM: %s\n", vramsize, strerror(errno));
+        free(regs);
+        return -1;
+    }
+    for (i = 0; i < (nframes * nsegs); i++) {
+        size_t offset = (size_t)(fpga.seq->region_start + i * framesz) * FPGA_FRAME_WORD_SIZE;
+        sim_pack_frame(vram + offset, hres, vres, i);
+    }
+
+    printf("Creating %ux%u %s simulation with %u segments of %u frames in %s\n",
+            hres, vres, color ? "color" : "monochrome", nsegs, nframes, dir);
+    ret = sim_write_file(dir, FPGA_SIM_REGISTERS, regs, FPGA_SIM_REG_SIZE);
+    if (ret == 0) {
+        ret = sim_write_file(dir, FPGA_SIM_VRAM, vram, vramsize);
+    }
+    free(vram);
+    free(regs);
+    return ret;
+}
+
+/*===============================================
+ * Camera Memory Dumps
+ *===============================================
+ */
+static int
+sim_dump(const char *dir)
+{
+    struct fpga *fpga = fpga_open();
+    uint16_t *regs;
+    uint8_t *chunk;
+    uint32_t addr, end;
+    size_t skip[2];
+    size_t i;
+    char filename[PATH_MAX];
+    int fd;
+
+    if (!fpga) {
+        fprintf(stderr, "Failed to open FPGA register space: %s\n", strerror(errno));
+        return -1;
+    }
+    regs = calloc(1, FPGA_SIM_REG_SIZE);
+    chunk = malloc(SIM_DUMP_CHUNK * FPGA_FRAME_WORD_SIZE);
+    if (!regs || !chunk) {
+        fprintf(stderr, "Memory allocation failed: %s\n", strerror(errno));
+        free(regs);
+        free(chunk);
+        fpga_close(fpga);
+        return -1;
+    }
+
+    /* Copy the registers, except for the FIFOs, which would lose data if read. */
+    skip[0] = ((uintptr_t)&fpga->seq->md_fifo_read - (uintptr_t)fpga->reg) / sizeof(uint16_t);
+    skip[1] = ((uintptr_t)&fpga->sensor->sci_fifo_read - (uintptr_t)fpga->reg) / sizeof(uint16_t);
+    for (i = 0; i < (FPGA_SIM_REG_SIZE / sizeof(uint16_t)); i++) {
+        if ((i == skip[0]) || (i == skip[0] + 1)) continue;
+        if ((i == skip[1]) || (i == skip[1] + 1)) continue;
+        regs[i] = fpga->reg[i];
+    }
+    printf("Saving FPGA registers to %s/%s\n", dir, FPGA_SIM_REGISTERS);
+    if (sim_write_file(dir, FPGA_SIM_REGISTERS, regs, FPGA_SIM_REG_SIZE) < 0) {
+        free(regs);
+        free(chunk);
+        fpga_close(fpga);
+        return -1;
+    }
+    free(regs);
+
+    /* Copy video RAM up to the end of the recording region. */
+    snprintf(filename, sizeof(filename), "%s/%s", dir, FPGA_SIM_VRAM);
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create file \'%s\': %s\n", filename, strerror(errno));
+        free(chunk);
+        fpga_close(fpga);
+        return -1;
+    }
+    end = fpga->seq->region_stop;
+    printf("Saving %llu bytes of video RAM to %s\n", (unsigned long long)end * FPGA_FRAME_WORD_SIZE, filename);
+    for (addr = 0; addr < end; addr += SIM_DUMP_CHUNK) {
+        uint32_t nwords = ((end - addr) < SIM_DUMP_CHUNK) ? (end - addr) : SIM_DUMP_CHUNK;
+        size_t len = (size_t)nwords * FPGA_FRAME_WORD_SIZE;
+        uint8_t *p = chunk;
+
+        fpga_vram_read(fpga, chunk, addr, nwords);
+        while (len) {
+            ssize_t ret = write(fd, p, len);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                fprintf(stderr, "Failed to write file \'%s\': %s\n", filename, strerror(errno));
+                close(fd);
+                free(chunk);
+                fpga_close(fpga);
+                return -1;
+            }
+            p += ret;
+            len -= ret;
+        }
+    }
+    close(fd);
+    free(chunk);
+    fpga_close(fpga);
+    return 0;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options] COMMAND DIR\n\n", argv[0]);
+    printf("Create or capture FPGA state for simulated testing, to be used by\n");
+    printf("setting %s=DIR in the environment of the camera tools. Setting\n", FPGA_SIM_ENV);
+    printf("%s=N as well flips a bit in one of every N video RAM reads.\n\n", FPGA_SIM_FLIPS_ENV);
+
+    printf("commands:\n");
+    printf("  create            build a synthetic recording in DIR\n");
+    printf("  dump              save the registers and video RAM of this camera to DIR\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  resolution of a synthetic recording (default: 640x480)\n");
+    printf("  -n, --frames NUM      frames per recorded segment (default: 16)\n");
+    printf("  -s, --segments NUM    number of recorded segments (default: 2)\n");
+    printf("  -m, --mono            create a monochrome recording\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long hres = 640;
+    unsigned long vres = 480;
+    unsigned long nframes = 16;
+    unsigned long nsegs = 2;
+    int color = 1;
+    const char *shortopts = "r:n:s:mh";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"frames",      required_argument,  NULL, 'n'},
+        {"segments",    required_argument,  NULL, 's'},
+        {"mono",        no_argument,        NULL, 'm'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    const char *command, *dir;
+    char *end;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'r':
+                hres = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (vres = strtoul(end + 1, &end, 10), *end != '\0') ||
+                    (hres < 16) || (vres < 2) || (hres % 16) || (vres & 1)) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                nframes = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !nframes) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 's':
+                nsegs = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !nsegs || (nsegs > 128)) {
+                    fprintf(stderr, "Invalid segment count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'm':
+                color = 0;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if ((argc - optind) != 2) {
+        usage(argc, argv);
+        return EXIT_FAILURE;
+    }
+    command = argv[optind];
+    dir = argv[optind + 1];
+
+    if ((mkdir(dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) && (errno != EEXIST)) {
+        fprintf(stderr, "Unable to create directory %s (%s)\n", dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (strcmp(command, "create") == 0) {
+        return (sim_create(dir, hres, vres, nframes, nsegs, color) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (strcmp(command, "dump") == 0) {
+        return (sim_dump(dir) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    fprintf(stderr, "Unknown command: %s\n", command);
+    return EXIT_FAILURE;
+}
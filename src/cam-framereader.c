@@ -0,0 +1,192 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "frame-ring.h"
+#include "utils.h"
+
+#define READER_POLL_USEC    2000
+
+/*
+ * Sample consumer of the shared memory frame ring, which measures the
+ * average luma of each live frame in place, without copying it out of
+ * the ring, and reports the frame rate along with any frames that were
+ * missed or overwritten before we were done with them.
+ */
+static unsigned int
+reader_mean_luma(const struct frame_ring_slot *slot)
+{
+    const uint8_t *luma = frame_ring_data(slot);
+    unsigned long long sum = 0;
+    unsigned int x, y;
+
+    for (y = 0; y < slot->height; y++) {
+        for (x = 0; x < slot->width; x++) {
+            sum += luma[y * slot->stride + x];
+        }
+    }
+    return sum / ((unsigned long long)slot->width * slot->height);
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Read live video frames from the shared memory frame ring.\n\n");
+
+    printf("options:\n");
+    printf("  -s, --socket PATH     socket to request the ring from (default: %s)\n", FRAME_RING_SOCKET);
+    printf("  -n, --count NUM       exit after reading NUM frames\n");
+    printf("  -o, --output FILE     write the last frame read to FILE as raw NV12 (default count: 1)\n");
+    printf("  -v, --verbose         print the details of every frame\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    const char *path = FRAME_RING_SOCKET;
+    const char *output = NULL;
+    unsigned long count = 0;
+    int verbose = 0;
+    const char *shortopts = "s:n:o:vh";
+    const struct option options[] = {
+        {"socket",      required_argument,  NULL, 's'},
+        {"count",       required_argument,  NULL, 'n'},
+        {"output",      required_argument,  NULL, 'o'},
+        {"verbose",     no_argument,        NULL, 'v'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct frame_ring *ring;
+    struct frame_ring_slot *slot, meta;
+    unsigned long long start, now;
+    unsigned long frames = 0, missed = 0, torn = 0, interval = 0;
+    uint32_t last;
+    char *end;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 's':
+                path = optarg;
+                break;
+
+            case 'n':
+                count = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !count) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (output && !count) {
+        count = 1;
+    }
+
+    ring = frame_ring_open(path);
+    if (!ring) {
+        fprintf(stderr, "Failed to open frame ring from \'%s\': %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    printf("Frame ring has %u slots of %u bytes\n", ring->hdr->nslots, ring->hdr->slotsize);
+
+    last = ring->hdr->head;
+    start = clock_usec(CLOCK_MONOTONIC);
+    while (!count || (frames < count)) {
+        uint32_t head = ring->hdr->head;
+        uint32_t seq;
+        unsigned int mean;
+
+        if (head == last) {
+            usleep(READER_POLL_USEC);
+            continue;
+        }
+
+        /* Skip ahead to the newest frame, and count anything we missed along the way. */
+        seq = head;
+        if (last && ((seq - last) > 1)) missed += (seq - last) - 1;
+        last = seq;
+
+        slot = frame_ring_slot(ring, seq);
+        if (!slot || (slot->format != FRAME_RING_FORMAT_NV12)) {
+            torn++;
+            continue;
+        }
+        meta = *slot;
+        mean = reader_mean_luma(slot);
+        if (output && ((frames + 1) == count)) {
+            FILE *fp = fopen(output, "wb");
+            if (fp) {
+                fwrite(frame_ring_data(slot), meta.length, 1, fp);
+                fclose(fp);
+            }
+        }
+        if (!frame_ring_valid(slot, seq)) {
+            /* The producer lapped us while we were reading. */
+            torn++;
+            continue;
+        }
+        frames++;
+        interval++;
+
+        if (verbose) {
+            printf("frame %u: %ux%u position=%d timestamp=%llu.%09llu luma=%u\n", seq,
+                   meta.width, meta.height, meta.position,
+                   (unsigned long long)(meta.timestamp / 1000000000ULL),
+                   (unsigned long long)(meta.timestamp % 1000000000ULL), mean);
+        }
+
+        /* Print a summary every second. */
+        now = clock_usec(CLOCK_MONOTONIC);
+        if ((now - start) >= 1000000) {
+            printf("%.1f fps, %lu frames, %lu missed, %lu torn\n",
+                   (interval * 1000000.0) / (now - start), frames, missed, torn);
+            interval = 0;
+            start = now;
+        }
+    }
+
+    printf("%lu frames, %lu missed, %lu torn\n", frames, missed, torn);
+    frame_ring_close(ring);
+    return EXIT_SUCCESS;
+}
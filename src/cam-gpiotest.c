@@ -0,0 +1,185 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpio-event.h"
+
+/*
+ * Open mock GPIO lines for each type of edge, and check the edge counts,
+ * timestamps and line values that they report. This only needs a timerfd,
+ * so it can be run on a host to exercise the GPIO event handling.
+ */
+static long
+gpiotest_diff(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000 + (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static int
+gpiotest_run(const char *name, int edges, unsigned long period, unsigned long count, unsigned long tolerance, int verbose)
+{
+    struct gpio_event_src *src;
+    struct timespec prev;
+    unsigned long total = 0;
+    int errors = 0;
+    int value;
+
+    clock_gettime(CLOCK_MONOTONIC, &prev);
+    src = gpio_event_open_mock(period, edges);
+    if (!src) {
+        fprintf(stderr, "%s: failed to open mock GPIO: %s\n", name, strerror(errno));
+        return 1;
+    }
+    value = gpio_event_value(src);
+
+    while (total < count) {
+        struct pollfd pfd = {
+            .fd = gpio_event_fd(src),
+            .events = gpio_event_pollmask(src),
+        };
+        struct gpio_event ev;
+        int coalesce = (total == (count / 2));
+        long delta;
+        int expect;
+        int n;
+
+        /* Fall behind halfway through, so that several edges are consumed in one read. */
+        if (coalesce) usleep(period * 2);
+
+        if (poll(&pfd, 1, (period * 4) / 1000 + 1) <= 0) {
+            fprintf(stderr, "%s: timed out waiting for edge %lu\n", name, total);
+            errors++;
+            break;
+        }
+        n = gpio_event_read(src, &ev);
+        if (n <= 0) {
+            fprintf(stderr, "%s: read returned %d after poll\n", name, n);
+            errors++;
+            break;
+        }
+        total += ev.count;
+        if (coalesce && (ev.count < 2)) {
+            fprintf(stderr, "%s: only %u edges pending after falling behind\n", name, ev.count);
+            errors++;
+        }
+
+        /* The timestamp should advance by one period for each edge consumed. */
+        delta = gpiotest_diff(&ev.timestamp, &prev);
+        if (!ev.exact || (labs(delta - (long)(period * ev.count)) > (long)tolerance)) {
+            fprintf(stderr, "%s: edge %lu at %ld us, expected %lu us%s\n", name, total, delta,
+                    period * ev.count, ev.exact ? "" : " (inexact)");
+            errors++;
+        }
+        prev = ev.timestamp;
+
+        /* Rising edges leave the line high, falling leave it low, and both toggle it. */
+        if (edges == GPIO_EDGE_BOTH) expect = (ev.count & 1) ? !value : value;
+        else expect = (edges == GPIO_EDGE_RISING);
+        if ((ev.value != expect) || (gpio_event_value(src) != expect)) {
+            fprintf(stderr, "%s: edge %lu value %d, expected %d\n", name, total, ev.value, expect);
+            errors++;
+        }
+        value = ev.value;
+
+        if (verbose) {
+            printf("%s: edge %lu count %u value %d after %ld us\n", name, total, ev.count, ev.value, delta);
+        }
+    }
+    gpio_event_close(src);
+
+    printf("%s: %lu edges, %d errors\n", name, total, errors);
+    return errors;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Check the edges generated by mock GPIO lines.\n\n");
+
+    printf("options:\n");
+    printf("  -p, --period USEC     period between mock edges (default: 10000)\n");
+    printf("  -n, --count N         number of edges to check per line (default: 20)\n");
+    printf("  -t, --tolerance USEC  allowed timestamp error (default: 1000)\n");
+    printf("  -v, --verbose         print every edge\n");
+    printf("  -h, --help            display this help and exit\n");
+}
+
+int
+main(int argc, char *const argv[])
+{
+    const char *shortopts = "p:n:t:vh";
+    const struct option options[] = {
+        {"period",      required_argument,  0, 'p'},
+        {"count",       required_argument,  0, 'n'},
+        {"tolerance",   required_argument,  0, 't'},
+        {"verbose",     no_argument,        0, 'v'},
+        {"help",        no_argument,        0, 'h'},
+        {0, 0, 0, 0}
+    };
+    unsigned long period = 10000;
+    unsigned long count = 20;
+    unsigned long tolerance = 1000;
+    int verbose = 0;
+    int errors = 0;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'p':
+                period = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                tolerance = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (!period) {
+        fprintf(stderr, "Invalid period: must be non-zero\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Lines without any edges can never generate an event. */
+    if (gpio_event_open_mock(period, 0) != NULL) {
+        fprintf(stderr, "none: opened a mock GPIO without edges\n");
+        errors++;
+    }
+
+    errors += gpiotest_run("rising", GPIO_EDGE_RISING, period, count, tolerance, verbose);
+    errors += gpiotest_run("falling", GPIO_EDGE_FALLING, period, count, tolerance, verbose);
+    errors += gpiotest_run("both", GPIO_EDGE_BOTH, period, count, tolerance, verbose);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
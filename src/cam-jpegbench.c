@@ -0,0 +1,232 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "jpeg-nv12.h"
+#include "nv12-scale.h"
+#include "utils.h"
+
+/*
+ * Benchmark harness for the screencap JPEG encoder, feeding it synthetic
+ * NV12 frames and reporting the latency and CPU time spent per grab.
+ */
+/* Render a moving test pattern so that every frame has different content. */
+static void
+bench_fill_nv12(uint8_t *frame, unsigned int width, unsigned int height, unsigned int count)
+{
+    uint8_t *chroma = frame + width * height;
+    unsigned int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            frame[y * width + x] = (x + y + count * 4) & 0xff;
+        }
+    }
+    for (y = 0; y < (height / 2); y++) {
+        for (x = 0; x < (width / 2); x++) {
+            chroma[y * width + x * 2 + 0] = 128 + ((((x + count) / 16) & 1) ? 32 : -32);
+            chroma[y * width + x * 2 + 1] = 128 + ((((y + count) / 16) & 1) ? 32 : -32);
+        }
+    }
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Benchmark JPEG encoding of synthetic NV12 video frames.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  frame resolution to encode (default: 1280x1024)\n");
+    printf("  -n, --count NUM       number of frames to encode (default: 100)\n");
+    printf("  -q, --quality NUM     JPEG quality factor (default: 85)\n");
+    printf("  -s, --scale WxH       downscale frames to WxH before encoding\n");
+    printf("  -c, --crop WxH+X+Y    crop frames to a region before scaling\n");
+    printf("  -l, --legacy          create a new encoder for every frame\n");
+    printf("  -o, --output FILE     write the last encoded frame to FILE\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long width = 1280;
+    unsigned long height = 1024;
+    unsigned long count = 100;
+    int quality = 85;
+    int legacy = 0;
+    const char *output = NULL;
+    unsigned long swidth = 0, sheight = 0;
+    unsigned long cropx = 0, cropy = 0, cropw = 0, croph = 0;
+    const char *shortopts = "r:n:q:s:c:lo:h";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"count",       required_argument,  NULL, 'n'},
+        {"quality",     required_argument,  NULL, 'q'},
+        {"scale",       required_argument,  NULL, 's'},
+        {"crop",        required_argument,  NULL, 'c'},
+        {"legacy",      no_argument,        NULL, 'l'},
+        {"output",      required_argument,  NULL, 'o'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct jpeg_nv12 *enc = NULL;
+    unsigned long long lat_min = ~0ULL, lat_max = 0, lat_sum = 0, cpu_sum = 0, bytes = 0;
+    const uint8_t *jpeg = NULL;
+    ssize_t jpeglen = 0;
+    struct nv12_frame src, roi, scaled;
+    uint8_t *frame, *scratch;
+    unsigned long i;
+    char *end;
+    int c, n;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') || !width || !height) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                count = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !count) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'q':
+                quality = strtol(optarg, &end, 10);
+                if ((*end != '\0') || (quality <= 0) || (quality > 100)) {
+                    fprintf(stderr, "Invalid quality: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 's':
+                swidth = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (sheight = strtoul(end + 1, &end, 10), *end != '\0') || !swidth || !sheight) {
+                    fprintf(stderr, "Invalid scale: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'c':
+                n = 0;
+                if ((sscanf(optarg, "%lux%lu+%lu+%lu%n", &cropw, &croph, &cropx, &cropy, &n) != 4) || optarg[n] != '\0') {
+                    fprintf(stderr, "Invalid crop: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'l':
+                legacy = 1;
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    frame = malloc(width * height * 3 / 2);
+    scratch = malloc(NV12_SCALE_SCRATCH(width, height));
+    if (!frame || !scratch) {
+        fprintf(stderr, "Failed to allocate frame: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < count; i++) {
+        unsigned long long start, cpu, lat;
+
+        bench_fill_nv12(frame, width, height, i);
+        start = clock_usec(CLOCK_MONOTONIC);
+        cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID);
+
+        /* The legacy mode mimics setting up and tearing down the encoder on every grab. */
+        if (!enc) {
+            enc = jpeg_nv12_new(width, quality);
+            if (!enc) {
+                fprintf(stderr, "Failed to create JPEG encoder\n");
+                return EXIT_FAILURE;
+            }
+        }
+        nv12_frame_init(&src, frame, width, height);
+        if (cropw && croph) {
+            nv12_crop(&roi, &src, cropx, cropy, cropw, croph);
+        } else {
+            roi = src;
+        }
+        if (swidth && sheight) {
+            nv12_scale(&scaled, &roi, swidth, sheight, scratch);
+        } else {
+            scaled = roi;
+        }
+        jpeglen = jpeg_nv12_encode(enc, scaled.luma, scaled.chroma, scaled.width, scaled.height, scaled.stride, &jpeg);
+        if (jpeglen < 0) {
+            fprintf(stderr, "Failed to encode frame %lu\n", i);
+            return EXIT_FAILURE;
+        }
+        if (output && ((i + 1) == count)) {
+            FILE *fp = fopen(output, "wb");
+            if (!fp || (fwrite(jpeg, jpeglen, 1, fp) != 1)) {
+                fprintf(stderr, "Failed to write %s: %s\n", output, strerror(errno));
+            }
+            if (fp) fclose(fp);
+        }
+        if (legacy) {
+            jpeg_nv12_free(enc);
+            enc = NULL;
+        }
+
+        cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+        lat = clock_usec(CLOCK_MONOTONIC) - start;
+        if (lat < lat_min) lat_min = lat;
+        if (lat > lat_max) lat_max = lat;
+        lat_sum += lat;
+        cpu_sum += cpu;
+        bytes += jpeglen;
+    }
+    if (enc) jpeg_nv12_free(enc);
+    free(scratch);
+    free(frame);
+
+    printf("Encoded %lu frames from %lux%lu to %ux%u (quality %d, %s encoder)\n", count, width, height,
+            scaled.width, scaled.height, quality, legacy ? "per-frame" : "persistent");
+    printf("\tLatency: min=%llu avg=%llu max=%llu usec\n", lat_min, lat_sum / count, lat_max);
+    printf("\tCPU time: avg=%llu usec per frame\n", cpu_sum / count);
+    printf("\tThroughput: %.1f fps\n", (count * 1000000.0) / lat_sum);
+    printf("\tAverage size: %llu bytes\n", bytes / count);
+    return EXIT_SUCCESS;
+} /* main */
@@ -0,0 +1,355 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "motion.h"
+#include "utils.h"
+
+/* Input clip formats. */
+#define CLIP_Y8     0   /* 8-bit greyscale. */
+#define CLIP_NV12   1   /* 8-bit NV12, as written by cam-framereader. */
+#define CLIP_RAW16  2   /* 12-bit samples, left aligned in 16-bit little-endian words. */
+#define CLIP_RAW12  3   /* 12-bit samples, packed as written by the raw save mode. */
+
+/* Frames of the synthetic clip. */
+#define SYNTH_FRAMES    120
+#define SYNTH_TRANSIENT 30  /* A brief flicker, which should be rejected. */
+#define SYNTH_ONSET     60  /* An object enters the scene and keeps moving. */
+
+/*
+ * Run the motion detector offline over a recorded clip, or a synthetic clip
+ * when none is given, and report the detection latency and false positives
+ * against the frame at which the real motion begins. The optimized block
+ * downsampling is also checked against the reference implementation.
+ */
+static size_t
+motiontest_frame_size(int format, unsigned long width, unsigned long height)
+{
+    switch (format) {
+        case CLIP_NV12:
+        case CLIP_RAW12:
+            return (width * height * 3) / 2;
+        case CLIP_RAW16:
+            return width * height * 2;
+        case CLIP_Y8:
+        default:
+            return width * height;
+    }
+}
+
+/* Convert a frame from the clip into 8-bit luma. */
+static void
+motiontest_luma(uint8_t *luma, const uint8_t *frame, int format, unsigned long count)
+{
+    unsigned long i;
+
+    switch (format) {
+        case CLIP_RAW16:
+            /* Keep the most significant byte of each sample. */
+            for (i = 0; i < count; i++) luma[i] = frame[2 * i + 1];
+            break;
+
+        case CLIP_RAW12:
+            /* Each pair of samples is packed into three bytes. */
+            for (i = 0; i < (count / 2); i++) {
+                const uint8_t *p = frame + 3 * i;
+                luma[2 * i] = ((p[1] >> 4) << 4) | (p[0] >> 4);
+                luma[2 * i + 1] = p[2];
+            }
+            break;
+
+        case CLIP_Y8:
+        case CLIP_NV12:
+        default:
+            /* The luma plane comes first. */
+            memcpy(luma, frame, count);
+            break;
+    }
+}
+
+/*
+ * Render a frame of the synthetic clip: a static textured scene with sensor
+ * noise, a flicker lasting two frames, and then a dark object which
+ * enters from the left and crosses the frame.
+ */
+static void
+motiontest_synth(uint8_t *luma, unsigned long width, unsigned long height, unsigned long frame, uint32_t *seed)
+{
+    unsigned long x, y;
+    long ox = (long)(frame - SYNTH_ONSET + 1) * (long)(width / 32) - (long)(height / 2);
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            int value = 60 + (int)(((x / 24) + (y / 24)) & 1) * 80 + (int)((x * 40) / width);
+
+            /* A brief flicker, such as a reflection. */
+            if ((frame >= SYNTH_TRANSIENT) && (frame < (SYNTH_TRANSIENT + 2)) &&
+                (x >= (width / 2)) && (x < ((width * 3) / 4)) && (y < height / 4)) {
+                value += 60;
+            }
+            /* A large object crossing the scene. */
+            if ((frame >= SYNTH_ONSET) && ((long)x >= ox) && ((long)x < (ox + (long)(height / 2))) &&
+                (y >= height / 4) && (y < (height * 3) / 4)) {
+                value = 20;
+            }
+
+            *seed = *seed * 1103515245 + 12345;
+            value += (int)((*seed >> 16) & 7) - 4;
+            if (value < 0) value = 0;
+            if (value > 255) value = 255;
+            *luma++ = value;
+        }
+    }
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options] [FILE]\n\n", argv[0]);
+    printf("Run the motion trigger over a recorded clip, or a synthetic clip if no FILE is given.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  frame resolution of the clip (default: 640x480)\n");
+    printf("  -f, --format FMT      clip format, one of y8, nv12, raw16 or raw12 (default: y8)\n");
+    printf("  -R, --rate FPS        frame rate of the clip (default: 60)\n");
+    printf("  -g, --onset FRAME     frame at which real motion begins, for measuring latency\n");
+    printf("                        and false positives (default: %u for the synthetic clip)\n", SYNTH_ONSET);
+    printf("  -l, --level LUMA      change in block luma that counts as motion (default: %u)\n", 12);
+    printf("  -t, --threshold PCT   percentage of the region that must change (default: %.1f)\n", 2.0);
+    printf("  -n, --frames NUM      consecutive frames of motion needed to trigger (default: %u)\n", 3);
+    printf("  -w, --region GEOM     region to watch, of the form WIDTHxHEIGHT+X+Y\n");
+    printf("  -v, --verbose         print the score of every frame\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long width = 640;
+    unsigned long height = 480;
+    unsigned long rate = 60;
+    long onset = -1;
+    int format = CLIP_Y8;
+    int verbose = 0;
+    const char *shortopts = "r:f:R:g:l:t:n:w:vh";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"format",      required_argument,  NULL, 'f'},
+        {"rate",        required_argument,  NULL, 'R'},
+        {"onset",       required_argument,  NULL, 'g'},
+        {"level",       required_argument,  NULL, 'l'},
+        {"threshold",   required_argument,  NULL, 't'},
+        {"frames",      required_argument,  NULL, 'n'},
+        {"region",      required_argument,  NULL, 'w'},
+        {"verbose",     no_argument,        NULL, 'v'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct motion_detector md;
+    FILE *fp = NULL;
+    uint8_t *frame, *luma, *grid, *ref;
+    void *scratch;
+    size_t fsize;
+    unsigned long n, mismatch = 0, falsepos = 0;
+    long first = -1;
+    unsigned long long cpu = 0;
+    uint32_t seed = 1;
+    int failed = 0;
+    char *end;
+    int c;
+
+    motion_init(&md);
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') ||
+                    (width < MOTION_BLOCK) || (height < MOTION_BLOCK) || (width & 1)) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'f':
+                if (strcasecmp(optarg, "y8") == 0) format = CLIP_Y8;
+                else if (strcasecmp(optarg, "nv12") == 0) format = CLIP_NV12;
+                else if (strcasecmp(optarg, "raw16") == 0) format = CLIP_RAW16;
+                else if (strcasecmp(optarg, "raw12") == 0) format = CLIP_RAW12;
+                else {
+                    fprintf(stderr, "Invalid format: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'R':
+                rate = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !rate) {
+                    fprintf(stderr, "Invalid frame rate: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'g':
+                onset = strtol(optarg, &end, 10);
+                if ((*end != '\0') || (onset < 0)) {
+                    fprintf(stderr, "Invalid onset frame: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'l':
+                md.level = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || (md.level > 255)) {
+                    fprintf(stderr, "Invalid level: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 't':
+                md.threshold = strtod(optarg, &end);
+                if ((*end != '\0') || (md.threshold <= 0) || (md.threshold > 100)) {
+                    fprintf(stderr, "Invalid threshold: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                md.frames = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !md.frames) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'w': {
+                int len = 0;
+                if ((sscanf(optarg, "%ux%u+%u+%u%n", &md.region.width, &md.region.height,
+                            &md.region.x, &md.region.y, &len) != 4) || (optarg[len] != '\0')) {
+                    fprintf(stderr, "Invalid region: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc) {
+        fp = fopen(argv[optind], "rb");
+        if (!fp) {
+            fprintf(stderr, "Failed to open \'%s\': %s\n", argv[optind], strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    else if (onset < 0) {
+        onset = SYNTH_ONSET;
+    }
+
+    fsize = motiontest_frame_size(format, width, height);
+    frame = malloc(fsize);
+    luma = malloc(width * height);
+    grid = malloc((width / MOTION_BLOCK) * (height / MOTION_BLOCK));
+    ref = malloc((width / MOTION_BLOCK) * (height / MOTION_BLOCK));
+    scratch = malloc(MOTION_SCRATCH(width));
+    if (!frame || !luma || !grid || !ref || !scratch) {
+        fprintf(stderr, "Failed to allocate frame: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (n = 0; fp ? (fread(frame, fsize, 1, fp) == 1) : (n < SYNTH_FRAMES); n++) {
+        unsigned long long start;
+        int detected;
+
+        if (fp) {
+            motiontest_luma(luma, frame, format, width * height);
+        } else {
+            motiontest_synth(luma, width, height, n, &seed);
+        }
+
+        /* Check the optimized downsampling against the reference. */
+        motion_downsample(grid, luma, width, height, width, scratch);
+        motion_downsample_ref(ref, luma, width, height, width);
+        if (memcmp(grid, ref, (width / MOTION_BLOCK) * (height / MOTION_BLOCK)) != 0) {
+            mismatch++;
+        }
+
+        start = clock_usec(CLOCK_PROCESS_CPUTIME_ID);
+        detected = motion_update(&md, luma, width, height, width, (n * 1000000ULL) / rate);
+        cpu += clock_usec(CLOCK_PROCESS_CPUTIME_ID) - start;
+
+        if (verbose) {
+            printf("\tframe %lu: score=%.1f%s\n", n, md.results.score, detected ? " TRIGGER" : "");
+        }
+        if (!detected) continue;
+
+        /* Any detection before the real motion begins is a false positive. */
+        printf("frame %lu: motion detected after %llu us\n", n, md.results.latency);
+        if ((onset >= 0) && ((long)n < onset)) {
+            falsepos++;
+        }
+        else if (first < 0) {
+            first = n;
+        }
+    }
+    if (fp) fclose(fp);
+
+    printf("frames:          %lu\n", md.results.frames);
+    printf("detections:      %lu\n", md.results.detections);
+    printf("rejected:        %lu\n", md.results.rejected);
+    printf("mismatches:      %lu\n", mismatch);
+    printf("cpu time:        %llu us/frame\n", md.results.frames ? cpu / md.results.frames : 0);
+    if (onset >= 0) {
+        printf("false positives: %lu\n", falsepos);
+        if (first >= 0) {
+            printf("latency:         %ld frames (%.1f ms)\n", first - onset, ((first - onset) * 1000.0) / rate);
+        } else {
+            printf("latency:         motion not detected\n");
+        }
+    }
+
+    /* The synthetic clip has a known answer. */
+    if (mismatch || (!fp && (falsepos || (first < 0) || ((unsigned long)(first - onset) >= (md.frames + 2))))) {
+        failed = 1;
+    }
+
+    motion_free(&md);
+    free(scratch);
+    free(ref);
+    free(grid);
+    free(luma);
+    free(frame);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,10 +26,17 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 #include <ftw.h>
 
+#include "calibrate.h"
+#include "crc32c.h"
+#include "demosaic.h"
 #include "fpga.h"
-#include "tiff.h"
+#include "recovery.h"
 #include "segment.h"
 #include "utils.h"
 
@@ -77,273 +84,907 @@ force_rmdir(const char *pathname, const struct stat *st, int type)
     return 0;
 }
 
-/* Dump memory from a given word address and size. */
+/*
+ * Calibration data, sized to the recorded resolution and held in a single
+ * mapping that is made read-only once loaded, to be shared by every frame.
+ */
+static struct calibration cal;
+static void     *cal_map = NULL;
+static size_t   cal_mapsize = 0;
+
+/* Demosaic using the same color matrix and white balance as the display pipeline. */
+static void
+load_colormatrix(struct demosaic_params *params, struct fpga *fpga)
+{
+    int16_t ccm[9];
+    uint16_t wbal[3];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        ccm[0 + i] = fpga->display->ccm_red[i];
+        ccm[3 + i] = fpga->display->ccm_green[i];
+        ccm[6 + i] = fpga->display->ccm_blue[i];
+        wbal[i] = fpga->display->wbal[i];
+    }
+    params->method = DEMOSAIC_EDGE;
+    params->cfa = DEMOSAIC_CFA_GRBG;
+    params->bits = SENSOR_DATA_WIDTH;
+    demosaic_matrix(params, ccm, wbal);
+}
+
+/*===============================================
+ * Pipelined Frame Recovery
+ *===============================================
+ */
+/*
+ * Frames are recovered a block of rows at a time by three stages: a thread
+ * that reads the packed pixels out of video RAM, a thread that unpacks and
+ * calibrates them, and the main thread which writes them out to disk. The
+ * blocks circulate through a small ring, so the readout of one block
+ * overlaps with the calibration of the block before it and the write of the
+ * block before that, and recovery runs at the speed of its slowest stage,
+ * which ought to be the disk. Color TIFF output has to demosaic the whole
+ * frame at once, so it uses blocks of a whole frame instead.
+ */
+#define RECOVER_NUM_BLOCKS      4
+#define RECOVER_BLOCK_ROWS      64
+#define RECOVER_BLOCK_ALIGN     2048    /* Keep each readout aligned to the VRAM burst buffer. */
+
+/* Block states, each stage moves a block on to the next. */
+#define RECOVER_BLOCK_FREE      0
+#define RECOVER_BLOCK_READ      1
+#define RECOVER_BLOCK_UNPACKED  2
+
+struct recover_block {
+    int             state;
+    unsigned long   frameno;
+    unsigned long   frameaddr;
+    unsigned int    row;
+    unsigned int    nrows;      /* An empty block marks the end of the recovery. */
+    unsigned long   badreads;   /* Readouts that failed verification. */
+    unsigned long   retries;
+    uint32_t        crc;        /* CRC-32C of the packed pixels of the frame up to the end of this block. */
+    uint8_t         *raw;
+    uint16_t        *pixels;
+    uint16_t        *outbuf;
+};
+
+struct recover_pipeline {
+    struct fpga             *fpga;
+    void                    *(*readout)(struct fpga *, void *, uint32_t, uint32_t);
+    struct video_seglist    *list;
+    const char              *outdir;
+    unsigned long           first;      /* Frames to recover, up to but not including stop. */
+    unsigned long           stop;
+    int                     tiff;
+    int                     dump;       /* Write raw video memory to the archive instead of frames. */
+    int                     archive;    /* First part of the archive, which holds the frame table. */
+    int                     part;       /* Part of the archive that frames are appended to. */
+    uint32_t                part_frames;
+    uint32_t                table_offset;   /* Of the archive frame table. */
+    int                     is_color;
+    unsigned int            hres;
+    unsigned int            vres;
+    unsigned int            blockrows;
+    size_t                  rawstride;  /* Bytes per row of packed pixels. */
+    size_t                  outstride;  /* Bytes per row of output. */
+    int                     abort;
+    struct demosaic_params  params;
+    void                    *scratch;
+    uint8_t                 header[RECOVERY_HEADER_SIZE];
+
+    /* Frames already recovered, and the manifest of those recovered since. */
+    uint8_t                 *done;
+    unsigned long           ndone;
+    FILE                    *manifest;
+
+    /* Progress reporting. */
+    const char              *status;
+    unsigned long           total;
+    unsigned long           frames;
+    unsigned long           errors;
+    unsigned long           badframes;  /* Frames that failed readout verification. */
+    unsigned long           retries;
+    unsigned long long      bytes;
+    struct timespec         started;
+    struct timespec         reported;
+
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;
+    struct recover_block    blocks[RECOVER_NUM_BLOCKS];
+};
+
+/* What to recover, from the command line. */
+struct recover_args {
+    const char      *outdir;
+    const char      *status;    /* JSON status file, or NULL for none. */
+    unsigned long   first;
+    unsigned long   stop;
+    int             tiff;
+    int             resume;
+    int             dump;
+};
+
+/* Wait for the next block in the ring to reach the given state. */
+static struct recover_block *
+recover_wait(struct recover_pipeline *pipe, unsigned long index, int state)
+{
+    struct recover_block *blk = &pipe->blocks[index % RECOVER_NUM_BLOCKS];
+
+    pthread_mutex_lock(&pipe->mutex);
+    while (blk->state != state) {
+        pthread_cond_wait(&pipe->cond, &pipe->mutex);
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+    return blk;
+}
+
+/* Hand a block over to the next stage. */
+static void
+recover_post(struct recover_pipeline *pipe, struct recover_block *blk, int state)
+{
+    pthread_mutex_lock(&pipe->mutex);
+    blk->state = state;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->mutex);
+}
+
+static int
+recover_aborted(struct recover_pipeline *pipe)
+{
+    int abort;
+    pthread_mutex_lock(&pipe->mutex);
+    abort = pipe->abort;
+    pthread_mutex_unlock(&pipe->mutex);
+    return abort;
+}
+
+/* Stage 1: read blocks of packed pixels out of video RAM. */
 static void *
-vram_readout_slow(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords)
+recover_read_thread(void *arg)
 {
-    uint8_t *out = dest;
-    uint32_t end = addr + nwords;
-    uint32_t pagewords = 4096 / FPGA_FRAME_WORD_SIZE;
-
-    while (addr < end) {
-        /* Set the offset. */
-        fpga->reg[GPMC_PAGE_OFFSET + 0] = (addr & 0x0000ffff) >> 0;
-        fpga->reg[GPMC_PAGE_OFFSET + 1] = (addr & 0xffff0000) >> 16;
-
-        /* Copy memory out. */
-        if ((addr + pagewords) > end) {
-            memcpy(out, (void *)fpga->ram, FPGA_FRAME_WORD_SIZE * (end - addr));
-            break;
-        } else {
-            memcpy(out, (void *)fpga->ram, FPGA_FRAME_WORD_SIZE * pagewords);
-            addr += pagewords;
-            out += pagewords * FPGA_FRAME_WORD_SIZE;
+    struct recover_pipeline *pipe = arg;
+    struct recover_block *blk;
+    unsigned long frameno, frameaddr;
+    unsigned long index = 0;
+
+    for (frameno = pipe->first; frameno < pipe->stop; frameno++) {
+        unsigned int row;
+        if (recover_aborted(pipe)) break;
+        if ((frameno < pipe->ndone) && pipe->done[frameno]) continue;
+        if (!video_segment_lookup(pipe->list, frameno, &frameaddr)) break;
+
+        for (row = 0; row < pipe->vres; row += pipe->blockrows) {
+            size_t offset = (size_t)row * pipe->rawstride;
+            unsigned long badreads = pipe->fpga->vram_errors;
+            unsigned long retries = pipe->fpga->vram_retries;
+            blk = recover_wait(pipe, index++, RECOVER_BLOCK_FREE);
+            blk->frameno = frameno;
+            blk->frameaddr = frameaddr;
+            blk->row = row;
+            blk->nrows = ((pipe->vres - row) < pipe->blockrows) ? (pipe->vres - row) : pipe->blockrows;
+            pipe->readout(pipe->fpga, blk->raw, frameaddr + offset / FPGA_FRAME_WORD_SIZE,
+                        (blk->nrows * pipe->rawstride + FPGA_FRAME_WORD_SIZE - 1) / FPGA_FRAME_WORD_SIZE);
+            blk->badreads = pipe->fpga->vram_errors - badreads;
+            blk->retries = pipe->fpga->vram_retries - retries;
+            recover_post(pipe, blk, RECOVER_BLOCK_READ);
         }
     }
-    return dest;
+
+    /* Send an empty block down the pipeline to finish up. */
+    blk = recover_wait(pipe, index, RECOVER_BLOCK_FREE);
+    blk->nrows = 0;
+    recover_post(pipe, blk, RECOVER_BLOCK_READ);
+    return NULL;
 }
 
-/* I suspect this can *only* read 2kB aligned */
+/* Stage 2: unpack, calibrate and optionally demosaic each block. */
 static void *
-vram_readout_fast(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords)
+recover_unpack_thread(void *arg)
 {
-    uint8_t *out = dest;
-    uint32_t end = addr + nwords;
-    uint32_t burstsize = sizeof(fpga->vram->buffer) / FPGA_FRAME_WORD_SIZE;
-    
-    fpga->vram->burst = 0x20;
-    while (addr < end) {
-        int i;
-
-        /* Instruct the FPGA to copy the data into cache. */
-        fpga->vram->address = addr;
-        fpga->vram->control = VRAM_CTL_TRIG_READ;
-        for (i = 0; i < 1000; i++) {
-            if (fpga->vram->control == 0) break;
-        }
-
-        /* Copy memory out. */
-        if ((addr + burstsize) >= end) {
-            memcpy(out, (void *)fpga->vram->buffer, FPGA_FRAME_WORD_SIZE * (end - addr));
+    struct recover_pipeline *pipe = arg;
+    unsigned long index;
+    uint32_t crc = 0;
+
+    for (index = 0;; index++) {
+        struct recover_block *blk = recover_wait(pipe, index, RECOVER_BLOCK_READ);
+        if (!blk->nrows) {
+            recover_post(pipe, blk, RECOVER_BLOCK_UNPACKED);
             break;
-        } else {
-            memcpy(out, (void *)fpga->vram->buffer, FPGA_FRAME_WORD_SIZE * burstsize);
-            addr += burstsize;
-            out += burstsize * FPGA_FRAME_WORD_SIZE;
         }
+
+        /* Checksum the frame as it was read out of video RAM. */
+        if (blk->row == 0) crc = 0;
+        crc = crc32c(crc, blk->raw, blk->nrows * pipe->rawstride);
+        blk->crc = crc;
+        if (pipe->dump) {
+            /* Leave the packed pixels for cam-convert. */
+            recover_post(pipe, blk, RECOVER_BLOCK_UNPACKED);
+            continue;
+        }
+        calibrate_unpack(blk->pixels, blk->raw, &cal, blk->row, blk->nrows);
+
+        if (pipe->tiff && pipe->is_color) {
+            /* Demosaic into RGB on the CPU, since the display pipeline isn't producing this frame. */
+            if (pipe->scratch) {
+                demosaic(blk->outbuf, blk->pixels, pipe->hres, pipe->vres, &pipe->params, pipe->scratch);
+            } else {
+                memset(blk->outbuf, 0, blk->nrows * pipe->outstride);
+            }
+        }
+        else if (pipe->tiff) {
+            /* Scale greyscale up to the full 16-bit range. */
+            size_t i;
+            for (i = 0; i < ((size_t)blk->nrows * pipe->hres); i++) {
+                blk->pixels[i] <<= (16 - SENSOR_DATA_WIDTH);
+            }
+        }
+        recover_post(pipe, blk, RECOVER_BLOCK_UNPACKED);
     }
-    return dest;
+    return NULL;
+}
+
+/* Write out an I/O vector in full, picking up after any short writes. */
+static int
+recover_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt) {
+        ssize_t ret = writev(fd, iov, iovcnt);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (iovcnt && ((size_t)ret >= iov->iov_len)) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+/* Create a file for writing, which may grow past 2 GiB. */
+static int
+recover_create(const char *filename)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_LARGEFILE)
+    flags |= O_LARGEFILE;
+#elif defined(__O_LARGEFILE)
+    flags |= __O_LARGEFILE;
+#endif
+    return open(filename, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
+/* Close the parts of the archive that are open, returning nonzero if any of them failed. */
+static int
+dump_close(struct recover_pipeline *pipe)
+{
+    int ret = 0;
+    if ((pipe->part >= 0) && (pipe->part != pipe->archive)) ret |= close(pipe->part);
+    if (pipe->archive >= 0) ret |= close(pipe->archive);
+    pipe->part = -1;
+    pipe->archive = -1;
+    return ret;
 }
 
-/* Some statically allocated calibration data. */
-static int      cal_npoints = 0;
-static int16_t  cal_fpn[MAX_HRES * MAX_VRES];
-static int16_t  cal_offset[MAX_HRES];
-static uint16_t cal_gain[MAX_HRES];
-static int16_t  cal_curve[MAX_HRES]; 
+/*===============================================
+ * Recovery Manifest and Progress
+ *===============================================
+ */
+/*
+ * The manifest lists each frame once its file has been completely written
+ * and closed, after a header line identifying the resolution and format,
+ * along with the CRC-32C of its packed pixels as they were read out. When
+ * resuming, the frames it lists are skipped, and anything that was cut
+ * short by an interruption, or that failed readout verification, is just
+ * recovered again.
+ */
+#define RECOVER_MANIFEST        "/manifest.txt"
+#define RECOVER_PROGRESS_SEC    2.0
 
-/* Pixel ram is 12-bit packed in big-endian, and we need to write out 16-bit host-endian. */
 static int
-write_pixels(int fd, const uint8_t *pxdata, size_t hres, size_t vres)
+manifest_open(struct recover_pipeline *pipe, int resume)
 {
-    size_t pix, col;
-    uint16_t outpx[16];
-
-    if (!cal_npoints) {
-        /* No calibration data, just unpack and write to disk. */
-        for (pix = 0; (pix + 16) <= (hres * vres); pix += 16) {
-            neon_be12_unpack_unsigned(outpx, pxdata);
-            if (write(fd, outpx, sizeof(outpx)) < 0) {
-                return -1;
+    char filename[PATH_MAX];
+    char header[64];
+    char line[PATH_MAX + 64];
+    FILE *fp;
+
+    snprintf(header, sizeof(header), "# cam-recover %ux%u %s\n", pipe->hres, pipe->vres, pipe->tiff ? "tiff" : "dng");
+    mkfilepath(filename, pipe->outdir, RECOVER_MANIFEST);
+
+    /* Mark off the frames that are already done. */
+    fp = resume ? fopen(filename, "r") : NULL;
+    if (fp) {
+        if (fgets(line, sizeof(line), fp) && (strcmp(line, header) != 0)) {
+            fprintf(stderr, "Unable to resume, %s is for a different resolution or format\n", filename);
+            fclose(fp);
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            unsigned long frameno;
+            if ((sscanf(line, "%lu", &frameno) == 1) && (frameno < pipe->ndone)) {
+                pipe->done[frameno] = 1;
             }
-            pxdata += 24;
         }
+        fclose(fp);
+    }
+
+    pipe->manifest = fopen(filename, resume ? "a" : "w");
+    if (!pipe->manifest) {
+        fprintf(stderr, "Unable to create file %s (%s)\n", filename, strerror(errno));
+        return -1;
+    }
+    if (ftell(pipe->manifest) == 0) {
+        fputs(header, pipe->manifest);
+        fflush(pipe->manifest);
+    }
+    return 0;
+}
+
+static double
+recover_seconds(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/* Write the JSON status file, replacing it atomically so readers never see it half-written. */
+static void
+recover_status(struct recover_pipeline *pipe, const char *state, double elapsed, double fps, double rate, double eta)
+{
+    char tmpname[PATH_MAX];
+    FILE *fp;
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", pipe->status);
+    fp = fopen(tmpname, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to create file %s (%s)\n", tmpname, strerror(errno));
+        return;
     }
-    else if (cal_npoints < 3) {
-        /* 2-point calibration data is present, unpack and calibrate */
-        for (pix = 0, col = 0; (pix + 16) <= (hres * vres); pix += 16, col += 16) {
-            if (col >= hres) col %= hres;
-            neon_be12_unpack_2point(outpx, pxdata, cal_fpn + pix, cal_gain + col);
-            if (write(fd, outpx, sizeof(outpx)) < 0) {
-                return -1;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"state\": \"%s\",\n", state);
+    fprintf(fp, "  \"frames\": %lu,\n", pipe->frames);
+    fprintf(fp, "  \"total\": %lu,\n", pipe->total);
+    fprintf(fp, "  \"errors\": %lu,\n", pipe->errors);
+    fprintf(fp, "  \"verify_failed\": %lu,\n", pipe->badframes);
+    fprintf(fp, "  \"retries\": %lu,\n", pipe->retries);
+    fprintf(fp, "  \"bytes\": %llu,\n", pipe->bytes);
+    fprintf(fp, "  \"elapsed\": %.1f,\n", elapsed);
+    fprintf(fp, "  \"fps\": %.2f,\n", fps);
+    fprintf(fp, "  \"rate\": %.2f,\n", rate);
+    fprintf(fp, "  \"eta\": %.0f\n", eta);
+    fprintf(fp, "}\n");
+    if (fclose(fp) != 0 || rename(tmpname, pipe->status) != 0) {
+        fprintf(stderr, "Failed to write status %s (%s)\n", pipe->status, strerror(errno));
+    }
+}
+
+/* Report progress on stderr and the status file, at most every RECOVER_PROGRESS_SEC unless forced. */
+static void
+recover_progress(struct recover_pipeline *pipe, const char *state)
+{
+    struct timespec now;
+    double elapsed, fps, rate, eta;
+    unsigned int mins, secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!state && (recover_seconds(&pipe->reported, &now) < RECOVER_PROGRESS_SEC)) return;
+    pipe->reported = now;
+
+    elapsed = recover_seconds(&pipe->started, &now);
+    fps = (elapsed > 0) ? (pipe->frames / elapsed) : 0;
+    rate = (elapsed > 0) ? (pipe->bytes / elapsed / 1000000.0) : 0;
+    eta = ((fps > 0) && (pipe->total > pipe->frames)) ? ((pipe->total - pipe->frames) / fps) : 0;
+    mins = (unsigned int)eta / 60;
+    secs = (unsigned int)eta % 60;
+    fprintf(stderr, "Recovered %lu/%lu frames (%.1f%%), %.1f fps, %.1f MB/s, %u:%02u remaining\n",
+            pipe->frames, pipe->total, pipe->total ? (pipe->frames * 100.0) / pipe->total : 100.0,
+            fps, rate, mins, secs);
+    if (pipe->status) {
+        recover_status(pipe, state ? state : "recovering", elapsed, fps, rate, eta);
+    }
+}
+
+/* Count the frames in the range that remain to be recovered. */
+static unsigned long
+recover_count(struct recover_pipeline *pipe)
+{
+    unsigned long frameno, count = 0;
+    unsigned long stop = (pipe->stop < pipe->list->totalframes) ? pipe->stop : pipe->list->totalframes;
+    for (frameno = pipe->first; frameno < stop; frameno++) {
+        if ((frameno < pipe->ndone) && pipe->done[frameno]) continue;
+        count++;
+    }
+    return count;
+}
+
+/*===============================================
+ * Pipelined Frame Recovery (cont'd)
+ *===============================================
+ */
+/* Stage 3, when dumping: append the packed pixels of each block to the archive. */
+static void
+recover_dump(struct recover_pipeline *pipe)
+{
+    char archivename[PATH_MAX];
+    char filename[PATH_MAX];
+    unsigned long index;
+    unsigned long badreads = 0;
+
+    mkfilepath(archivename, pipe->outdir, "/" RECOVERY_ARCHIVE_NAME);
+    strcpy(filename, archivename);
+    for (index = 0;; index++) {
+        struct recover_block *blk = recover_wait(pipe, index, RECOVER_BLOCK_UNPACKED);
+        struct recovery_archive_frame entry;
+        struct iovec iov;
+        int failed = 0;
+
+        if (!blk->nrows) {
+            recover_post(pipe, blk, RECOVER_BLOCK_FREE);
+            break;
+        }
+        /* Move on to the next part of the archive once this one is full. */
+        if ((blk->row == 0) && (pipe->archive >= 0) && pipe->frames && !(pipe->frames % pipe->part_frames)) {
+            if ((pipe->part != pipe->archive) && (close(pipe->part) != 0)) {
+                fprintf(stderr, "Failed to write archive \'%s\': %s\n", filename, strerror(errno));
+                pipe->errors++;
+            }
+            recovery_archive_part(filename, sizeof(filename), archivename, pipe->frames / pipe->part_frames);
+            pipe->part = recover_create(filename);
+            failed = (pipe->part < 0);
+        }
+        if (blk->row == 0) {
+            printf("Backing up frame from 0x%08lx to %s\n", blk->frameaddr, filename);
+            badreads = 0;
+        }
+        badreads += blk->badreads;
+        pipe->retries += blk->retries;
+
+        /* Frames must stay in step with the frame table, so give up on the first failure. */
+        iov.iov_base = blk->raw;
+        iov.iov_len = blk->nrows * pipe->rawstride;
+        if ((pipe->archive >= 0) && !failed) {
+            failed = (recover_writev(pipe->part, &iov, 1) < 0);
+        }
+
+        /* Fill in the checksum once the frame is complete. */
+        if ((pipe->archive >= 0) && !failed && ((blk->row + blk->nrows) >= pipe->vres)) {
+            entry.frameno = blk->frameno;
+            entry.address = blk->frameaddr;
+            entry.crc32c = blk->crc;
+            entry.flags = badreads ? RECOVERY_FRAME_BADREAD : 0;
+            failed = pwrite(pipe->archive, &entry, sizeof(entry),
+                            pipe->table_offset + pipe->frames * sizeof(entry)) != sizeof(entry);
+            if (badreads) {
+                fprintf(stderr, "Frame %lu failed readout verification (%lu bad reads)\n", blk->frameno, badreads);
+                pipe->badframes++;
+            }
+        }
+        if (failed) {
+            fprintf(stderr, "Failed to write archive \'%s\': %s\n", filename, strerror(errno));
+            dump_close(pipe);
+            pipe->errors++;
+            pthread_mutex_lock(&pipe->mutex);
+            pipe->abort = 1;
+            pthread_mutex_unlock(&pipe->mutex);
+        }
+        if (pipe->archive >= 0) {
+            pipe->bytes += iov.iov_len;
+            if ((blk->row + blk->nrows) >= pipe->vres) {
+                pipe->frames++;
+                recover_progress(pipe, NULL);
             }
-            pxdata += 24;
         }
+        recover_post(pipe, blk, RECOVER_BLOCK_FREE);
     }
-    else {
-        /* 3-point calibration data is present, unpack and calibrate */
-        for (pix = 0, col = 0; (pix + 16) <= (hres * vres); pix += 16, col += 16) {
-            if (col >= hres) col %= hres;
-            neon_be12_unpack_3point(outpx, pxdata, cal_fpn + pix, cal_offset + col, cal_gain + col, cal_curve + col);
-            if (write(fd, outpx, sizeof(outpx)) < 0) {
-                return -1;
+    if (dump_close(pipe) != 0) {
+        fprintf(stderr, "Failed to write archive \'%s\': %s\n", filename, strerror(errno));
+        pipe->errors++;
+    }
+}
+
+/* Stage 3: write each block out to its frame file, prefixed by the header. */
+static void
+recover_write(struct recover_pipeline *pipe)
+{
+    char filename[PATH_MAX];
+    unsigned long index;
+    unsigned long badreads = 0;
+    int fd = -1;
+
+    for (index = 0;; index++) {
+        struct recover_block *blk = recover_wait(pipe, index, RECOVER_BLOCK_UNPACKED);
+        struct iovec iov[2];
+        int iovcnt = 0;
+
+        if (!blk->nrows) {
+            recover_post(pipe, blk, RECOVER_BLOCK_FREE);
+            break;
+        }
+
+        if (blk->row == 0) {
+            mkfilepath(filename, pipe->outdir, pipe->tiff ? "/frame_%06lu.tiff" : "/frame_%06lu.dng", blk->frameno);
+            printf("Backing up frame from 0x%08lx to %s\n", blk->frameaddr, filename);
+            fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            if (fd < 0) {
+                fprintf(stderr, "Failed to create file \'%s\': %s\n", filename, strerror(errno));
+                pipe->errors++;
+            }
+            iov[iovcnt].iov_base = pipe->header;
+            iov[iovcnt].iov_len = sizeof(pipe->header);
+            iovcnt++;
+            badreads = 0;
+        }
+        badreads += blk->badreads;
+        pipe->retries += blk->retries;
+        iov[iovcnt].iov_base = blk->outbuf;
+        iov[iovcnt].iov_len = blk->nrows * pipe->outstride;
+        iovcnt++;
+
+        if ((fd >= 0) && (recover_writev(fd, iov, iovcnt) < 0)) {
+            fprintf(stderr, "Failed to write frame \'%s\': %s\n", filename, strerror(errno));
+            close(fd);
+            fd = -1;
+            pipe->errors++;
+        }
+        if (fd >= 0) {
+            pipe->bytes += blk->nrows * pipe->outstride;
+        }
+        if ((fd >= 0) && ((blk->row + blk->nrows) >= pipe->vres)) {
+            /* The frame is only done once it has been closed without error, and read out intact. */
+            if (close(fd) != 0) {
+                fprintf(stderr, "Failed to write frame \'%s\': %s\n", filename, strerror(errno));
+                pipe->errors++;
+            } else if (badreads) {
+                fprintf(stderr, "Frame %lu failed readout verification (%lu bad reads)\n", blk->frameno, badreads);
+                pipe->badframes++;
+                pipe->frames++;
+            } else {
+                fprintf(pipe->manifest, "%lu 0x%08lx %s %08x\n", blk->frameno, blk->frameaddr,
+                        strrchr(filename, '/') + 1, blk->crc);
+                fflush(pipe->manifest);
+                pipe->frames++;
             }
-            pxdata += 24;
+            fd = -1;
+            recover_progress(pipe, NULL);
         }
+        recover_post(pipe, blk, RECOVER_BLOCK_FREE);
     }
-    return 0;
 }
 
-static int
-write_frame(struct fpga *fpga, const char *filename, uint32_t addr, 
-    void *(*readout)(struct fpga *, void *, uint32_t, uint32_t))
+static void
+recover_free(struct recover_pipeline *pipe)
 {
-    uint8_t tiffbuf[1024];
-    uint8_t *framebuf;
-    uint8_t is_color = (fpga->display->control & DISPLAY_CTL_COLOR_MODE) != 0;
-    size_t f_size = fpga->display->h_res * fpga->display->v_res * 2;
-    uint32_t offset;
-    struct tiff_ifd ifd;
-
-    const uint8_t cfa_pattern[] = {1, 0, 2, 1}; /* GRBG Bayer pattern */
-    const uint16_t cfa_repeat[] = {2, 2};       /* 2x2 Bayer Pattern */
-    const uint8_t dng_version[] = {1, 4, 0, 0};
-    const uint8_t dng_compatible[] = {1, 0, 0, 0};
-    struct tiff_rational wbneutral[3] = {
-        {4096, fpga->display->wbal[0]},
-        {4096, fpga->display->wbal[1]},
-        {4096, fpga->display->wbal[2]}
-    };
-    const struct tiff_srational cmatrix[9] = {
-        /* CIE XYZ to LUX1310 color space conversion matrix. */
-        {17716, 10000}, {-5404, 10000}, {-1674, 10000},
-        {-2845, 10000}, {12494, 10000}, {247,   10000},
-        {-2300, 10000}, {6236,  10000}, {6471,  10000}
-    };
-    const struct tiff_srational mmatrix[3] = {
-        {0, 1}, {1, 1}, {0, 1},
-    };
-
-    /* TIFF Baseline Tags (color) */
-    const struct tiff_tag colortags[] = {
-        /* TIFF Baseline Tags */
-        TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
-        TIFF_TAG_LONG(256, fpga->display->h_res),   /* ImageWidth */
-        TIFF_TAG_LONG(257, fpga->display->v_res),   /* ImageLength */
-        TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
-        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
-        TIFF_TAG_SHORT(262, 32803),         /* PhotometricInterpretation = Color Filter Array */
-        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
-        TIFF_TAG_STRING(272, "Chronos 1.4"),        /* Model */
-        TIFF_TAG_LONG(273, sizeof(tiffbuf)),        /* StripOffsets */
-        TIFF_TAG_SHORT(274, 1),             /* Orientation = Zero/zero is Top Left */
-        TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
-        TIFF_TAG_LONG(278, fpga->display->v_res),   /* RowsPerStrip */
-        TIFF_TAG_LONG(279, f_size),         /* StripByteCounts */
-        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
-        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
-    
-        /* TIFF-EP Tags */
-        TIFF_TAG(33421, TIFF_TYPE_SHORT, cfa_repeat),   /* CFARepeatPatternDim = 2x2 */
-        TIFF_TAG(33422, TIFF_TYPE_BYTE, cfa_pattern),   /* CFAPattern = GRBG */
-    
-        /* CinemaDNG Tags */
-        TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
-        TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
-        TIFF_TAG_STRING(50708, "Krontech Chronos 1.4"), /* UniqueCameraModel */
-        TIFF_TAG_SHORT(50711, 1),                       /* CFALayout = square */
-        TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
-        TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, cmatrix, sizeof(cmatrix)/sizeof(struct tiff_srational)),
-        TIFF_TAG_VECTOR(50728, TIFF_TYPE_RATIONAL, wbneutral, sizeof(wbneutral)/sizeof(struct tiff_rational)),
-        TIFF_TAG_SHORT(50778, 20),                      /* CalibrationIlluminant1 = D55 */
-    };
-
-    /* TIFF Baseline Tags (monochrome) */
-    const struct tiff_tag monotags[] = {
-        /* TIFF Baseline Tags */
-        TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
-        TIFF_TAG_LONG(256, fpga->display->h_res),   /* ImageWidth */
-        TIFF_TAG_LONG(257, fpga->display->v_res),   /* ImageLength */
-        TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
-        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
-        TIFF_TAG_SHORT(262, 34892),         /* PhotometricInterpretation = LinearRaw */
-        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
-        TIFF_TAG_STRING(272, "Chronos 1.4"),        /* Model */
-        TIFF_TAG_LONG(273, sizeof(tiffbuf)),        /* StripOffsets */
-        TIFF_TAG_SHORT(274, 1),             /* Orientation = Zero/zero is Top Left */
-        TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
-        TIFF_TAG_LONG(278, fpga->display->v_res),   /* RowsPerStrip */
-        TIFF_TAG_LONG(279, f_size),         /* StripByteCounts */
-        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
-        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
-
-        /* CinemaDNG Tags */
-        TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
-        TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
-        TIFF_TAG_STRING(50708, "Krontech Chronos 1.4"), /* UniqueCameraModel */
-        TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
-        TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, mmatrix, sizeof(mmatrix)/sizeof(struct tiff_srational)),
-    };
-
-    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0) {
-        fprintf(stderr, "Failed to create file \'%s\': %s\n", filename, strerror(errno));
-        return -1;
+    int i;
+    for (i = 0; i < RECOVER_NUM_BLOCKS; i++) {
+        struct recover_block *blk = &pipe->blocks[i];
+        if (blk->outbuf != blk->pixels) free(blk->outbuf);
+        free(blk->pixels);
+        free(blk->raw);
     }
+    if (pipe->manifest) fclose(pipe->manifest);
+    dump_close(pipe);
+    free(pipe->done);
+    free(pipe->scratch);
+    free(pipe);
+}
 
-    if (is_color) {
-        ifd.tags = colortags;
-        ifd.count = sizeof(colortags)/sizeof(struct tiff_tag);
-    } else {
-        ifd.tags = monotags;
-        ifd.count = sizeof(monotags)/sizeof(struct tiff_tag);
+/*
+ * Start the archive for a raw dump, with everything cam-convert will need
+ * to turn the frames back into DNG or TIFF files on a host: the resolution,
+ * color settings, segment and frame tables, and the calibration registers
+ * and packed FPN frame. The frames themselves are appended by the pipeline.
+ */
+static int
+dump_open(struct recover_pipeline *pipe, size_t nframes)
+{
+    struct fpga *fpga = pipe->fpga;
+    struct recovery_archive archive;
+    struct recovery_archive_segment *segtab;
+    struct recovery_archive_frame *frametab;
+    struct video_segment *seg;
+    char filename[PATH_MAX];
+    unsigned long frameno, frameaddr;
+    uint8_t *preamble;
+    size_t i, offset;
+    unsigned long badreads;
+    struct iovec iov;
+
+    memset(&archive, 0, sizeof(archive));
+    archive.flags = pipe->is_color ? RECOVERY_FLAG_COLOR : 0;
+    archive.flags |= (fpga->display->gainctl & DISPLAY_GAINCTL_3POINT) ? RECOVERY_FLAG_3POINT : 0;
+    archive.hres = pipe->hres;
+    archive.vres = pipe->vres;
+    archive.nsegments = pipe->list->totalsegs;
+    archive.nframes = nframes;
+    for (i = 0; i < 3; i++) {
+        archive.ccm[0 + i] = fpga->display->ccm_red[i];
+        archive.ccm[3 + i] = fpga->display->ccm_green[i];
+        archive.ccm[6 + i] = fpga->display->ccm_blue[i];
+        archive.wbal[i] = fpga->display->wbal[i];
     }
-    tiff_build_header(tiffbuf, sizeof(tiffbuf), &ifd);
-    if (write(fd, tiffbuf, sizeof(tiffbuf)) < 0) {
-        fprintf(stderr, "Failed to write header \'%s\': %s\n", filename, strerror(errno));
-        close(fd);
+    recovery_archive_layout(&archive);
+
+    /* Build everything up to the first frame, leaving room for the FPN readout to overrun. */
+    preamble = calloc(1, archive.data_offset + FPGA_FRAME_WORD_SIZE);
+    if (!preamble) {
+        fprintf(stderr, "Failed to allocate archive header: %s\n", strerror(errno));
         return -1;
     }
+    segtab = (struct recovery_archive_segment *)(preamble + archive.seg_offset);
+    for (seg = pipe->list->head, i = 0; seg && (i < archive.nsegments); seg = seg->next, i++) {
+        segtab[i].segno = seg->segno;
+        segtab[i].start = seg->start;
+        segtab[i].offset = seg->offset;
+        segtab[i].frameno = seg->frameno;
+        segtab[i].nframes = seg->nframes;
+    }
+    frametab = (struct recovery_archive_frame *)(preamble + archive.table_offset);
+    for (frameno = pipe->first, i = 0; i < nframes; frameno++, i++) {
+        video_segment_lookup(pipe->list, frameno, &frameaddr);
+        frametab[i].frameno = frameno;
+        frametab[i].address = frameaddr;
+    }
+    offset = archive.cal_offset;
+    memcpy(preamble + offset, (uint8_t *)fpga->reg + FPGA_COL_GAIN_BASE, sizeof(uint16_t) * pipe->hres);
+    offset += sizeof(uint16_t) * pipe->hres;
+    memcpy(preamble + offset, (uint8_t *)fpga->reg + FPGA_COL_OFFSET_BASE, sizeof(int16_t) * pipe->hres);
+    offset += sizeof(int16_t) * pipe->hres;
+    memcpy(preamble + offset, (uint8_t *)fpga->reg + FPGA_COL_CURVE_BASE, sizeof(int16_t) * pipe->hres);
+    offset += sizeof(int16_t) * pipe->hres;
+    badreads = fpga->vram_errors;
+    pipe->readout(fpga, preamble + offset, fpga->display->fpn_address,
+                  (archive.frame_size + FPGA_FRAME_WORD_SIZE - 1) / FPGA_FRAME_WORD_SIZE);
+    if (fpga->vram_errors != badreads) {
+        fprintf(stderr, "Warning: FPN frame failed readout verification\n");
+    }
+    archive.fpn_crc32c = crc32c(0, preamble + offset, archive.frame_size);
+    memset(preamble + offset + archive.frame_size, 0, archive.data_offset - offset - archive.frame_size);
+    memcpy(preamble, &archive, sizeof(archive));
+    pipe->table_offset = archive.table_offset;
 
-    framebuf = malloc(f_size);
-    if (!framebuf) {
-        fprintf(stderr, "Failed to allocate frame memory for \'%s\': %s\n", filename, strerror(errno));
-        close(fd);
+    /* Write it out, and leave the file positioned for the first frame. */
+    mkfilepath(filename, pipe->outdir, "/" RECOVERY_ARCHIVE_NAME);
+    printf("Dumping video memory to %s\n", filename);
+    pipe->archive = recover_create(filename);
+    pipe->part = pipe->archive;
+    pipe->part_frames = archive.part_frames;
+    if (pipe->archive < 0) {
+        fprintf(stderr, "Failed to create file \'%s\': %s\n", filename, strerror(errno));
+        free(preamble);
         return -1;
     }
-    readout(fpga, framebuf, addr, (f_size + FPGA_FRAME_WORD_SIZE - 1) / FPGA_FRAME_WORD_SIZE);
-    write_pixels(fd, framebuf, fpga->display->h_res, fpga->display->v_res);
-    free(framebuf);
-    close(fd);
+    iov.iov_base = preamble;
+    iov.iov_len = archive.data_offset;
+    if (recover_writev(pipe->archive, &iov, 1) < 0) {
+        fprintf(stderr, "Failed to write archive \'%s\': %s\n", filename, strerror(errno));
+        free(preamble);
+        return -1;
+    }
+    free(preamble);
     return 0;
 }
 
 static int
-load_caldata(struct fpga *fpga, void *(*readout)(struct fpga *, void *, uint32_t, uint32_t))
+recover_frames(struct fpga *fpga, void *(*readout)(struct fpga *, void *, uint32_t, uint32_t),
+    struct video_seglist *list, const struct recover_args *args)
 {
-    size_t in, out;
-    uint32_t f_size = fpga->seq->frame_size * FPGA_FRAME_WORD_SIZE;
-    uint8_t *cal_fpn_raw = malloc(f_size * FPGA_FRAME_WORD_SIZE);
+    struct recover_pipeline *pipe = calloc(1, sizeof(struct recover_pipeline));
+    pthread_t reader, unpacker;
+    uint16_t wbal[3];
+    size_t rawsize;
+    int ret = 0;
+    int i;
 
-    /* Grab FPN and column gain. */
-    memcpy(cal_gain, (uint8_t *)fpga->reg + FPGA_COL_GAIN_BASE, sizeof(uint16_t) * fpga->display->h_res);
-    readout(fpga, cal_fpn_raw, fpga->display->fpn_address, fpga->seq->frame_size);
+    if (!pipe) {
+        fprintf(stderr, "Failed to allocate recovery pipeline: %s\n", strerror(errno));
+        return -1;
+    }
+    pipe->fpga = fpga;
+    pipe->readout = readout;
+    pipe->list = list;
+    pipe->outdir = args->outdir;
+    pipe->status = args->status;
+    pipe->first = args->first;
+    pipe->stop = args->stop;
+    pipe->tiff = args->tiff;
+    pipe->dump = args->dump;
+    pipe->archive = -1;
+    pipe->part = -1;
+    pipe->is_color = (fpga->display->control & DISPLAY_CTL_COLOR_MODE) != 0;
+    pipe->hres = fpga->display->h_res;
+    pipe->vres = fpga->display->v_res;
+    pipe->rawstride = (pipe->hres * 3) / 2;
+    pipe->outstride = pipe->hres * sizeof(uint16_t) * ((pipe->tiff && pipe->is_color) ? 3 : 1);
+    for (i = 0; i < 3; i++) {
+        wbal[i] = fpga->display->wbal[i];
+    }
+    recovery_build_header(pipe->header, pipe->hres, pipe->vres, pipe->is_color ? RECOVERY_FLAG_COLOR : 0, wbal, pipe->tiff);
 
+    /* Find out what's been done already. */
+    pipe->ndone = list->totalframes;
+    pipe->done = calloc(pipe->ndone + 1, sizeof(uint8_t));
+    if (!pipe->done) {
+        fprintf(stderr, "Failed to allocate recovery pipeline: %s\n", strerror(errno));
+        recover_free(pipe);
+        return -1;
+    }
+    if (pipe->dump ? (dump_open(pipe, recover_count(pipe)) < 0) : (manifest_open(pipe, args->resume) < 0)) {
+        recover_free(pipe);
+        return -1;
+    }
+    pipe->total = recover_count(pipe);
+    if (args->resume) {
+        printf("Resuming recovery with %lu frames remaining\n", pipe->total);
+    }
 
-    if (fpga->display->gainctl & DISPLAY_GAINCTL_3POINT) {
-        cal_npoints = 3;
+    /* Pick a block size that keeps every readout aligned, or a whole frame for the demosaic. */
+    pipe->blockrows = RECOVER_BLOCK_ROWS;
+    while (((pipe->blockrows * pipe->rawstride) % RECOVER_BLOCK_ALIGN) && (pipe->blockrows < pipe->vres)) {
+        pipe->blockrows *= 2;
+    }
+    if ((pipe->tiff && pipe->is_color) || (pipe->blockrows > pipe->vres)) {
+        pipe->blockrows = pipe->vres;
+    }
+    if (pipe->tiff && pipe->is_color) {
+        pipe->scratch = malloc(DEMOSAIC_SCRATCH(pipe->hres));
+        load_colormatrix(&pipe->params, fpga);
+    }
 
-        /* Convert FPN to signed 16-bit data for 2-point calibration. */
-        for (in = 0, out = 0; (in + 24) <= f_size; in += 24, out += 16) {
-            neon_be12_unpack_signed(cal_fpn + out, cal_fpn_raw + in);
+    /* Allocate the ring of blocks, with the readout rounded up to whole words. */
+    rawsize = pipe->blockrows * pipe->rawstride + FPGA_FRAME_WORD_SIZE;
+    for (i = 0; i < RECOVER_NUM_BLOCKS; i++) {
+        struct recover_block *blk = &pipe->blocks[i];
+        blk->state = RECOVER_BLOCK_FREE;
+        blk->raw = malloc(rawsize);
+        blk->pixels = malloc(pipe->blockrows * pipe->hres * sizeof(uint16_t));
+        blk->outbuf = (pipe->tiff && pipe->is_color) ? malloc(pipe->blockrows * pipe->outstride) : blk->pixels;
+        if (!blk->raw || !blk->pixels || !blk->outbuf) {
+            fprintf(stderr, "Failed to allocate frame memory: %s\n", strerror(errno));
+            recover_free(pipe);
+            return -1;
         }
-        
-        /* Allocate memory for 3-point calibration data. */
-        memcpy(cal_offset, (uint8_t *)fpga->reg + FPGA_COL_OFFSET_BASE, sizeof(int16_t) * fpga->display->h_res);
-        memcpy(cal_curve,  (uint8_t *)fpga->reg + FPGA_COL_CURVE_BASE,  sizeof(int16_t) * fpga->display->h_res);
     }
-    else {
-        cal_npoints = 2;
 
-        /* Convert FPN to unsigned 16-bit data for 2-point calibration. */
-        for (in = 0, out = 0; (in + 24) <= f_size; in += 24, out += 16) {
-            neon_be12_unpack_unsigned(cal_fpn + out, cal_fpn_raw + in);
+    clock_gettime(CLOCK_MONOTONIC, &pipe->started);
+    pipe->reported = pipe->started;
+    pthread_mutex_init(&pipe->mutex, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+    if (pthread_create(&reader, NULL, recover_read_thread, pipe) != 0) {
+        fprintf(stderr, "Failed to start readout thread: %s\n", strerror(errno));
+        recover_free(pipe);
+        return -1;
+    }
+    if (pthread_create(&unpacker, NULL, recover_unpack_thread, pipe) != 0) {
+        unsigned long index;
+        unsigned int nrows;
+        fprintf(stderr, "Failed to start unpacking thread: %s\n", strerror(errno));
+
+        /* Stop the reader, and drain whatever it had already read. */
+        pthread_mutex_lock(&pipe->mutex);
+        pipe->abort = 1;
+        pthread_mutex_unlock(&pipe->mutex);
+        for (index = 0;; index++) {
+            struct recover_block *blk = recover_wait(pipe, index, RECOVER_BLOCK_READ);
+            nrows = blk->nrows;
+            recover_post(pipe, blk, RECOVER_BLOCK_FREE);
+            if (!nrows) break;
         }
+        ret = -1;
+    }
+    else {
+        if (pipe->dump) {
+            recover_dump(pipe);
+        } else {
+            recover_write(pipe);
+        }
+        pthread_join(unpacker, NULL);
+        recover_progress(pipe, (pipe->errors || pipe->badframes) ? "failed" : "done");
+        if (fpga->vram_verify) {
+            printf("Readout verification: %lu retries, %lu frames failed\n", pipe->retries, pipe->badframes);
+        }
+        if (pipe->errors || pipe->badframes) ret = -1;
+    }
+    pthread_join(reader, NULL);
+
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->mutex);
+    recover_free(pipe);
+    return ret;
+}
+
+/* FPN readout chunk size, a multiple of both the 24-byte unpack and the 32-byte word size. */
+#define CAL_CHUNK_SIZE  (96 * 1024)
+
+static int
+load_caldata(struct fpga *fpga, void *(*readout)(struct fpga *, void *, uint32_t, uint32_t))
+{
+    size_t hres = fpga->display->h_res;
+    size_t vres = fpga->display->v_res;
+    size_t npix = hres * vres;
+    size_t ncols = CALIBRATE_ALIGN(hres);
+    size_t f_size = (size_t)fpga->seq->frame_size * FPGA_FRAME_WORD_SIZE;
+    size_t offset;
+    unsigned long badreads = fpga->vram_errors;
+    unsigned int npoints;
+    int16_t *fpn, *coloffset, *curve;
+    uint16_t *gain;
+    uint8_t *chunk;
+
+    /* Frames are left uncalibrated unless everything below succeeds. */
+    cal.hres = hres;
+    if (!hres || !vres || (hres > MAX_HRES) || (vres > MAX_VRES)) {
+        fprintf(stderr, "Invalid resolution for calibration: %zux%zu\n", hres, vres);
+        return -1;
+    }
+
+    /* Map the calibration arrays, FPN last so it gets the padding at the end. */
+    cal_mapsize = (ncols * 3 + CALIBRATE_ALIGN(npix) + 16) * sizeof(int16_t);
+    cal_map = mmap(NULL, cal_mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cal_map == MAP_FAILED) {
+        fprintf(stderr, "Failed to allocate calibration data: %s\n", strerror(errno));
+        cal_map = NULL;
+        return -1;
+    }
+    chunk = malloc(CAL_CHUNK_SIZE);
+    if (!chunk) {
+        fprintf(stderr, "Failed to allocate calibration data: %s\n", strerror(errno));
+        munmap(cal_map, cal_mapsize);
+        cal_map = NULL;
+        return -1;
+    }
+    gain = (uint16_t *)cal_map;
+    coloffset = (int16_t *)cal_map + ncols;
+    curve = (int16_t *)cal_map + ncols * 2;
+    fpn = (int16_t *)cal_map + ncols * 3;
+    npoints = (fpga->display->gainctl & DISPLAY_GAINCTL_3POINT) ? 3 : 2;
+
+    /* Grab the column gain, and the offset and curve for 3-point calibration. */
+    memcpy(gain, (uint8_t *)fpga->reg + FPGA_COL_GAIN_BASE, sizeof(uint16_t) * hres);
+    if (npoints == 3) {
+        memcpy(coloffset, (uint8_t *)fpga->reg + FPGA_COL_OFFSET_BASE, sizeof(int16_t) * hres);
+        memcpy(curve,  (uint8_t *)fpga->reg + FPGA_COL_CURVE_BASE,  sizeof(int16_t) * hres);
+    }
+
+    /*
+     * Stream the FPN frame through a small buffer, converting it to signed
+     * 16-bit data for 3-point calibration, or unsigned for 2-point.
+     */
+    if (f_size > (npix * 12 / 8)) f_size = npix * 12 / 8;
+    for (offset = 0; offset < f_size; offset += CAL_CHUNK_SIZE) {
+        size_t len = ((f_size - offset) < CAL_CHUNK_SIZE) ? (f_size - offset) : CAL_CHUNK_SIZE;
+        readout(fpga, chunk, fpga->display->fpn_address + offset / FPGA_FRAME_WORD_SIZE,
+                (len + FPGA_FRAME_WORD_SIZE - 1) / FPGA_FRAME_WORD_SIZE);
+        calibrate_unpack_fpn(fpn + (offset * 2) / 3, chunk, (len * 2) / 3, npoints);
+    }
+    free(chunk);
+    if (fpga->vram_errors != badreads) {
+        fprintf(stderr, "Warning: FPN frame failed readout verification\n");
     }
-    free(cal_fpn_raw);
+
+    /* The calibration data is now shared, read-only, by the recovery threads. */
+    mprotect(cal_map, cal_mapsize, PROT_READ);
+    cal.npoints = npoints;
+    cal.fpn = fpn;
+    cal.offset = coloffset;
+    cal.gain = gain;
+    cal.curve = curve;
     return 0;
 }
 
+static void
+free_caldata(void)
+{
+    if (cal_map) munmap(cal_map, cal_mapsize);
+    cal_map = NULL;
+    memset(&cal, 0, sizeof(cal));
+}
+
 /*===============================================
  * Recording Region Management
  *===============================================
@@ -414,10 +1055,21 @@ usage(int argc, char *const argv[])
     printf("options:\n");
     printf("  -d, --dest DIR    save video data to DIR (default: /media/sda1/recovery)\n");
     printf("  -f, --force       ignore existing files, possibly overwriting data\n");
+    printf("  -r, --resume      continue an interrupted recovery into DIR, skipping the\n");
+    printf("                    frames listed in its manifest\n");
     printf("  -i, --inspect     inspect FPGA state only, don't attempt recovery\n");
     printf("  -s, --start OFFS  start recovery from frame number OFFS (default: 0)\n");
     printf("  -l, --length NUM  recover up to NUM frames from memory (default: all)\n");
+    printf("  -n, --frames A-B  recover frame numbers A through B inclusive\n");
+    printf("  -g, --segment NUM recover only the frames of segment NUM\n");
     printf("  -a, --all         recover all video memory (ignores segment data)\n");
+    printf("  -t, --tiff        demosaic frames and save them as 16-bit RGB TIFF instead of DNG\n");
+    printf("  -D, --dump        dump raw video memory and calibration data into an archive\n");
+    printf("                    in DIR, to be converted by cam-convert on a host. The archive\n");
+    printf("                    is split into parts of under 4 GiB for FAT32 media\n");
+    printf("  -j, --status FILE periodically write the recovery progress to FILE as JSON\n");
+    printf("  -V, --verify      read video memory twice and retry until the reads agree,\n");
+    printf("                    reporting any frames that could not be read reliably\n");
     printf("  --help            display this message and exit\n");
 } /* usage */
 
@@ -427,18 +1079,33 @@ main(int argc, char *const argv[])
     int force = 0;
     int allmem = 0;
     int inspect = 0;
+    int resume = 0;
+    int tiff = 0;
+    int dump = 0;
+    int verify = 0;
     unsigned long length = ULONG_MAX;
     unsigned long frameno = 0;
+    unsigned long lastframe = ULONG_MAX;
+    unsigned long segno = ULONG_MAX;
+    const char *status = NULL;
+    struct recover_args args;
 
     const char *outdir = "/media/sda1/recovery";
-	const char *shortopts = "haid:s:l:f";
+	const char *shortopts = "haitrDVd:s:l:n:g:j:f";
 	const struct option options[] = {
         {"dest",    required_argument,  NULL, 'd'},
         {"force",   no_argument,        NULL, 'f'},
+        {"resume",  no_argument,        NULL, 'r'},
         {"inspect", no_argument,        NULL, 'i'},
         {"start",   required_argument,  NULL, 's'},
         {"length",  required_argument,  NULL, 'l'},
+        {"frames",  required_argument,  NULL, 'n'},
+        {"segment", required_argument,  NULL, 'g'},
         {"all",     no_argument ,       NULL, 'a'},
+        {"tiff",    no_argument,        NULL, 't'},
+        {"dump",    no_argument,        NULL, 'D'},
+        {"status",  required_argument,  NULL, 'j'},
+        {"verify",  no_argument,        NULL, 'V'},
 		{"help",    no_argument,        NULL, 'h'},
 		{0, 0, 0, 0}
 	};
@@ -489,6 +1156,10 @@ main(int argc, char *const argv[])
             case 'f':
                 force = 1;
                 break;
+
+            case 'r':
+                resume = 1;
+                break;
             
             case 'i':
                 inspect = 1;
@@ -510,15 +1181,55 @@ main(int argc, char *const argv[])
                 }
                 break;
             
+            case 'n':
+                frameno = strtoul(optarg, &end, 0);
+                if ((*end != '-') || (lastframe = strtoul(end + 1, &end, 0), *end != '\0') || (lastframe < frameno)) {
+                    fprintf(stderr, "Failed to parse argument: \'%s\'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'g':
+                segno = strtoul(optarg, &end, 0);
+                if (*end != '\0') {
+                    fprintf(stderr, "Failed to parse argument: \'%s\'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'j':
+                status = optarg;
+                break;
+
             case 'a':
                 allmem = 1;
                 break;
 
+            case 't':
+                tiff = 1;
+                break;
+
+            case 'D':
+                dump = 1;
+                break;
+
+            case 'V':
+                verify = 1;
+                break;
+
             case 'h':
                 usage(argc, argv);
                 return 0;
 		}
 	}
+    if (force && resume) {
+        fprintf(stderr, "The --force and --resume options cannot be used together\n");
+        return EXIT_FAILURE;
+    }
+    if (dump && (tiff || resume)) {
+        fprintf(stderr, "The --dump option cannot be used with --tiff or --resume\n");
+        return EXIT_FAILURE;
+    }
 
 
     /* Step 1) Ensure that we can retreieve a sane FPGA version. */
@@ -537,10 +1248,10 @@ main(int argc, char *const argv[])
     printf("\tTotal Frames: %u\n", (r_stop - r_start) / f_size);
     if (fpga->vram->identifier == VRAM_IDENTIFIER) {
         printf("\tFast VRAM Readout: Supported\n");
-        vram_readout_func = vram_readout_fast;
+        vram_readout_func = fpga_vram_read_fast;
     } else {
         printf("\tFast VRAM Readout: Unsupported\n");
-        vram_readout_func = vram_readout_slow;
+        vram_readout_func = fpga_vram_read_slow;
     }
     if (fpga->display->gainctl & DISPLAY_GAINCTL_3POINT) {
         printf("\tCalibration: 3-Point\n");
@@ -549,8 +1260,11 @@ main(int argc, char *const argv[])
     }
     printf("\n");
 
-    /* Step 2) Extract the calibration data. */
-    load_caldata(fpga, vram_readout_func);
+    /* Step 2) Extract the calibration data, unless it's going into the archive as-is. */
+    fpga->vram_verify = verify;
+    if (!dump && (load_caldata(fpga, vram_readout_func) < 0)) {
+        printf("Calibration Data Unavailable - Recovering Uncalibrated Frames\n");
+    }
 
     /* Step 3) Generate the recording segment data. */
     video_segments_init(&list, fpga->seq->region_start, fpga->seq->region_stop, fpga->seq->frame_size);
@@ -564,6 +1278,35 @@ main(int argc, char *const argv[])
         return 0;
     }
 
+    /* Work out which frames to recover. */
+    args.outdir = outdir;
+    args.status = status;
+    args.tiff = tiff;
+    args.resume = resume;
+    args.dump = dump;
+    if (segno != ULONG_MAX) {
+        struct video_segment *seg;
+        for (seg = list.head; seg; seg = seg->next) {
+            if (seg->segno == segno) break;
+        }
+        if (!seg) {
+            fprintf(stderr, "Segment %lu not found\n", segno);
+            return EXIT_FAILURE;
+        }
+        args.first = seg->frameno + frameno;
+        args.stop = seg->frameno + seg->nframes;
+    }
+    else {
+        args.first = frameno;
+        args.stop = (lastframe != ULONG_MAX) ? lastframe + 1 : list.totalframes;
+    }
+    if (args.first > args.stop) {
+        args.stop = args.first;
+    }
+    if ((length != ULONG_MAX) && ((args.stop - args.first) > length)) {
+        args.stop = args.first + length;
+    }
+
     /* Create a directory for the recovery data. */
     printf("Creating video recovery directory at %s\n", outdir);
     if (force) {
@@ -579,7 +1322,7 @@ main(int argc, char *const argv[])
             return EXIT_FAILURE;
         }
     }
-    else if (mkdir(outdir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+    else if ((mkdir(outdir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) && (!resume || (errno != EEXIST))) {
         fprintf(stderr, "Unable to create directory %s (%s)\n", outdir, strerror(errno));
         return EXIT_FAILURE;
     }
@@ -602,14 +1345,7 @@ main(int argc, char *const argv[])
     }
 
     /* Step 4) Begin dumping frames. */
-    while (frameno < length) {
-        unsigned long frameaddr;
-        if (!video_segment_lookup(&list, frameno, &frameaddr)) break;
-
-        mkfilepath(filename, outdir, "/frame_%06d.dng", frameno);
-        printf("Backing up frame from 0x%08lx to %s\n", frameaddr, filename);
-        write_frame(fpga, filename, frameaddr, vram_readout_func);
-        
-        frameno++;
-    }
+    ret = recover_frames(fpga, vram_readout_func, &list, &args);
+    free_caldata();
+    return (ret < 0) ? EXIT_FAILURE : 0;
 } /* main */
@@ -0,0 +1,270 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <gst/gst.h>
+#include <gst/controller/gstcontroller.h>
+
+#include "image-stats.h"
+#include "pipeline/gst/gstneon.h"
+
+/*
+ * Run the image statistics element on video test patterns, printing each of
+ * the results that it reports, and checking every frame against the scalar
+ * reference implementation over a range of subsampling steps. This needs
+ * nothing more than GStreamer's videotestsrc, so it can be run on a host.
+ */
+static struct {
+    GMainLoop       *loop;
+    unsigned long   frames;
+    unsigned long   reports;
+    unsigned long   mismatch;
+    int             verbose;
+} test = {
+    .loop = NULL,
+};
+
+static int
+stats_compare(const struct image_stats *a, const struct image_stats *b)
+{
+    return (a->step != b->step) || (a->width != b->width) || (a->height != b->height) ||
+        (a->samples != b->samples) || (a->clipblack != b->clipblack) || (a->clipwhite != b->clipwhite) ||
+        (a->focus != b->focus) || memcmp(a->histogram, b->histogram, sizeof(a->histogram)) ||
+        memcmp(a->meter, b->meter, sizeof(a->meter)) ||
+        memcmp(a->rows, b->rows, sizeof(a->rows)) || memcmp(a->columns, b->columns, sizeof(a->columns));
+}
+
+static gboolean
+stats_probe(GstPad *pad, GstBuffer *buffer, gpointer cbdata)
+{
+    GstStructure *gstruct = gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0);
+    unsigned int width = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+    unsigned int height = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+    struct image_stats opt, ref;
+    void *scratch = g_malloc(IMAGE_STATS_SCRATCH(width, height));
+    unsigned int step;
+    /* Meter the centre of the frame, with an odd alignment. */
+    struct image_window meter = {
+        .x = width / 4 + 1,
+        .y = height / 4 + 1,
+        .width = width / 2 - 1,
+        .height = height / 2 - 1,
+    };
+
+    for (step = 1; step <= 4; step++) {
+        image_stats(&opt, GST_BUFFER_DATA(buffer), width, height, width, step, &meter, scratch);
+        image_stats_ref(&ref, GST_BUFFER_DATA(buffer), width, height, width, step, &meter);
+        if (stats_compare(&opt, &ref)) {
+            fprintf(stderr, "frame %lu: mismatch at step %u (focus %g != %g)\n", test.frames, step, opt.focus, ref.focus);
+            test.mismatch++;
+        }
+    }
+    g_free(scratch);
+    test.frames++;
+    return TRUE;
+}
+
+static gboolean
+stats_bus_watch(GstBus *bus, GstMessage *msg, gpointer data)
+{
+    GstElement *stats = data;
+    struct image_stats results;
+    guint64 cputime;
+    GError *error;
+    gchar *debug;
+    unsigned int i;
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ELEMENT:
+            if (!gst_structure_has_name(gst_message_get_structure(msg), "neonstats")) {
+                break;
+            }
+            test.reports++;
+            cputime = g_value_get_uint64(gst_structure_get_value(gst_message_get_structure(msg), "cpu-time"));
+            gst_neon_stats_get_results(GST_NEON_STATS(stats), &results);
+            printf("step=%u %ux%u clip-black=%.2f%% clip-white=%.2f%% focus=%.1f cpu-time=%llu us\n",
+                   results.step, results.width, results.height, results.clipblack, results.clipwhite,
+                   results.focus, (unsigned long long)cputime);
+            if (test.verbose) {
+                printf("\trows:");
+                for (i = 0; i < IMAGE_STATS_BANDS; i++) printf(" %u", results.rows[i]);
+                printf("\n\tcolumns:");
+                for (i = 0; i < IMAGE_STATS_BANDS; i++) printf(" %u", results.columns[i]);
+                printf("\n");
+            }
+            break;
+
+        case GST_MESSAGE_EOS:
+            g_main_loop_quit(test.loop);
+            break;
+
+        case GST_MESSAGE_ERROR:
+            gst_message_parse_error(msg, &error, &debug);
+            fprintf(stderr, "GST error received from %s: %s\n", GST_OBJECT_NAME(msg->src), error->message);
+            g_free(debug);
+            g_error_free(error);
+            test.mismatch++;
+            g_main_loop_quit(test.loop);
+            break;
+
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Gather image statistics from video test patterns and check them against the reference.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  resolution of the test pattern (default: 1280x1024)\n");
+    printf("  -n, --count NUM       number of frames to analyze (default: 30)\n");
+    printf("  -p, --pattern NUM     videotestsrc pattern number (default: 0)\n");
+    printf("  -b, --budget USEC     CPU time budget per frame (default: 2000)\n");
+    printf("  -v, --verbose         print the waveforms with each result\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long width = 1280;
+    unsigned long height = 1024;
+    unsigned long count = 30;
+    unsigned long pattern = 0;
+    unsigned long budget = 2000;
+    const char *shortopts = "r:n:p:b:vh";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"count",       required_argument,  NULL, 'n'},
+        {"pattern",     required_argument,  NULL, 'p'},
+        {"budget",      required_argument,  NULL, 'b'},
+        {"verbose",     no_argument,        NULL, 'v'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    GstElement *pipeline, *src, *stats, *sink;
+    GstCaps *caps;
+    GstBus *bus;
+    GstPad *pad;
+    char *end;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') ||
+                    (width < 2) || (height < 2) || (width & 1) || (height & 1)) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                count = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !count) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'p':
+                pattern = strtoul(optarg, &end, 10);
+                if (*end != '\0') {
+                    fprintf(stderr, "Invalid pattern: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'b':
+                budget = strtoul(optarg, &end, 10);
+                if (*end != '\0') {
+                    fprintf(stderr, "Invalid budget: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'v':
+                test.verbose = 1;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    gst_init(&argc, &argv);
+    gst_controller_init(NULL, NULL);
+    if (!gst_element_register(NULL, "neonstats", GST_RANK_NONE, GST_TYPE_NEON_STATS)) {
+        fprintf(stderr, "Failed to register Gstreamer NEON statistics element.\n");
+        return EXIT_FAILURE;
+    }
+
+    pipeline = gst_pipeline_new("pipeline");
+    src = gst_element_factory_make("videotestsrc", "source");
+    stats = gst_element_factory_make("neonstats", "stats");
+    sink = gst_element_factory_make("fakesink", "sink");
+    if (!pipeline || !src || !stats || !sink) {
+        fprintf(stderr, "Failed to create pipeline elements.\n");
+        return EXIT_FAILURE;
+    }
+    g_object_set(G_OBJECT(src), "num-buffers", (gint)count, NULL);
+    g_object_set(G_OBJECT(src), "pattern", (gint)pattern, NULL);
+    g_object_set(G_OBJECT(stats), "interval", (guint)0, NULL);
+    g_object_set(G_OBJECT(stats), "budget", (guint)budget, NULL);
+    gst_bin_add_many(GST_BIN(pipeline), src, stats, sink, NULL);
+
+    caps = gst_caps_new_simple ("video/x-raw-yuv",
+                "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC('N', 'V', '1', '2'),
+                "width", G_TYPE_INT, (gint)width,
+                "height", G_TYPE_INT, (gint)height,
+                NULL);
+    if (!gst_element_link_filtered(src, stats, caps) || !gst_element_link(stats, sink)) {
+        fprintf(stderr, "Failed to link pipeline elements.\n");
+        return EXIT_FAILURE;
+    }
+    gst_caps_unref(caps);
+
+    pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_buffer_probe(pad, G_CALLBACK(stats_probe), NULL);
+    gst_object_unref(pad);
+
+    test.loop = g_main_loop_new(NULL, FALSE);
+    bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_add_watch(bus, stats_bus_watch, stats);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    g_main_loop_run(test.loop);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(GST_OBJECT(pipeline));
+
+    printf("%lu frames, %lu reports, %lu mismatches\n", test.frames, test.reports, test.mismatch);
+    return (test.mismatch || !test.reports) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
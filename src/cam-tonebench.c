@@ -0,0 +1,204 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "tone-curve.h"
+#include "utils.h"
+
+/*
+ * Benchmark and correctness check for the tone curve kernel. Frames of
+ * random 12-bit samples, both right-aligned and left-aligned in 16 bits as
+ * in the raw16 format, are mapped through each of the built-in curves by
+ * both the optimized and reference implementations, which must agree
+ * exactly. The curves themselves must also be monotonic and span the full
+ * 8-bit range, with middle grey landing where each curve says it should.
+ */
+struct bench_curve {
+    const char      *name;
+    unsigned int    curve;
+    unsigned int    grey;   /* Expected encoding of 18% grey. */
+};
+
+static const struct bench_curve bench_curves[] = {
+    {"linear",  TONE_CURVE_LINEAR,  46},
+    {"srgb",    TONE_CURVE_SRGB,    118},
+    {"rec709",  TONE_CURVE_REC709,  104},
+    {"log",     TONE_CURVE_LOG,     201},
+};
+#define BENCH_NUM_CURVES    (sizeof(bench_curves) / sizeof(bench_curves[0]))
+
+/* Check the shape of a curve, returning the number of problems found. */
+static unsigned int
+bench_check_curve(const uint8_t *lut, const struct bench_curve *c)
+{
+    unsigned int grey = lut[(unsigned int)(0.18 * (TONE_CURVE_SIZE - 1) + 0.5)];
+    unsigned int errors = 0;
+    unsigned int i;
+
+    for (i = 1; i < TONE_CURVE_SIZE; i++) {
+        if (lut[i] < lut[i - 1]) errors++;
+    }
+    if ((lut[0] != 0) || (lut[TONE_CURVE_SIZE - 1] != 255)) errors++;
+    if ((grey + 1 < c->grey) || (grey > c->grey + 1)) {
+        fprintf(stderr, "%s: 18%% grey encoded as %u, expected %u\n", c->name, grey, c->grey);
+        errors++;
+    }
+    return errors;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Benchmark and verify 12 to 8-bit tone mapping of random frames.\n\n");
+
+    printf("options:\n");
+    printf("  -r, --resolution WxH  frame resolution to map (default: 1280x1024)\n");
+    printf("  -n, --count NUM       number of frames to map (default: 10)\n");
+    printf("  -c, --curve NAME      tone curve, linear, srgb, rec709 or log (default: all)\n");
+    printf("  --help                display this message and exit\n");
+} /* usage */
+
+int
+main(int argc, char *const argv[])
+{
+    unsigned long width = 1280;
+    unsigned long height = 1024;
+    unsigned long count = 10;
+    int curve = -1;
+    const char *shortopts = "r:n:c:h";
+    const struct option options[] = {
+        {"resolution",  required_argument,  NULL, 'r'},
+        {"count",       required_argument,  NULL, 'n'},
+        {"curve",       required_argument,  NULL, 'c'},
+        {"help",        no_argument,        NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    uint8_t lut[TONE_CURVE_SIZE];
+    uint16_t *samples;
+    uint8_t *ref, *out;
+    unsigned long npixels, i;
+    unsigned int c, shift;
+    int failed = 0;
+    char *end;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (opt) {
+            case 'r':
+                width = strtoul(optarg, &end, 10);
+                if ((*end != 'x') || (height = strtoul(end + 1, &end, 10), *end != '\0') || !width || !height) {
+                    fprintf(stderr, "Invalid resolution: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                count = strtoul(optarg, &end, 10);
+                if ((*end != '\0') || !count) {
+                    fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'c':
+                for (c = 0; c < BENCH_NUM_CURVES; c++) {
+                    if (strcasecmp(optarg, bench_curves[c].name) == 0) break;
+                }
+                if (c >= BENCH_NUM_CURVES) {
+                    fprintf(stderr, "Invalid curve: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                curve = c;
+                break;
+
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* Leave an odd tail to exercise the leftovers. */
+    npixels = width * height;
+    samples = malloc((npixels + 7) * sizeof(uint16_t));
+    ref = malloc(npixels + 7);
+    out = malloc(npixels + 7);
+    if (!samples || !ref || !out) {
+        fprintf(stderr, "Failed to allocate frame: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    npixels += 7;
+
+    for (c = 0; c < BENCH_NUM_CURVES; c++) {
+        unsigned int errors;
+
+        if ((curve >= 0) && (c != (unsigned int)curve)) continue;
+        tone_curve_init(lut, bench_curves[c].curve);
+        errors = bench_check_curve(lut, &bench_curves[c]);
+        printf("%s:\n", bench_curves[c].name);
+        printf("\tcurve errors: %u\n", errors);
+        if (errors) failed = 1;
+
+        for (shift = 0; shift <= 4; shift += 4) {
+            unsigned long long start, cpu, reftime;
+            size_t mismatch = 0;
+
+            /* Random samples, with a few out of range to exercise the clamp. */
+            srand(c + shift);
+            for (i = 0; i < npixels; i++) {
+                samples[i] = (rand() & 0x1fff) << shift;
+            }
+
+            start = clock_usec(CLOCK_MONOTONIC);
+            tone_map_ref(ref, samples, npixels, shift, lut);
+            reftime = clock_usec(CLOCK_MONOTONIC) - start;
+
+            start = clock_usec(CLOCK_MONOTONIC);
+            cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID);
+            for (i = 0; i < count; i++) {
+                tone_map(out, samples, npixels, shift, lut);
+            }
+            cpu = clock_usec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+            start = clock_usec(CLOCK_MONOTONIC) - start;
+
+            for (i = 0; i < npixels; i++) {
+                if (out[i] != ref[i]) mismatch++;
+            }
+            printf("\t%s samples:\n", shift ? "left-aligned" : "right-aligned");
+            printf("\t\treference:   %llu us/frame\n", reftime);
+            printf("\t\toptimized:   %llu us/frame (%llu us cpu)\n", start / count, cpu / count);
+            printf("\t\tmismatches:  %zu\n", mismatch);
+            if (mismatch) failed = 1;
+        }
+    }
+
+    free(out);
+    free(ref);
+    free(samples);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
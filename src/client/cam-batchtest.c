@@ -0,0 +1,398 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "jsmn.h"
+
+/*
+ * Check the atomic batch requests of cam-scgi, by talking SCGI to it directly
+ * rather than through a web server. This needs cam-scgi to be serving the
+ * video interface of cam-dbusmock, which rejects unknown parameter names and
+ * treats videoState as read-only, the same as the camera daemons do:
+ *
+ *   $ cam-dbusmock --video &
+ *   $ cam-scgi --video &
+ *   $ cam-batchtest
+ *
+ * Each test makes a batch of sets that partly fails, and checks the status of
+ * every operation, then reads the parameters back to check that the sets that
+ * succeeded were reverted. Request bodies that are not an array of operations
+ * should be refused.
+ */
+#define BATCHTEST_MAX_RESPONSE  65536
+#define BATCHTEST_MAX_TOKENS    256
+
+struct batchtest_response {
+    int         status;
+    char        body[BATCHTEST_MAX_RESPONSE];
+    jsmntok_t   tokens[BATCHTEST_MAX_TOKENS];
+    int         ntokens;
+};
+
+static const char *batchtest_host = "127.0.0.1";
+static const char *batchtest_port = "8111";
+static int batchtest_verbose = 0;
+
+/* Append an SCGI header, returning the new length of the headers. */
+static size_t
+batchtest_header(char *headers, size_t hdrlen, const char *name, const char *value)
+{
+    memcpy(headers + hdrlen, name, strlen(name) + 1);
+    hdrlen += strlen(name) + 1;
+    memcpy(headers + hdrlen, value, strlen(value) + 1);
+    return hdrlen + strlen(value) + 1;
+}
+
+/* Make an SCGI request to the batch handler, returning zero on success. */
+static int
+batchtest_request(const char *query, const char *body, struct batchtest_response *resp)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *ai;
+    char headers[512];
+    char length[32];
+    char *buf;
+    size_t hdrlen, total = 0;
+    ssize_t len;
+    jsmn_parser parser;
+    char *payload;
+    int fd, err;
+
+    /* The headers are a netstring of NUL-terminated names and values, starting with the length. */
+    snprintf(length, sizeof(length), "%zu", strlen(body));
+    hdrlen = batchtest_header(headers, 0, "CONTENT_LENGTH", length);
+    hdrlen = batchtest_header(headers, hdrlen, "SCGI", "1");
+    hdrlen = batchtest_header(headers, hdrlen, "REQUEST_METHOD", "POST");
+    hdrlen = batchtest_header(headers, hdrlen, "PATH_INFO", "/batch");
+    hdrlen = batchtest_header(headers, hdrlen, "QUERY_STRING", query);
+    hdrlen = batchtest_header(headers, hdrlen, "CONTENT_TYPE", "application/json");
+
+    if ((err = getaddrinfo(batchtest_host, batchtest_port, &hints, &ai)) != 0) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", batchtest_host, gai_strerror(err));
+        return -1;
+    }
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if ((fd < 0) || (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)) {
+        fprintf(stderr, "Failed to connect to %s:%s: %s\n", batchtest_host, batchtest_port, strerror(errno));
+        if (fd >= 0) close(fd);
+        freeaddrinfo(ai);
+        return -1;
+    }
+    freeaddrinfo(ai);
+
+    /* Send the request, and read the response until the server closes the connection. */
+    buf = resp->body;
+    total = snprintf(buf, sizeof(resp->body), "%zu:", hdrlen);
+    memcpy(buf + total, headers, hdrlen);
+    total += hdrlen;
+    total += snprintf(buf + total, sizeof(resp->body) - total, ",%s", body);
+    if (write(fd, buf, total) != (ssize_t)total) {
+        fprintf(stderr, "Failed to send request: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    total = 0;
+    while ((len = read(fd, buf + total, sizeof(resp->body) - total - 1)) > 0) {
+        total += len;
+    }
+    close(fd);
+    buf[total] = '\0';
+    if (batchtest_verbose) printf("%s\n", buf);
+
+    /* Get the status, and parse the JSON payload after the headers. */
+    if (sscanf(buf, "Status: %d", &resp->status) != 1) {
+        fprintf(stderr, "Malformed response: %.40s\n", buf);
+        return -1;
+    }
+    memset(resp->tokens, 0, sizeof(resp->tokens));
+    resp->ntokens = 0;
+    if ((resp->status != 200) && (resp->status != 409)) {
+        /* Only a batch that ran has an array of results. */
+        return 0;
+    }
+    if ((payload = strstr(buf, "\r\n\r\n")) == NULL) {
+        fprintf(stderr, "Response has no payload\n");
+        return -1;
+    }
+    payload += 4;
+    memmove(buf, payload, strlen(payload) + 1);
+    jsmn_init(&parser);
+    resp->ntokens = jsmn_parse(&parser, buf, strlen(buf), resp->tokens, BATCHTEST_MAX_TOKENS);
+    if ((resp->ntokens <= 0) || (resp->tokens[0].type != JSMN_ARRAY)) {
+        fprintf(stderr, "Response is not a JSON array: %.40s\n", buf);
+        return -1;
+    }
+    return 0;
+}
+
+/* Count the tokens making up a value, including its children. */
+static int
+batchtest_token_size(const jsmntok_t *tok)
+{
+    const jsmntok_t *start = tok;
+    int i;
+
+    if (tok->type == JSMN_OBJECT) {
+        int count = tok->size;
+        for (tok++, i = 0; i < count; i++) {
+            tok++;
+            tok += batchtest_token_size(tok);
+        }
+        return tok - start;
+    }
+    if (tok->type == JSMN_ARRAY) {
+        int count = tok->size;
+        for (tok++, i = 0; i < count; i++) {
+            tok += batchtest_token_size(tok);
+        }
+        return tok - start;
+    }
+    return 1;
+}
+
+/* Find the Nth element of the result array, or NULL if there are fewer. */
+static const jsmntok_t *
+batchtest_result(const struct batchtest_response *resp, int index)
+{
+    const jsmntok_t *tok = &resp->tokens[1];
+    int i;
+
+    if (index >= resp->tokens[0].size) return NULL;
+    for (i = 0; i < index; i++) tok += batchtest_token_size(tok);
+    return tok;
+}
+
+/* Find a member of an object by name, or NULL if it is missing. */
+static const jsmntok_t *
+batchtest_member(const struct batchtest_response *resp, const jsmntok_t *obj, const char *name)
+{
+    const jsmntok_t *tok;
+    int i;
+
+    if (!obj || (obj->type != JSMN_OBJECT)) return NULL;
+    tok = obj + 1;
+    for (i = 0; i < obj->size; i++) {
+        int len = tok->end - tok->start;
+        if ((len == (int)strlen(name)) && (memcmp(resp->body + tok->start, name, len) == 0)) return tok + 1;
+        tok++;
+        tok += batchtest_token_size(tok);
+    }
+    return NULL;
+}
+
+static int
+batchtest_check_status(const struct batchtest_response *resp, const char *name, int index, int expect)
+{
+    const jsmntok_t *tok = batchtest_member(resp, batchtest_result(resp, index), "status");
+    int status = tok ? atoi(resp->body + tok->start) : -1;
+
+    if (status != expect) {
+        fprintf(stderr, "%s: operation %d returned status %d, expected %d\n", name, index, status, expect);
+        return 1;
+    }
+    return 0;
+}
+
+/* Read the parameters back, and check them against the values before the test. */
+static int
+batchtest_check_values(const char *name, double zoom, int overlay)
+{
+    static struct batchtest_response resp;
+    const char *get = "[{\"op\": \"get\", \"interface\": \"video\", \"names\": [\"videoZoom\", \"overlayEnable\"]}]";
+    const jsmntok_t *result;
+    const jsmntok_t *tok;
+    int errors = 0;
+
+    if (batchtest_request("", get, &resp) != 0) return 1;
+    result = batchtest_member(&resp, batchtest_result(&resp, 0), "result");
+    if ((tok = batchtest_member(&resp, result, "videoZoom")) == NULL) {
+        fprintf(stderr, "%s: videoZoom missing from the reply\n", name);
+        errors++;
+    }
+    else if (strtod(resp.body + tok->start, NULL) != zoom) {
+        fprintf(stderr, "%s: videoZoom is %.*s, expected %g\n", name, tok->end - tok->start, resp.body + tok->start, zoom);
+        errors++;
+    }
+    if ((tok = batchtest_member(&resp, result, "overlayEnable")) == NULL) {
+        fprintf(stderr, "%s: overlayEnable missing from the reply\n", name);
+        errors++;
+    }
+    else if ((resp.body[tok->start] == 't') != overlay) {
+        fprintf(stderr, "%s: overlayEnable is %.*s, expected %s\n", name, tok->end - tok->start, resp.body + tok->start,
+                overlay ? "true" : "false");
+        errors++;
+    }
+    return errors;
+}
+
+/*
+ * Run an atomic batch, check the HTTP status and the status of each operation,
+ * and that the parameters were restored afterwards.
+ */
+static int
+batchtest_run(const char *name, const char *body, int status, const int *expect, int count)
+{
+    static struct batchtest_response resp;
+    int errors = 0;
+    int i;
+
+    if (batchtest_request("atomic=true", body, &resp) != 0) {
+        printf("%s: request failed\n", name);
+        return 1;
+    }
+    if (resp.status != status) {
+        fprintf(stderr, "%s: returned HTTP status %d, expected %d\n", name, resp.status, status);
+        errors++;
+    }
+    if (resp.tokens[0].size != count) {
+        fprintf(stderr, "%s: returned %d results, expected %d\n", name, resp.tokens[0].size, count);
+        errors++;
+    }
+    for (i = 0; (i < count) && (i < resp.tokens[0].size); i++) {
+        errors += batchtest_check_status(&resp, name, i, expect[i]);
+    }
+    errors += batchtest_check_values(name, 1.0, 0);
+
+    printf("%s: %d errors\n", name, errors);
+    return errors;
+}
+
+/* Make a malformed batch request, and check that it is refused without running anything. */
+static int
+batchtest_reject(const char *name, const char *body)
+{
+    static struct batchtest_response resp;
+    int errors = 0;
+
+    if (batchtest_request("", body, &resp) != 0) {
+        printf("%s: request failed\n", name);
+        return 1;
+    }
+    if (resp.status != 400) {
+        fprintf(stderr, "%s: returned HTTP status %d, expected 400\n", name, resp.status);
+        errors++;
+    }
+
+    printf("%s: %d errors\n", name, errors);
+    return errors;
+}
+
+static void
+usage(int argc, char *const argv[])
+{
+    printf("usage: %s [options]\n\n", argv[0]);
+    printf("Check the rollback of atomic batch requests made to cam-scgi,\n");
+    printf("while it serves the video interface of cam-dbusmock.\n\n");
+
+    printf("options:\n");
+    printf("  -H, --host HOST   host where cam-scgi is running (default: 127.0.0.1)\n");
+    printf("  -p, --port PORT   SCGI port to connect to (default: 8111)\n");
+    printf("  -v, --verbose     print every response\n");
+    printf("  -h, --help        display this help and exit\n");
+}
+
+int
+main(int argc, char *const argv[])
+{
+    const char *shortopts = "H:p:vh";
+    const struct option options[] = {
+        {"host",    required_argument,  0, 'H'},
+        {"port",    required_argument,  0, 'p'},
+        {"verbose", no_argument,        0, 'v'},
+        {"help",    no_argument,        0, 'h'},
+        {0, 0, 0, 0}
+    };
+    static struct batchtest_response resp;
+    const char *reset = "[{\"op\": \"set\", \"interface\": \"video\", \"values\": {\"videoZoom\": 1.0, \"overlayEnable\": false}}]";
+    int errors = 0;
+    int c;
+
+    optind = 1;
+    while ((c = getopt_long(argc, argv, shortopts, options, NULL)) >= 0) {
+        switch (c) {
+            case 'H':
+                batchtest_host = optarg;
+                break;
+            case 'p':
+                batchtest_port = optarg;
+                break;
+            case 'v':
+                batchtest_verbose = 1;
+                break;
+            case 'h':
+                usage(argc, argv);
+                return EXIT_SUCCESS;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* Start from known values. */
+    if ((batchtest_request("", reset, &resp) != 0) || (resp.status != 200) ||
+        batchtest_check_status(&resp, "reset", 0, 200)) {
+        fprintf(stderr, "Failed to reset the parameters\n");
+        return EXIT_FAILURE;
+    }
+
+    /* A set that partly fails only reports the rejected name, and is reverted. */
+    do {
+        const int expect[] = {400};
+        errors += batchtest_run("unknown",
+                "[{\"op\": \"set\", \"interface\": \"video\", \"values\": {\"videoZoom\": 2.0, \"bogusParameter\": 1}}]",
+                409, expect, 1);
+    } while (0);
+
+    /* A set that succeeds becomes a conflict when a later one fails. */
+    do {
+        const int expect[] = {409, 400};
+        errors += batchtest_run("conflict",
+                "[{\"op\": \"set\", \"interface\": \"video\", \"values\": {\"videoZoom\": 3.0}},"
+                " {\"op\": \"set\", \"interface\": \"video\", \"values\": {\"bogusParameter\": 1}}]",
+                409, expect, 2);
+    } while (0);
+
+    /* Read-only parameters are reported, but never written back. */
+    do {
+        const int expect[] = {400};
+        errors += batchtest_run("readonly",
+                "[{\"op\": \"set\", \"interface\": \"video\", \"values\": {\"overlayEnable\": true, \"videoState\": \"live\"}}]",
+                409, expect, 1);
+    } while (0);
+
+    /* Nothing is reverted when nothing was set. */
+    do {
+        const int expect[] = {400};
+        errors += batchtest_run("rejected",
+                "[{\"op\": \"set\", \"interface\": \"video\", \"values\": {\"bogusParameter\": 1}}]",
+                200, expect, 1);
+    } while (0);
+
+    /* Bodies that are not an array of operations are refused outright. */
+    errors += batchtest_reject("object", "{\"op\": \"get\", \"interface\": \"video\", \"names\": [\"videoZoom\"]}");
+    errors += batchtest_reject("mixed", "[{\"op\": \"get\", \"interface\": \"video\", \"names\": [\"videoZoom\"]}, 5]");
+    errors += batchtest_reject("strings", "[\"videoZoom\"]");
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,616 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <dbus/dbus.h>
+
+#include "api/cam-rpc.h"
+#include "utils.h"
+
+/*
+ * Mock of the camera D-Bus API, for testing cam-scgi and the other clients
+ * on a host without the camera daemons. It serves a handful of parameters
+ * through the get, set and availableKeys methods, emits an update signal
+ * whenever they change, and answers any other method with an empty reply.
+ * Unknown and read-only parameters are reported the way the daemons do.
+ *
+ * Replies can be held back for a while to simulate a busy daemon, such as
+ * cam-pipeline during a pipeline restart. Delayed replies are queued rather
+ * than blocking, so any number of calls can be outstanding at once, and the
+ * log shows how many were in flight as each one was answered.
+ *
+ * The camera daemons live on the system bus, so to run against a private
+ * bus instead, start one and point both ends of the test at it:
+ *
+ *   $ export DBUS_SYSTEM_BUS_ADDRESS=$(dbus-daemon --session --fork --print-address)
+ *   $ cam-dbusmock --video --delay 2000 &
+ *   $ cam-scgi --video
+ */
+#define MOCK_MAX_DELAYS     16
+
+struct mock_param {
+    const char      *name;
+    int             type;       /* DBUS_TYPE_INT32, DBUS_TYPE_DOUBLE, DBUS_TYPE_BOOLEAN or DBUS_TYPE_STRING */
+    dbus_int32_t    ival;       /* Also used for booleans. */
+    double          fval;
+    char            sval[64];
+    int             readonly;
+};
+
+static struct mock_param mock_params[] = {
+    {"exposurePeriod",      DBUS_TYPE_INT32,    .ival = 1000000},
+    {"framePeriod",         DBUS_TYPE_INT32,    .ival = 1666666},
+    {"playbackRate",        DBUS_TYPE_INT32,    .ival = 60},
+    {"playbackPosition",    DBUS_TYPE_INT32,    .ival = 0},
+    {"videoZoom",           DBUS_TYPE_DOUBLE,   .fval = 1.0},
+    {"overlayEnable",       DBUS_TYPE_BOOLEAN,  .ival = FALSE},
+    {"videoState",          DBUS_TYPE_STRING,   .sval = "paused", .readonly = TRUE},
+};
+
+/* Messages waiting to be sent, in order of their deadline. */
+struct mock_reply {
+    struct mock_reply   *next;
+    DBusMessage         *msg;
+    unsigned long long  deadline;
+    char                member[64];
+};
+
+static struct {
+    DBusConnection      *conn;
+    const char          *iface;
+    const char          *path;
+    unsigned int        delay;      /* Default reply delay in milliseconds. */
+    unsigned int        ndelays;
+    struct {
+        const char      *method;
+        unsigned int    delay;
+    } delays[MOCK_MAX_DELAYS];
+    struct mock_reply   *queue;
+    unsigned int        inflight;
+    unsigned int        maxflight;
+    unsigned long       calls;
+    unsigned long long  start;
+} mock;
+
+static struct mock_param *
+mock_find_param(const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(mock_params) / sizeof(mock_params[0]); i++) {
+        if (strcmp(mock_params[i].name, name) == 0) return &mock_params[i];
+    }
+    return NULL;
+}
+
+/* Queue up a reply to be sent once the delay for its method has passed. */
+static void
+mock_queue(DBusMessage *call, DBusMessage *reply)
+{
+    struct mock_reply *r = calloc(1, sizeof(struct mock_reply));
+    struct mock_reply **pp;
+    unsigned int delay = mock.delay;
+    unsigned int i;
+
+    if (!r) {
+        /* Drop it, and let the caller time out. */
+        dbus_message_unref(reply);
+        return;
+    }
+    snprintf(r->member, sizeof(r->member), "%s", dbus_message_get_member(call));
+    for (i = 0; i < mock.ndelays; i++) {
+        if (strcmp(mock.delays[i].method, r->member) == 0) delay = mock.delays[i].delay;
+    }
+    r->msg = reply;
+    r->deadline = clock_usec(CLOCK_MONOTONIC) + delay * 1000ULL;
+    for (pp = &mock.queue; *pp && ((*pp)->deadline <= r->deadline); pp = &(*pp)->next) { }
+    r->next = *pp;
+    *pp = r;
+
+    mock.calls++;
+    mock.inflight++;
+    if (mock.inflight > mock.maxflight) mock.maxflight = mock.inflight;
+}
+
+/* Send all the replies that are due, and return the milliseconds until the next, or -1 if none. */
+static int
+mock_send_due(void)
+{
+    unsigned long long now = clock_usec(CLOCK_MONOTONIC);
+
+    while (mock.queue && (mock.queue->deadline <= now)) {
+        struct mock_reply *r = mock.queue;
+        mock.queue = r->next;
+        printf("%9.3f %-16s replied (%u in flight, %u max)\n",
+                (now - mock.start) / 1000000.0, r->member, mock.inflight, mock.maxflight);
+        dbus_connection_send(mock.conn, r->msg, NULL);
+        dbus_message_unref(r->msg);
+        free(r);
+        mock.inflight--;
+    }
+    dbus_connection_flush(mock.conn);
+    fflush(stdout);
+
+    if (!mock.queue) return -1;
+    return (mock.queue->deadline - now + 999) / 1000;
+}
+
+/* Append a parameter to a dictionary of variants. */
+static void
+mock_append_param(DBusMessageIter *dict, const struct mock_param *p)
+{
+    DBusMessageIter entry, variant;
+    char signature[2] = {(char)p->type, '\0'};
+    dbus_bool_t bval = p->ival ? TRUE : FALSE;
+    const char *sval = p->sval;
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &p->name);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+    switch (p->type) {
+        case DBUS_TYPE_INT32:
+            dbus_message_iter_append_basic(&variant, DBUS_TYPE_INT32, &p->ival);
+            break;
+        case DBUS_TYPE_DOUBLE:
+            dbus_message_iter_append_basic(&variant, DBUS_TYPE_DOUBLE, &p->fval);
+            break;
+        case DBUS_TYPE_BOOLEAN:
+            dbus_message_iter_append_basic(&variant, DBUS_TYPE_BOOLEAN, &bval);
+            break;
+        case DBUS_TYPE_STRING:
+            dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &sval);
+            break;
+    }
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/* Update a parameter from a variant, returning zero on success. */
+static int
+mock_set_param(struct mock_param *p, DBusMessageIter *variant)
+{
+    int type = dbus_message_iter_get_arg_type(variant);
+    DBusBasicValue value;
+
+    if (!dbus_type_is_basic(type)) return -1;
+    dbus_message_iter_get_basic(variant, &value);
+    switch (p->type) {
+        case DBUS_TYPE_INT32:
+            if (type == DBUS_TYPE_INT32) p->ival = value.i32;
+            else if (type == DBUS_TYPE_UINT32) p->ival = value.u32;
+            else if (type == DBUS_TYPE_INT64) p->ival = value.i64;
+            else if (type == DBUS_TYPE_DOUBLE) p->ival = value.dbl;
+            else return -1;
+            return 0;
+
+        case DBUS_TYPE_DOUBLE:
+            if (type == DBUS_TYPE_DOUBLE) p->fval = value.dbl;
+            else if (type == DBUS_TYPE_INT32) p->fval = value.i32;
+            else if (type == DBUS_TYPE_UINT32) p->fval = value.u32;
+            else return -1;
+            return 0;
+
+        case DBUS_TYPE_BOOLEAN:
+            if (type != DBUS_TYPE_BOOLEAN) return -1;
+            p->ival = value.bool_val;
+            return 0;
+
+        case DBUS_TYPE_STRING:
+            if (type != DBUS_TYPE_STRING) return -1;
+            snprintf(p->sval, sizeof(p->sval), "%s", value.str);
+            return 0;
+    }
+    return -1;
+}
+
+static DBusMessage *
+mock_error(DBusMessage *call, const char *name, const char *fmt, ...)
+{
+    char message[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    return dbus_message_new_error(call, name, message);
+}
+
+/* Append a dictionary entry for a parameter that could not be read or written, and why. */
+static void
+mock_append_error(DBusMessageIter *errors, const char *name, const char *reason)
+{
+    DBusMessageIter entry, variant;
+
+    dbus_message_iter_open_container(errors, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "s", &variant);
+    dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &reason);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(errors, &entry);
+}
+
+/* Open the "error" entry of a reply, which holds a dictionary of parameter names and reasons. */
+static void
+mock_open_errors(DBusMessageIter *dict, DBusMessageIter *entry, DBusMessageIter *variant, DBusMessageIter *errors)
+{
+    const char *name = "error";
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, entry);
+    dbus_message_iter_append_basic(entry, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_open_container(entry, DBUS_TYPE_VARIANT, "a{sv}", variant);
+    dbus_message_iter_open_container(variant, DBUS_TYPE_ARRAY, "{sv}", errors);
+}
+
+static void
+mock_close_errors(DBusMessageIter *dict, DBusMessageIter *entry, DBusMessageIter *variant, DBusMessageIter *errors)
+{
+    dbus_message_iter_close_container(variant, errors);
+    dbus_message_iter_close_container(entry, variant);
+    dbus_message_iter_close_container(dict, entry);
+}
+
+/* Update a parameter by name, returning NULL on success or the reason it failed. */
+static const char *
+mock_apply(const char *name, DBusMessageIter *variant)
+{
+    struct mock_param *p = mock_find_param(name);
+
+    if (!p) return "Unknown parameter";
+    if (p->readonly) return "Parameter is read-only";
+    if (mock_set_param(p, variant) != 0) return "Invalid value";
+    return NULL;
+}
+
+/*
+ * Like the camera daemons, get and set reply with the parameters that they
+ * could read or write, and an "error" dictionary giving the reason for each
+ * of those they couldn't, rather than failing the whole call.
+ */
+static DBusMessage *
+mock_get(DBusMessage *call)
+{
+    DBusMessage *reply;
+    DBusMessageIter args, names, out, dict;
+    DBusMessageIter entry, variant, errors;
+    unsigned int errcount = 0;
+
+    if (!dbus_message_iter_init(call, &args) || (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) ||
+        (dbus_message_iter_get_element_type(&args) != DBUS_TYPE_STRING)) {
+        return mock_error(call, DBUS_ERROR_INVALID_ARGS, "Expected an array of parameter names");
+    }
+    reply = dbus_message_new_method_return(call);
+    dbus_message_iter_init_append(reply, &out);
+    dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    for (dbus_message_iter_recurse(&args, &names);
+         dbus_message_iter_get_arg_type(&names) == DBUS_TYPE_STRING;
+         dbus_message_iter_next(&names)) {
+        const char *name;
+        struct mock_param *p;
+
+        dbus_message_iter_get_basic(&names, &name);
+        p = mock_find_param(name);
+        if (p) mock_append_param(&dict, p);
+        else errcount++;
+    }
+
+    /* Go around again for the names that weren't found. */
+    if (errcount) {
+        mock_open_errors(&dict, &entry, &variant, &errors);
+        for (dbus_message_iter_recurse(&args, &names);
+             dbus_message_iter_get_arg_type(&names) == DBUS_TYPE_STRING;
+             dbus_message_iter_next(&names)) {
+            const char *name;
+
+            dbus_message_iter_get_basic(&names, &name);
+            if (!mock_find_param(name)) mock_append_error(&errors, name, "Unknown parameter");
+        }
+        mock_close_errors(&dict, &entry, &variant, &errors);
+    }
+    dbus_message_iter_close_container(&out, &dict);
+    return reply;
+}
+
+static DBusMessage *
+mock_set(DBusMessage *call)
+{
+    DBusMessage *reply, *signal;
+    DBusMessageIter args, entries, out, dict, sigout, sigdict;
+    DBusMessageIter errentry, errvariant, errors;
+    unsigned int errcount = 0;
+
+    if (!dbus_message_iter_init(call, &args) || (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) ||
+        (dbus_message_iter_get_element_type(&args) != DBUS_TYPE_DICT_ENTRY)) {
+        return mock_error(call, DBUS_ERROR_INVALID_ARGS, "Expected a dictionary of parameters");
+    }
+
+    /* Reply with the new values, and send them out in an update signal too. */
+    reply = dbus_message_new_method_return(call);
+    signal = dbus_message_new_signal(mock.path, mock.iface, "update");
+    dbus_message_iter_init_append(reply, &out);
+    dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    dbus_message_iter_init_append(signal, &sigout);
+    dbus_message_iter_open_container(&sigout, DBUS_TYPE_ARRAY, "{sv}", &sigdict);
+    for (dbus_message_iter_recurse(&args, &entries);
+         dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_DICT_ENTRY;
+         dbus_message_iter_next(&entries)) {
+        DBusMessageIter entry, variant;
+        const char *name;
+
+        dbus_message_iter_recurse(&entries, &entry);
+        dbus_message_iter_get_basic(&entry, &name);
+        dbus_message_iter_next(&entry);
+        dbus_message_iter_recurse(&entry, &variant);
+        if (mock_apply(name, &variant)) {
+            errcount++;
+            continue;
+        }
+        mock_append_param(&dict, mock_find_param(name));
+        mock_append_param(&sigdict, mock_find_param(name));
+    }
+
+    /*
+     * Go around again for the reasons that the rest failed. Those that were
+     * set already just get set to the same value again.
+     */
+    if (errcount) {
+        mock_open_errors(&dict, &errentry, &errvariant, &errors);
+        for (dbus_message_iter_recurse(&args, &entries);
+             dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_DICT_ENTRY;
+             dbus_message_iter_next(&entries)) {
+            DBusMessageIter entry, variant;
+            const char *name;
+            const char *reason;
+
+            dbus_message_iter_recurse(&entries, &entry);
+            dbus_message_iter_get_basic(&entry, &name);
+            dbus_message_iter_next(&entry);
+            dbus_message_iter_recurse(&entry, &variant);
+            if ((reason = mock_apply(name, &variant)) != NULL) mock_append_error(&errors, name, reason);
+        }
+        mock_close_errors(&dict, &errentry, &errvariant, &errors);
+    }
+    dbus_message_iter_close_container(&out, &dict);
+    dbus_message_iter_close_container(&sigout, &sigdict);
+    dbus_connection_send(mock.conn, signal, NULL);
+    dbus_message_unref(signal);
+    return reply;
+}
+
+static DBusMessage *
+mock_available_keys(DBusMessage *call)
+{
+    DBusMessage *reply = dbus_message_new_method_return(call);
+    DBusMessageIter out, dict;
+    unsigned int i;
+
+    dbus_message_iter_init_append(reply, &out);
+    dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    for (i = 0; i < sizeof(mock_params) / sizeof(mock_params[0]); i++) {
+        mock_append_param(&dict, &mock_params[i]);
+    }
+    dbus_message_iter_close_container(&out, &dict);
+    return reply;
+}
+
+/* Any other method just gets back an empty dictionary. */
+static DBusMessage *
+mock_empty(DBusMessage *call)
+{
+    DBusMessage *reply = dbus_message_new_method_return(call);
+    DBusMessageIter out, dict;
+
+    dbus_message_iter_init_append(reply, &out);
+    dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    dbus_message_iter_close_container(&out, &dict);
+    return reply;
+}
+
+static DBusMessage *
+mock_introspect(DBusMessage *call)
+{
+    DBusMessage *reply = dbus_message_new_method_return(call);
+    char buffer[2048];
+    const char *xml = buffer;
+
+    snprintf(buffer, sizeof(buffer),
+        "<node>\n"
+        "  <interface name=\"%s\">\n"
+        "    <method name=\"get\">\n"
+        "      <arg name=\"names\" direction=\"in\" type=\"as\"/>\n"
+        "      <arg name=\"data\" direction=\"out\" type=\"a{sv}\"/>\n"
+        "    </method>\n"
+        "    <method name=\"set\">\n"
+        "      <arg name=\"data\" direction=\"in\" type=\"a{sv}\"/>\n"
+        "      <arg name=\"data\" direction=\"out\" type=\"a{sv}\"/>\n"
+        "    </method>\n"
+        "    <method name=\"availableKeys\">\n"
+        "      <arg name=\"data\" direction=\"out\" type=\"a{sv}\"/>\n"
+        "    </method>\n"
+        "    <method name=\"status\">\n"
+        "      <arg name=\"data\" direction=\"out\" type=\"a{sv}\"/>\n"
+        "    </method>\n"
+        "    <method name=\"configure\">\n"
+        "      <arg name=\"args\" direction=\"in\" type=\"a{sv}\"/>\n"
+        "      <arg name=\"data\" direction=\"out\" type=\"a{sv}\"/>\n"
+        "    </method>\n"
+        "    <signal name=\"update\">\n"
+        "      <arg name=\"data\" type=\"a{sv}\"/>\n"
+        "    </signal>\n"
+        "  </interface>\n"
+        "  <interface name=\"" DBUS_INTERFACE_INTROSPECTABLE "\">\n"
+        "    <method name=\"Introspect\">\n"
+        "      <arg name=\"data\" direction=\"out\" type=\"s\"/>\n"
+        "    </method>\n"
+        "  </interface>\n"
+        "</node>\n", mock.iface);
+    dbus_message_append_args(reply, DBUS_TYPE_STRING, &xml, DBUS_TYPE_INVALID);
+    return reply;
+}
+
+static DBusHandlerResult
+mock_message(DBusConnection *conn, DBusMessage *msg, void *user_data)
+{
+    const char *member = dbus_message_get_member(msg);
+    DBusMessage *reply;
+
+    if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    /* Introspection is answered right away, everything else gets delayed. */
+    if (dbus_message_is_method_call(msg, DBUS_INTERFACE_INTROSPECTABLE, "Introspect")) {
+        reply = mock_introspect(msg);
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_get_interface(msg) && (strcmp(dbus_message_get_interface(msg), mock.iface) != 0)) {
+        reply = mock_error(msg, DBUS_ERROR_UNKNOWN_METHOD, "Unknown interface: %s", dbus_message_get_interface(msg));
+    }
+    else if (strcmp(member, "get") == 0) reply = mock_get(msg);
+    else if (strcmp(member, "set") == 0) reply = mock_set(msg);
+    else if (strcmp(member, "availableKeys") == 0) reply = mock_available_keys(msg);
+    else reply = mock_empty(msg);
+
+    if (reply) {
+        mock_queue(msg, reply);
+    }
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void
+usage(FILE *fp, int argc, char * const argv[])
+{
+    fprintf(fp, "Usage: %s [options]\n\n", argv[0]);
+
+    fprintf(fp, "Mock the D-Bus API of the Chronos camera daemons, for testing\n");
+    fprintf(fp, "clients such as cam-scgi without a camera. Replies can be delayed\n");
+    fprintf(fp, "to simulate a busy daemon, without holding up other calls.\n\n");
+
+    fprintf(fp, "options:\n");
+    fprintf(fp, "\t-n, --control  mock the control DBus interface\n");
+    fprintf(fp, "\t-v, --video    mock the video DBus interface\n");
+    fprintf(fp, "\t-d, --delay MSEC\n");
+    fprintf(fp, "\t               delay every reply by MSEC milliseconds (default: 0)\n");
+    fprintf(fp, "\t-m, --method NAME=MSEC\n");
+    fprintf(fp, "\t               delay replies to method NAME by MSEC milliseconds instead\n");
+    fprintf(fp, "\t-h, --help     display this help and exit\n");
+}
+
+int
+main(int argc, char * const argv[])
+{
+    DBusObjectPathVTable vtable = { .message_function = mock_message };
+    DBusError err;
+    const char *service = CAM_DBUS_CONTROL_SERVICE;
+    int ret;
+
+    /* Option Parsing */
+    const char *short_options = "nvd:m:h";
+    const struct option long_options[] = {
+        {"control", no_argument,        0, 'n'},
+        {"video",   no_argument,        0, 'v'},
+        {"delay",   required_argument,  0, 'd'},
+        {"method",  required_argument,  0, 'm'},
+        {"help",    no_argument,        0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int c;
+
+    mock.path = CAM_DBUS_CONTROL_PATH;
+    mock.iface = CAM_DBUS_CONTROL_INTERFACE;
+    optind = 0;
+    while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) > 0) {
+        char *end;
+        switch (c) {
+            case 'v':
+                service = CAM_DBUS_VIDEO_SERVICE;
+                mock.path = CAM_DBUS_VIDEO_PATH;
+                mock.iface = CAM_DBUS_VIDEO_INTERFACE;
+                break;
+
+            case 'n':
+                service = CAM_DBUS_CONTROL_SERVICE;
+                mock.path = CAM_DBUS_CONTROL_PATH;
+                mock.iface = CAM_DBUS_CONTROL_INTERFACE;
+                break;
+
+            case 'd':
+                mock.delay = strtoul(optarg, &end, 10);
+                if (*end != '\0') {
+                    fprintf(stderr, "Invalid delay given: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'm':
+                end = strchr(optarg, '=');
+                if (!end || (mock.ndelays >= MOCK_MAX_DELAYS)) {
+                    fprintf(stderr, "Invalid method delay given: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                *end++ = '\0';
+                mock.delays[mock.ndelays].method = optarg;
+                mock.delays[mock.ndelays].delay = strtoul(end, &end, 10);
+                if (*end != '\0') {
+                    fprintf(stderr, "Invalid method delay given: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                mock.ndelays++;
+                break;
+
+            case 'h':
+                usage(stdout, argc, argv);
+                return EXIT_SUCCESS;
+            case '?':
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* Claim the service name and object path on the system bus. */
+    dbus_error_init(&err);
+    mock.conn = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
+    if (!mock.conn) {
+        fprintf(stderr, "Failed to connect to system DBus: %s\n", err.message);
+        return EXIT_FAILURE;
+    }
+    ret = dbus_bus_request_name(mock.conn, service, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
+    if (ret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+        fprintf(stderr, "Failed to claim %s: %s\n", service, dbus_error_is_set(&err) ? err.message : "name in use");
+        return EXIT_FAILURE;
+    }
+    if (!dbus_connection_register_object_path(mock.conn, mock.path, &vtable, NULL)) {
+        fprintf(stderr, "Failed to register %s\n", mock.path);
+        return EXIT_FAILURE;
+    }
+    printf("Mocking %s at %s\n", service, mock.path);
+    fflush(stdout);
+
+    /* Handle calls until the bus goes away, sending replies as they come due. */
+    mock.start = clock_usec(CLOCK_MONOTONIC);
+    while (dbus_connection_read_write_dispatch(mock.conn, mock_send_due())) {
+        /* Dispatch anything else that arrived along with the last message. */
+        while (dbus_connection_dispatch(mock.conn) == DBUS_DISPATCH_DATA_REMAINS) { }
+    }
+    printf("Disconnected after %lu calls, with up to %u in flight\n", mock.calls, mock.maxflight);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <math.h>
+
+#include "auto-exposure.h"
+#include "image-stats.h"
+
+void
+auto_exposure_init(struct auto_exposure *ae)
+{
+    ae->target = 118;   /* Middle grey, after gamma encoding. */
+    ae->damping = 0.5;
+    ae->tolerance = 0.1;
+    ae->maxstep = 1.0;
+    ae->highlight = 2.0;
+    ae->error = 0;
+    ae->last = 0;
+    ae->gain = 1.0;
+}
+
+/*
+ * The error is measured in stops, by linearizing the mean luma, so that
+ * each update makes a proportional change to the exposure time. Damping
+ * the correction lets the loop settle without overshooting when the image
+ * responds faster or slower than the gamma model predicts.
+ */
+unsigned long long
+auto_exposure_update(struct auto_exposure *ae, const uint32_t *histogram,
+                     unsigned long long exposure, unsigned long long tmin, unsigned long long tmax)
+{
+    unsigned long long count = 0, sum = 0, clipped = 0;
+    double mean, step, next;
+    unsigned int i;
+
+    for (i = 0; i < IMAGE_STATS_BINS; i++) {
+        count += histogram[i];
+        sum += (unsigned long long)histogram[i] * i;
+        if (i >= IMAGE_STATS_CLIP_WHITE) clipped += histogram[i];
+    }
+    if (!count) {
+        ae->error = 0;
+        return exposure;
+    }
+
+    /* Treat a black frame as half a level to keep the logarithm finite. */
+    mean = (double)sum / count;
+    if (mean < 0.5) mean = 0.5;
+    ae->error = AUTO_EXPOSURE_GAMMA * log2(ae->target / mean);
+
+    /*
+     * The mean cannot see how far past white the highlights are, so limit
+     * the error by how far the clipped highlights are from their allowance,
+     * pulling back whenever too many are clipped.
+     */
+    if (clipped) {
+        double over = log2((ae->highlight * count) / (clipped * 100.0));
+        if (over < ae->error) ae->error = over;
+    }
+    if (fabs(ae->error) < ae->tolerance) {
+        ae->last = 0;
+        ae->gain = 1.0;
+        return exposure;
+    }
+
+    /*
+     * When the correction changes direction, the scene is not responding the
+     * way we expect (such as highlights that all clip at once), so cut the
+     * gain to stop the loop from hunting, and recover it while the direction
+     * holds steady.
+     */
+    if ((ae->last != 0) && ((ae->error > 0) != (ae->last > 0))) {
+        ae->gain *= 0.25;
+    } else if (ae->gain < 1.0) {
+        ae->gain *= 2.0;
+    }
+    ae->last = ae->error;
+
+    /* Once the gain has been reduced, hold still rather than dither by tiny steps. */
+    step = (1.0 - ae->damping) * ae->gain * ae->error;
+    if ((ae->gain < 1.0) && (fabs(step) < ae->tolerance)) {
+        return exposure;
+    }
+    if (step > ae->maxstep) step = ae->maxstep;
+    if (step < -ae->maxstep) step = -ae->maxstep;
+    next = exposure * exp2(step);
+    if (next < tmin) return tmin;
+    if (next > tmax) return tmax;
+    return (unsigned long long)next;
+}
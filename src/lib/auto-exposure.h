@@ -0,0 +1,47 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __AUTO_EXPOSURE_H
+#define __AUTO_EXPOSURE_H
+
+#include <stdint.h>
+
+/* Live video is gamma encoded, which is approximated by a simple power law. */
+#define AUTO_EXPOSURE_GAMMA     2.2
+
+struct auto_exposure {
+    double  target;     /* Mean luma to aim for within the metering window. */
+    double  damping;    /* Fraction of the error left uncorrected by each update, from 0 up to 1. */
+    double  tolerance;  /* Errors smaller than this (in stops) are ignored to avoid hunting. */
+    double  maxstep;    /* Largest change in exposure made by one update (in stops). */
+    double  highlight;  /* Percentage of clipped highlights allowed, beyond which the exposure is reduced. */
+    double  error;      /* Exposure error found by the last update (in stops). */
+    double  last;       /* Exposure error that was last corrected (in stops), or zero once settled. */
+    double  gain;       /* Loop gain, which is reduced when the correction changes direction. */
+};
+
+/* Load the default controller settings. */
+void auto_exposure_init(struct auto_exposure *ae);
+
+/*
+ * Compute the next exposure time from a histogram of the metered luma, and
+ * the current exposure time, limited to the range of [tmin, tmax]. All times
+ * are in nanoseconds.
+ */
+unsigned long long auto_exposure_update(struct auto_exposure *ae, const uint32_t *histogram,
+                                        unsigned long long exposure, unsigned long long tmin, unsigned long long tmax);
+
+#endif /* __AUTO_EXPOSURE_H */
@@ -0,0 +1,213 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+
+#include "bayer-bin.h"
+
+/*
+ * Each row of cells is unpacked a byte plane at a time: a deinterleaving
+ * load splits eight pixel pairs into their first, middle and last bytes,
+ * from which the even and odd samples of both rows are rebuilt in 16-bit
+ * lanes. The rows are swapped on entry so that red is always on the first
+ * of them, and a select mask picks red and blue out of the first and second
+ * rows respectively, which leaves the sum of the greens as the sum of the
+ * cell less red and blue. Green is then halved rounding down, which is the
+ * same as the average of its two samples in bayer_bin_rgb_ref().
+ */
+static inline unsigned int
+bayer_even(const uint8_t *p)
+{
+    return p[0] | ((p[1] & 0x0f) << 8);
+}
+
+static inline unsigned int
+bayer_odd(const uint8_t *p)
+{
+    return (p[2] << 4) | (p[1] >> 4);
+}
+
+static inline uint16_t
+bayer_gain(unsigned int x, uint16_t gain)
+{
+    uint32_t y = ((uint32_t)x * gain) >> 12;
+    return (y > UINT16_MAX) ? UINT16_MAX : y;
+}
+
+#ifdef __ARM_NEON
+/* Unpack eight cells from row0 and row1 into q8/q9 (even/odd samples of row0) and q10/q11 (row1). */
+#define BAYER_BIN_UNPACK \
+    "   pld         [%[r0], #96]        \n" \
+    "   pld         [%[r1], #96]        \n" \
+    "   vld3.8      {d0,d1,d2}, [%[r0]]!\n" \
+    "   vld3.8      {d4,d5,d6}, [%[r1]]!\n" \
+    "   vmovl.u8    q8, d0              \n" /* Even = low byte | low nibble of the middle byte << 8 */ \
+    "   vshll.u8    q12, d1, #8         \n" \
+    "   vand        q12, q12, q15       \n" \
+    "   vorr        q8, q8, q12         \n" \
+    "   vshll.u8    q9, d2, #4          \n" /* Odd = high byte << 4 | high nibble of the middle byte */ \
+    "   vshr.u8     d1, d1, #4          \n" \
+    "   vaddw.u8    q9, q9, d1          \n" \
+    "   vmovl.u8    q10, d4             \n" \
+    "   vshll.u8    q12, d5, #8         \n" \
+    "   vand        q12, q12, q15       \n" \
+    "   vorr        q10, q10, q12       \n" \
+    "   vshll.u8    q11, d6, #4         \n" \
+    "   vshr.u8     d5, d5, #4          \n" \
+    "   vaddw.u8    q11, q11, d5        \n" \
+    "   vadd.u16    q12, q8, q9         \n" /* Sum of the cell. */ \
+    "   vadd.u16    q12, q12, q10       \n" \
+    "   vadd.u16    q12, q12, q11       \n"
+#endif
+
+void
+bayer_bin_rgb(uint16_t *rgb, const uint8_t *row0, const uint8_t *row1, unsigned int width,
+              unsigned int cfa, const uint16_t *wbal)
+{
+    unsigned int redcol = cfa & 1;
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = width & ~7;
+    width -= bulk;
+#endif
+
+    /* Put red on the first row. */
+    if (cfa & 2) {
+        const uint8_t *tmp = row0;
+        row0 = row1;
+        row1 = tmp;
+    }
+
+#ifdef __ARM_NEON
+    if (bulk) {
+        uint16_t gains[4] __attribute__((aligned(8))) = { wbal[0], wbal[1], wbal[2], 0 };
+        uint16_t mask = redcol ? 0xffff : 0;
+        asm volatile (
+            "   vmov.i16    q15, #0x0f00        \n"
+            "   vdup.16     q14, %[mask]        \n" /* All ones when red is on the odd column. */
+            "   vld1.16     {d7}, [%[g]:64]     \n" /* Multiply by scalar needs d0-d7 for 16-bit lanes. */
+            "1:                                 \n"
+            BAYER_BIN_UNPACK
+            "   vmov        q0, q14             \n" /* Red from the first row. */
+            "   vbsl        q0, q9, q8          \n"
+            "   vmov        q2, q14             \n" /* Blue from the other column of the second row. */
+            "   vbsl        q2, q10, q11        \n"
+            "   vsub.u16    q12, q12, q0        \n" /* Green is what remains. */
+            "   vsub.u16    q12, q12, q2        \n"
+            "   vshr.u16    q1, q12, #1         \n"
+            "   vmull.u16   q8, d0, d7[0]       \n" /* White balance, saturating to 16 bits. */
+            "   vmull.u16   q9, d1, d7[0]       \n"
+            "   vmull.u16   q10, d2, d7[1]      \n"
+            "   vmull.u16   q11, d3, d7[1]      \n"
+            "   vqshrn.u32  d0, q8, #12         \n"
+            "   vqshrn.u32  d1, q9, #12         \n"
+            "   vqshrn.u32  d2, q10, #12        \n"
+            "   vqshrn.u32  d3, q11, #12        \n"
+            "   vmull.u16   q8, d4, d7[2]       \n"
+            "   vmull.u16   q9, d5, d7[2]       \n"
+            "   vqshrn.u32  d4, q8, #12         \n"
+            "   vqshrn.u32  d5, q9, #12         \n"
+            "   vst3.16     {d0,d2,d4}, [%[d]]! \n"
+            "   vst3.16     {d1,d3,d5}, [%[d]]! \n"
+            "   subs %[n], %[n], #8             \n"
+            "   bgt 1b                          \n"
+            : [d]"+r"(rgb), [r0]"+r"(row0), [r1]"+r"(row1), [n]"+r"(bulk)
+            : [g]"r"(gains), [mask]"r"(mask)
+            : "cc", "memory", "q0", "q1", "q2", "q3", "q8", "q9", "q10", "q11", "q12", "q14", "q15");
+    }
+#endif
+    for (i = 0; i < width; i++) {
+        unsigned int s0 = bayer_even(row0), s1 = bayer_odd(row0);
+        unsigned int s2 = bayer_even(row1), s3 = bayer_odd(row1);
+        unsigned int r = redcol ? s1 : s0;
+        unsigned int b = redcol ? s2 : s3;
+        *rgb++ = bayer_gain(r, wbal[0]);
+        *rgb++ = bayer_gain((s0 + s1 + s2 + s3 - r - b) >> 1, wbal[1]);
+        *rgb++ = bayer_gain(b, wbal[2]);
+        row0 += 3;
+        row1 += 3;
+    }
+}
+
+void
+bayer_bin_luma(uint16_t *luma, const uint8_t *row0, const uint8_t *row1, unsigned int width)
+{
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = width & ~7;
+    width -= bulk;
+    if (bulk) {
+        asm volatile (
+            "   vmov.i16    q15, #0x0f00        \n"
+            "1:                                 \n"
+            BAYER_BIN_UNPACK
+            "   vshr.u16    q12, q12, #2        \n"
+            "   vst1.16     {q12}, [%[d]]!      \n"
+            "   subs %[n], %[n], #8             \n"
+            "   bgt 1b                          \n"
+            : [d]"+r"(luma), [r0]"+r"(row0), [r1]"+r"(row1), [n]"+r"(bulk)
+            :: "cc", "memory", "q0", "q1", "q2", "q3", "q8", "q9", "q10", "q11", "q12", "q15");
+    }
+#endif
+    for (i = 0; i < width; i++) {
+        *luma++ = (bayer_even(row0) + bayer_odd(row0) + bayer_even(row1) + bayer_odd(row1)) >> 2;
+        row0 += 3;
+        row1 += 3;
+    }
+}
+
+/*===============================================
+ * Reference Implementations
+ *===============================================
+ */
+void
+bayer_bin_rgb_ref(uint16_t *rgb, const uint8_t *row0, const uint8_t *row1, unsigned int width,
+                  unsigned int cfa, const uint16_t *wbal)
+{
+    unsigned int rx = cfa & 1;
+    unsigned int ry = (cfa >> 1) & 1;
+    unsigned int x;
+
+    for (x = 0; x < width; x++) {
+        const uint8_t *rows[2] = { row0 + x * 3, row1 + x * 3 };
+        unsigned int cell[2][2];
+        unsigned int y;
+
+        for (y = 0; y < 2; y++) {
+            cell[y][0] = rows[y][0] | ((rows[y][1] & 0x0f) << 8);
+            cell[y][1] = (rows[y][2] << 4) | (rows[y][1] >> 4);
+        }
+        *rgb++ = bayer_gain(cell[ry][rx], wbal[0]);
+        *rgb++ = bayer_gain((cell[ry][!rx] + cell[!ry][rx]) / 2, wbal[1]);
+        *rgb++ = bayer_gain(cell[!ry][!rx], wbal[2]);
+    }
+}
+
+void
+bayer_bin_luma_ref(uint16_t *luma, const uint8_t *row0, const uint8_t *row1, unsigned int width)
+{
+    unsigned int x;
+
+    for (x = 0; x < width; x++) {
+        const uint8_t *p0 = row0 + x * 3;
+        const uint8_t *p1 = row1 + x * 3;
+        unsigned int sum = p0[0] | ((p0[1] & 0x0f) << 8);
+        sum += (p0[2] << 4) | (p0[1] >> 4);
+        sum += p1[0] | ((p1[1] & 0x0f) << 8);
+        sum += (p1[2] << 4) | (p1[1] >> 4);
+        *luma++ = sum / 4;
+    }
+}
@@ -0,0 +1,45 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __BAYER_BIN_H
+#define __BAYER_BIN_H
+
+#include <stdint.h>
+
+/*
+ * Bin each 2x2 cell of Bayer samples down to a single pixel, reading the
+ * samples straight out of the 12-bit packing used by video memory, where
+ * each pair of pixels occupies three bytes. The pair of rows holding a row
+ * of cells are given separately, so they need not be adjacent in memory,
+ * and the width is the number of cells (or half the sensor width).
+ *
+ * The Bayer pattern is one of DEMOSAIC_CFA_xxx, and the white balance gains
+ * have 12 fractional bits. Red and blue are taken from their one sample in
+ * the cell, green is the average of its two samples, and the output is 12
+ * bit linear, interleaved RGB, saturating at 16 bits.
+ */
+void bayer_bin_rgb(uint16_t *rgb, const uint8_t *row0, const uint8_t *row1, unsigned int width,
+                   unsigned int cfa, const uint16_t *wbal);
+
+/* Bin each 2x2 cell of 12-bit packed samples down to their average, for monochrome sensors. */
+void bayer_bin_luma(uint16_t *luma, const uint8_t *row0, const uint8_t *row1, unsigned int width);
+
+/* Scalar reference implementations, producing identical results to the above. */
+void bayer_bin_rgb_ref(uint16_t *rgb, const uint8_t *row0, const uint8_t *row1, unsigned int width,
+                       unsigned int cfa, const uint16_t *wbal);
+void bayer_bin_luma_ref(uint16_t *luma, const uint8_t *row0, const uint8_t *row1, unsigned int width);
+
+#endif /* __BAYER_BIN_H */
@@ -0,0 +1,161 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "calibrate.h"
+#include "utils.h"
+
+/*
+ * Each pair of pixels is packed into three bytes, with the first pixel in
+ * the low byte and the low nibble of the middle byte, and the second pixel
+ * in the high nibble of the middle byte and the last byte. The NEON kernels
+ * take sixteen pixels at a time, so rows are split into a bulk handled by
+ * them and a tail handled by the scalar code, and the calibration is kept
+ * in the same order of operations as the kernels so the two are identical.
+ */
+static inline unsigned int
+cal_first(const uint8_t *p)
+{
+    return p[0] | ((p[1] & 0x0f) << 8);
+}
+
+static inline unsigned int
+cal_second(const uint8_t *p)
+{
+    return (p[2] << 4) | (p[1] >> 4);
+}
+
+/* 2-point: subtract the FPN, saturating at zero, then apply the column gain. */
+static inline uint16_t
+cal_2point(unsigned int x, uint16_t fpn, uint16_t gain)
+{
+    x = (x > fpn) ? (x - fpn) : 0;
+    return (uint16_t)(((uint32_t)x * gain) >> 12);
+}
+
+/* 3-point: apply the column gain, then subtract the FPN less the column offset, saturating at zero. */
+static inline uint16_t
+cal_3point(unsigned int x, int16_t fpn, int16_t offset, uint16_t gain)
+{
+    uint16_t y = (uint16_t)(((uint32_t)x * gain) >> 12);
+    uint16_t d = (uint16_t)(fpn - offset);
+    return (y > d) ? (y - d) : 0;
+}
+
+/* Unpack and calibrate a span of pixels within one row, starting at column col. */
+static void
+cal_unpack_span(uint16_t *out, const uint8_t *raw, const struct calibration *cal,
+                const int16_t *fpn, size_t col, size_t count)
+{
+    size_t i;
+
+    switch (cal->npoints) {
+        case 2:
+            for (i = 0; i < count; i += 2, raw += 3) {
+                out[i + 0] = cal_2point(cal_first(raw), fpn[i + 0], cal->gain[col + i + 0]);
+                out[i + 1] = cal_2point(cal_second(raw), fpn[i + 1], cal->gain[col + i + 1]);
+            }
+            break;
+
+        case 3:
+            for (i = 0; i < count; i += 2, raw += 3) {
+                out[i + 0] = cal_3point(cal_first(raw), fpn[i + 0], cal->offset[col + i + 0], cal->gain[col + i + 0]);
+                out[i + 1] = cal_3point(cal_second(raw), fpn[i + 1], cal->offset[col + i + 1], cal->gain[col + i + 1]);
+            }
+            break;
+
+        default:
+            for (i = 0; i < count; i += 2, raw += 3) {
+                out[i + 0] = cal_first(raw);
+                out[i + 1] = cal_second(raw);
+            }
+            break;
+    }
+}
+
+void
+calibrate_unpack_fpn(int16_t *fpn, const uint8_t *raw, size_t npix, unsigned int npoints)
+{
+    size_t i = 0;
+#ifdef __arm__
+    for (; (i + 16) <= npix; i += 16) {
+        if (npoints == 3) {
+            neon_be12_unpack_signed(fpn + i, raw + (i * 3) / 2);
+        } else {
+            neon_be12_unpack_unsigned(fpn + i, raw + (i * 3) / 2);
+        }
+    }
+#endif
+    for (; (i + 2) <= npix; i += 2) {
+        const uint8_t *p = raw + (i * 3) / 2;
+        if (npoints == 3) {
+            /* Sign extend from 12 bits. */
+            fpn[i + 0] = (int16_t)(cal_first(p) << 4) >> 4;
+            fpn[i + 1] = (int16_t)(cal_second(p) << 4) >> 4;
+        } else {
+            fpn[i + 0] = cal_first(p);
+            fpn[i + 1] = cal_second(p);
+        }
+    }
+}
+
+void
+calibrate_unpack_ref(uint16_t *out, const uint8_t *raw, const struct calibration *cal, size_t row, size_t nrows)
+{
+    size_t hres = cal->hres;
+    size_t y;
+
+    for (y = 0; y < nrows; y++) {
+        const int16_t *fpn = cal->npoints ? (cal->fpn + (row + y) * hres) : NULL;
+        cal_unpack_span(out + y * hres, raw + (y * hres * 3) / 2, cal, fpn, 0, hres);
+    }
+}
+
+#ifdef __arm__
+void
+calibrate_unpack(uint16_t *out, const uint8_t *raw, const struct calibration *cal, size_t row, size_t nrows)
+{
+    size_t hres = cal->hres;
+    size_t bulk = hres & ~15;
+    size_t x, y;
+
+    for (y = 0; y < nrows; y++) {
+        const int16_t *fpn = cal->npoints ? (cal->fpn + (row + y) * hres) : NULL;
+        const uint8_t *src = raw + (y * hres * 3) / 2;
+        uint16_t *dst = out + y * hres;
+
+        for (x = 0; x < bulk; x += 16) {
+            if (cal->npoints == 3) {
+                neon_be12_unpack_3point(dst + x, src + (x * 3) / 2, fpn + x, cal->offset + x, cal->gain + x, cal->curve + x);
+            } else if (cal->npoints == 2) {
+                neon_be12_unpack_2point(dst + x, src + (x * 3) / 2, fpn + x, cal->gain + x);
+            } else {
+                neon_be12_unpack_unsigned(dst + x, src + (x * 3) / 2);
+            }
+        }
+        cal_unpack_span(dst + bulk, src + (bulk * 3) / 2, cal, fpn ? (fpn + bulk) : NULL, bulk, hres - bulk);
+    }
+}
+#else
+/* Without NEON, the reference is written so that the compiler can vectorize it. */
+void
+calibrate_unpack(uint16_t *out, const uint8_t *raw, const struct calibration *cal, size_t row, size_t nrows)
+{
+    calibrate_unpack_ref(out, raw, cal, row, nrows);
+}
+#endif
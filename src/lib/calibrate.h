@@ -0,0 +1,54 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __CALIBRATE_H
+#define __CALIBRATE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Pad the per-column arrays so that a whole vector can be loaded past the end of a row. */
+#define CALIBRATE_ALIGN(_n_)    (((_n_) + 15) & ~15)
+
+/*
+ * Calibration data for the frames in video RAM. The FPN is one sample per
+ * pixel, unpacked by calibrate_unpack_fpn(), and the column gain has 12
+ * fractional bits. The column offset and curve are only used by 3-point
+ * calibration.
+ */
+struct calibration {
+    unsigned int    npoints;    /* Zero for uncalibrated frames, otherwise 2 or 3. */
+    unsigned int    hres;
+    const int16_t   *fpn;
+    const int16_t   *offset;
+    const uint16_t  *gain;
+    const int16_t   *curve;
+};
+
+/* Unpack npix samples of 12-bit FPN, sign extending them for 3-point calibration. */
+void calibrate_unpack_fpn(int16_t *fpn, const uint8_t *raw, size_t npix, unsigned int npoints);
+
+/*
+ * Unpack nrows rows of 12-bit packed pixels starting at the given row of the
+ * frame, where each pair of pixels occupies three bytes, and apply the
+ * calibration to them. The width must be even.
+ */
+void calibrate_unpack(uint16_t *out, const uint8_t *raw, const struct calibration *cal, size_t row, size_t nrows);
+
+/* Scalar reference implementation, producing identical results to calibrate_unpack(). */
+void calibrate_unpack_ref(uint16_t *out, const uint8_t *raw, const struct calibration *cal, size_t row, size_t nrows);
+
+#endif /* __CALIBRATE_H */
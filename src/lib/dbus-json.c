@@ -228,6 +228,8 @@ json_token_size(jsmntok_t *start)
     return 1;
 }
 
+static GValue *json_parse_object(jsmntok_t *tokens, const char *js, int *errcode);
+
 /* Parse a simple JSON array where all members are of the same type. */
 static GValue *
 json_parse_array(jsmntok_t *tokens, const char *js, int *errcode)
@@ -239,8 +241,8 @@ json_parse_array(jsmntok_t *tokens, const char *js, int *errcode)
         return NULL;
     }
 
-    /* String cases - use a GPtrArray */
-    if (tokens[1].type == JSMN_STRING) {
+    /* String cases, and empty arrays - use a GPtrArray */
+    if ((tokens->size == 0) || (tokens[1].type == JSMN_STRING)) {
         GPtrArray *arr = g_ptr_array_sized_new(tokens->size);
         if (!arr) {
             *errcode = JSONRPC_ERR_INTERNAL_ERROR;
@@ -262,8 +264,44 @@ json_parse_array(jsmntok_t *tokens, const char *js, int *errcode)
         g_value_take_boxed(gval, arr);
         return gval;
     }
+    /* Arrays of objects - use a GPtrArray of dictionaries */
+    else if (tokens[1].type == JSMN_OBJECT) {
+        GPtrArray *arr = g_ptr_array_sized_new(tokens->size);
+        if (!arr) {
+            *errcode = JSONRPC_ERR_INTERNAL_ERROR;
+            g_free(gval);
+            return NULL;
+        }
+        g_ptr_array_set_free_func(arr, (GDestroyNotify)g_hash_table_destroy);
+
+        /* Add all objects to the pointer array, taking ownership of their dictionaries. */
+        for (children = 0; children < tokens->size; children++) {
+            jsmntok_t *tok = &tokens[i];
+            GValue *member;
+
+            /* Anything else mixed in would be lost, so refuse the whole array. */
+            if (tok->type != JSMN_OBJECT) {
+                *errcode = JSONRPC_ERR_PARSE_ERROR;
+                g_ptr_array_free(arr, TRUE);
+                g_free(gval);
+                return NULL;
+            }
+            member = json_parse_object(tok, js, errcode);
+            if (!member) {
+                g_ptr_array_free(arr, TRUE);
+                g_free(gval);
+                return NULL;
+            }
+            g_ptr_array_add(arr, g_value_get_boxed(member));
+            g_free(member);
+            i += json_token_size(tok);
+        }
+        g_value_init(gval, dbus_g_type_get_collection("GPtrArray", CAM_DBUS_HASH_MAP));
+        g_value_take_boxed(gval, arr);
+        return gval;
+    }
     else if (tokens[1].type != JSMN_PRIMITIVE) {
-        /* Arrays of complex types are not supported for now. */
+        /* Arrays of other complex types are not supported for now. */
         *errcode = JSONRPC_ERR_INTERNAL_ERROR;
         g_free(gval);
         return NULL;
@@ -399,7 +437,7 @@ json_parse_token(jsmntok_t *tok, const char *js, int *errcode)
         return json_parse_object(tok, js, errcode);
     }
     else if (tok->type == JSMN_ARRAY) {
-        return json_parse_object(tok, js, errcode);
+        return json_parse_array(tok, js, errcode);
     }
     /* Otherwise, a primitive type is expected. */
     else if (tok->type != JSMN_PRIMITIVE) {
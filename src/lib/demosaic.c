@@ -0,0 +1,408 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "demosaic.h"
+
+/*
+ * The demosaic works a row at a time. The row being interpolated is copied
+ * into a line buffer that is padded by mirroring the samples at either end,
+ * and the rows above and below are reduced to their average and absolute
+ * difference. Each site then needs only the samples to its left and right
+ * from these three buffers, which is something that NEON can load with a
+ * deinterleaving load at offsets of -1, 0 and +1 sample pairs. The
+ * interpolated row is written out as planar red, green and blue, and then
+ * the color matrix is applied while interleaving it into RGB.
+ *
+ * All averages are taken with a halving add, rounding down, so that the
+ * scalar and NEON paths produce the same results as demosaic_ref().
+ */
+#define DEMOSAIC_PAD    8
+
+void
+demosaic_matrix(struct demosaic_params *params, const int16_t *ccm, const uint16_t *wbal)
+{
+    int row, col;
+
+    memset(params->matrix, 0, sizeof(params->matrix));
+    for (row = 0; row < 3; row++) {
+        for (col = 0; col < 3; col++) {
+            int32_t coeff = ((int32_t)ccm[row * 3 + col] * wbal[col] + 2048) >> 12;
+            if (coeff > INT16_MAX) coeff = INT16_MAX;
+            if (coeff < -INT16_MAX) coeff = -INT16_MAX;
+            params->matrix[row * 3 + col] = coeff;
+        }
+    }
+}
+
+static inline unsigned int
+demosaic_absdiff(unsigned int a, unsigned int b)
+{
+    return (a > b) ? (a - b) : (b - a);
+}
+
+/* Choose the green sample at a red or blue site. */
+static inline unsigned int
+demosaic_green(unsigned int h, unsigned int v, unsigned int dh, unsigned int dv, unsigned int method)
+{
+    if (method == DEMOSAIC_EDGE) {
+        if (dh < dv) return h;
+        if (dh > dv) return v;
+    }
+    return (h + v) >> 1;
+}
+
+/* Apply one row of the color matrix, rounding and clamping the result to 16 bits. */
+static inline uint16_t
+demosaic_apply(const int16_t *m, unsigned int r, unsigned int g, unsigned int b, unsigned int shift)
+{
+    int32_t sum = m[0] * (int32_t)r + m[1] * (int32_t)g + m[2] * (int32_t)b;
+    sum = (sum + (1 << (shift - 1))) >> shift;
+    if (sum < 0) return 0;
+    if (sum > UINT16_MAX) return UINT16_MAX;
+    return sum;
+}
+
+/* Which plane gets the row's own red or blue samples, and whether green is on the even columns. */
+static inline void
+demosaic_row_layout(unsigned int cfa, unsigned int y, int *redrow, int *greeneven)
+{
+    unsigned int rx = (cfa & 1);
+    unsigned int ry = (cfa >> 1) & 1;
+    *redrow = ((y & 1) == ry);
+    *greeneven = *redrow ? rx : !rx;
+}
+
+/*===============================================
+ * Row Pipeline
+ *===============================================
+ */
+/* Mirror the samples either side of a padded line buffer, which keeps the Bayer phase intact. */
+static inline void
+demosaic_mirror(uint16_t *row, unsigned int width)
+{
+    row[-1] = row[1];
+    row[-2] = row[2];
+    row[width] = row[width - 2];
+    row[width + 1] = row[width - 3];
+}
+
+/* Reduce the rows above and below to their average and absolute difference. */
+static inline void
+demosaic_vertical(uint16_t *avg, uint16_t *diff, const uint16_t *up, const uint16_t *down, unsigned int count)
+{
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~7;
+    count -= bulk;
+    if (bulk) {
+        asm volatile (
+            "1:                                 \n"
+            "   vld1.16     {q0}, [%[u]]!       \n"
+            "   vld1.16     {q1}, [%[d]]!       \n"
+            "   vhadd.u16   q2, q0, q1          \n"
+            "   vabd.u16    q3, q0, q1          \n"
+            "   vst1.16     {q2}, [%[a]]!       \n"
+            "   vst1.16     {q3}, [%[f]]!       \n"
+            "   subs %[n], %[n], #8             \n"
+            "   bgt 1b                          \n"
+            : [a]"+r"(avg), [f]"+r"(diff), [u]"+r"(up), [d]"+r"(down), [n]"+r"(bulk)
+            :: "cc", "memory", "q0", "q1", "q2", "q3");
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        avg[i] = (up[i] + down[i]) >> 1;
+        diff[i] = demosaic_absdiff(up[i], down[i]);
+    }
+}
+
+/*
+ * Interpolate a row into planes of its own color (red or blue), green and
+ * the other color. The count must be a multiple of 16, and the line buffers
+ * must be padded by at least two samples on the left and 16 on the right.
+ */
+static inline void
+demosaic_interp_row(uint16_t *own, uint16_t *green, uint16_t *other,
+                    const uint16_t *c, const uint16_t *v, const uint16_t *d,
+                    unsigned int count, int greeneven, unsigned int method)
+{
+#ifdef __ARM_NEON
+    int edge = (method == DEMOSAIC_EDGE);
+    uint16_t *tmp;
+
+    if (greeneven) {
+        asm volatile (
+            "1:                                 \n"
+            "   sub         %[t], %[c], #4      \n"
+            "   vld2.16     {q2,q3}, [%[t]]     \n" /* q3 = odd samples to the left. */
+            "   add         %[t], %[c], #4      \n"
+            "   vld2.16     {q4,q5}, [%[t]]     \n" /* q4 = even samples to the right. */
+            "   vld2.16     {q0,q1}, [%[c]]!    \n" /* q0 = even (green), q1 = odd samples. */
+            "   add         %[t], %[v], #4      \n"
+            "   vld2.16     {q8,q9}, [%[t]]     \n" /* q8 = vertical average of even samples to the right. */
+            "   vld2.16     {q6,q7}, [%[v]]!    \n" /* q6/q7 = vertical average of even/odd samples. */
+            "   vhadd.u16   q2, q3, q1          \n" /* Own color at green sites. */
+            "   vmov        q3, q1              \n"
+            "   vhadd.u16   q9, q6, q8          \n" /* Other color at non-green sites, from the diagonals. */
+            "   vmov        q8, q6              \n" /* Other color at green sites. */
+            "   vhadd.u16   q5, q0, q4          \n" /* Horizontal green at non-green sites. */
+            "   vhadd.u16   q11, q5, q7         \n" /* Bilinear green at non-green sites. */
+            "   cmp         %[e], #0            \n"
+            "   beq         2f                  \n"
+            "   vld2.16     {q14,q15}, [%[d]]!  \n" /* q15 = vertical gradient at non-green sites. */
+            "   vabd.u16    q12, q0, q4         \n" /* q12 = horizontal gradient at non-green sites. */
+            "   vclt.u16    q13, q12, q15       \n" /* Follow the direction with the smaller gradient. */
+            "   vbsl        q13, q5, q11        \n"
+            "   vcgt.u16    q12, q12, q15       \n"
+            "   vbsl        q12, q7, q13        \n"
+            "   vmov        q11, q12            \n"
+            "2:                                 \n"
+            "   vmov        q10, q0             \n"
+            "   vst2.16     {q2,q3}, [%[po]]!   \n"
+            "   vst2.16     {q10,q11}, [%[go]]! \n"
+            "   vst2.16     {q8,q9}, [%[qo]]!   \n"
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            : [po]"+r"(own), [go]"+r"(green), [qo]"+r"(other), [c]"+r"(c), [v]"+r"(v), [d]"+r"(d),
+              [n]"+r"(count), [t]"=&r"(tmp)
+            : [e]"r"(edge)
+            : "cc", "memory", "q0", "q1", "q2", "q3", "q4", "q5", "q6", "q7",
+              "q8", "q9", "q10", "q11", "q12", "q13", "q14", "q15");
+    }
+    else {
+        asm volatile (
+            "1:                                 \n"
+            "   sub         %[t], %[c], #4      \n"
+            "   vld2.16     {q2,q3}, [%[t]]     \n" /* q3 = odd samples to the left. */
+            "   add         %[t], %[c], #4      \n"
+            "   vld2.16     {q4,q5}, [%[t]]     \n" /* q4 = even samples to the right. */
+            "   vld2.16     {q0,q1}, [%[c]]!    \n" /* q0 = even, q1 = odd (green) samples. */
+            "   sub         %[t], %[v], #4      \n"
+            "   vld2.16     {q8,q9}, [%[t]]     \n" /* q9 = vertical average of odd samples to the left. */
+            "   vld2.16     {q6,q7}, [%[v]]!    \n" /* q6/q7 = vertical average of even/odd samples. */
+            "   vhadd.u16   q5, q0, q4          \n" /* Own color at green sites. */
+            "   vmov        q4, q0              \n"
+            "   vhadd.u16   q8, q9, q7          \n" /* Other color at non-green sites, from the diagonals. */
+            "   vmov        q9, q7              \n" /* Other color at green sites. */
+            "   vhadd.u16   q2, q3, q1          \n" /* Horizontal green at non-green sites. */
+            "   vhadd.u16   q10, q2, q6         \n" /* Bilinear green at non-green sites. */
+            "   cmp         %[e], #0            \n"
+            "   beq         2f                  \n"
+            "   vld2.16     {q14,q15}, [%[d]]!  \n" /* q14 = vertical gradient at non-green sites. */
+            "   vabd.u16    q12, q3, q1         \n" /* q12 = horizontal gradient at non-green sites. */
+            "   vclt.u16    q13, q12, q14       \n" /* Follow the direction with the smaller gradient. */
+            "   vbsl        q13, q2, q10        \n"
+            "   vcgt.u16    q12, q12, q14       \n"
+            "   vbsl        q12, q6, q13        \n"
+            "   vmov        q10, q12            \n"
+            "2:                                 \n"
+            "   vmov        q11, q1             \n"
+            "   vst2.16     {q4,q5}, [%[po]]!   \n"
+            "   vst2.16     {q10,q11}, [%[go]]! \n"
+            "   vst2.16     {q8,q9}, [%[qo]]!   \n"
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            : [po]"+r"(own), [go]"+r"(green), [qo]"+r"(other), [c]"+r"(c), [v]"+r"(v), [d]"+r"(d),
+              [n]"+r"(count), [t]"=&r"(tmp)
+            : [e]"r"(edge)
+            : "cc", "memory", "q0", "q1", "q2", "q3", "q4", "q5", "q6", "q7",
+              "q8", "q9", "q10", "q11", "q12", "q13", "q14", "q15");
+    }
+#else
+    int x;
+    for (x = 0; x < (int)count; x++) {
+        if ((x & 1) == (greeneven ? 0 : 1)) {
+            own[x] = (c[x - 1] + c[x + 1]) >> 1;
+            green[x] = c[x];
+            other[x] = v[x];
+        }
+        else {
+            own[x] = c[x];
+            green[x] = demosaic_green((c[x - 1] + c[x + 1]) >> 1, v[x],
+                                      demosaic_absdiff(c[x - 1], c[x + 1]), d[x], method);
+            other[x] = (v[x - 1] + v[x + 1]) >> 1;
+        }
+    }
+#endif
+}
+
+/* Apply the color matrix to planar red, green and blue, and interleave the result into RGB. */
+static inline void
+demosaic_matrix_row(uint16_t *rgb, const uint16_t *r, const uint16_t *g, const uint16_t *b,
+                    unsigned int count, const int16_t *m, unsigned int shift)
+{
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~7;
+    count -= bulk;
+    if (bulk) {
+        asm volatile (
+            "   vld1.16     {d0,d1,d2}, [%[m]]  \n" /* d0-d2 = color matrix coefficients. */
+            "   vdup.32     q15, %[sh]          \n" /* q15 = negative shift, for a rounding right shift. */
+            "1:                                 \n"
+            "   vld1.16     {q8}, [%[r]]!       \n"
+            "   vld1.16     {q9}, [%[g]]!       \n"
+            "   vld1.16     {q10}, [%[b]]!      \n"
+            /* Red */
+            "   vmull.s16   q11, d16, d0[0]     \n"
+            "   vmull.s16   q12, d17, d0[0]     \n"
+            "   vmlal.s16   q11, d18, d0[1]     \n"
+            "   vmlal.s16   q12, d19, d0[1]     \n"
+            "   vmlal.s16   q11, d20, d0[2]     \n"
+            "   vmlal.s16   q12, d21, d0[2]     \n"
+            "   vqrshl.s32  q11, q11, q15       \n"
+            "   vqrshl.s32  q12, q12, q15       \n"
+            "   vqmovun.s32 d6, q11             \n"
+            "   vqmovun.s32 d7, q12             \n"
+            /* Green */
+            "   vmull.s16   q11, d16, d0[3]     \n"
+            "   vmull.s16   q12, d17, d0[3]     \n"
+            "   vmlal.s16   q11, d18, d1[0]     \n"
+            "   vmlal.s16   q12, d19, d1[0]     \n"
+            "   vmlal.s16   q11, d20, d1[1]     \n"
+            "   vmlal.s16   q12, d21, d1[1]     \n"
+            "   vqrshl.s32  q11, q11, q15       \n"
+            "   vqrshl.s32  q12, q12, q15       \n"
+            "   vqmovun.s32 d8, q11             \n"
+            "   vqmovun.s32 d9, q12             \n"
+            /* Blue */
+            "   vmull.s16   q11, d16, d1[2]     \n"
+            "   vmull.s16   q12, d17, d1[2]     \n"
+            "   vmlal.s16   q11, d18, d1[3]     \n"
+            "   vmlal.s16   q12, d19, d1[3]     \n"
+            "   vmlal.s16   q11, d20, d2[0]     \n"
+            "   vmlal.s16   q12, d21, d2[0]     \n"
+            "   vqrshl.s32  q11, q11, q15       \n"
+            "   vqrshl.s32  q12, q12, q15       \n"
+            "   vqmovun.s32 d10, q11            \n"
+            "   vqmovun.s32 d11, q12            \n"
+            /* Interleave and write out */
+            "   vst3.16     {d6,d8,d10}, [%[d]]!\n"
+            "   vst3.16     {d7,d9,d11}, [%[d]]!\n"
+            "   subs %[n], %[n], #8             \n"
+            "   bgt 1b                          \n"
+            : [d]"+r"(rgb), [r]"+r"(r), [g]"+r"(g), [b]"+r"(b), [n]"+r"(bulk)
+            : [m]"r"(m), [sh]"r"(-(int)shift)
+            : "cc", "memory", "q0", "q1", "q3", "q4", "q5", "q8", "q9", "q10", "q11", "q12", "q15");
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        *rgb++ = demosaic_apply(m + 0, r[i], g[i], b[i], shift);
+        *rgb++ = demosaic_apply(m + 3, r[i], g[i], b[i], shift);
+        *rgb++ = demosaic_apply(m + 6, r[i], g[i], b[i], shift);
+    }
+}
+
+void
+demosaic(uint16_t *rgb, const uint16_t *bayer, unsigned int width, unsigned int height,
+         const struct demosaic_params *params, void *scratch)
+{
+    unsigned int align = DEMOSAIC_ALIGN(width);
+    unsigned int shift = params->bits - 4;
+    uint16_t *center = (uint16_t *)scratch + 2;
+    uint16_t *vavg = center + align + DEMOSAIC_PAD;
+    uint16_t *vdiff = vavg + align + DEMOSAIC_PAD;
+    uint16_t *planes = vdiff + align + DEMOSAIC_PAD - 2;
+    unsigned int y;
+
+    /* Clear the line buffers, so that the padding past the end of the row is defined. */
+    memset(scratch, 0, (align + DEMOSAIC_PAD) * 3 * sizeof(uint16_t));
+
+    for (y = 0; y < height; y++) {
+        const uint16_t *up = bayer + ((y > 0) ? (y - 1) : 1) * width;
+        const uint16_t *down = bayer + (((y + 1) < height) ? (y + 1) : (height - 2)) * width;
+        uint16_t *red = planes;
+        uint16_t *blue = planes + (align * 2);
+        int redrow, greeneven;
+
+        demosaic_row_layout(params->cfa, y, &redrow, &greeneven);
+
+        memcpy(center, bayer + (y * width), width * sizeof(uint16_t));
+        demosaic_mirror(center, width);
+        demosaic_vertical(vavg, vdiff, up, down, width);
+        demosaic_mirror(vavg, width);
+        demosaic_mirror(vdiff, width);
+
+        demosaic_interp_row(redrow ? red : blue, planes + align, redrow ? blue : red,
+                            center, vavg, vdiff, align, greeneven, params->method);
+        demosaic_matrix_row(rgb + (y * width * 3), red, planes + align, blue, width, params->matrix, shift);
+    }
+}
+
+/*===============================================
+ * Scalar Reference
+ *===============================================
+ */
+static inline unsigned int
+demosaic_sample(const uint16_t *bayer, unsigned int width, unsigned int height, int x, int y)
+{
+    if (x < 0) x = -x;
+    if (x >= (int)width) x = 2 * (width - 1) - x;
+    if (y < 0) y = -y;
+    if (y >= (int)height) y = 2 * (height - 1) - y;
+    return bayer[y * width + x];
+}
+
+void
+demosaic_ref(uint16_t *rgb, const uint16_t *bayer, unsigned int width, unsigned int height,
+             const struct demosaic_params *params)
+{
+    unsigned int shift = params->bits - 4;
+    int x, y;
+
+#define S(_x_, _y_) demosaic_sample(bayer, width, height, (_x_), (_y_))
+    for (y = 0; y < (int)height; y++) {
+        int redrow, greeneven;
+        demosaic_row_layout(params->cfa, y, &redrow, &greeneven);
+
+        for (x = 0; x < (int)width; x++) {
+            unsigned int own, green, other;
+            unsigned int left = S(x - 1, y);
+            unsigned int right = S(x + 1, y);
+            unsigned int up = S(x, y - 1);
+            unsigned int down = S(x, y + 1);
+
+            if ((x & 1) == (greeneven ? 0 : 1)) {
+                /* Green site: own color from the left and right, other color from above and below. */
+                own = (left + right) >> 1;
+                green = S(x, y);
+                other = (up + down) >> 1;
+            }
+            else {
+                /* Red or blue site: green from the cross, other color from the diagonals. */
+                unsigned int ldiag = (S(x - 1, y - 1) + S(x - 1, y + 1)) >> 1;
+                unsigned int rdiag = (S(x + 1, y - 1) + S(x + 1, y + 1)) >> 1;
+                own = S(x, y);
+                green = demosaic_green((left + right) >> 1, (up + down) >> 1,
+                                       demosaic_absdiff(left, right), demosaic_absdiff(up, down), params->method);
+                other = (ldiag + rdiag) >> 1;
+            }
+
+            if (redrow) {
+                *rgb++ = demosaic_apply(params->matrix + 0, own, green, other, shift);
+                *rgb++ = demosaic_apply(params->matrix + 3, own, green, other, shift);
+                *rgb++ = demosaic_apply(params->matrix + 6, own, green, other, shift);
+            } else {
+                *rgb++ = demosaic_apply(params->matrix + 0, other, green, own, shift);
+                *rgb++ = demosaic_apply(params->matrix + 3, other, green, own, shift);
+                *rgb++ = demosaic_apply(params->matrix + 6, other, green, own, shift);
+            }
+        }
+    }
+#undef S
+}
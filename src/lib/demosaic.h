@@ -0,0 +1,62 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __DEMOSAIC_H
+#define __DEMOSAIC_H
+
+#include <stdint.h>
+
+/* Interpolation methods. */
+#define DEMOSAIC_BILINEAR   0
+#define DEMOSAIC_EDGE       1   /* Interpolate green along the direction of the smallest gradient. */
+
+/* Bayer patterns, encoded as the column and row parity of the red pixel. */
+#define DEMOSAIC_CFA_RGGB   0
+#define DEMOSAIC_CFA_GRBG   1
+#define DEMOSAIC_CFA_GBRG   2
+#define DEMOSAIC_CFA_BGGR   3
+
+struct demosaic_params {
+    unsigned int    method;     /* One of DEMOSAIC_BILINEAR or DEMOSAIC_EDGE */
+    unsigned int    cfa;        /* One of DEMOSAIC_CFA_xxx */
+    unsigned int    bits;       /* Significant bits per input sample, up to 14. */
+    int16_t         matrix[12]; /* 3x3 color matrix, row major, with 12 fractional bits (padded for NEON loads). */
+};
+
+/* Scratch memory required to demosaic a frame of the given width. */
+#define DEMOSAIC_ALIGN(_w_)     (((_w_) + 15) & ~15)
+#define DEMOSAIC_SCRATCH(_w_)   ((DEMOSAIC_ALIGN(_w_) * 6 + 24) * sizeof(uint16_t))
+
+/*
+ * Build the color matrix from the FPGA's color correction matrix and white
+ * balance, both with 12 fractional bits, by folding the white balance into
+ * the columns of the matrix.
+ */
+void demosaic_matrix(struct demosaic_params *params, const int16_t *ccm, const uint16_t *wbal);
+
+/*
+ * Demosaic a frame of Bayer samples, one per 16-bit word, into 16-bit
+ * interleaved RGB, scaling the input to the full 16-bit output range. The
+ * width must be even, and at least 4 pixels.
+ */
+void demosaic(uint16_t *rgb, const uint16_t *bayer, unsigned int width, unsigned int height,
+              const struct demosaic_params *params, void *scratch);
+
+/* Scalar reference implementation, producing bit-identical results to demosaic(). */
+void demosaic_ref(uint16_t *rgb, const uint16_t *bayer, unsigned int width, unsigned int height,
+                  const struct demosaic_params *params);
+
+#endif /* __DEMOSAIC_H */
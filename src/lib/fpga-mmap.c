@@ -34,11 +34,16 @@ fpga_open(void)
 {
 	int fd;
 	struct fpga *fpga;
+	const char *simpath = getenv(FPGA_SIM_ENV);
+
+	/* Use the simulation instead, if one was given. */
+	if (simpath && *simpath) {
+		return fpga_sim_open(simpath);
+	}
 
 	fd = open("/dev/mem", O_RDWR | O_SYNC);
 	if (fd < 0) {
 		fprintf(stderr, "Unable to open /dev/mem: %s\n", strerror(errno));
-		free(fpga);
 		return NULL;
 	}
 
@@ -48,6 +53,10 @@ fpga_open(void)
 		return NULL;
 	}
 	fpga->fd = fd;
+	fpga->sim = NULL;
+	fpga->vram_verify = 0;
+	fpga->vram_retries = 0;
+	fpga->vram_errors = 0;
 	fpga->reg = (volatile uint16_t *)mmap(0, 16 * SIZE_MB, PROT_READ | PROT_WRITE, MAP_SHARED, fpga->fd, GPMC_RANGE_BASE + GPMC_REGISTER_OFFSET);
 	if (fpga->reg == MAP_FAILED) {
 		fprintf(stderr, "Failed to map FPGA registers: %s\n", strerror(errno));
@@ -80,7 +89,14 @@ fpga_open(void)
 		return NULL;
 	}
 
-	/* Setup structured access to FPGA registers. */
+	fpga_setup(fpga);
+	return fpga;
+} /* fpga_open */
+
+/* Setup structured access to FPGA registers. */
+void
+fpga_setup(struct fpga *fpga)
+{
 	fpga->sensor = (struct fpga_sensor *)((uint8_t *)fpga->reg + FPGA_SENSOR_BASE);
 	fpga->seq = (struct fpga_seq *)((uint8_t *)fpga->reg + FPGA_SEQUENCER_BASE);
 	fpga->display = (struct fpga_display *)((uint8_t *)fpga->reg + FPGA_DISPLAY_BASE);
@@ -91,13 +107,13 @@ fpga_open(void)
 	fpga->zebra = (struct fpga_zebra *)((uint8_t *)fpga->reg + FPGA_ZEBRA_BASE);
 	fpga->imager = (struct fpga_imager *)((uint8_t *)fpga->reg + FPGA_IMAGER_BASE);
 	fpga->timing = (struct fpga_timing *)((uint8_t *)fpga->reg + FPGA_TIMING_BASE);
-	return fpga;
-} /* fpga_open */
+} /* fpga_setup */
 
 void
 fpga_close(struct fpga *fpga)
 {
 	if (fpga) {
+		if (fpga->sim) fpga_sim_close(fpga);
 		if (fpga->gpio.enc_a >= 0) close(fpga->gpio.enc_a);
 		if (fpga->gpio.enc_b >= 0) close(fpga->gpio.enc_b);
 		if (fpga->gpio.enc_sw >= 0) close(fpga->gpio.enc_sw);
@@ -107,7 +123,7 @@ fpga_close(struct fpga *fpga)
 		if (fpga->gpio.frame_irq >= 0) close(fpga->gpio.frame_irq);
 		if (fpga->reg != MAP_FAILED) munmap((void *)fpga->reg, 16 * SIZE_MB);
 		if (fpga->ram != MAP_FAILED) munmap((void *)fpga->ram, 16 * SIZE_MB);
-		close(fpga->fd);
+		if (fpga->fd >= 0) close(fpga->fd);
 		free(fpga);
 	}
 } /* fpga_close */
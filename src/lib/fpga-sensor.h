@@ -104,6 +104,12 @@ struct image_sensor {
 
 /* Init functions */
 struct image_sensor *lux1310_init(struct fpga *fpga, const struct ioport *iop);
+struct image_sensor *lux1310_attach(struct fpga *fpga, const struct ioport *iop);
+struct image_sensor *sim_sensor_init(unsigned long hres, unsigned long vres);
+
+/* Simulated sensor model, rendering luma frames of a scene given its reflectance. */
+void sim_sensor_render(struct image_sensor *sensor, uint8_t *luma, const uint8_t *scene, double light);
+unsigned long long sim_sensor_exposure(struct image_sensor *sensor);
 
 /* API Wrapper Calls */
 int image_sensor_bpp(struct image_sensor *sensor);
@@ -0,0 +1,388 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fpga.h"
+
+/*
+ * A simulated FPGA for testing on a host without the camera hardware. The
+ * register blocks are loaded from a file into ordinary memory, and the
+ * video RAM image is mapped copy-on-write from a second file, so recorded
+ * memory dumps can be replayed without being modified.
+ *
+ * Plain memory has none of the side effects of the real registers, so the
+ * parts of the FPGA that the software waits on are modelled here instead:
+ *  - The VRAM burst engine copies a burst between the image and the burst
+ *    buffer, and clears vram->control, when triggered.
+ *  - The GPMC page window is refilled from the image at the page offset.
+ *  - The image sensor SCI transfers complete immediately.
+ *  - The segment table is erased by SEGMENT_CONTROL_RESET, and appended to
+ *    by fpga_sim_record(), which also pushes the region into the sequencer
+ *    metadata FIFO for fpga_md_fifo_read() to pop.
+ *
+ * Anything that software polls for completion is serviced by a background
+ * thread, and the readout functions service the model synchronously after
+ * each trigger, since the real hardware is done long before they look.
+ *
+ * To exercise readout verification, FPGA_SIM_FLIPS_ENV can be set to N to
+ * flip a random bit in one of every N video RAM reads, as a marginal bus
+ * might. The flips are transient, so reading the same memory again gets
+ * the right data, and the sequence is repeatable from one run to the next.
+ */
+#define SIZE_MB                 (1024 * 1024)
+#define FPGA_SIM_POLL_USEC      100
+#define FPGA_SIM_PAGE_SIZE      4096
+#define FPGA_SIM_FIFO_DEPTH     (3 * 128)   /* Three words per region, for a full segment table. */
+
+struct fpga_sim {
+    pthread_mutex_t mutex;
+    pthread_t       thread;
+    int             running;
+    int             shutdown;
+
+    uint8_t         *vram;
+    size_t          vramsize;
+    uint32_t        page;
+
+    uint32_t        fifo[FPGA_SIM_FIFO_DEPTH];
+    unsigned int    fifo_head;
+    unsigned int    fifo_count;
+
+    unsigned long   flips;
+    uint32_t        random;
+};
+
+/* Copy out of the video RAM image, reading zeros anywhere beyond the end of it. */
+static void
+fpga_sim_vram_get(struct fpga_sim *sim, void *dest, uint64_t offset, size_t len)
+{
+    size_t avail = (offset < sim->vramsize) ? (sim->vramsize - offset) : 0;
+    if (avail > len) avail = len;
+    if (avail) memcpy(dest, sim->vram + offset, avail);
+    memset((uint8_t *)dest + avail, 0, len - avail);
+}
+
+/* Copy into the video RAM image, dropping anything beyond the end of it. */
+static void
+fpga_sim_vram_put(struct fpga_sim *sim, const void *src, uint64_t offset, size_t len)
+{
+    size_t avail = (offset < sim->vramsize) ? (sim->vramsize - offset) : 0;
+    if (avail > len) avail = len;
+    if (avail) memcpy(sim->vram + offset, src, avail);
+}
+
+/* Update the FIFO status and read register after the FIFO changes. */
+static void
+fpga_sim_fifo_update(struct fpga *fpga)
+{
+    struct fpga_sim *sim = fpga->sim;
+    if (sim->fifo_count) {
+        fpga->seq->status &= ~SEQ_STATUS_FIFO_EMPTY;
+        fpga->seq->md_fifo_read = sim->fifo[sim->fifo_head];
+    } else {
+        fpga->seq->status |= SEQ_STATUS_FIFO_EMPTY;
+    }
+}
+
+/* Carry out any pending operations that the software has triggered. */
+void
+fpga_sim_service(struct fpga *fpga)
+{
+    struct fpga_sim *sim = fpga->sim;
+    uint32_t page;
+
+    pthread_mutex_lock(&sim->mutex);
+
+    /* VRAM burst engine. */
+    if (fpga->vram->control & VRAM_CTL_TRIG_READ) {
+        fpga_sim_vram_get(sim, (void *)fpga->vram->buffer, (uint64_t)fpga->vram->address * FPGA_FRAME_WORD_SIZE,
+                          sizeof(fpga->vram->buffer));
+        fpga->vram->control = 0;
+    }
+    else if (fpga->vram->control & VRAM_CTL_TRIG_WRITE) {
+        fpga_sim_vram_put(sim, (void *)fpga->vram->buffer, (uint64_t)fpga->vram->address * FPGA_FRAME_WORD_SIZE,
+                          sizeof(fpga->vram->buffer));
+        fpga->vram->control = 0;
+        sim->page = UINT32_MAX;
+    }
+
+    /* GPMC page window. */
+    page = fpga->reg[GPMC_PAGE_OFFSET + 0] | (fpga->reg[GPMC_PAGE_OFFSET + 1] << 16);
+    if (page != sim->page) {
+        fpga_sim_vram_get(sim, (void *)fpga->ram, (uint64_t)page * FPGA_FRAME_WORD_SIZE, FPGA_SIM_PAGE_SIZE);
+        sim->page = page;
+    }
+
+    /* Image sensor serial transfers. */
+    if (fpga->sensor->sci_control & SENSOR_SCI_CONTROL_RUN_MASK) {
+        fpga->sensor->sci_control &= ~SENSOR_SCI_CONTROL_RUN_MASK;
+    }
+
+    /* Segment table reset. */
+    if (fpga->segments->control & SEGMENT_CONTROL_RESET) {
+        memset((void *)fpga->segments->data, 0, sizeof(fpga->segments->data));
+        fpga->segments->blockno = 0;
+        fpga->segments->control &= ~SEGMENT_CONTROL_RESET;
+    }
+
+    pthread_mutex_unlock(&sim->mutex);
+}
+
+static void *
+fpga_sim_thread(void *arg)
+{
+    struct fpga *fpga = arg;
+    for (;;) {
+        int shutdown;
+        pthread_mutex_lock(&fpga->sim->mutex);
+        shutdown = fpga->sim->shutdown;
+        pthread_mutex_unlock(&fpga->sim->mutex);
+        if (shutdown) break;
+
+        fpga_sim_service(fpga);
+        usleep(FPGA_SIM_POLL_USEC);
+    }
+    return NULL;
+}
+
+uint32_t
+fpga_sim_fifo_read(struct fpga *fpga)
+{
+    struct fpga_sim *sim = fpga->sim;
+    uint32_t value;
+
+    pthread_mutex_lock(&sim->mutex);
+    value = fpga->seq->md_fifo_read;
+    if (sim->fifo_count) {
+        value = sim->fifo[sim->fifo_head];
+        sim->fifo_head = (sim->fifo_head + 1) % FPGA_SIM_FIFO_DEPTH;
+        sim->fifo_count--;
+    }
+    fpga_sim_fifo_update(fpga);
+    pthread_mutex_unlock(&sim->mutex);
+    return value;
+}
+
+/* Called by the readout functions with each page or burst read, to inject bit flips. */
+void
+fpga_sim_corrupt(struct fpga *fpga, void *buf, size_t len)
+{
+    struct fpga_sim *sim = fpga->sim;
+    uint32_t x;
+
+    if (!sim->flips || !len) return;
+    pthread_mutex_lock(&sim->mutex);
+    /* xorshift32 */
+    x = sim->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->random = x;
+    if ((x % sim->flips) == 0) {
+        size_t bit = (x / sim->flips) % (len * 8);
+        ((uint8_t *)buf)[bit / 8] ^= 1 << (bit % 8);
+    }
+    pthread_mutex_unlock(&sim->mutex);
+}
+
+/*
+ * Record a region of video RAM as if the sequencer had just finished
+ * capturing it, by adding it to the segment table and the metadata FIFO.
+ * Returns zero on success, or -1 if the FIFO is full.
+ */
+int
+fpga_sim_record(struct fpga *fpga, uint32_t start, uint32_t end, uint32_t last)
+{
+    struct fpga_sim *sim = fpga->sim;
+    struct fpga_segment_entry entry;
+    uint32_t blockno;
+    unsigned int i;
+
+    pthread_mutex_lock(&sim->mutex);
+    if ((sim->fifo_count + 3) > FPGA_SIM_FIFO_DEPTH) {
+        pthread_mutex_unlock(&sim->mutex);
+        errno = ENOSPC;
+        return -1;
+    }
+
+    blockno = fpga->segments->blockno;
+    entry.start = start;
+    entry.end = end;
+    entry.last = last;
+    entry.data = blockno & SEGMENT_DATA_BLOCKNO;
+    memcpy((void *)&fpga->segments->data[blockno % 128], &entry, sizeof(entry));
+    fpga->segments->blockno = blockno + 1;
+    fpga->seq->last_addr = last;
+
+    for (i = 0; i < 3; i++) {
+        uint32_t word = (i == 0) ? start : (i == 1) ? end : last;
+        sim->fifo[(sim->fifo_head + sim->fifo_count) % FPGA_SIM_FIFO_DEPTH] = word;
+        sim->fifo_count++;
+    }
+    fpga_sim_fifo_update(fpga);
+    pthread_mutex_unlock(&sim->mutex);
+    return 0;
+}
+
+/* Load the register blocks, leaving anything missing from the file zeroed. */
+static int
+fpga_sim_load_registers(struct fpga *fpga, const char *filename)
+{
+    uint8_t *dest = (uint8_t *)fpga->reg;
+    size_t total = 0;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    while (total < FPGA_SIM_REG_SIZE) {
+        ssize_t len = read(fd, dest + total, FPGA_SIM_REG_SIZE - total);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to read %s: %s\n", filename, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (len == 0) break;
+        total += len;
+    }
+    close(fd);
+    return 0;
+}
+
+static int
+fpga_sim_map_vram(struct fpga_sim *sim, const char *filename)
+{
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+        fprintf(stderr, "Invalid video RAM image %s: %s\n", filename, st.st_size ? strerror(errno) : "empty file");
+        close(fd);
+        return -1;
+    }
+    sim->vramsize = st.st_size;
+    sim->vram = mmap(NULL, sim->vramsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (sim->vram == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+struct fpga *
+fpga_sim_open(const char *path)
+{
+    char filename[PATH_MAX];
+    struct fpga *fpga = calloc(1, sizeof(struct fpga));
+    struct fpga_sim *sim = calloc(1, sizeof(struct fpga_sim));
+
+    if (!fpga || !sim) {
+        fprintf(stderr, "Memory allocation failed: %s\n", strerror(errno));
+        free(fpga);
+        free(sim);
+        return NULL;
+    }
+    fpga->fd = -1;
+    fpga->sim = sim;
+    fpga->gpio.dac_cs = -1;
+    fpga->gpio.color_sel = -1;
+    fpga->gpio.trig_io = -1;
+    fpga->gpio.enc_a = -1;
+    fpga->gpio.enc_b = -1;
+    fpga->gpio.enc_sw = -1;
+    fpga->gpio.shutter = -1;
+    fpga->gpio.led_front = -1;
+    fpga->gpio.led_back = -1;
+    fpga->gpio.frame_irq = -1;
+    sim->vram = MAP_FAILED;
+    sim->page = UINT32_MAX;
+    sim->random = 0x2545f491;
+    pthread_mutex_init(&sim->mutex, NULL);
+    if (getenv(FPGA_SIM_FLIPS_ENV)) {
+        sim->flips = strtoul(getenv(FPGA_SIM_FLIPS_ENV), NULL, 0);
+    }
+
+    /* Anonymous mappings the same size as the hardware, so that fpga_close() can unmap either. */
+    fpga->reg = mmap(NULL, 16 * SIZE_MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    fpga->ram = mmap(NULL, 16 * SIZE_MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((fpga->reg == MAP_FAILED) || (fpga->ram == MAP_FAILED)) {
+        fprintf(stderr, "Failed to map simulated FPGA: %s\n", strerror(errno));
+        fpga_close(fpga);
+        return NULL;
+    }
+    fpga_setup(fpga);
+
+    snprintf(filename, sizeof(filename), "%s/%s", path, FPGA_SIM_REGISTERS);
+    if (fpga_sim_load_registers(fpga, filename) < 0) {
+        fpga_close(fpga);
+        return NULL;
+    }
+    snprintf(filename, sizeof(filename), "%s/%s", path, FPGA_SIM_VRAM);
+    if (fpga_sim_map_vram(sim, filename) < 0) {
+        fpga_close(fpga);
+        return NULL;
+    }
+
+    /* Nothing is in progress, and the FIFO contents were not saved with the registers. */
+    fpga->vram->control = 0;
+    fpga->sensor->sci_control &= ~SENSOR_SCI_CONTROL_RUN_MASK;
+    fpga->segments->control &= ~SEGMENT_CONTROL_RESET;
+    fpga_sim_fifo_update(fpga);
+
+    if (pthread_create(&sim->thread, NULL, fpga_sim_thread, fpga) != 0) {
+        fprintf(stderr, "Failed to start simulated FPGA: %s\n", strerror(errno));
+        fpga_close(fpga);
+        return NULL;
+    }
+    sim->running = 1;
+    return fpga;
+}
+
+/* Called by fpga_close() to stop the model and release the video RAM image. */
+void
+fpga_sim_close(struct fpga *fpga)
+{
+    struct fpga_sim *sim = fpga->sim;
+
+    if (sim->running) {
+        pthread_mutex_lock(&sim->mutex);
+        sim->shutdown = 1;
+        pthread_mutex_unlock(&sim->mutex);
+        pthread_join(sim->thread, NULL);
+    }
+    if (sim->vram != MAP_FAILED) munmap(sim->vram, sim->vramsize);
+    pthread_mutex_destroy(&sim->mutex);
+    free(sim);
+    fpga->sim = NULL;
+}
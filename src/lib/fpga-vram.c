@@ -0,0 +1,123 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "fpga.h"
+
+#define FPGA_VRAM_PAGE_SIZE 4096
+
+/* Copy up to a page of memory out of the GPMC page window. */
+static void
+fpga_vram_page(struct fpga *fpga, void *dest, uint32_t addr, size_t len)
+{
+    fpga->reg[GPMC_PAGE_OFFSET + 0] = (addr & 0x0000ffff) >> 0;
+    fpga->reg[GPMC_PAGE_OFFSET + 1] = (addr & 0xffff0000) >> 16;
+    if (fpga->sim) fpga_sim_service(fpga);
+    memcpy(dest, (void *)fpga->ram, len);
+    if (fpga->sim) fpga_sim_corrupt(fpga, dest, len);
+}
+
+/* Copy up to a burst of memory out of the VRAM burst engine. */
+static void
+fpga_vram_burst(struct fpga *fpga, void *dest, uint32_t addr, size_t len)
+{
+    int i;
+
+    /* Instruct the FPGA to copy the data into cache. */
+    fpga->vram->address = addr;
+    fpga->vram->control = VRAM_CTL_TRIG_READ;
+    if (fpga->sim) fpga_sim_service(fpga);
+    for (i = 0; i < 1000; i++) {
+        if (fpga->vram->control == 0) break;
+    }
+    memcpy(dest, (void *)fpga->vram->buffer, len);
+    if (fpga->sim) fpga_sim_corrupt(fpga, dest, len);
+}
+
+/* Read a page or burst, and when verifying, keep reading it until two reads agree. */
+static void
+fpga_vram_fetch(struct fpga *fpga, void (*fetch)(struct fpga *, void *, uint32_t, size_t),
+                void *dest, uint32_t addr, size_t len)
+{
+    uint8_t check[FPGA_VRAM_PAGE_SIZE];
+    int tries;
+
+    fetch(fpga, dest, addr, len);
+    if (!fpga->vram_verify) return;
+    for (tries = 0; tries < FPGA_VRAM_RETRIES; tries++) {
+        fetch(fpga, check, addr, len);
+        if (memcmp(dest, check, len) == 0) return;
+        fpga->vram_retries++;
+        fetch(fpga, dest, addr, len);
+    }
+    fpga->vram_errors++;
+}
+
+/* Dump memory from a given word address and size using the GPMC page window. */
+void *
+fpga_vram_read_slow(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords)
+{
+    uint8_t *out = dest;
+    uint32_t end = addr + nwords;
+    uint32_t pagewords = FPGA_VRAM_PAGE_SIZE / FPGA_FRAME_WORD_SIZE;
+
+    while (addr < end) {
+        if ((addr + pagewords) > end) {
+            fpga_vram_fetch(fpga, fpga_vram_page, out, addr, FPGA_FRAME_WORD_SIZE * (end - addr));
+            break;
+        } else {
+            fpga_vram_fetch(fpga, fpga_vram_page, out, addr, FPGA_FRAME_WORD_SIZE * pagewords);
+            addr += pagewords;
+            out += pagewords * FPGA_FRAME_WORD_SIZE;
+        }
+    }
+    return dest;
+}
+
+/* Dump memory using the VRAM burst engine - I suspect this can *only* read 2kB aligned */
+void *
+fpga_vram_read_fast(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords)
+{
+    uint8_t *out = dest;
+    uint32_t end = addr + nwords;
+    uint32_t burstsize = sizeof(fpga->vram->buffer) / FPGA_FRAME_WORD_SIZE;
+
+    fpga->vram->burst = 0x20;
+    while (addr < end) {
+        if ((addr + burstsize) >= end) {
+            fpga_vram_fetch(fpga, fpga_vram_burst, out, addr, FPGA_FRAME_WORD_SIZE * (end - addr));
+            break;
+        } else {
+            fpga_vram_fetch(fpga, fpga_vram_burst, out, addr, FPGA_FRAME_WORD_SIZE * burstsize);
+            addr += burstsize;
+            out += burstsize * FPGA_FRAME_WORD_SIZE;
+        }
+    }
+    return dest;
+}
+
+/* Dump memory using the fastest readout method supported by the FPGA. */
+void *
+fpga_vram_read(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords)
+{
+    if (fpga->vram->identifier == VRAM_IDENTIFIER) {
+        return fpga_vram_read_fast(fpga, dest, addr, nwords);
+    } else {
+        return fpga_vram_read_slow(fpga, dest, addr, nwords);
+    }
+}
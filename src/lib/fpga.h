@@ -477,11 +477,57 @@ struct fpga {
     volatile struct fpga_zebra      *zebra;
     volatile struct fpga_imager     *imager;
     volatile struct fpga_timing     *timing;
+
+    /* Behavioural model when simulated, or NULL for real hardware. */
+    struct fpga_sim *sim;
+
+    /* Video RAM readout verification, enabled by setting vram_verify. */
+    int             vram_verify;
+    unsigned long   vram_retries;   /* Reads that differed, and had to be repeated. */
+    unsigned long   vram_errors;    /* Reads that never matched within FPGA_VRAM_RETRIES. */
 };
 
 struct fpga *fpga_open(void);
 void fpga_close(struct fpga *fpga);
+void fpga_setup(struct fpga *fpga);
 int fpga_load(const struct ioport *iops, const char *bitstream, FILE *log);
 int fpga_unload(const struct ioport *iops);
 
+/*
+ * Video RAM readout, with addresses and sizes given in FPGA_FRAME_WORD_SIZE
+ * words. When verification is enabled, each burst or page is read twice and
+ * compared, and read again up to FPGA_VRAM_RETRIES times until they agree.
+ */
+#define FPGA_VRAM_RETRIES   4
+
+void *fpga_vram_read(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords);
+void *fpga_vram_read_fast(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords);
+void *fpga_vram_read_slow(struct fpga *fpga, void *dest, uint32_t addr, uint32_t nwords);
+
+/*
+ * Simulated FPGA, with the registers and video RAM loaded from files in a
+ * directory. This is selected at runtime by fpga_open() when the directory
+ * is named by the FPGA_SIM_ENV environment variable.
+ */
+#define FPGA_SIM_ENV            "CAM_FPGA_SIM"
+#define FPGA_SIM_REGISTERS      "registers.bin"
+#define FPGA_SIM_VRAM           "vram.bin"
+#define FPGA_SIM_REG_SIZE       0x10000     /* Span of the register blocks saved in a simulation. */
+#define FPGA_SIM_FLIPS_ENV      "CAM_FPGA_SIM_FLIPS"    /* Flip a bit in one of every N video RAM reads. */
+
+struct fpga *fpga_sim_open(const char *path);
+void fpga_sim_close(struct fpga *fpga);
+void fpga_sim_service(struct fpga *fpga);
+uint32_t fpga_sim_fifo_read(struct fpga *fpga);
+int fpga_sim_record(struct fpga *fpga, uint32_t start, uint32_t end, uint32_t last);
+void fpga_sim_corrupt(struct fpga *fpga, void *buf, size_t len);
+
+/* Pop a word from the sequencer metadata FIFO, which the hardware does as a side effect of the read. */
+static inline uint32_t
+fpga_md_fifo_read(struct fpga *fpga)
+{
+    if (fpga->sim) return fpga_sim_fifo_read(fpga);
+    return fpga->seq->md_fifo_read;
+}
+
 #endif /* _FPGA_H */
@@ -0,0 +1,327 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "frame-ring.h"
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING   0x0002U
+#endif
+
+/* Round up to a whole number of pages. */
+#define FRAME_RING_PAGE_ALIGN(_x_) (((_x_) + FRAME_RING_PAGE_SIZE - 1) & ~(FRAME_RING_PAGE_SIZE - 1))
+
+/*
+ * Create an anonymous file to back the ring. Older kernels lack memfd, so
+ * fall back to a POSIX shared memory object that is unlinked immediately,
+ * which leaves us with an equally anonymous file descriptor.
+ */
+static int
+frame_ring_memfd(void)
+{
+    char name[64];
+    int fd;
+
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, "cam-frames", MFD_ALLOW_SEALING);
+    if (fd >= 0) {
+        return fd;
+    }
+#endif
+    snprintf(name, sizeof(name), "/cam-frames-%d", getpid());
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+    return fd;
+}
+
+static struct frame_ring *
+frame_ring_mmap(int fd, size_t mapsize, int prot)
+{
+    struct frame_ring *ring = malloc(sizeof(struct frame_ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->hdr = mmap(NULL, mapsize, prot, MAP_SHARED, fd, 0);
+    if (ring->hdr == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+    ring->mapsize = mapsize;
+    ring->fd = fd;
+    ring->rdfd = -1;
+    return ring;
+}
+
+/*
+ * Stop the ring from being resized, or from being written through any new
+ * descriptor or mapping, once the producer has mapped it. This requires a
+ * memfd, and is silently skipped for the POSIX shared memory fallback, or
+ * where the kernel doesn't support a particular seal.
+ */
+static void
+frame_ring_seal(int fd)
+{
+#ifdef F_ADD_SEALS
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#ifdef F_SEAL_FUTURE_WRITE
+    fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL);
+#endif
+}
+
+/*===============================================
+ * Producer API
+ *===============================================
+ */
+struct frame_ring *
+frame_ring_create(unsigned int nslots, size_t slotsize)
+{
+    size_t slotstride = FRAME_RING_PAGE_SIZE + FRAME_RING_PAGE_ALIGN(slotsize);
+    size_t mapsize = FRAME_RING_PAGE_SIZE + nslots * slotstride;
+    struct frame_ring *ring;
+    char path[64];
+    int fd;
+
+    fd = frame_ring_memfd();
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create frame ring: %s\n", strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, mapsize) != 0) {
+        fprintf(stderr, "Failed to resize frame ring: %s\n", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    ring = frame_ring_mmap(fd, mapsize, PROT_READ | PROT_WRITE);
+    if (!ring) {
+        fprintf(stderr, "Failed to map frame ring: %s\n", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    /* The file starts out zero-filled, so every slot is already marked empty. */
+    ring->hdr->version = FRAME_RING_VERSION;
+    ring->hdr->nslots = nslots;
+    ring->hdr->slotsize = slotsize;
+    ring->hdr->slotstride = slotstride;
+    ring->hdr->head = 0;
+    __sync_synchronize();
+    ring->hdr->magic = FRAME_RING_MAGIC;
+
+    /* Consumers get their own read-only descriptor, so they can't scribble on the ring. */
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    ring->rdfd = open(path, O_RDONLY);
+    if (ring->rdfd < 0) {
+        fprintf(stderr, "Failed to reopen frame ring read-only: %s\n", strerror(errno));
+        frame_ring_close(ring);
+        return NULL;
+    }
+    frame_ring_seal(fd);
+    return ring;
+}
+
+static inline struct frame_ring_slot *
+frame_ring_index(struct frame_ring *ring, uint32_t sequence)
+{
+    unsigned int index = sequence % ring->hdr->nslots;
+    return (struct frame_ring_slot *)((uint8_t *)ring->hdr + FRAME_RING_PAGE_SIZE + index * ring->hdr->slotstride);
+}
+
+/* Claim the next slot to be written, invalidating the frame it held. */
+struct frame_ring_slot *
+frame_ring_begin(struct frame_ring *ring)
+{
+    uint32_t next = ring->hdr->head + 1;
+    struct frame_ring_slot *slot;
+
+    if (next == 0) next++; /* Zero marks an empty slot. */
+    slot = frame_ring_index(ring, next);
+    slot->sequence = 0;
+    __sync_synchronize();
+    return slot;
+}
+
+/* Publish the slot once its metadata and frame data have been written. */
+void
+frame_ring_commit(struct frame_ring *ring, struct frame_ring_slot *slot)
+{
+    uint32_t next = ring->hdr->head + 1;
+    if (next == 0) next++;
+
+    __sync_synchronize();
+    slot->sequence = next;
+    __sync_synchronize();
+    ring->hdr->head = next;
+}
+
+/*===============================================
+ * Consumer API
+ *===============================================
+ */
+struct frame_ring *
+frame_ring_map(int fd)
+{
+    struct frame_ring_header hdr;
+    struct stat st;
+
+    if ((fstat(fd, &st) != 0) || (st.st_size < FRAME_RING_PAGE_SIZE)) {
+        return NULL;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        return NULL;
+    }
+    if ((hdr.magic != FRAME_RING_MAGIC) || (hdr.version != FRAME_RING_VERSION) || !hdr.nslots ||
+        ((FRAME_RING_PAGE_SIZE + (size_t)hdr.nslots * hdr.slotstride) > (size_t)st.st_size)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* Consumers only get to look. */
+    return frame_ring_mmap(fd, st.st_size, PROT_READ);
+}
+
+/* Connect to the producer's socket and map the ring it hands back. */
+struct frame_ring *
+frame_ring_open(const char *path)
+{
+    struct sockaddr_un addr;
+    struct frame_ring *ring;
+    int sock, fd;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return NULL;
+    }
+    fd = frame_ring_recv_fd(sock);
+    close(sock);
+    if (fd < 0) {
+        return NULL;
+    }
+    ring = frame_ring_map(fd);
+    if (!ring) {
+        close(fd);
+    }
+    return ring;
+}
+
+/* Return the slot holding a frame, or NULL if it has already been overwritten. */
+struct frame_ring_slot *
+frame_ring_slot(struct frame_ring *ring, uint32_t sequence)
+{
+    struct frame_ring_slot *slot = frame_ring_index(ring, sequence);
+    if (slot->sequence != sequence) {
+        return NULL;
+    }
+    __sync_synchronize();
+    return slot;
+}
+
+/* Check that the slot wasn't overwritten while the frame was being read. */
+int
+frame_ring_valid(const struct frame_ring_slot *slot, uint32_t sequence)
+{
+    __sync_synchronize();
+    return (slot->sequence == sequence);
+}
+
+void
+frame_ring_close(struct frame_ring *ring)
+{
+    munmap(ring->hdr, ring->mapsize);
+    if (ring->rdfd >= 0) close(ring->rdfd);
+    close(ring->fd);
+    free(ring);
+}
+
+/*===============================================
+ * File Descriptor Passing
+ *===============================================
+ */
+int
+frame_ring_send_fd(int sock, int fd)
+{
+    uint32_t magic = FRAME_RING_MAGIC;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = &magic, .iov_len = sizeof(magic) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return (sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(magic)) ? 0 : -1;
+}
+
+int
+frame_ring_recv_fd(int sock)
+{
+    uint32_t magic = 0;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = &magic, .iov_len = sizeof(magic) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(sock, &msg, 0) != sizeof(magic)) {
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if ((fd >= 0) && (magic != FRAME_RING_MAGIC)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,100 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __FRAME_RING_H
+#define __FRAME_RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* UNIX socket handing out the live frame ring to local consumers. */
+#define FRAME_RING_SOCKET       "/tmp/cam-frames.sock"
+
+#define FRAME_RING_MAGIC        0x474e4952  /* "RING" */
+#define FRAME_RING_VERSION      1
+
+/* Pixel formats, as V4L2/GStreamer style fourcc codes. */
+#define FRAME_RING_FOURCC(_a_, _b_, _c_, _d_) \
+    ((uint32_t)(_a_) | ((uint32_t)(_b_) << 8) | ((uint32_t)(_c_) << 16) | ((uint32_t)(_d_) << 24))
+#define FRAME_RING_FORMAT_NV12  FRAME_RING_FOURCC('N', 'V', '1', '2')
+
+/*
+ * The ring is a single memory-backed file shared between one producer and
+ * any number of consumers. A page of header is followed by a fixed number
+ * of slots, each with a page of metadata and then the frame data.
+ *
+ * Frames are numbered by a sequence that starts at one, and the frame with
+ * sequence N lives in slot (N % nslots). The producer clears the sequence
+ * of a slot before overwriting it, and only sets it again once the frame
+ * is complete, so consumers can read the frame in place and then check
+ * that the slot still holds the same sequence to detect if it was
+ * overwritten while they were looking at it.
+ */
+struct frame_ring_slot {
+    volatile uint32_t   sequence;   /* Sequence of the frame held in this slot, or zero while being written. */
+    uint32_t            format;     /* One of FRAME_RING_FORMAT_xxx */
+    uint32_t            width;
+    uint32_t            height;
+    uint32_t            stride;     /* Bytes between rows of each plane. */
+    uint32_t            length;     /* Length of the frame data. */
+    int32_t             position;   /* Playback frame number, or negative for live video. */
+    uint32_t            reserved;
+    uint64_t            timestamp;  /* CLOCK_MONOTONIC nanoseconds when the frame was captured. */
+};
+
+struct frame_ring_header {
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            nslots;
+    uint32_t            slotsize;   /* Maximum length of the frame data in each slot. */
+    uint32_t            slotstride; /* Bytes between the start of each slot, including its metadata. */
+    volatile uint32_t   head;       /* Sequence of the most recently completed frame. */
+    uint32_t            reserved[10];
+};
+
+#define FRAME_RING_PAGE_SIZE    4096
+
+struct frame_ring {
+    struct frame_ring_header *hdr;
+    size_t              mapsize;
+    int                 fd;
+    int                 rdfd;       /* Read-only descriptor handed out to consumers, or -1. */
+};
+
+/* Producer API */
+struct frame_ring *frame_ring_create(unsigned int nslots, size_t slotsize);
+struct frame_ring_slot *frame_ring_begin(struct frame_ring *ring);
+void frame_ring_commit(struct frame_ring *ring, struct frame_ring_slot *slot);
+
+/* Consumer API */
+struct frame_ring *frame_ring_open(const char *path);
+struct frame_ring *frame_ring_map(int fd);
+struct frame_ring_slot *frame_ring_slot(struct frame_ring *ring, uint32_t sequence);
+int frame_ring_valid(const struct frame_ring_slot *slot, uint32_t sequence);
+
+void frame_ring_close(struct frame_ring *ring);
+
+/* Pass the ring's file descriptor over a connected UNIX socket. */
+int frame_ring_send_fd(int sock, int fd);
+int frame_ring_recv_fd(int sock);
+
+static inline uint8_t *
+frame_ring_data(const struct frame_ring_slot *slot)
+{
+    return (uint8_t *)slot + FRAME_RING_PAGE_SIZE;
+}
+
+#endif /* __FRAME_RING_H */
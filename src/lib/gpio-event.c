@@ -0,0 +1,517 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#ifdef HAVE_LINUX_GPIO_H
+#include <linux/gpio.h>
+#endif
+
+#include "gpio-event.h"
+
+#define GPIO_SYSFS_ROOT     "/sys/class/gpio"
+#define GPIO_CHARDEV_MAX    16
+#define GPIO_EVENT_BATCH    16
+
+const char *
+gpio_event_backend(const struct gpio_event_src *src)
+{
+    switch (src->backend) {
+        case GPIO_EVENT_CHARDEV:
+            return "chardev";
+        case GPIO_EVENT_SYSFS:
+            return "sysfs";
+        case GPIO_EVENT_MOCK:
+            return "mock";
+        default:
+            return "unknown";
+    }
+}
+
+static struct gpio_event_src *
+gpio_event_alloc(int fd, int backend, int edges, short pollmask)
+{
+    struct gpio_event_src *src = malloc(sizeof(struct gpio_event_src));
+    if (!src) {
+        close(fd);
+        return NULL;
+    }
+    src->fd = fd;
+    src->backend = backend;
+    src->edges = edges;
+    src->value = -1;
+    src->pollmask = pollmask;
+    return src;
+}
+
+/* Extract the GPIO number from a sysfs path, eg: /sys/class/gpio/gpio51/value */
+static int
+gpio_sysfs_number(const char *path)
+{
+    const char *s = strstr(path, "/gpio");
+    char *end;
+    long num;
+
+    while (s) {
+        num = strtol(s + 5, &end, 10);
+        if ((end != (s + 5)) && (*end == '/')) return num;
+        s = strstr(s + 1, "/gpio");
+    }
+    return -1;
+}
+
+/*===============================================
+ * Character Device Backend
+ *===============================================
+ */
+#ifdef HAVE_LINUX_GPIO_H
+/* Read a small sysfs attribute into a string, removing the trailing newline. */
+static int
+gpio_sysfs_attr(const char *dir, const char *name, char *buf, size_t len)
+{
+    char path[PATH_MAX];
+    int fd, n;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", GPIO_SYSFS_ROOT, dir, name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) return -1;
+    while ((n > 0) && (buf[n-1] == '\n')) n--;
+    buf[n] = '\0';
+    return n;
+}
+
+/* Convert a line event timestamp into CLOCK_MONOTONIC. */
+static void
+gpio_chardev_timestamp(uint64_t ns, struct timespec *ts)
+{
+    struct timespec mono, real;
+    int64_t nmono, nreal;
+    int64_t dmono, dreal;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    nmono = (int64_t)mono.tv_sec * 1000000000LL + mono.tv_nsec;
+    nreal = (int64_t)real.tv_sec * 1000000000LL + real.tv_nsec;
+
+    /* Kernels older than 5.7 timestamp line events with CLOCK_REALTIME. */
+    dmono = nmono - (int64_t)ns;
+    dreal = nreal - (int64_t)ns;
+    if (dmono < 0) dmono = -dmono;
+    if (dreal < 0) dreal = -dreal;
+    if (dreal < dmono) {
+        ns = (uint64_t)((int64_t)ns - nreal + nmono);
+    }
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/* Request line events from a GPIO chip, returning the event file descriptor. */
+static int
+gpio_chardev_request(const char *chip, unsigned int line, int edges, int *value)
+{
+    struct gpioevent_request req;
+    struct gpiohandle_data data;
+    int flags;
+    int fd = open(chip, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = line;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    if (edges & GPIO_EDGE_RISING) req.eventflags |= GPIOEVENT_REQUEST_RISING_EDGE;
+    if (edges & GPIO_EDGE_FALLING) req.eventflags |= GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(req.consumer_label, "chronos-cli", sizeof(req.consumer_label) - 1);
+    if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    close(fd);
+
+    /* Get the initial state of the line. */
+    memset(&data, 0, sizeof(data));
+    if (ioctl(req.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) == 0) {
+        *value = data.values[0];
+    }
+    flags = fcntl(req.fd, F_GETFL);
+    fcntl(req.fd, F_SETFL, flags | O_NONBLOCK);
+    return req.fd;
+}
+
+/* Find the character device and line offset matching a sysfs GPIO number. */
+static int
+gpio_chardev_lookup(int gpionum, char *chip, size_t len, unsigned int *line)
+{
+    struct dirent *d;
+    char label[64] = "";
+    char attr[32];
+    long base = -1;
+    int i;
+    DIR *dir = opendir(GPIO_SYSFS_ROOT);
+    if (!dir) {
+        return -1;
+    }
+
+    /* Search the sysfs chips for the base GPIO number and label. */
+    while ((d = readdir(dir)) != NULL) {
+        long b, n;
+        if (strncmp(d->d_name, "gpiochip", 8) != 0) continue;
+        if (gpio_sysfs_attr(d->d_name, "base", attr, sizeof(attr)) <= 0) continue;
+        b = strtol(attr, NULL, 10);
+        if (gpio_sysfs_attr(d->d_name, "ngpio", attr, sizeof(attr)) <= 0) continue;
+        n = strtol(attr, NULL, 10);
+        if ((gpionum < b) || (gpionum >= (b + n))) continue;
+
+        gpio_sysfs_attr(d->d_name, "label", label, sizeof(label));
+        base = b;
+        break;
+    }
+    closedir(dir);
+    if (base < 0) {
+        return -1;
+    }
+
+    /* Find the character device with the same label. */
+    for (i = 0; i < GPIO_CHARDEV_MAX; i++) {
+        struct gpiochip_info info;
+        int fd;
+
+        snprintf(chip, len, "/dev/gpiochip%d", i);
+        fd = open(chip, O_RDONLY);
+        if (fd < 0) continue;
+        memset(&info, 0, sizeof(info));
+        if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) < 0) {
+            close(fd);
+            continue;
+        }
+        close(fd);
+        if (strncmp(info.label, label, sizeof(info.label)) == 0) {
+            *line = gpionum - base;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static struct gpio_event_src *
+gpio_chardev_open(const char *path, int edges)
+{
+    struct gpio_event_src *src;
+    char chip[PATH_MAX];
+    unsigned int line;
+    int value = -1;
+    int fd;
+
+    /* Explicit character device as "/dev/gpiochipN:line" */
+    if (strncmp(path, "/dev/", 5) == 0) {
+        const char *sep = strrchr(path, ':');
+        if (!sep || ((sep - path) >= sizeof(chip))) {
+            errno = EINVAL;
+            return NULL;
+        }
+        memcpy(chip, path, sep - path);
+        chip[sep - path] = '\0';
+        line = strtoul(sep + 1, NULL, 10);
+    }
+    /* Otherwise, translate the sysfs GPIO number into a character device. */
+    else if (gpio_chardev_lookup(gpio_sysfs_number(path), chip, sizeof(chip), &line) != 0) {
+        errno = ENODEV;
+        return NULL;
+    }
+
+    fd = gpio_chardev_request(chip, line, edges, &value);
+    if (fd < 0) {
+        return NULL;
+    }
+    src = gpio_event_alloc(fd, GPIO_EVENT_CHARDEV, edges, POLLIN | POLLERR);
+    if (src) src->value = value;
+    return src;
+}
+
+static int
+gpio_chardev_read(struct gpio_event_src *src, struct gpio_event *ev)
+{
+    struct gpioevent_data data[GPIO_EVENT_BATCH];
+    int count = 0;
+
+    /* Drain the event queue, keeping only the most recent edge. */
+    while (1) {
+        int n = read(src->fd, data, sizeof(data));
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        n /= sizeof(struct gpioevent_data);
+        if (n == 0) break;
+
+        count += n;
+        src->value = (data[n-1].id == GPIOEVENT_EVENT_RISING_EDGE);
+        gpio_chardev_timestamp(data[n-1].timestamp, &ev->timestamp);
+        ev->exact = 1;
+        if (n < GPIO_EVENT_BATCH) break;
+    }
+    return count;
+}
+#endif /* HAVE_LINUX_GPIO_H */
+
+/*===============================================
+ * Legacy Sysfs Backend
+ *===============================================
+ */
+static int
+gpio_sysfs_write(const char *value, const char *name, const char *str)
+{
+    char path[PATH_MAX];
+    int dirlen = strlen(value);
+    ssize_t len = strlen(str);
+    int fd;
+
+    /* Get the length of the directory name for the GPIO value. */
+    if (dirlen >= sizeof(path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    while ((dirlen > 0) && (value[dirlen] != '/')) dirlen--;
+    if ((dirlen + 1 + strlen(name)) >= sizeof(path)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(path, value, dirlen + 1);
+    strcpy(path + dirlen + 1, name);
+
+    /* Sysfs rejects unsupported values when they are written, so check the write itself. */
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (write(fd, str, len) != len) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return close(fd);
+}
+
+static struct gpio_event_src *
+gpio_sysfs_open(const char *path, int edges)
+{
+    struct gpio_event_src *src;
+    const char *edgestr = "none";
+    char buf[2];
+    int fd;
+
+    /* Export the GPIO, if not already done. */
+    if (access(path, F_OK) != 0) {
+        int gpionum = gpio_sysfs_number(path);
+        FILE *fp = fopen(GPIO_SYSFS_ROOT "/export", "w");
+        if (fp && (gpionum >= 0)) {
+            fprintf(fp, "%d", gpionum);
+        }
+        if (fp) fclose(fp);
+    }
+
+    /* Configure direction and edge detection. */
+    if ((edges & GPIO_EDGE_BOTH) == GPIO_EDGE_BOTH) edgestr = "both";
+    else if (edges & GPIO_EDGE_RISING) edgestr = "rising";
+    else if (edges & GPIO_EDGE_FALLING) edgestr = "falling";
+    gpio_sysfs_write(path, "direction", "in");
+    if (gpio_sysfs_write(path, "edge", edgestr) != 0) {
+        /* Lines without interrupt support would never report an edge. */
+        return NULL;
+    }
+
+    /* And finally, open the GPIO file descriptor */
+    fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        return NULL;
+    }
+    src = gpio_event_alloc(fd, GPIO_EVENT_SYSFS, edges, POLLPRI | POLLERR);
+    if (src && (pread(fd, buf, sizeof(buf), 0) > 0)) {
+        src->value = (buf[0] == '1');
+    }
+    return src;
+}
+
+static int
+gpio_sysfs_read(struct gpio_event_src *src, struct gpio_event *ev)
+{
+    char buf[2];
+
+    /* A positional read at zero re-arms the edge detection in one syscall. */
+    if (pread(src->fd, buf, sizeof(buf), 0) < 0) {
+        return -1;
+    }
+    /* Sysfs has no edge timestamps, so the best we can do is when it was read. */
+    clock_gettime(CLOCK_MONOTONIC, &ev->timestamp);
+    ev->exact = 0;
+    src->value = (buf[0] == '1');
+    return 1;
+}
+
+/*===============================================
+ * Timer-Driven Mock Backend
+ *===============================================
+ */
+struct gpio_event_src *
+gpio_event_open_mock(unsigned long usec, int edges)
+{
+    struct itimerspec its;
+    struct gpio_event_src *src;
+    int fd;
+
+    if (!usec || !(edges & GPIO_EDGE_BOTH)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0) {
+        return NULL;
+    }
+    its.it_interval.tv_sec = usec / 1000000;
+    its.it_interval.tv_nsec = (usec % 1000000) * 1000;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(fd, 0, &its, NULL) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    src = gpio_event_alloc(fd, GPIO_EVENT_MOCK, edges, POLLIN | POLLERR);
+    if (src) src->value = (edges == GPIO_EDGE_FALLING);
+    return src;
+}
+
+static int
+gpio_mock_read(struct gpio_event_src *src, struct gpio_event *ev)
+{
+    struct itimerspec its;
+    uint64_t expirations;
+
+    if (read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ev->timestamp);
+    ev->exact = 0;
+
+    /* The most recent expiration happened one interval before the next one. */
+    if (timerfd_gettime(src->fd, &its) == 0) {
+        ev->timestamp.tv_sec += its.it_value.tv_sec - its.it_interval.tv_sec;
+        ev->timestamp.tv_nsec += its.it_value.tv_nsec - its.it_interval.tv_nsec;
+        while (ev->timestamp.tv_nsec < 0) {
+            ev->timestamp.tv_nsec += 1000000000;
+            ev->timestamp.tv_sec--;
+        }
+        while (ev->timestamp.tv_nsec >= 1000000000) {
+            ev->timestamp.tv_nsec -= 1000000000;
+            ev->timestamp.tv_sec++;
+        }
+        ev->exact = 1;
+    }
+
+    /* Each timer expiration generates one edge of the requested type. */
+    if ((src->edges & GPIO_EDGE_BOTH) == GPIO_EDGE_BOTH) {
+        if (expirations & 1) src->value = !src->value;
+    }
+    else {
+        src->value = (src->edges & GPIO_EDGE_RISING) != 0;
+    }
+    return (expirations > INT_MAX) ? INT_MAX : (int)expirations;
+}
+
+/*===============================================
+ * Public API
+ *===============================================
+ */
+struct gpio_event_src *
+gpio_event_open(const char *path, int edges)
+{
+    if (!path) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strncmp(path, GPIO_EVENT_MOCK_PREFIX, strlen(GPIO_EVENT_MOCK_PREFIX)) == 0) {
+        return gpio_event_open_mock(strtoul(path + strlen(GPIO_EVENT_MOCK_PREFIX), NULL, 10), edges);
+    }
+
+#ifdef HAVE_LINUX_GPIO_H
+    /* Prefer line events from the character device when available. */
+    struct gpio_event_src *src = gpio_chardev_open(path, edges);
+    if (src) return src;
+    if (strncmp(path, "/dev/", 5) == 0) return NULL;
+#endif
+
+    /* Fall back to the sysfs interface. */
+    return gpio_sysfs_open(path, edges);
+}
+
+void
+gpio_event_close(struct gpio_event_src *src)
+{
+    if (src) {
+        close(src->fd);
+        free(src);
+    }
+}
+
+int
+gpio_event_read(struct gpio_event_src *src, struct gpio_event *ev)
+{
+    int count;
+
+    switch (src->backend) {
+#ifdef HAVE_LINUX_GPIO_H
+        case GPIO_EVENT_CHARDEV:
+            count = gpio_chardev_read(src, ev);
+            break;
+#endif
+        case GPIO_EVENT_SYSFS:
+            count = gpio_sysfs_read(src, ev);
+            break;
+        case GPIO_EVENT_MOCK:
+            count = gpio_mock_read(src, ev);
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    if (count > 0) {
+        ev->count = count;
+        ev->value = src->value;
+    }
+    return count;
+}
@@ -0,0 +1,93 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef _GPIO_EVENT_H
+#define _GPIO_EVENT_H
+
+#include <time.h>
+
+/* Edges to generate events on. */
+#define GPIO_EDGE_RISING    0x1
+#define GPIO_EDGE_FALLING   0x2
+#define GPIO_EDGE_BOTH      (GPIO_EDGE_RISING | GPIO_EDGE_FALLING)
+
+/* Backend implementations. */
+#define GPIO_EVENT_CHARDEV  1   /* Line events from /dev/gpiochipN with kernel timestamps. */
+#define GPIO_EVENT_SYSFS    2   /* Legacy /sys/class/gpio value file with POLLPRI. */
+#define GPIO_EVENT_MOCK     3   /* Timer-driven edges for testing without hardware. */
+
+/* Prefix of a GPIO path to select the mock backend, eg: "mock:16667" for 60Hz */
+#define GPIO_EVENT_MOCK_PREFIX  "mock:"
+
+struct gpio_event {
+    struct timespec timestamp;  /* CLOCK_MONOTONIC time of the most recent edge. */
+    unsigned int    count;      /* Number of edges consumed by this read. */
+    int             value;      /* Line value after the most recent edge. */
+    int             exact;      /* Non-zero if timestamp is the time of the edge, rather than when it was read. */
+};
+
+struct gpio_event_src {
+    int             fd;
+    int             backend;
+    int             edges;
+    int             value;
+    short           pollmask;
+};
+
+/*
+ * Open a GPIO for edge events. The path can be one of:
+ *  - A sysfs GPIO value, eg: "/sys/class/gpio/gpio51/value", which will use
+ *    the character device for the same line when supported by the kernel.
+ *  - A character device and line offset, eg: "/dev/gpiochip1:19"
+ *  - A mock timer period in microseconds, eg: "mock:16667"
+ *
+ * Returns NULL and sets errno if the line cannot generate edge events.
+ */
+struct gpio_event_src *gpio_event_open(const char *path, int edges);
+struct gpio_event_src *gpio_event_open_mock(unsigned long usec, int edges);
+void gpio_event_close(struct gpio_event_src *src);
+
+/*
+ * Read the pending edge events, returning the number of edges consumed, zero
+ * if no edges were pending, or less than zero on error. When multiple edges
+ * were pending, only the most recent one is reported.
+ */
+int gpio_event_read(struct gpio_event_src *src, struct gpio_event *ev);
+
+/* Return the last known value of the GPIO. */
+static inline int
+gpio_event_value(const struct gpio_event_src *src)
+{
+    return src->value;
+}
+
+/* Helpers to setup a struct pollfd. */
+static inline int
+gpio_event_fd(const struct gpio_event_src *src)
+{
+    return src->fd;
+}
+
+static inline short
+gpio_event_pollmask(const struct gpio_event_src *src)
+{
+    return src->pollmask;
+}
+
+/* Return a human readable name of the backend in use. */
+const char *gpio_event_backend(const struct gpio_event_src *src);
+
+#endif /* _GPIO_EVENT_H */
@@ -0,0 +1,367 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image-stats.h"
+
+/*
+ * Reduce the per-row and per-column sums into the waveform bands, and the
+ * histogram and Laplacian sums into the clipping and focus scores. Bands
+ * are spread evenly over the image, and repeat rows or columns when the
+ * subsampled image has fewer than IMAGE_STATS_BANDS of them.
+ */
+static void
+image_stats_finish(struct image_stats *stats, const uint32_t *rowsum, const uint32_t *colsum,
+                   long long lapsum, unsigned long long lapsq)
+{
+    unsigned long black = 0, white = 0;
+    unsigned int i, j;
+
+    stats->samples = (unsigned long)stats->width * stats->height;
+    for (i = 0; i <= IMAGE_STATS_CLIP_BLACK; i++) black += stats->histogram[i];
+    for (i = IMAGE_STATS_CLIP_WHITE; i < IMAGE_STATS_BINS; i++) white += stats->histogram[i];
+    stats->clipblack = stats->samples ? (black * 100.0) / stats->samples : 0;
+    stats->clipwhite = stats->samples ? (white * 100.0) / stats->samples : 0;
+
+    for (i = 0; i < IMAGE_STATS_BANDS; i++) {
+        unsigned int lo = (i * stats->height) / IMAGE_STATS_BANDS;
+        unsigned int hi = ((i + 1) * stats->height) / IMAGE_STATS_BANDS;
+        unsigned long long sum = 0;
+        if (hi <= lo) hi = lo + 1;
+        if (hi > stats->height) break;
+        for (j = lo; j < hi; j++) sum += rowsum[j];
+        stats->rows[i] = sum / ((unsigned long long)(hi - lo) * stats->width);
+    }
+    for (; i < IMAGE_STATS_BANDS; i++) stats->rows[i] = 0;
+
+    for (i = 0; i < IMAGE_STATS_BANDS; i++) {
+        unsigned int lo = (i * stats->width) / IMAGE_STATS_BANDS;
+        unsigned int hi = ((i + 1) * stats->width) / IMAGE_STATS_BANDS;
+        unsigned long long sum = 0;
+        if (hi <= lo) hi = lo + 1;
+        if (hi > stats->width) break;
+        for (j = lo; j < hi; j++) sum += colsum[j];
+        stats->columns[i] = sum / ((unsigned long long)(hi - lo) * stats->height);
+    }
+    for (; i < IMAGE_STATS_BANDS; i++) stats->columns[i] = 0;
+
+    /* The Laplacian is only evaluated away from the edges of the image. */
+    if ((stats->width >= 3) && (stats->height >= 3)) {
+        double n = (double)(stats->width - 2) * (stats->height - 2);
+        double mean = lapsum / n;
+        stats->focus = (lapsq / n) - (mean * mean);
+    } else {
+        stats->focus = 0;
+    }
+}
+
+/* Convert the metering window into a range of samples, given as [x0, x1) and [y0, y1). */
+static void
+image_stats_window(const struct image_stats *stats, const struct image_window *meter,
+                   unsigned int *x0, unsigned int *x1, unsigned int *y0, unsigned int *y1)
+{
+    unsigned int step = stats->step;
+
+    if (!meter || !meter->width || !meter->height) {
+        *x0 = *y0 = 0;
+        *x1 = stats->width;
+        *y1 = stats->height;
+        return;
+    }
+    /* Include every sample that lands within the window. */
+    *x0 = (meter->x + step - 1) / step;
+    *y0 = (meter->y + step - 1) / step;
+    *x1 = (meter->x + meter->width + step - 1) / step;
+    *y1 = (meter->y + meter->height + step - 1) / step;
+    if (*x1 > stats->width) *x1 = stats->width;
+    if (*y1 > stats->height) *y1 = stats->height;
+    if (*x0 > *x1) *x0 = *x1;
+    if (*y0 > *y1) *y0 = *y1;
+}
+
+/*===============================================
+ * Row Kernels
+ *===============================================
+ */
+/* Gather every step'th pixel from a row, returning the row itself when there is nothing to skip. */
+static const uint8_t *
+image_stats_gather(uint8_t *dst, const uint8_t *src, unsigned int count, unsigned int step)
+{
+    const uint8_t *out = dst;
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk;
+#endif
+
+    if (step == 1) {
+        return src;
+    }
+#ifdef __ARM_NEON
+    if (step == 2) {
+        bulk = count & ~15;
+        count -= bulk;
+        if (bulk) {
+            asm volatile (
+                "1:                                 \n"
+                "   vld2.8      {q0,q1}, [%[s]]!    \n" /* Keep the even pixels. */
+                "   vst1.8      {q0}, [%[d]]!       \n"
+                "   subs %[n], %[n], #16            \n"
+                "   bgt 1b                          \n"
+                : [d]"+r"(dst), [s]"+r"(src), [n]"+r"(bulk)
+                :: "cc", "memory", "q0", "q1");
+        }
+    }
+    else if (step == 4) {
+        bulk = count & ~7;
+        count -= bulk;
+        if (bulk) {
+            asm volatile (
+                "1:                                 \n"
+                "   vld4.8      {d0-d3}, [%[s]]!    \n" /* Keep every fourth pixel. */
+                "   vst1.8      {d0}, [%[d]]!       \n"
+                "   subs %[n], %[n], #8             \n"
+                "   bgt 1b                          \n"
+                : [d]"+r"(dst), [s]"+r"(src), [n]"+r"(bulk)
+                :: "cc", "memory", "d0", "d1", "d2", "d3");
+        }
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        dst[i] = src[i * step];
+    }
+    return out;
+}
+
+/* Accumulate a row into the column sums, and return the sum of the row. */
+static uint32_t
+image_stats_sum(uint32_t *colsum, const uint8_t *row, unsigned int count)
+{
+    uint32_t sum = 0;
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~15;
+    count -= bulk;
+    if (bulk) {
+        uint32_t *store = colsum;
+        asm volatile (
+            "   vmov.i32    q12, #0                 \n"
+            "1:                                     \n"
+            "   vld1.8      {q0}, [%[r]]!           \n"
+            "   vld1.32     {q8,q9}, [%[c]]!        \n"
+            "   vld1.32     {q10,q11}, [%[c]]!      \n"
+            "   vmovl.u8    q1, d0                  \n" /* Widen to 16 bits. */
+            "   vmovl.u8    q2, d1                  \n"
+            "   vaddw.u16   q8, q8, d2              \n" /* Accumulate the columns. */
+            "   vaddw.u16   q9, q9, d3              \n"
+            "   vaddw.u16   q10, q10, d4            \n"
+            "   vaddw.u16   q11, q11, d5            \n"
+            "   vpadal.u16  q12, q1                 \n" /* Accumulate the row. */
+            "   vpadal.u16  q12, q2                 \n"
+            "   vst1.32     {q8,q9}, [%[s]]!        \n"
+            "   vst1.32     {q10,q11}, [%[s]]!      \n"
+            "   subs %[n], %[n], #16                \n"
+            "   bgt 1b                              \n"
+            "   vpadd.u32   d24, d24, d25           \n"
+            "   vpadd.u32   d24, d24, d24           \n"
+            "   vmov.32     %[sum], d24[0]          \n"
+            : [r]"+r"(row), [c]"+r"(colsum), [s]"+r"(store), [n]"+r"(bulk), [sum]"=r"(sum)
+            :: "cc", "memory", "q0", "q1", "q2", "q8", "q9", "q10", "q11", "q12");
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        colsum[i] += row[i];
+        sum += row[i];
+    }
+    return sum;
+}
+
+/*
+ * Apply the Laplacian kernel (4c - l - r - u - d) across the interior of a
+ * row, accumulating the sum and sum of squares of the response.
+ */
+static void
+image_stats_laplace(const uint8_t *up, const uint8_t *row, const uint8_t *down, unsigned int width,
+                    long long *lapsum, unsigned long long *lapsq)
+{
+    unsigned int count = width - 2;
+    int32_t sum = 0;
+    uint64_t sq = 0;
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~7;
+    count -= bulk;
+#endif
+
+    /* Start from the second pixel, with the row pointer trailing by one for the left neighbour. */
+    up++;
+    down++;
+#ifdef __ARM_NEON
+    if (bulk) {
+        asm volatile (
+            "   vmov.i32    q8, #0                  \n"
+            "   vmov.i32    q9, #0                  \n"
+            "1:                                     \n"
+            "   vld1.8      {d0,d1}, [%[r]]         \n"
+            "   vld1.8      {d4}, [%[u]]!           \n"
+            "   vld1.8      {d5}, [%[d]]!           \n"
+            "   add         %[r], %[r], #8          \n"
+            "   vext.8      d2, d0, d1, #1          \n" /* Centre pixels. */
+            "   vext.8      d3, d0, d1, #2          \n" /* Right neighbours. */
+            "   vshll.u8    q3, d2, #2              \n"
+            "   vaddl.u8    q10, d0, d3             \n"
+            "   vaddl.u8    q11, d4, d5             \n"
+            "   vsub.i16    q3, q3, q10             \n"
+            "   vsub.i16    q3, q3, q11             \n"
+            "   vpadal.s16  q8, q3                  \n" /* Accumulate the sum. */
+            "   vmull.s16   q10, d6, d6             \n" /* Accumulate the squares. */
+            "   vmull.s16   q11, d7, d7             \n"
+            "   vpadal.u32  q9, q10                 \n"
+            "   vpadal.u32  q9, q11                 \n"
+            "   subs %[n], %[n], #8                 \n"
+            "   bgt 1b                              \n"
+            "   vpadd.i32   d16, d16, d17           \n"
+            "   vpadd.i32   d16, d16, d16           \n"
+            "   vmov.32     %[sum], d16[0]          \n"
+            "   vadd.i64    d18, d18, d19           \n"
+            "   vmov        %Q[sq], %R[sq], d18     \n"
+            : [r]"+r"(row), [u]"+r"(up), [d]"+r"(down), [n]"+r"(bulk), [sum]"=r"(sum), [sq]"=r"(sq)
+            :: "cc", "memory", "q0", "q1", "q2", "q3", "q8", "q9", "q10", "q11");
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        int lap = 4 * row[i + 1] - row[i] - row[i + 2] - up[i] - down[i];
+        sum += lap;
+        sq += lap * lap;
+    }
+    *lapsum += sum;
+    *lapsq += sq;
+}
+
+/*===============================================
+ * Statistics
+ *===============================================
+ */
+void
+image_stats(struct image_stats *stats, const uint8_t *luma, unsigned int width, unsigned int height,
+            unsigned int stride, unsigned int step, const struct image_window *meter, void *scratch)
+{
+    unsigned int sw = width / step;
+    unsigned int sh = height / step;
+    unsigned int linesize = IMAGE_STATS_ALIGN(sw) + 16;
+    uint32_t *colsum = (uint32_t *)((uint8_t *)scratch + linesize * 3);
+    uint32_t *rowsum = colsum + IMAGE_STATS_ALIGN(sw);
+    uint32_t hist[4][IMAGE_STATS_BINS];
+    const uint8_t *lines[3] = {NULL, NULL, NULL};
+    long long lapsum = 0;
+    unsigned long long lapsq = 0;
+    unsigned int mx0, mx1, my0, my1;
+    unsigned int x, y;
+
+    stats->step = step;
+    stats->width = sw;
+    stats->height = sh;
+    image_stats_window(stats, meter, &mx0, &mx1, &my0, &my1);
+    memset(stats->meter, 0, sizeof(stats->meter));
+    memset(hist, 0, sizeof(hist));
+    memset(colsum, 0, IMAGE_STATS_ALIGN(sw) * sizeof(uint32_t));
+
+    for (y = 0; y < sh; y++) {
+        const uint8_t *row = image_stats_gather((uint8_t *)scratch + linesize * (y % 3),
+                                                luma + (y * step * stride), sw, step);
+
+        /* Split the histogram four ways to avoid stalling on repeated increments of the same bin. */
+        for (x = 0; (x + 4) <= sw; x += 4) {
+            hist[0][row[x + 0]]++;
+            hist[1][row[x + 1]]++;
+            hist[2][row[x + 2]]++;
+            hist[3][row[x + 3]]++;
+        }
+        for (; x < sw; x++) {
+            hist[0][row[x]]++;
+        }
+        if ((y >= my0) && (y < my1)) {
+            for (x = mx0; x < mx1; x++) {
+                stats->meter[row[x]]++;
+            }
+        }
+        rowsum[y] = image_stats_sum(colsum, row, sw);
+
+        /* Once three rows are available, apply the Laplacian to the middle one. */
+        lines[0] = lines[1];
+        lines[1] = lines[2];
+        lines[2] = row;
+        if (lines[0] && (sw >= 3)) {
+            image_stats_laplace(lines[0], lines[1], lines[2], sw, &lapsum, &lapsq);
+        }
+    }
+
+    for (x = 0; x < IMAGE_STATS_BINS; x++) {
+        stats->histogram[x] = hist[0][x] + hist[1][x] + hist[2][x] + hist[3][x];
+    }
+    image_stats_finish(stats, rowsum, colsum, lapsum, lapsq);
+}
+
+void
+image_stats_ref(struct image_stats *stats, const uint8_t *luma, unsigned int width, unsigned int height,
+                unsigned int stride, unsigned int step, const struct image_window *meter)
+{
+    unsigned int sw = width / step;
+    unsigned int sh = height / step;
+    uint32_t *rowsum = calloc(sh + sw + 1, sizeof(uint32_t));
+    uint32_t *colsum = rowsum + sh;
+    long long lapsum = 0;
+    unsigned long long lapsq = 0;
+    unsigned int x, y;
+    unsigned int mx0 = 0, mx1 = UINT32_MAX, my0 = 0, my1 = UINT32_MAX;
+
+#define SAMPLE(_x_, _y_) luma[(_y_) * step * stride + (_x_) * step]
+    stats->step = step;
+    stats->width = sw;
+    stats->height = sh;
+    memset(stats->histogram, 0, sizeof(stats->histogram));
+    memset(stats->meter, 0, sizeof(stats->meter));
+    if (!rowsum) {
+        return;
+    }
+    if (meter && meter->width && meter->height) {
+        mx0 = meter->x;
+        my0 = meter->y;
+        mx1 = meter->x + meter->width;
+        my1 = meter->y + meter->height;
+    }
+    for (y = 0; y < sh; y++) {
+        for (x = 0; x < sw; x++) {
+            uint8_t px = SAMPLE(x, y);
+            stats->histogram[px]++;
+            if (((x * step) >= mx0) && ((x * step) < mx1) && ((y * step) >= my0) && ((y * step) < my1)) {
+                stats->meter[px]++;
+            }
+            rowsum[y] += px;
+            colsum[x] += px;
+            if ((x > 0) && (y > 0) && (x < (sw - 1)) && (y < (sh - 1))) {
+                int lap = 4 * px - SAMPLE(x - 1, y) - SAMPLE(x + 1, y) - SAMPLE(x, y - 1) - SAMPLE(x, y + 1);
+                lapsum += lap;
+                lapsq += lap * lap;
+            }
+        }
+    }
+#undef SAMPLE
+    image_stats_finish(stats, rowsum, colsum, lapsum, lapsq);
+    free(rowsum);
+}
@@ -0,0 +1,65 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __IMAGE_STATS_H
+#define __IMAGE_STATS_H
+
+#include <stdint.h>
+
+#define IMAGE_STATS_BINS        256
+#define IMAGE_STATS_BANDS       64  /* Number of bands in the row and column waveforms. */
+#define IMAGE_STATS_CLIP_BLACK  4   /* Luma at or below this level counts as clipped to black. */
+#define IMAGE_STATS_CLIP_WHITE  251 /* Luma at or above this level counts as clipped to white. */
+
+/* A rectangle within the frame, in pixels. A width or height of zero selects the whole frame. */
+struct image_window {
+    unsigned int    x;
+    unsigned int    y;
+    unsigned int    width;
+    unsigned int    height;
+};
+
+struct image_stats {
+    unsigned int    step;       /* Subsampling step in both directions. */
+    unsigned int    width;      /* Resolution of the subsampled image. */
+    unsigned int    height;
+    unsigned long   samples;    /* Number of pixels sampled. */
+    uint32_t        histogram[IMAGE_STATS_BINS];
+    uint32_t        meter[IMAGE_STATS_BINS];    /* Histogram of the metering window. */
+    double          clipblack;  /* Percentage of samples clipped to black. */
+    double          clipwhite;  /* Percentage of samples clipped to white. */
+    uint8_t         rows[IMAGE_STATS_BANDS];    /* Mean luma of horizontal bands, from top to bottom. */
+    uint8_t         columns[IMAGE_STATS_BANDS]; /* Mean luma of vertical bands, from left to right. */
+    double          focus;      /* Variance of the Laplacian, which grows with image sharpness. */
+};
+
+/* Scratch memory required to gather statistics from a frame of the given resolution. */
+#define IMAGE_STATS_ALIGN(_w_)          (((_w_) + 15) & ~15)
+#define IMAGE_STATS_SCRATCH(_w_, _h_)   ((IMAGE_STATS_ALIGN(_w_) + 16) * 3 + (IMAGE_STATS_ALIGN(_w_) + (_h_)) * sizeof(uint32_t))
+
+/*
+ * Gather statistics from an 8-bit luma plane, sampling every step'th pixel
+ * of every step'th row. Steps of 1, 2 and 4 are the fastest. The metering
+ * window may be NULL to meter the whole frame.
+ */
+void image_stats(struct image_stats *stats, const uint8_t *luma, unsigned int width, unsigned int height,
+                 unsigned int stride, unsigned int step, const struct image_window *meter, void *scratch);
+
+/* Scalar reference implementation, producing identical results to image_stats(). */
+void image_stats_ref(struct image_stats *stats, const uint8_t *luma, unsigned int width, unsigned int height,
+                     unsigned int stride, unsigned int step, const struct image_window *meter);
+
+#endif /* __IMAGE_STATS_H */
@@ -0,0 +1,275 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include "jpeg-nv12.h"
+#include "utils.h"
+
+/* Encoding is done in strips of one iMCU row, which is 16 rows for 4:2:0 sampling. */
+#define JPEG_NV12_STRIP_ROWS    (2 * DCTSIZE)
+
+struct jpeg_nv12 {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr       jerr;
+    struct jpeg_destination_mgr dest;
+    jmp_buf                     jmp_abort;
+
+    /* Current encoder configuration. */
+    unsigned int    maxwidth;
+    unsigned int    width;
+    unsigned int    height;
+    int             quality;
+
+    /* Scanline buffers in cacheable memory, for one strip of each plane. */
+    unsigned int    ypitch;
+    unsigned int    cpitch;
+    JSAMPLE         *ystrip;
+    JSAMPLE         *ustrip;
+    JSAMPLE         *vstrip;
+    JSAMPROW        yrows[JPEG_NV12_STRIP_ROWS];
+    JSAMPROW        urows[DCTSIZE];
+    JSAMPROW        vrows[DCTSIZE];
+    JSAMPARRAY      planes[3];
+
+    /* Output buffer, grown as necessary and never shrunk. */
+    uint8_t         *outbuf;
+    size_t          outsize;
+    size_t          outlen;
+};
+
+/*===============================================
+ * libjpeg Error and Destination Handlers
+ *===============================================
+ */
+static void
+jpeg_nv12_abort(j_common_ptr cinfo)
+{
+    struct jpeg_nv12 *enc = cinfo->client_data;
+    longjmp(enc->jmp_abort, 1);
+}
+
+static void
+jpeg_nv12_init_dest(j_compress_ptr cinfo)
+{
+    struct jpeg_nv12 *enc = cinfo->client_data;
+    enc->dest.next_output_byte = enc->outbuf;
+    enc->dest.free_in_buffer = enc->outsize;
+    enc->outlen = 0;
+}
+
+static boolean
+jpeg_nv12_empty_dest(j_compress_ptr cinfo)
+{
+    struct jpeg_nv12 *enc = cinfo->client_data;
+    size_t oldsize = enc->outsize;
+    uint8_t *newbuf = realloc(enc->outbuf, oldsize * 2);
+    if (!newbuf) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    }
+    enc->outbuf = newbuf;
+    enc->outsize = oldsize * 2;
+    enc->dest.next_output_byte = newbuf + oldsize;
+    enc->dest.free_in_buffer = enc->outsize - oldsize;
+    return TRUE;
+}
+
+static void
+jpeg_nv12_term_dest(j_compress_ptr cinfo)
+{
+    struct jpeg_nv12 *enc = cinfo->client_data;
+    enc->outlen = enc->outsize - enc->dest.free_in_buffer;
+}
+
+/*===============================================
+ * NV12 Scanline Conversion
+ *===============================================
+ */
+/* Copy a row of luma into cacheable memory, padding out to a whole MCU. */
+static inline void
+jpeg_nv12_copy_luma(JSAMPLE *dst, const uint8_t *src, unsigned int width, unsigned int padded)
+{
+#ifdef __arm__
+    unsigned int bulk = width & ~63;
+    if (bulk) memcpy_neon(dst, src, bulk);
+    memcpy(dst + bulk, src + bulk, width - bulk);
+#else
+    memcpy(dst, src, width);
+#endif
+    memset(dst + width, dst[width - 1], padded - width);
+}
+
+/* Split a row of interleaved chroma into U and V planes, padding out to a whole MCU. */
+static inline void
+jpeg_nv12_split_chroma(JSAMPLE *u, JSAMPLE *v, const uint8_t *chroma, unsigned int num, unsigned int padded)
+{
+    JSAMPLE *ustart = u;
+    JSAMPLE *vstart = v;
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int count = num & ~7;
+    if (count) {
+        asm volatile (
+            "1:                             \n"
+            "   vld2.8   {d0,d1}, [%[s]]!   \n" /* Read and split the U/V planes. */
+            "   vst1.8   {d0}, [%[udst]]!   \n" /* Output the U plane. */
+            "   vst1.8   {d1}, [%[vdst]]!   \n" /* Output the V plane. */
+            "   subs %[count],%[count], #8  \n"
+            "   bgt 1b                      \n"
+            : [udst]"+r"(u), [vdst]"+r"(v), [s]"+r"(chroma), [count]"+r"(count) :: "cc", "d0", "d1", "memory");
+    }
+    num &= 7;
+#endif
+    for (i = 0; i < num; i++) {
+        *u++ = chroma[2 * i];
+        *v++ = chroma[2 * i + 1];
+    }
+    memset(u, u[-1], padded - (u - ustart));
+    memset(v, v[-1], padded - (v - vstart));
+}
+
+/*===============================================
+ * NV12 Encoder API
+ *===============================================
+ */
+struct jpeg_nv12 *
+jpeg_nv12_new(unsigned int maxwidth, int quality)
+{
+    struct jpeg_nv12 *enc = calloc(1, sizeof(struct jpeg_nv12));
+    if (!enc) {
+        return NULL;
+    }
+
+    /* Scanline pitch is rounded up to a whole MCU, and 64 bytes for the NEON copy. */
+    enc->maxwidth = maxwidth;
+    enc->quality = quality;
+    enc->ypitch = (maxwidth + 63) & ~63;
+    enc->cpitch = ((((maxwidth + 15) & ~15) / 2) + 63) & ~63;
+    enc->ystrip = malloc(enc->ypitch * JPEG_NV12_STRIP_ROWS);
+    enc->ustrip = malloc(enc->cpitch * DCTSIZE);
+    enc->vstrip = malloc(enc->cpitch * DCTSIZE);
+    enc->outsize = maxwidth * 256;
+    enc->outbuf = malloc(enc->outsize);
+    if (!enc->ystrip || !enc->ustrip || !enc->vstrip || !enc->outbuf) {
+        jpeg_nv12_free(enc);
+        return NULL;
+    }
+    enc->planes[0] = enc->yrows;
+    enc->planes[1] = enc->urows;
+    enc->planes[2] = enc->vrows;
+
+    /* Create the compressor with our error and destination handlers. */
+    enc->cinfo.err = jpeg_std_error(&enc->jerr);
+    enc->cinfo.client_data = enc;
+    enc->jerr.error_exit = jpeg_nv12_abort;
+    if (setjmp(enc->jmp_abort) != 0) {
+        jpeg_nv12_free(enc);
+        return NULL;
+    }
+    jpeg_create_compress(&enc->cinfo);
+    enc->dest.init_destination = jpeg_nv12_init_dest;
+    enc->dest.empty_output_buffer = jpeg_nv12_empty_dest;
+    enc->dest.term_destination = jpeg_nv12_term_dest;
+    enc->cinfo.dest = &enc->dest;
+    return enc;
+}
+
+void
+jpeg_nv12_free(struct jpeg_nv12 *enc)
+{
+    jpeg_destroy_compress(&enc->cinfo);
+    free(enc->ystrip);
+    free(enc->ustrip);
+    free(enc->vstrip);
+    free(enc->outbuf);
+    free(enc);
+}
+
+ssize_t
+jpeg_nv12_encode(struct jpeg_nv12 *enc, const uint8_t *luma, const uint8_t *chroma,
+                unsigned int width, unsigned int height, unsigned int stride, const uint8_t **out)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+    unsigned int ywidth = (width + 15) & ~15;
+    unsigned int cwidth = ywidth / 2;
+    unsigned int cheight = (height + 1) / 2;
+    unsigned int row, i;
+
+    if (!width || !height || (width > enc->maxwidth)) {
+        return -1;
+    }
+    if (setjmp(enc->jmp_abort) != 0) {
+        /* Reset the compressor, but keep it around for the next frame. */
+        jpeg_abort_compress(cinfo);
+        return -1;
+    }
+
+    /* Only redo the compressor setup when the frame geometry changes. */
+    if ((width != enc->width) || (height != enc->height)) {
+        cinfo->image_width = width;
+        cinfo->image_height = height;
+        cinfo->input_components = 3;
+        cinfo->in_color_space = JCS_YCbCr;
+        jpeg_set_defaults(cinfo);
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->raw_data_in = TRUE;
+        /* NV12 is 4:2:0 subsampled, which the JPEG encoder can take natively. */
+        cinfo->comp_info[0].h_samp_factor = 2;
+        cinfo->comp_info[0].v_samp_factor = 2;
+        cinfo->comp_info[1].h_samp_factor = 1;
+        cinfo->comp_info[1].v_samp_factor = 1;
+        cinfo->comp_info[2].h_samp_factor = 1;
+        cinfo->comp_info[2].v_samp_factor = 1;
+        jpeg_set_quality(cinfo, enc->quality, TRUE);
+        enc->width = width;
+        enc->height = height;
+    }
+
+    jpeg_start_compress(cinfo, TRUE);
+    for (row = 0; row < height; row += JPEG_NV12_STRIP_ROWS) {
+        /* Copy a strip of luma, repeating the last row to fill out the bottom. */
+        for (i = 0; i < JPEG_NV12_STRIP_ROWS; i++) {
+            if ((row + i) < height) {
+                enc->yrows[i] = enc->ystrip + i * enc->ypitch;
+                jpeg_nv12_copy_luma(enc->yrows[i], luma + (row + i) * stride, width, ywidth);
+            } else {
+                enc->yrows[i] = enc->yrows[i - 1];
+            }
+        }
+        /* Split a strip of chroma, repeating the last row to fill out the bottom. */
+        for (i = 0; i < DCTSIZE; i++) {
+            unsigned int crow = (row / 2) + i;
+            if (crow < cheight) {
+                enc->urows[i] = enc->ustrip + i * enc->cpitch;
+                enc->vrows[i] = enc->vstrip + i * enc->cpitch;
+                jpeg_nv12_split_chroma(enc->urows[i], enc->vrows[i], chroma + crow * stride, (width + 1) / 2, cwidth);
+            } else {
+                enc->urows[i] = enc->urows[i - 1];
+                enc->vrows[i] = enc->vrows[i - 1];
+            }
+        }
+        jpeg_write_raw_data(cinfo, enc->planes, JPEG_NV12_STRIP_ROWS);
+    }
+    jpeg_finish_compress(cinfo);
+
+    *out = enc->outbuf;
+    return enc->outlen;
+}
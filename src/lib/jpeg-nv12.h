@@ -0,0 +1,44 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __JPEG_NV12_H
+#define __JPEG_NV12_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Long-lived JPEG compressor for NV12 video frames. The libjpeg state,
+ * scanline buffers and output buffer are allocated once and reused for
+ * every frame, so encoding a frame performs no memory allocation unless
+ * the output grows beyond anything seen before.
+ */
+struct jpeg_nv12;
+
+struct jpeg_nv12 *jpeg_nv12_new(unsigned int maxwidth, int quality);
+void jpeg_nv12_free(struct jpeg_nv12 *enc);
+
+/*
+ * Encode an NV12 frame, given pointers to the luma and interleaved chroma
+ * planes and the stride in bytes between rows of each plane. On success,
+ * the length of the JPEG image is returned and *out is set to point at
+ * the data, which remains valid until the next call to jpeg_nv12_encode.
+ * Returns -1 on error.
+ */
+ssize_t jpeg_nv12_encode(struct jpeg_nv12 *enc, const uint8_t *luma, const uint8_t *chroma,
+                        unsigned int width, unsigned int height, unsigned int stride, const uint8_t **out);
+
+#endif /* __JPEG_NV12_H */
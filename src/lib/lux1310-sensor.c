@@ -400,12 +400,23 @@ lux1310_set_period(struct image_sensor *sensor, const struct image_geometry *g,
     return 0;
 } /* lux1310_set_period */
 
+/* Return the line period (in clocks) of the active wavetable. */
+static unsigned long
+lux1310_line_period(struct lux1310_private_data *data, const struct image_geometry *g)
+{
+    /* When attached to a running sensor, the wavetable is unknown but the line period was already programmed. */
+    if (!data->wavetab) {
+        return data->reg->line_period + 1;
+    }
+    return max((g->hres / LUX1310_HRES_INCREMENT)+2, (data->wavetab->read_delay + 3));
+} /* lux1310_line_period */
+
 static int
 lux1310_set_exposure(struct image_sensor *sensor, const struct image_geometry *g, unsigned long long nsec)
 {
     struct lux1310_private_data *data = CONTAINER_OF(sensor, struct lux1310_private_data, sensor);
     /* Compute timing first in units of sensor clock periods. */
-    unsigned long t_line = max((g->hres / LUX1310_HRES_INCREMENT)+2, (data->wavetab->read_delay + 3));
+    unsigned long t_line = lux1310_line_period(data, g);
     unsigned long t_exposure = (nsec * LUX1310_SENSOR_CLOCK_RATE + 500000000) / 1000000000;
     unsigned long t_start = LUX1310_MAGIC_ABN_DELAY;
 
@@ -416,6 +427,7 @@ lux1310_set_exposure(struct image_sensor *sensor, const struct image_geometry *g
      */
     uint32_t exp_lines = (t_exposure + t_line/2) / t_line;
     data->reg->int_time = (t_start + (t_line * exp_lines)) * LUX1310_TIMING_CLOCK_RATE / LUX1310_SENSOR_CLOCK_RATE;
+    return 0;
 } /* lux1310_set_exposure */
 
 static int
@@ -517,6 +529,42 @@ static const struct image_sensor_ops lux1310_ops = {
     /* TODO: Calibration Data and API */
 };
 
+/* Fill in the sensor limits and pixel format. */
+static void
+lux1310_describe(struct lux1310_private_data *data, struct fpga *fpga, const struct ioport *iops)
+{
+    int color;
+
+    /* Setup the sensor limits */
+    data->sensor.fpga = fpga;
+    data->sensor.ops = &lux1310_ops;
+    data->sensor.name = "lux1310";
+    data->sensor.mfr = "Luxima";
+    //data->sensor.h_max_res = 1296;
+    data->sensor.h_max_res = 1280;
+    data->sensor.v_max_res = 1024;
+    data->sensor.h_min_res = 336;
+    data->sensor.v_min_res = 96;
+    data->sensor.h_increment = LUX1310_HRES_INCREMENT;
+    data->sensor.v_increment = 2;
+    data->sensor.pixel_rate = data->sensor.h_max_res * data->sensor.v_max_res * 1057;
+    data->sensor.adc_count = LUX1310_ADC_COUNT;
+
+    /* Determine the sensor type and set the appropriate pixel format. */
+    color = ioport_open(iops, "lux1310-color", O_RDONLY);
+    if (color < 0) {
+        data->sensor.format = FOURCC_CODE('Y', '1', '2', ' ');
+    }
+    else if (gpio_read(color)) {
+        data->sensor.format = FOURCC_CODE('B', 'G', '1', '2');
+        close(color);
+    }
+    else {
+        data->sensor.format = FOURCC_CODE('Y', '1', '2', ' ');
+        close(color);
+    }
+} /* lux1310_describe */
+
 struct image_sensor *
 lux1310_init(struct fpga *fpga, const struct ioport *iops)
 {
@@ -526,7 +574,6 @@ lux1310_init(struct fpga *fpga, const struct ioport *iops)
     uint8_t wordsz = 16;
     uint16_t dacmode = htole16(LUX1310_DAC_AUTOUPDATE << 12);
     uint16_t rev;
-    int color;
     int err;
     int i;
 
@@ -563,35 +610,7 @@ lux1310_init(struct fpga *fpga, const struct ioport *iops)
     data->reg = fpga->sensor;
     data->reg->fifo_start = 0x100;
     data->reg->fifo_stop = 0x100;
-
-    /* Setup the sensor limits */
-    data->sensor.fpga = fpga;
-    data->sensor.ops = &lux1310_ops;
-    data->sensor.name = "lux1310";
-    data->sensor.mfr = "Luxima";
-    //data->sensor.h_max_res = 1296;
-    data->sensor.h_max_res = 1280;
-    data->sensor.v_max_res = 1024;
-    data->sensor.h_min_res = 336;
-    data->sensor.v_min_res = 96;
-    data->sensor.h_increment = LUX1310_HRES_INCREMENT;
-    data->sensor.v_increment = 2;
-    data->sensor.pixel_rate = data->sensor.h_max_res * data->sensor.v_max_res * 1057;
-    data->sensor.adc_count = LUX1310_ADC_COUNT;
-
-    /* Determine the sensor type and set the appropriate pixel format. */
-    color = ioport_open(iops, "lux1310-color", O_RDONLY);
-    if (color < 0) {
-        data->sensor.format = FOURCC_CODE('Y', '1', '2', ' ');
-    }
-    else if (gpio_read(color)) {
-        data->sensor.format = FOURCC_CODE('B', 'G', '1', '2');
-        close(color);
-    }
-    else {
-        data->sensor.format = FOURCC_CODE('Y', '1', '2', ' ');
-        close(color);
-    }
+    lux1310_describe(data, fpga, iops);
 
     /* Disable integration */
     data->reg->frame_period = 100 * 4000;
@@ -688,3 +707,31 @@ err:
     free(data);
     return NULL;
 } /* lux1310_init */
+
+/* Operations that are safe on a sensor configured by another process. */
+static const struct image_sensor_ops lux1310_attach_ops = {
+    .set_exposure = lux1310_set_exposure,
+    .get_constraints = lux1310_constraints,
+};
+
+/*
+ * Attach to a sensor that is already running, without resetting it or
+ * touching the SPI bus, so that the exposure can be adjusted underneath
+ * the process which owns the sensor configuration.
+ */
+struct image_sensor *
+lux1310_attach(struct fpga *fpga, const struct ioport *iops)
+{
+    struct lux1310_private_data *data = malloc(sizeof(struct lux1310_private_data));
+    if (!data) {
+        return NULL;
+    }
+    data->spifd = -1;
+    data->daccs = -1;
+    data->gaintab = NULL;
+    data->wavetab = NULL;
+    data->reg = fpga->sensor;
+    lux1310_describe(data, fpga, iops);
+    data->sensor.ops = &lux1310_attach_ops;
+    return &data->sensor;
+} /* lux1310_attach */
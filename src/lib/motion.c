@@ -0,0 +1,261 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion.h"
+
+/*
+ * Motion is detected by downsampling each frame into the mean luma of
+ * 16x16 blocks, which averages away most of the sensor noise, and then
+ * counting the blocks within the region whose mean changed by more than
+ * a given level since the previous frame. Motion is detected when enough
+ * of the region changes for several consecutive frames, while shorter
+ * runs are counted as rejected so that the persistence filter can be tuned
+ * against the rate of false positives it suppresses.
+ */
+#define MOTION_DEFAULT_LEVEL        12
+#define MOTION_DEFAULT_THRESHOLD    2.0
+#define MOTION_DEFAULT_FRAMES       3
+
+void
+motion_init(struct motion_detector *md)
+{
+    memset(md, 0, sizeof(struct motion_detector));
+    md->level = MOTION_DEFAULT_LEVEL;
+    md->threshold = MOTION_DEFAULT_THRESHOLD;
+    md->frames = MOTION_DEFAULT_FRAMES;
+}
+
+void
+motion_free(struct motion_detector *md)
+{
+    free(md->grid);
+    free(md->prev);
+    free(md->scratch);
+    md->grid = NULL;
+    md->prev = NULL;
+    md->scratch = NULL;
+    md->width = 0;
+    md->height = 0;
+}
+
+/*===============================================
+ * Block Kernels
+ *===============================================
+ */
+/* Accumulate the sums of adjacent pixel pairs from a row. */
+static void
+motion_accumulate(uint16_t *acc, const uint8_t *row, unsigned int count)
+{
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~15;
+    count -= bulk;
+    if (bulk) {
+        uint16_t *store = acc;
+        asm volatile (
+            "1:                                 \n"
+            "   vld1.8      {q0}, [%[r]]!       \n"
+            "   vld1.16     {q8}, [%[a]]!       \n"
+            "   vpadal.u8   q8, q0              \n" /* Add the pairs of pixels. */
+            "   vst1.16     {q8}, [%[s]]!       \n"
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            : [r]"+r"(row), [a]"+r"(acc), [s]"+r"(store), [n]"+r"(bulk)
+            :: "cc", "memory", "q0", "q8");
+        acc = store;
+    }
+#endif
+    for (i = 0; i < (count / 2); i++) {
+        acc[i] += row[2 * i] + row[2 * i + 1];
+    }
+}
+
+void
+motion_downsample(uint8_t *grid, const uint8_t *luma, unsigned int width, unsigned int height,
+                  unsigned int stride, void *scratch)
+{
+    unsigned int gwidth = width / MOTION_BLOCK;
+    unsigned int gheight = height / MOTION_BLOCK;
+    uint16_t *acc = scratch;
+    unsigned int bx, by, y, i;
+
+    for (by = 0; by < gheight; by++) {
+        /* Each pair sum reaches at most 16 * 510, which fits in 16 bits. */
+        memset(acc, 0, gwidth * (MOTION_BLOCK / 2) * sizeof(uint16_t));
+        for (y = 0; y < MOTION_BLOCK; y++) {
+            motion_accumulate(acc, luma + (by * MOTION_BLOCK + y) * stride, gwidth * MOTION_BLOCK);
+        }
+        for (bx = 0; bx < gwidth; bx++) {
+            unsigned int sum = 0;
+            for (i = 0; i < (MOTION_BLOCK / 2); i++) sum += acc[bx * (MOTION_BLOCK / 2) + i];
+            *grid++ = (sum + (MOTION_BLOCK * MOTION_BLOCK / 2)) / (MOTION_BLOCK * MOTION_BLOCK);
+        }
+    }
+}
+
+void
+motion_downsample_ref(uint8_t *grid, const uint8_t *luma, unsigned int width, unsigned int height,
+                      unsigned int stride)
+{
+    unsigned int gwidth = width / MOTION_BLOCK;
+    unsigned int gheight = height / MOTION_BLOCK;
+    unsigned int bx, by, x, y;
+
+    for (by = 0; by < gheight; by++) {
+        for (bx = 0; bx < gwidth; bx++) {
+            unsigned int sum = 0;
+            for (y = 0; y < MOTION_BLOCK; y++) {
+                const uint8_t *row = luma + (by * MOTION_BLOCK + y) * stride + bx * MOTION_BLOCK;
+                for (x = 0; x < MOTION_BLOCK; x++) sum += row[x];
+            }
+            *grid++ = (sum + (MOTION_BLOCK * MOTION_BLOCK / 2)) / (MOTION_BLOCK * MOTION_BLOCK);
+        }
+    }
+}
+
+unsigned int
+motion_compare(const uint8_t *a, const uint8_t *b, unsigned int count, unsigned int level)
+{
+    unsigned int changed = 0;
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~15;
+    count -= bulk;
+    if (bulk) {
+        uint8_t thresh = (level > 255) ? 255 : level;
+        asm volatile (
+            "   vdup.8      q15, %[t]           \n"
+            "   vmov.i16    q12, #0             \n"
+            "1:                                 \n"
+            "   vld1.8      {q0}, [%[a]]!       \n"
+            "   vld1.8      {q1}, [%[b]]!       \n"
+            "   vabd.u8     q0, q0, q1          \n" /* Absolute difference of the blocks. */
+            "   vcgt.u8     q0, q0, q15         \n" /* All ones where it exceeds the level. */
+            "   vshr.u8     q0, q0, #7          \n"
+            "   vpadal.u8   q12, q0             \n" /* Count them. */
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            "   vpaddl.u16  q12, q12            \n"
+            "   vpadd.u32   d24, d24, d25       \n"
+            "   vpadd.u32   d24, d24, d24       \n"
+            "   vmov.32     %[c], d24[0]        \n"
+            : [a]"+r"(a), [b]"+r"(b), [n]"+r"(bulk), [c]"=r"(changed)
+            : [t]"r"(thresh)
+            : "cc", "q0", "q1", "q12", "q15");
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        unsigned int diff = (a[i] > b[i]) ? (a[i] - b[i]) : (b[i] - a[i]);
+        if (diff > level) changed++;
+    }
+    return changed;
+}
+
+/*===============================================
+ * Motion Detector
+ *===============================================
+ */
+/* Reallocate the grids and scratch memory for a new resolution, returning nonzero on success. */
+static int
+motion_resize(struct motion_detector *md, unsigned int width, unsigned int height)
+{
+    size_t gsize = (size_t)(width / MOTION_BLOCK) * (height / MOTION_BLOCK);
+
+    motion_free(md);
+    md->grid = malloc(gsize);
+    md->prev = malloc(gsize);
+    md->scratch = malloc(MOTION_SCRATCH(width));
+    if (!md->grid || !md->prev || !md->scratch) {
+        motion_free(md);
+        return 0;
+    }
+    md->width = width;
+    md->height = height;
+    md->primed = 0;
+    md->run = 0;
+    md->fired = 0;
+    return 1;
+}
+
+int
+motion_update(struct motion_detector *md, const uint8_t *luma, unsigned int width, unsigned int height,
+              unsigned int stride, unsigned long long timestamp)
+{
+    unsigned int gwidth = width / MOTION_BLOCK;
+    unsigned int gheight = height / MOTION_BLOCK;
+    unsigned int x0 = 0, x1 = gwidth, y0 = 0, y1 = gheight;
+    unsigned int changed = 0, total, by;
+    int detected = 0;
+    uint8_t *swap;
+
+    if (!gwidth || !gheight) {
+        return 0;
+    }
+    if ((width != md->width) || (height != md->height)) {
+        if (!motion_resize(md, width, height)) return 0;
+    }
+    motion_downsample(md->grid, luma, width, height, stride, md->scratch);
+    md->results.frames++;
+
+    /* Watch every block that overlaps the region. */
+    if (md->region.width && md->region.height) {
+        x0 = md->region.x / MOTION_BLOCK;
+        y0 = md->region.y / MOTION_BLOCK;
+        x1 = (md->region.x + md->region.width + MOTION_BLOCK - 1) / MOTION_BLOCK;
+        y1 = (md->region.y + md->region.height + MOTION_BLOCK - 1) / MOTION_BLOCK;
+        if (x1 > gwidth) x1 = gwidth;
+        if (y1 > gheight) y1 = gheight;
+        if (x0 > x1) x0 = x1;
+        if (y0 > y1) y0 = y1;
+    }
+    total = (x1 - x0) * (y1 - y0);
+
+    /* The first frame only becomes the reference for the next. */
+    if (md->primed && total) {
+        for (by = y0; by < y1; by++) {
+            changed += motion_compare(md->grid + by * gwidth + x0, md->prev + by * gwidth + x0, x1 - x0, md->level);
+        }
+    }
+    md->primed = 1;
+    md->results.score = total ? (changed * 100.0) / total : 0;
+    swap = md->prev;
+    md->prev = md->grid;
+    md->grid = swap;
+
+    if (changed && (md->results.score >= md->threshold)) {
+        if (!md->run++) {
+            md->results.onset = timestamp;
+        }
+        if (!md->fired && (md->run >= md->frames)) {
+            md->fired = 1;
+            md->results.detections++;
+            md->results.latency = timestamp - md->results.onset;
+            detected = 1;
+        }
+    }
+    else {
+        if (md->run && !md->fired) {
+            md->results.rejected++;
+        }
+        md->run = 0;
+        md->fired = 0;
+    }
+    return detected;
+}
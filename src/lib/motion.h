@@ -0,0 +1,86 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __MOTION_H
+#define __MOTION_H
+
+#include <stdint.h>
+
+#include "image-stats.h"
+
+#define MOTION_BLOCK        16  /* Frames are downsampled to the mean of square blocks of this size. */
+
+/* Scratch memory required to downsample a frame of the given width. */
+#define MOTION_SCRATCH(_w_) ((((_w_) / 2) + 8) * sizeof(uint16_t))
+
+struct motion_results {
+    unsigned long       frames;     /* Number of frames analyzed. */
+    double              score;      /* Percentage of the blocks in the region that changed in the last frame. */
+    unsigned long       detections; /* Number of times that motion was detected. */
+    unsigned long       rejected;   /* Runs of motion that ended before reaching the frame count. */
+    unsigned long long  onset;      /* Timestamp of the first frame in the last run of motion. */
+    unsigned long long  latency;    /* Time from the onset to the detection of the last motion. */
+};
+
+struct motion_detector {
+    /* Configuration, which may be changed between frames. */
+    unsigned int        level;      /* Change in the mean luma of a block that counts as motion. */
+    double              threshold;  /* Percentage of the blocks in the region which must change. */
+    unsigned int        frames;     /* Consecutive frames over the threshold needed to detect motion. */
+    struct image_window region;     /* Region to watch, in pixels. */
+    struct motion_results results;
+
+    /* Private state. */
+    unsigned int        width;
+    unsigned int        height;
+    int                 primed;     /* The previous frame is available for comparison. */
+    unsigned int        run;        /* Consecutive frames over the threshold so far. */
+    int                 fired;      /* Motion was detected during this run. */
+    uint8_t             *grid;      /* Downsampled current and previous frames. */
+    uint8_t             *prev;
+    void                *scratch;
+};
+
+/* Load the default detector settings. */
+void motion_init(struct motion_detector *md);
+
+/* Release the memory used by the detector. */
+void motion_free(struct motion_detector *md);
+
+/*
+ * Analyze the next frame from an 8-bit luma plane, with a timestamp in any
+ * monotonic unit, and return nonzero when motion is detected. Motion is only
+ * detected once per run of frames over the threshold.
+ */
+int motion_update(struct motion_detector *md, const uint8_t *luma, unsigned int width, unsigned int height,
+                  unsigned int stride, unsigned long long timestamp);
+
+/*
+ * Downsample a luma plane into the rounded mean of each block, storing
+ * (width / MOTION_BLOCK) by (height / MOTION_BLOCK) bytes into the grid.
+ * Partial blocks at the right and bottom edges are ignored.
+ */
+void motion_downsample(uint8_t *grid, const uint8_t *luma, unsigned int width, unsigned int height,
+                       unsigned int stride, void *scratch);
+
+/* Scalar reference implementation, producing identical results to motion_downsample(). */
+void motion_downsample_ref(uint8_t *grid, const uint8_t *luma, unsigned int width, unsigned int height,
+                           unsigned int stride);
+
+/* Count the blocks whose mean luma differs by more than level between two rows of the grid. */
+unsigned int motion_compare(const uint8_t *a, const uint8_t *b, unsigned int count, unsigned int level);
+
+#endif /* __MOTION_H */
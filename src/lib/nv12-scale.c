@@ -0,0 +1,395 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "nv12-scale.h"
+
+void
+nv12_frame_init(struct nv12_frame *frame, uint8_t *data, unsigned int width, unsigned int height)
+{
+    frame->luma = data;
+    frame->chroma = data + (width * height);
+    frame->width = width;
+    frame->height = height;
+    frame->stride = width;
+}
+
+void
+nv12_crop(struct nv12_frame *dst, const struct nv12_frame *src,
+          unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+    /* Align to the chroma subsampling and clamp to the source. */
+    x &= ~1;
+    y &= ~1;
+    if (x > (src->width - 2)) x = src->width - 2;
+    if (y > (src->height - 2)) y = src->height - 2;
+    if (!width || (width > (src->width - x))) width = src->width - x;
+    if (!height || (height > (src->height - y))) height = src->height - y;
+
+    dst->luma = src->luma + (y * src->stride) + x;
+    dst->chroma = src->chroma + ((y / 2) * src->stride) + x;
+    dst->width = (width < 2) ? 2 : (width & ~1);
+    dst->height = (height < 2) ? 2 : (height & ~1);
+    dst->stride = src->stride;
+}
+
+/*===============================================
+ * Crop, Pad and Flip
+ *===============================================
+ */
+/* Copy a row, reversing the order of its samples when flipped, with a step of one byte for luma or two for chroma. */
+static inline void
+nv12_transform_row(uint8_t *dst, const uint8_t *src, unsigned int count, unsigned int step, int flip)
+{
+    const uint8_t *end = src + count;
+    unsigned int i;
+
+    if (!flip) {
+        memcpy(dst, src, count);
+        return;
+    }
+#ifdef __ARM_NEON
+    {
+        unsigned int bulk = count & ~15;
+        const int rewind = -16;
+        count -= bulk;
+        end -= 16;
+        if (bulk && (step == 1)) {
+            asm volatile (
+                "1:                                 \n"
+                "   vld1.8      {q0}, [%[s]], %[r]  \n" /* Walk backwards from the end of the row. */
+                "   vrev64.8    q0, q0              \n" /* Reverse the bytes within each half. */
+                "   vswp        d0, d1              \n" /* And then swap the halves. */
+                "   vst1.8      {q0}, [%[d]]!       \n"
+                "   subs %[n], %[n], #16            \n"
+                "   bgt 1b                          \n"
+                : [d]"+r"(dst), [s]"+r"(end), [n]"+r"(bulk)
+                : [r]"r"(rewind)
+                : "cc", "memory", "q0");
+        }
+        else if (bulk) {
+            asm volatile (
+                "1:                                 \n"
+                "   vld1.8      {q0}, [%[s]], %[r]  \n" /* Walk backwards from the end of the row. */
+                "   vrev64.16   q0, q0              \n" /* Reverse the chroma pairs within each half. */
+                "   vswp        d0, d1              \n" /* And then swap the halves. */
+                "   vst1.8      {q0}, [%[d]]!       \n"
+                "   subs %[n], %[n], #16            \n"
+                "   bgt 1b                          \n"
+                : [d]"+r"(dst), [s]"+r"(end), [n]"+r"(bulk)
+                : [r]"r"(rewind)
+                : "cc", "memory", "q0");
+        }
+        end += 16;
+    }
+#endif
+    /* Whatever is left comes from the start of the source row. */
+    for (i = 0; i < count; i += step) {
+        end -= step;
+        dst[i] = end[0];
+        if (step == 2) dst[i + 1] = end[1];
+    }
+}
+
+/* Fill a chroma row with a single color. */
+static inline void
+nv12_fill_chroma(uint8_t *dst, uint8_t u, uint8_t v, unsigned int count)
+{
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~15;
+    count -= bulk;
+    if (bulk) {
+        asm volatile (
+            "   vdup.16     q0, %[uv]           \n"
+            "1:                                 \n"
+            "   vst1.8      {q0}, [%[d]]!       \n"
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            : [d]"+r"(dst), [n]"+r"(bulk)
+            : [uv]"r"((v << 8) | u)
+            : "cc", "memory", "q0");
+    }
+#endif
+    for (i = 0; i < count; i += 2) {
+        dst[i] = u;
+        dst[i + 1] = v;
+    }
+}
+
+void
+nv12_transform(const struct nv12_frame *dst, const struct nv12_frame *src, unsigned int top, unsigned int flags)
+{
+    unsigned int bottom = top + src->height;
+    int hflip = (flags & NV12_FLIP_HORIZ) != 0;
+    unsigned int y, sy;
+
+    for (y = 0; y < dst->height; y++) {
+        uint8_t *row = dst->luma + (y * dst->stride);
+        if ((y < top) || (y >= bottom)) {
+            memset(row, NV12_BLACK_LUMA, src->width);
+            continue;
+        }
+        sy = (flags & NV12_FLIP_VERT) ? (bottom - 1 - y) : (y - top);
+        nv12_transform_row(row, src->luma + (sy * src->stride), src->width, 1, hflip);
+    }
+    for (y = 0; y < (dst->height / 2); y++) {
+        uint8_t *row = dst->chroma + (y * dst->stride);
+        if ((y < (top / 2)) || (y >= (bottom / 2))) {
+            nv12_fill_chroma(row, NV12_BLACK_CHROMA, NV12_BLACK_CHROMA, src->width);
+            continue;
+        }
+        sy = (flags & NV12_FLIP_VERT) ? ((bottom / 2) - 1 - y) : (y - (top / 2));
+        nv12_transform_row(row, src->chroma + (sy * src->stride), src->width, 2, hflip);
+    }
+}
+
+void
+nv12_transform_ref(const struct nv12_frame *dst, const struct nv12_frame *src, unsigned int top, unsigned int flags)
+{
+    unsigned int x, y;
+
+    for (y = 0; y < dst->height; y++) {
+        for (x = 0; x < src->width; x++) {
+            unsigned int sx = (flags & NV12_FLIP_HORIZ) ? (src->width - 1 - x) : x;
+            unsigned int sy = (flags & NV12_FLIP_VERT) ? (top + src->height - 1 - y) : (y - top);
+            uint8_t luma = NV12_BLACK_LUMA;
+            uint8_t chroma = NV12_BLACK_CHROMA;
+
+            if ((y >= top) && (y < (top + src->height))) {
+                luma = src->luma[sy * src->stride + sx];
+                /* Chroma pairs move together, and each chroma row covers two luma rows. */
+                chroma = src->chroma[(sy / 2) * src->stride + (sx & ~1) + (x & 1)];
+            }
+            dst->luma[y * dst->stride + x] = luma;
+            if ((y & 1) == 0) dst->chroma[(y / 2) * dst->stride + x] = chroma;
+        }
+    }
+}
+
+/*===============================================
+ * 2x2 Box Filter
+ *===============================================
+ */
+/* Average 2x2 blocks of bytes from two rows, with a step of one byte for luma or two for chroma. */
+static inline void
+nv12_box2x_row(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, unsigned int count, unsigned int step)
+{
+    unsigned int i;
+#ifdef __ARM_NEON
+    unsigned int bulk = count & ~15;
+    count -= bulk;
+    if (bulk && (step == 1)) {
+        asm volatile (
+            "1:                                 \n"
+            "   vld2.8      {q0,q1}, [%[r0]]!   \n" /* Split even and odd luma. */
+            "   vld2.8      {q2,q3}, [%[r1]]!   \n"
+            "   vaddl.u8    q8, d0, d2          \n" /* Sum horizontal pairs. */
+            "   vaddl.u8    q9, d1, d3          \n"
+            "   vaddl.u8    q10, d4, d6         \n"
+            "   vaddl.u8    q11, d5, d7         \n"
+            "   vadd.u16    q8, q8, q10         \n" /* Sum vertical pairs. */
+            "   vadd.u16    q9, q9, q11         \n"
+            "   vrshrn.u16  d0, q8, #2          \n" /* Round and divide by four. */
+            "   vrshrn.u16  d1, q9, #2          \n"
+            "   vst1.8      {d0,d1}, [%[d]]!    \n"
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            : [d]"+r"(dst), [r0]"+r"(row0), [r1]"+r"(row1), [n]"+r"(bulk)
+            :: "cc", "memory", "q0", "q1", "q2", "q3", "q8", "q9", "q10", "q11");
+    }
+    else if (bulk) {
+        asm volatile (
+            "1:                                 \n"
+            "   vld2.16     {q0,q1}, [%[r0]]!   \n" /* Split even and odd chroma pairs. */
+            "   vld2.16     {q2,q3}, [%[r1]]!   \n"
+            "   vaddl.u8    q8, d0, d2          \n" /* Sum horizontal pairs. */
+            "   vaddl.u8    q9, d1, d3          \n"
+            "   vaddl.u8    q10, d4, d6         \n"
+            "   vaddl.u8    q11, d5, d7         \n"
+            "   vadd.u16    q8, q8, q10         \n" /* Sum vertical pairs. */
+            "   vadd.u16    q9, q9, q11         \n"
+            "   vrshrn.u16  d0, q8, #2          \n" /* Round and divide by four. */
+            "   vrshrn.u16  d1, q9, #2          \n"
+            "   vst1.8      {d0,d1}, [%[d]]!    \n"
+            "   subs %[n], %[n], #16            \n"
+            "   bgt 1b                          \n"
+            : [d]"+r"(dst), [r0]"+r"(row0), [r1]"+r"(row1), [n]"+r"(bulk)
+            :: "cc", "memory", "q0", "q1", "q2", "q3", "q8", "q9", "q10", "q11");
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        unsigned int j = ((i / step) * step * 2) + (i % step);
+        dst[i] = (row0[j] + row0[j + step] + row1[j] + row1[j + step] + 2) >> 2;
+    }
+}
+
+void
+nv12_box2x(struct nv12_frame *dst, const struct nv12_frame *src)
+{
+    unsigned int width = (src->width / 2) & ~1;
+    unsigned int height = (src->height / 2) & ~1;
+    unsigned int y;
+
+    /* Rows are produced in order, so the output never overtakes the input when working in-place. */
+    for (y = 0; y < height; y++) {
+        const uint8_t *row = src->luma + (2 * y * src->stride);
+        nv12_box2x_row(dst->luma + (y * dst->stride), row, row + src->stride, width, 1);
+    }
+    for (y = 0; y < (height / 2); y++) {
+        const uint8_t *row = src->chroma + (2 * y * src->stride);
+        nv12_box2x_row(dst->chroma + (y * dst->stride), row, row + src->stride, width, 2);
+    }
+    dst->width = width;
+    dst->height = height;
+}
+
+/*===============================================
+ * Bilinear Filter
+ *===============================================
+ */
+/* Blend two rows together with a 7-bit weight for the second row. */
+static inline void
+nv12_blend_row(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, unsigned int count, unsigned int frac)
+{
+    unsigned int i;
+    if (frac == 0) {
+        memcpy(dst, row0, count);
+        return;
+    }
+#ifdef __ARM_NEON
+    {
+        unsigned int bulk = count & ~15;
+        count -= bulk;
+        if (bulk) {
+            asm volatile (
+                "   vdup.8      d30, %[w0]          \n"
+                "   vdup.8      d31, %[w1]          \n"
+                "1:                                 \n"
+                "   vld1.8      {q0}, [%[r0]]!      \n"
+                "   vld1.8      {q1}, [%[r1]]!      \n"
+                "   vmull.u8    q8, d0, d30         \n" /* Weight the first row. */
+                "   vmull.u8    q9, d1, d30         \n"
+                "   vmlal.u8    q8, d2, d31         \n" /* Accumulate the second row. */
+                "   vmlal.u8    q9, d3, d31         \n"
+                "   vrshrn.u16  d0, q8, #7          \n" /* Round and normalize. */
+                "   vrshrn.u16  d1, q9, #7          \n"
+                "   vst1.8      {q0}, [%[d]]!       \n"
+                "   subs %[n], %[n], #16            \n"
+                "   bgt 1b                          \n"
+                : [d]"+r"(dst), [r0]"+r"(row0), [r1]"+r"(row1), [n]"+r"(bulk)
+                : [w0]"r"(128 - frac), [w1]"r"(frac)
+                : "cc", "memory", "q0", "q1", "q8", "q9", "d30", "d31");
+        }
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        dst[i] = (row0[i] * (128 - frac) + row1[i] * frac + 64) >> 7;
+    }
+}
+
+/* Horizontally resample a blended row, with a step of one byte for luma or two for chroma. */
+static inline void
+nv12_resample_row(uint8_t *dst, const uint8_t *row, unsigned int swidth, unsigned int dwidth, unsigned int step)
+{
+    unsigned int xstep = (swidth << 16) / dwidth;
+    unsigned int last = swidth - 1;
+    int sx = (xstep / 2) - 0x8000;
+    unsigned int x, c;
+
+    for (x = 0; x < dwidth; x++, sx += xstep) {
+        unsigned int x0 = (sx < 0) ? 0 : (sx >> 16);
+        unsigned int x1 = (x0 < last) ? x0 + 1 : last;
+        unsigned int frac = (sx < 0) ? 0 : ((sx >> 9) & 0x7f);
+        for (c = 0; c < step; c++) {
+            *dst++ = (row[x0 * step + c] * (128 - frac) + row[x1 * step + c] * frac + 64) >> 7;
+        }
+    }
+}
+
+/* Compute the pair of source rows and the blending weight for a destination row. */
+static inline unsigned int
+nv12_bilinear_rows(unsigned int y, unsigned int sheight, unsigned int dheight, unsigned int *y0, unsigned int *y1)
+{
+    unsigned int ystep = (sheight << 16) / dheight;
+    int sy = (y * ystep) + (ystep / 2) - 0x8000;
+    if (sy < 0) sy = 0;
+    *y0 = sy >> 16;
+    *y1 = (*y0 < (sheight - 1)) ? (*y0 + 1) : *y0;
+    return (sy >> 9) & 0x7f;
+}
+
+void
+nv12_bilinear(const struct nv12_frame *dst, const struct nv12_frame *src, uint8_t *rowbuf)
+{
+    unsigned int y, y0, y1, frac;
+
+    for (y = 0; y < dst->height; y++) {
+        frac = nv12_bilinear_rows(y, src->height, dst->height, &y0, &y1);
+        nv12_blend_row(rowbuf, src->luma + y0 * src->stride, src->luma + y1 * src->stride, src->width, frac);
+        nv12_resample_row(dst->luma + y * dst->stride, rowbuf, src->width, dst->width, 1);
+    }
+    for (y = 0; y < (dst->height / 2); y++) {
+        frac = nv12_bilinear_rows(y, src->height / 2, dst->height / 2, &y0, &y1);
+        nv12_blend_row(rowbuf, src->chroma + y0 * src->stride, src->chroma + y1 * src->stride, src->width, frac);
+        nv12_resample_row(dst->chroma + y * dst->stride, rowbuf, src->width / 2, dst->width / 2, 2);
+    }
+}
+
+/*===============================================
+ * Frame Scaling
+ *===============================================
+ */
+void
+nv12_scale(struct nv12_frame *dst, const struct nv12_frame *src,
+           unsigned int width, unsigned int height, uint8_t *scratch)
+{
+    struct nv12_frame cur = *src;
+    unsigned int boxsize = ((src->width / 2) * (src->height / 2) * 3) / 2;
+
+    /* Never upscale, and keep the chroma subsampling simple. */
+    if (width > src->width) width = src->width;
+    if (height > src->height) height = src->height;
+    width = (width < 2) ? 2 : (width & ~1);
+    height = (height < 2) ? 2 : (height & ~1);
+    if ((width == src->width) && (height == src->height)) {
+        *dst = *src;
+        return;
+    }
+
+    /* Halve the frame with the box filter, then keep halving it in-place. */
+    if ((src->width >= (width * 2)) && (src->height >= (height * 2))) {
+        struct nv12_frame box;
+        box.luma = scratch;
+        box.chroma = scratch + (src->width / 2) * (src->height / 2);
+        box.stride = src->width / 2;
+        nv12_box2x(&box, &cur);
+        while ((box.width >= (width * 2)) && (box.height >= (height * 2))) {
+            nv12_box2x(&box, &box);
+        }
+        cur = box;
+    }
+    if ((cur.width == width) && (cur.height == height)) {
+        *dst = cur;
+        return;
+    }
+
+    /* Finish with the bilinear filter into the remaining scratch memory. */
+    nv12_frame_init(dst, scratch + boxsize, width, height);
+    nv12_bilinear(dst, &cur, scratch + boxsize + (width * height * 3) / 2);
+}
@@ -0,0 +1,79 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __NV12_SCALE_H
+#define __NV12_SCALE_H
+
+#include <stdint.h>
+
+/* A view of an NV12 frame, with the luma and chroma planes sharing a stride. */
+struct nv12_frame {
+    uint8_t         *luma;
+    uint8_t         *chroma;
+    unsigned int    width;
+    unsigned int    height;
+    unsigned int    stride;
+};
+
+/* Flags for nv12_transform(). */
+#define NV12_FLIP_HORIZ     (1 << 0)
+#define NV12_FLIP_VERT      (1 << 1)
+
+/* Black, for padding. */
+#define NV12_BLACK_LUMA     16
+#define NV12_BLACK_CHROMA   128
+
+/* Scratch memory required to scale a frame of the given source resolution. */
+#define NV12_SCALE_SCRATCH(_w_, _h_) ((_w_) * (_h_) * 2 + (_w_) * 2)
+
+/* Describe an NV12 frame stored contiguously in memory. */
+void nv12_frame_init(struct nv12_frame *frame, uint8_t *data, unsigned int width, unsigned int height);
+
+/*
+ * Crop a region out of a frame without copying, by pointing the view at the
+ * region within the source. The region is clamped to the source and aligned
+ * to the chroma subsampling.
+ */
+void nv12_crop(struct nv12_frame *dst, const struct nv12_frame *src,
+               unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+/*
+ * Copy a frame into a destination of the same width, optionally flipping it,
+ * and starting top rows down from the top of the destination. Any rows of the
+ * destination above or below the copied frame are filled with black. Each
+ * byte of the frame is read and written once. The top padding must be even.
+ */
+void nv12_transform(const struct nv12_frame *dst, const struct nv12_frame *src, unsigned int top, unsigned int flags);
+
+/* Scalar reference implementation, producing identical results to nv12_transform(). */
+void nv12_transform_ref(const struct nv12_frame *dst, const struct nv12_frame *src, unsigned int top, unsigned int flags);
+
+/* Downscale by exactly two using a 2x2 box filter. The destination may overlap the source if it shares its stride. */
+void nv12_box2x(struct nv12_frame *dst, const struct nv12_frame *src);
+
+/* Resample to the destination resolution using bilinear interpolation, with a rowbuf of at least src->width bytes. */
+void nv12_bilinear(const struct nv12_frame *dst, const struct nv12_frame *src, uint8_t *rowbuf);
+
+/*
+ * Downscale a frame to the requested resolution, halving it with the box
+ * filter for as long as possible before finishing with bilinear filtering.
+ * The output is written into scratch memory of NV12_SCALE_SCRATCH() bytes,
+ * unless no scaling was necessary, in which case dst is the source view.
+ */
+void nv12_scale(struct nv12_frame *dst, const struct nv12_frame *src,
+                unsigned int width, unsigned int height, uint8_t *scratch);
+
+#endif /* __NV12_SCALE_H */
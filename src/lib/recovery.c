@@ -0,0 +1,218 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "recovery.h"
+#include "tiff.h"
+
+/*===============================================
+ * Recovered Frame Headers
+ *===============================================
+ */
+void
+recovery_build_header(void *buf, unsigned int hres, unsigned int vres, unsigned int flags,
+                      const uint16_t *wbal, int tiff)
+{
+    uint8_t is_color = (flags & RECOVERY_FLAG_COLOR) != 0;
+    size_t f_size = (size_t)hres * vres * 2;
+    size_t out_size = (tiff && is_color) ? (f_size * 3) : f_size;
+    struct tiff_ifd ifd;
+
+    const uint8_t cfa_pattern[] = {1, 0, 2, 1}; /* GRBG Bayer pattern */
+    const uint16_t cfa_repeat[] = {2, 2};       /* 2x2 Bayer Pattern */
+    const uint8_t dng_version[] = {1, 4, 0, 0};
+    const uint8_t dng_compatible[] = {1, 0, 0, 0};
+    struct tiff_rational wbneutral[3] = {
+        {4096, wbal[0]},
+        {4096, wbal[1]},
+        {4096, wbal[2]}
+    };
+    const struct tiff_srational cmatrix[9] = {
+        /* CIE XYZ to LUX1310 color space conversion matrix. */
+        {17716, 10000}, {-5404, 10000}, {-1674, 10000},
+        {-2845, 10000}, {12494, 10000}, {247,   10000},
+        {-2300, 10000}, {6236,  10000}, {6471,  10000}
+    };
+    const struct tiff_srational mmatrix[3] = {
+        {0, 1}, {1, 1}, {0, 1},
+    };
+
+    /* TIFF Baseline Tags (color) */
+    const struct tiff_tag colortags[] = {
+        /* TIFF Baseline Tags */
+        TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
+        TIFF_TAG_LONG(256, hres),   /* ImageWidth */
+        TIFF_TAG_LONG(257, vres),   /* ImageLength */
+        TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
+        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
+        TIFF_TAG_SHORT(262, 32803),         /* PhotometricInterpretation = Color Filter Array */
+        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
+        TIFF_TAG_STRING(272, "Chronos 1.4"),        /* Model */
+        TIFF_TAG_LONG(273, RECOVERY_HEADER_SIZE),    /* StripOffsets */
+        TIFF_TAG_SHORT(274, 1),             /* Orientation = Zero/zero is Top Left */
+        TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
+        TIFF_TAG_LONG(278, vres),   /* RowsPerStrip */
+        TIFF_TAG_LONG(279, f_size),         /* StripByteCounts */
+        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
+        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
+    
+        /* TIFF-EP Tags */
+        TIFF_TAG(33421, TIFF_TYPE_SHORT, cfa_repeat),   /* CFARepeatPatternDim = 2x2 */
+        TIFF_TAG(33422, TIFF_TYPE_BYTE, cfa_pattern),   /* CFAPattern = GRBG */
+    
+        /* CinemaDNG Tags */
+        TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
+        TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
+        TIFF_TAG_STRING(50708, "Krontech Chronos 1.4"), /* UniqueCameraModel */
+        TIFF_TAG_SHORT(50711, 1),                       /* CFALayout = square */
+        TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
+        TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, cmatrix, sizeof(cmatrix)/sizeof(struct tiff_srational)),
+        TIFF_TAG_VECTOR(50728, TIFF_TYPE_RATIONAL, wbneutral, sizeof(wbneutral)/sizeof(struct tiff_rational)),
+        TIFF_TAG_SHORT(50778, 20),                      /* CalibrationIlluminant1 = D55 */
+    };
+
+    /* TIFF Baseline Tags (monochrome) */
+    const struct tiff_tag monotags[] = {
+        /* TIFF Baseline Tags */
+        TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
+        TIFF_TAG_LONG(256, hres),   /* ImageWidth */
+        TIFF_TAG_LONG(257, vres),   /* ImageLength */
+        TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
+        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
+        TIFF_TAG_SHORT(262, 34892),         /* PhotometricInterpretation = LinearRaw */
+        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
+        TIFF_TAG_STRING(272, "Chronos 1.4"),        /* Model */
+        TIFF_TAG_LONG(273, RECOVERY_HEADER_SIZE),    /* StripOffsets */
+        TIFF_TAG_SHORT(274, 1),             /* Orientation = Zero/zero is Top Left */
+        TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
+        TIFF_TAG_LONG(278, vres),   /* RowsPerStrip */
+        TIFF_TAG_LONG(279, f_size),         /* StripByteCounts */
+        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
+        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
+
+        /* CinemaDNG Tags */
+        TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
+        TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
+        TIFF_TAG_STRING(50708, "Krontech Chronos 1.4"), /* UniqueCameraModel */
+        TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
+        TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, mmatrix, sizeof(mmatrix)/sizeof(struct tiff_srational)),
+    };
+
+    /* TIFF Baseline Tags (demosaiced RGB or greyscale) */
+    const uint16_t tiff_bpp[] = {16, 16, 16};
+    const struct tiff_tag tifftags[] = {
+        TIFF_TAG_LONG(256, hres),   /* ImageWidth */
+        TIFF_TAG_LONG(257, vres),   /* ImageLength */
+        TIFF_TAG_VECTOR(258, TIFF_TYPE_SHORT, tiff_bpp, is_color ? 3 : 1),  /* BitsPerSample */
+        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
+        TIFF_TAG_SHORT(262, is_color ? 2 : 1),      /* PhotometricInterpretation = RGB or BlackIsZero */
+        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
+        TIFF_TAG_STRING(272, "Chronos 1.4"),        /* Model */
+        TIFF_TAG_LONG(273, RECOVERY_HEADER_SIZE),    /* StripOffsets */
+        TIFF_TAG_SHORT(274, 1),             /* Orientation = Zero/zero is Top Left */
+        TIFF_TAG_SHORT(277, is_color ? 3 : 1),      /* SamplesPerPixel */
+        TIFF_TAG_LONG(278, vres),   /* RowsPerStrip */
+        TIFF_TAG_LONG(279, out_size),       /* StripByteCounts */
+        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
+        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
+    };
+
+    if (tiff) {
+        ifd.tags = tifftags;
+        ifd.count = sizeof(tifftags)/sizeof(struct tiff_tag);
+    } else if (is_color) {
+        ifd.tags = colortags;
+        ifd.count = sizeof(colortags)/sizeof(struct tiff_tag);
+    } else {
+        ifd.tags = monotags;
+        ifd.count = sizeof(monotags)/sizeof(struct tiff_tag);
+    }
+    tiff_build_header(buf, RECOVERY_HEADER_SIZE, &ifd);
+}
+
+/*===============================================
+ * Raw Video Memory Archives
+ *===============================================
+ */
+static uint32_t
+recovery_align(uint32_t offset, uint32_t align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+void
+recovery_archive_layout(struct recovery_archive *archive)
+{
+    memcpy(archive->magic, RECOVERY_ARCHIVE_MAGIC, sizeof(archive->magic));
+    archive->version = RECOVERY_ARCHIVE_VERSION;
+    archive->frame_size = (archive->hres * archive->vres * 3) / 2;
+    archive->seg_offset = sizeof(struct recovery_archive);
+    archive->table_offset = archive->seg_offset + archive->nsegments * sizeof(struct recovery_archive_segment);
+    archive->cal_offset = archive->table_offset + archive->nframes * sizeof(struct recovery_archive_frame);
+    archive->data_offset = recovery_align(archive->cal_offset + archive->hres * sizeof(int16_t) * 3 + archive->frame_size,
+                                          RECOVERY_ARCHIVE_ALIGN);
+    archive->part_frames = 1;
+    if ((archive->data_offset + archive->frame_size) < RECOVERY_ARCHIVE_PART_SIZE) {
+        archive->part_frames = (RECOVERY_ARCHIVE_PART_SIZE - archive->data_offset) / archive->frame_size;
+    }
+}
+
+long
+recovery_archive_check(const struct recovery_archive *archive, off_t filesize)
+{
+    struct recovery_archive expect;
+    off_t frames;
+
+    if (filesize < (off_t)sizeof(struct recovery_archive)) return -1;
+    if (memcmp(archive->magic, RECOVERY_ARCHIVE_MAGIC, sizeof(archive->magic)) != 0) return -1;
+    if (archive->version != RECOVERY_ARCHIVE_VERSION) return -1;
+    if (!archive->hres || !archive->vres || (archive->hres & 1)) return -1;
+    if ((archive->hres > 0x10000) || (archive->vres > 0x10000)) return -1;
+
+    /* The sections must be where the layout puts them. */
+    memset(&expect, 0, sizeof(expect));
+    expect.hres = archive->hres;
+    expect.vres = archive->vres;
+    expect.nsegments = archive->nsegments;
+    expect.nframes = archive->nframes;
+    if ((archive->nsegments > 0x10000) || (archive->nframes > 0x1000000)) return -1;
+    recovery_archive_layout(&expect);
+    if ((archive->frame_size != expect.frame_size) ||
+        (archive->seg_offset != expect.seg_offset) ||
+        (archive->table_offset != expect.table_offset) ||
+        (archive->cal_offset != expect.cal_offset) ||
+        (archive->data_offset != expect.data_offset) ||
+        (archive->part_frames != expect.part_frames)) {
+        return -1;
+    }
+    if (filesize < (off_t)archive->data_offset) return -1;
+
+    /* A dump that was cut short still holds the frames that were written in full. */
+    frames = (filesize - archive->data_offset) / archive->frame_size;
+    if (frames > archive->part_frames) frames = archive->part_frames;
+    return (frames < archive->nframes) ? (long)frames : (long)archive->nframes;
+}
+
+void
+recovery_archive_part(char *buf, size_t len, const char *filename, unsigned long part)
+{
+    if (part) snprintf(buf, len, "%s.%lu", filename, part);
+    else snprintf(buf, len, "%s", filename);
+}
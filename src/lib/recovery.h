@@ -0,0 +1,104 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __RECOVERY_H
+#define __RECOVERY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Formats written by video memory recovery: the header of each recovered
+ * DNG or TIFF frame, and the archive of raw video memory that is dumped on
+ * the camera and converted into frames on a host.
+ */
+#define RECOVERY_HEADER_SIZE    1024    /* Also the offset to the image data. */
+
+#define RECOVERY_FLAG_COLOR     (1 << 0)
+#define RECOVERY_FLAG_3POINT    (1 << 1)
+
+/* Build the DNG, or 16-bit TIFF for demosaiced frames, header that is the same for every frame. */
+void recovery_build_header(void *buf, unsigned int hres, unsigned int vres, unsigned int flags,
+                           const uint16_t *wbal, int tiff);
+
+/*
+ * The archive is laid out as the header, the segment and frame tables, then
+ * the calibration data: the column gain, offset and curve registers with
+ * hres entries each, followed by the packed FPN frame. The frames follow as
+ * packed pixels, each frame_size bytes, starting from an aligned offset. All
+ * fields are little-endian, and the CRC-32C of each frame and of the FPN
+ * frame are of their packed pixels as they were read out of video RAM.
+ *
+ * Removable media is usually FAT32, which cannot hold a file of 4 GiB, so
+ * the archive is split into parts of part_frames whole frames each. The
+ * first part is RECOVERY_ARCHIVE_NAME, with everything up to data_offset in
+ * front of its frames, and the rest just hold frames, with the part number
+ * appended to the name as in "recovery.vram.1".
+ */
+#define RECOVERY_ARCHIVE_MAGIC      "CHRNVRAM"
+#define RECOVERY_ARCHIVE_VERSION    3
+#define RECOVERY_ARCHIVE_NAME       "recovery.vram"
+#define RECOVERY_ARCHIVE_ALIGN      4096
+#define RECOVERY_ARCHIVE_PART_SIZE  0xFFFFFFFFULL   /* Largest file that FAT32 can hold. */
+
+struct recovery_archive {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    flags;          /* RECOVERY_FLAG_xxx */
+    uint32_t    hres;
+    uint32_t    vres;
+    uint32_t    frame_size;     /* Bytes of packed pixels per frame. */
+    uint32_t    nsegments;
+    uint32_t    nframes;
+    uint32_t    seg_offset;
+    uint32_t    table_offset;
+    uint32_t    cal_offset;
+    uint32_t    data_offset;
+    int16_t     ccm[9];         /* Color correction matrix and white balance, 12 fractional bits. */
+    uint16_t    wbal[3];
+    uint32_t    fpn_crc32c;
+    uint32_t    part_frames;    /* Frames in each part of the archive. */
+    uint8_t     reserved[44];   /* Pads the header to 128 bytes. */
+};
+
+struct recovery_archive_segment {
+    uint32_t    segno;
+    uint32_t    start;          /* Address of the segment in video RAM. */
+    uint32_t    offset;         /* Offset (in frames) into the segment where recording starts. */
+    uint32_t    frameno;        /* Number of the first frame in the segment. */
+    uint32_t    nframes;
+};
+
+/* Frame flags. */
+#define RECOVERY_FRAME_BADREAD      (1 << 0)    /* The frame failed readout verification. */
+
+struct recovery_archive_frame {
+    uint32_t    frameno;
+    uint32_t    address;
+    uint32_t    crc32c;
+    uint32_t    flags;          /* RECOVERY_FRAME_xxx */
+};
+
+/* Fill in the offsets of the archive sections, from its resolution and number of segments and frames. */
+void recovery_archive_layout(struct recovery_archive *archive);
+
+/* Check an archive header, returning the number of whole frames in a first part of the given size, or -1 if invalid. */
+long recovery_archive_check(const struct recovery_archive *archive, off_t filesize);
+
+/* Build the filename of a part of the archive, from the filename of the first part. */
+void recovery_archive_part(char *buf, size_t len, const char *filename, unsigned long part);
+
+#endif /* __RECOVERY_H */
@@ -83,6 +83,7 @@ video_segment_delete(struct video_seglist *list, struct video_segment *seg)
     else list->head = seg->next;
     list->totalframes -= seg->nframes;
     list->totalsegs--;
+    if (list->release) list->release(list, seg);
     free(seg);
 }
 
@@ -138,6 +139,7 @@ video_segment_add(struct video_seglist *list, unsigned long start, unsigned long
         else if (last != end) seg->offset = ((last - start) / seg->framesz) + 1;
     }
     memset(&seg->metadata, 0, sizeof(seg->metadata));
+    seg->priv = NULL;
 
     /* Free any segments that would overlap. */
     while (list->head) {
@@ -39,6 +39,9 @@ struct video_segment {
         unsigned long interval;
         unsigned long timebase;
     } metadata;
+
+    /* Private data attached by the user of the segment list. */
+    void            *priv;
 };
 
 /* Combined video recording from multiple segments. */
@@ -55,6 +58,9 @@ struct video_seglist {
     /* Some total recording info. */
     unsigned long   totalsegs;      /* Total number of recording segments captured. */
     unsigned long   totalframes;    /* Total number of frames when in playback mode. */
+
+    /* Optional callback to release private data when a segment is removed. */
+    void            (*release)(struct video_seglist *list, struct video_segment *seg);
 };
 
 int video_segment_includes(struct video_segment *seg, unsigned long address);
@@ -0,0 +1,189 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm-frame.h"
+
+static uint32_t
+shm_frame_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static struct shm_frame *
+shm_frame_map(int fd, size_t mapsize)
+{
+    struct shm_frame *shm = malloc(sizeof(struct shm_frame));
+    if (!shm) {
+        return NULL;
+    }
+    shm->hdr = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm->hdr == MAP_FAILED) {
+        free(shm);
+        return NULL;
+    }
+    shm->mapsize = mapsize;
+    return shm;
+}
+
+/* Create, or re-use, a shared memory frame buffer as the producer. */
+struct shm_frame *
+shm_frame_create(const char *name, size_t size)
+{
+    size_t mapsize = sizeof(struct shm_frame_header) + size;
+    struct shm_frame *shm;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, mapsize) != 0) {
+        fprintf(stderr, "Failed to resize shared memory %s: %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    shm = shm_frame_map(fd, mapsize);
+    close(fd);
+    if (!shm) {
+        fprintf(stderr, "Failed to map shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    /*
+     * Keep the sequence number running if we are re-using an existing buffer,
+     * so that consumers from a previous run still see the following frames as
+     * being new. An odd sequence means we died part way through an update.
+     */
+    if ((shm->hdr->magic != SHM_FRAME_MAGIC) || (shm->hdr->size != size)) {
+        shm->hdr->magic = SHM_FRAME_MAGIC;
+        shm->hdr->size = size;
+        shm->hdr->sequence = 0;
+        shm->hdr->length = 0;
+        shm->hdr->heartbeat = 0;
+    }
+    else if (shm->hdr->sequence & 1) {
+        shm->hdr->sequence++;
+    }
+    return shm;
+}
+
+/* Open an existing shared memory frame buffer as a consumer. */
+struct shm_frame *
+shm_frame_open(const char *name)
+{
+    struct shm_frame *shm;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_size < sizeof(struct shm_frame_header))) {
+        close(fd);
+        return NULL;
+    }
+    shm = shm_frame_map(fd, st.st_size);
+    close(fd);
+    if (!shm) {
+        return NULL;
+    }
+    if ((shm->hdr->magic != SHM_FRAME_MAGIC) || ((shm->hdr->size + sizeof(struct shm_frame_header)) > shm->mapsize)) {
+        shm_frame_close(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+void
+shm_frame_close(struct shm_frame *shm)
+{
+    munmap(shm->hdr, shm->mapsize);
+    free(shm);
+}
+
+/* Overwrite the frame in shared memory. */
+void
+shm_frame_publish(struct shm_frame *shm, const void *data, size_t length, unsigned int width, unsigned int height)
+{
+    struct shm_frame_header *hdr = shm->hdr;
+    if (length > hdr->size) {
+        return;
+    }
+
+    hdr->sequence++;
+    __sync_synchronize();
+    memcpy(hdr->data, data, length);
+    hdr->length = length;
+    hdr->width = width;
+    hdr->height = height;
+    __sync_synchronize();
+    hdr->sequence++;
+}
+
+/* Check if a consumer has read from the buffer within the last timeout seconds. */
+int
+shm_frame_watched(struct shm_frame *shm, unsigned int timeout)
+{
+    uint32_t heartbeat = shm->hdr->heartbeat;
+    return heartbeat && ((shm_frame_now() - heartbeat) <= timeout);
+}
+
+ssize_t
+shm_frame_read(struct shm_frame *shm, uint32_t *sequence, void *buf, size_t maxlen,
+               unsigned int *width, unsigned int *height)
+{
+    struct shm_frame_header *hdr = shm->hdr;
+    uint32_t start, length;
+
+    /* Let the producer know we are still interested. */
+    hdr->heartbeat = shm_frame_now();
+
+    /* Nothing to do if the frame hasn't changed, or an update is in progress. */
+    start = hdr->sequence;
+    if ((start == *sequence) || (start & 1)) {
+        return 0;
+    }
+    __sync_synchronize();
+    length = hdr->length;
+    if (length > maxlen) {
+        return -1;
+    }
+    memcpy(buf, hdr->data, length);
+    if (width) *width = hdr->width;
+    if (height) *height = hdr->height;
+    __sync_synchronize();
+
+    /* If the frame was updated while we were copying it, try again later. */
+    if (hdr->sequence != start) {
+        return 0;
+    }
+    *sequence = start;
+    return length;
+}
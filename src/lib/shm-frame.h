@@ -0,0 +1,72 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __SHM_FRAME_H
+#define __SHM_FRAME_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* POSIX shared memory object holding the most recent live preview frame. */
+#define SHM_FRAME_PREVIEW       "/cam-preview"
+#define SHM_FRAME_PREVIEW_SIZE  (2 * 1024 * 1024)
+
+#define SHM_FRAME_MAGIC         0x4d46524d  /* "MRFM" */
+
+/*
+ * A single-producer latest-frame buffer in shared memory. The producer
+ * overwrites the frame in place, and the sequence number acts as a seqlock
+ * so that consumers can detect and discard frames that were torn by a
+ * concurrent update. The sequence number is odd while an update is in
+ * progress.
+ *
+ * Consumers also write a heartbeat timestamp into the header, which lets
+ * the producer skip encoding frames when nobody is watching.
+ */
+struct shm_frame_header {
+    uint32_t            magic;
+    uint32_t            size;       /* Maximum length of the frame data. */
+    volatile uint32_t   sequence;   /* Incremented before and after each update. */
+    volatile uint32_t   length;     /* Length of the frame data. */
+    volatile uint32_t   width;
+    volatile uint32_t   height;
+    volatile uint32_t   heartbeat;  /* CLOCK_MONOTONIC seconds of the last consumer read. */
+    uint32_t            reserved[9];
+    uint8_t             data[];
+};
+
+struct shm_frame {
+    struct shm_frame_header *hdr;
+    size_t                  mapsize;
+};
+
+struct shm_frame *shm_frame_create(const char *name, size_t size);
+struct shm_frame *shm_frame_open(const char *name);
+void shm_frame_close(struct shm_frame *shm);
+
+/* Producer API */
+void shm_frame_publish(struct shm_frame *shm, const void *data, size_t length, unsigned int width, unsigned int height);
+int shm_frame_watched(struct shm_frame *shm, unsigned int timeout);
+
+/*
+ * Consumer API: if a frame newer than *sequence is available, copy it into
+ * buf, update *sequence and return its length. Returns zero if no new frame
+ * is available, or -1 if the frame is larger than maxlen.
+ */
+ssize_t shm_frame_read(struct shm_frame *shm, uint32_t *sequence, void *buf, size_t maxlen,
+                       unsigned int *width, unsigned int *height);
+
+#endif /* __SHM_FRAME_H */
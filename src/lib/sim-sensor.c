@@ -0,0 +1,145 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "fpga-sensor.h"
+#include "utils.h"
+
+#define SIM_SENSOR_PIXEL_RATE       1400000000ULL   /* Pixels per second, similar to the LUX1310. */
+#define SIM_SENSOR_LINE_NSEC        1000            /* Exposure is quantized to whole lines. */
+#define SIM_SENSOR_MIN_EXPOSURE     1000
+#define SIM_SENSOR_EXPOSURE_DELAY   260
+#define SIM_SENSOR_NOISE            (2.0 / 4095)    /* Read noise, as a fraction of full scale. */
+
+/*
+ * A simulated image sensor, which accepts the same timing operations as a
+ * real sensor and renders luma frames of a scene at the configured exposure,
+ * for testing control loops away from the camera. The light falling on the
+ * scene is given as the fraction of full scale reached by a white surface
+ * in one millisecond, and the output is clipped, noisy and gamma encoded
+ * just like the live video.
+ */
+struct sim_sensor_private_data {
+    struct image_sensor sensor;
+    unsigned long long  exposure;
+    unsigned long long  period;
+    uint32_t            seed;
+};
+
+static int
+sim_sensor_constraints(struct image_sensor *sensor, const struct image_geometry *g, struct image_constraints *c)
+{
+    c->t_min_period = ((unsigned long long)g->hres * g->vres * 1000000000ULL) / SIM_SENSOR_PIXEL_RATE;
+    c->t_max_period = UINT32_MAX;
+    c->f_quantization = 100000000;
+    c->t_min_exposure = SIM_SENSOR_MIN_EXPOSURE;
+    c->t_max_shutter = 360;
+    c->t_exposure_delay = SIM_SENSOR_EXPOSURE_DELAY;
+    return 0;
+}
+
+static int
+sim_sensor_set_exposure(struct image_sensor *sensor, const struct image_geometry *g, unsigned long long nsec)
+{
+    struct sim_sensor_private_data *data = CONTAINER_OF(sensor, struct sim_sensor_private_data, sensor);
+    unsigned long long lines = (nsec + SIM_SENSOR_LINE_NSEC / 2) / SIM_SENSOR_LINE_NSEC;
+
+    data->exposure = lines ? lines * SIM_SENSOR_LINE_NSEC : SIM_SENSOR_MIN_EXPOSURE;
+    if (data->exposure > (data->period - SIM_SENSOR_EXPOSURE_DELAY)) {
+        data->exposure = data->period - SIM_SENSOR_EXPOSURE_DELAY;
+    }
+    return 0;
+}
+
+static int
+sim_sensor_set_period(struct image_sensor *sensor, const struct image_geometry *g, unsigned long long nsec)
+{
+    struct sim_sensor_private_data *data = CONTAINER_OF(sensor, struct sim_sensor_private_data, sensor);
+    data->period = nsec;
+    return 0;
+}
+
+static const struct image_sensor_ops sim_sensor_ops = {
+    .set_exposure = sim_sensor_set_exposure,
+    .set_period = sim_sensor_set_period,
+    .get_constraints = sim_sensor_constraints,
+};
+
+struct image_sensor *
+sim_sensor_init(unsigned long hres, unsigned long vres)
+{
+    struct sim_sensor_private_data *data = calloc(1, sizeof(struct sim_sensor_private_data));
+    if (!data) {
+        return NULL;
+    }
+    data->sensor.ops = &sim_sensor_ops;
+    data->sensor.name = "simulated";
+    data->sensor.mfr = "Kron Technologies";
+    data->sensor.format = FOURCC_CODE('Y', '1', '2', ' ');
+    data->sensor.h_max_res = hres;
+    data->sensor.v_max_res = vres;
+    data->sensor.h_min_res = 16;
+    data->sensor.v_min_res = 2;
+    data->sensor.h_increment = 16;
+    data->sensor.v_increment = 2;
+    data->sensor.pixel_rate = SIM_SENSOR_PIXEL_RATE;
+    data->sensor.adc_count = 16;
+
+    /* Start out at 1000fps with a 180 degree shutter. */
+    data->period = 1000000;
+    data->exposure = 500000;
+    data->seed = 1;
+    return &data->sensor;
+}
+
+unsigned long long
+sim_sensor_exposure(struct image_sensor *sensor)
+{
+    struct sim_sensor_private_data *data = CONTAINER_OF(sensor, struct sim_sensor_private_data, sensor);
+    return data->exposure;
+}
+
+/* Render a frame at the full resolution of the sensor from a map of the scene's reflectance. */
+void
+sim_sensor_render(struct image_sensor *sensor, uint8_t *luma, const uint8_t *scene, double light)
+{
+    struct sim_sensor_private_data *data = CONTAINER_OF(sensor, struct sim_sensor_private_data, sensor);
+    unsigned long i, count = sensor->h_max_res * sensor->v_max_res;
+    double gain = light * (data->exposure / 1000000.0) / 255.0;
+    uint8_t encode[4096];
+
+    for (i = 0; i < 4096; i++) {
+        encode[i] = (uint8_t)(pow(i / 4095.0, 1 / 2.2) * 255.0 + 0.5);
+    }
+    for (i = 0; i < count; i++) {
+        double signal, noise;
+
+        /* Approximate gaussian noise from the sum of two uniform samples. */
+        data->seed = data->seed * 1103515245 + 12345;
+        noise = (double)((data->seed >> 16) & 0x7fff) / 0x7fff;
+        data->seed = data->seed * 1103515245 + 12345;
+        noise += (double)((data->seed >> 16) & 0x7fff) / 0x7fff;
+
+        signal = scene[i] * gain + (noise - 1.0) * SIM_SENSOR_NOISE;
+        if (signal < 0) signal = 0;
+        if (signal > 1) signal = 1;
+        luma[i] = encode[(unsigned int)(signal * 4095)];
+    }
+}
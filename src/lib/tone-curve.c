@@ -0,0 +1,119 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdint.h>
+#include <math.h>
+
+#include "tone-curve.h"
+
+/* Encode a linear value in the range of 0 to 1. */
+static double
+tone_curve_encode(double v, unsigned int curve)
+{
+    switch (curve) {
+        case TONE_CURVE_SRGB:
+            return (v <= 0.0031308) ? (12.92 * v) : (1.055 * pow(v, 1 / 2.4) - 0.055);
+
+        case TONE_CURVE_REC709:
+            return (v < 0.018) ? (4.5 * v) : (1.099 * pow(v, 0.45) - 0.099);
+
+        case TONE_CURVE_LOG:
+            return log2(v * (TONE_CURVE_SIZE - 1) + 1) / TONE_CURVE_BITS;
+
+        case TONE_CURVE_LINEAR:
+        default:
+            return v;
+    }
+}
+
+void
+tone_curve_init(uint8_t *lut, unsigned int curve)
+{
+    unsigned int i;
+    for (i = 0; i < TONE_CURVE_SIZE; i++) {
+        double y = tone_curve_encode((double)i / (TONE_CURVE_SIZE - 1), curve);
+        if (y < 0) y = 0;
+        if (y > 1) y = 1;
+        lut[i] = (uint8_t)(y * 255.0 + 0.5);
+    }
+}
+
+/*
+ * A 4096-entry table is far too big for vtbl, which tops out at 32 bytes,
+ * so the lookups themselves have to be done with ARM loads. NEON does the
+ * shifting and clamping of 16 samples at a time into a small index buffer,
+ * which leaves the ARM side with nothing but a load and store per sample.
+ */
+void
+tone_map(uint8_t *dst, const uint16_t *src, unsigned long count, unsigned int shift, const uint8_t *lut)
+{
+    unsigned long i;
+#ifdef __ARM_NEON
+    uint16_t idx[16] __attribute__((aligned(16)));
+    unsigned long bulk = count & ~15UL;
+
+    for (i = 0; i < bulk; i += 16) {
+        const uint16_t *s = src + i;
+        uint8_t *d = dst + i;
+        asm volatile (
+            "   pld         [%[s], #128]        \n"
+            "   vdup.16     q14, %[shift]       \n" /* Negative shift counts shift right. */
+            "   vdup.16     q15, %[max]         \n"
+            "   vld1.16     {q0,q1}, [%[s]]     \n"
+            "   vshl.u16    q0, q0, q14         \n"
+            "   vshl.u16    q1, q1, q14         \n"
+            "   vmin.u16    q0, q0, q15         \n"
+            "   vmin.u16    q1, q1, q15         \n"
+            "   vst1.16     {q0,q1}, [%[i]:128] \n"
+            :: [s]"r"(s), [i]"r"(idx), [shift]"r"(-(int)shift), [max]"r"(TONE_CURVE_SIZE - 1)
+            : "memory", "q0", "q1", "q14", "q15");
+        d[0] = lut[idx[0]];   d[1] = lut[idx[1]];   d[2] = lut[idx[2]];   d[3] = lut[idx[3]];
+        d[4] = lut[idx[4]];   d[5] = lut[idx[5]];   d[6] = lut[idx[6]];   d[7] = lut[idx[7]];
+        d[8] = lut[idx[8]];   d[9] = lut[idx[9]];   d[10] = lut[idx[10]]; d[11] = lut[idx[11]];
+        d[12] = lut[idx[12]]; d[13] = lut[idx[13]]; d[14] = lut[idx[14]]; d[15] = lut[idx[15]];
+    }
+    dst += bulk;
+    src += bulk;
+    count -= bulk;
+#else
+    /* Portable fallback, unrolled to keep a few lookups in flight. */
+    for (; count >= 4; count -= 4, src += 4, dst += 4) {
+        unsigned int a = src[0] >> shift;
+        unsigned int b = src[1] >> shift;
+        unsigned int c = src[2] >> shift;
+        unsigned int d = src[3] >> shift;
+        dst[0] = lut[(a < TONE_CURVE_SIZE) ? a : TONE_CURVE_SIZE - 1];
+        dst[1] = lut[(b < TONE_CURVE_SIZE) ? b : TONE_CURVE_SIZE - 1];
+        dst[2] = lut[(c < TONE_CURVE_SIZE) ? c : TONE_CURVE_SIZE - 1];
+        dst[3] = lut[(d < TONE_CURVE_SIZE) ? d : TONE_CURVE_SIZE - 1];
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        unsigned int v = src[i] >> shift;
+        dst[i] = lut[(v < TONE_CURVE_SIZE) ? v : TONE_CURVE_SIZE - 1];
+    }
+}
+
+void
+tone_map_ref(uint8_t *dst, const uint16_t *src, unsigned long count, unsigned int shift, const uint8_t *lut)
+{
+    unsigned long i;
+    for (i = 0; i < count; i++) {
+        unsigned int v = src[i] >> shift;
+        if (v > (TONE_CURVE_SIZE - 1)) v = TONE_CURVE_SIZE - 1;
+        dst[i] = lut[v];
+    }
+}
@@ -0,0 +1,45 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#ifndef __TONE_CURVE_H
+#define __TONE_CURVE_H
+
+#include <stdint.h>
+
+/* Built-in tone curves. */
+#define TONE_CURVE_LINEAR   0
+#define TONE_CURVE_SRGB     1   /* IEC 61966-2-1 transfer function. */
+#define TONE_CURVE_REC709   2   /* ITU-R BT.709 transfer function. */
+#define TONE_CURVE_LOG      3   /* Equal code values for each of the 12 stops. */
+
+#define TONE_CURVE_BITS     12
+#define TONE_CURVE_SIZE     (1 << TONE_CURVE_BITS)
+
+/* Fill a lookup table of TONE_CURVE_SIZE entries mapping linear 12-bit samples to 8-bit output. */
+void tone_curve_init(uint8_t *lut, unsigned int curve);
+
+/*
+ * Map samples through a tone curve lookup table, first shifting them right
+ * by the given number of bits, which is zero for 12-bit samples or four for
+ * 12-bit samples left-aligned in 16 bits. Anything larger than 12 bits after
+ * the shift is clamped to white.
+ */
+void tone_map(uint8_t *dst, const uint16_t *src, unsigned long count, unsigned int shift, const uint8_t *lut);
+
+/* Scalar reference implementation, producing identical results to tone_map(). */
+void tone_map_ref(uint8_t *dst, const uint16_t *src, unsigned long count, unsigned int shift, const uint8_t *lut);
+
+#endif /* __TONE_CURVE_H */
@@ -18,6 +18,7 @@
 #define _CLI_UTILS_H
 
 #include <unistd.h>
+#include <time.h>
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(_x_) (sizeof(_x_)/sizeof((_x_)[0]))
@@ -103,6 +104,15 @@ gpio_write(int fd, int val)
     return write(fd, val ? "1" : "0", 1);
 } /* gpio_write */
 
+/* Read a clock, such as CLOCK_MONOTONIC, in microseconds. */
+static inline unsigned long long
+clock_usec(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* clock_usec */
+
 #ifdef __arm__
 void memcpy_neon(void *dest, const void *src, size_t len);
 void memcpy_bgr2rgb(void *dest, const void *src, size_t len);
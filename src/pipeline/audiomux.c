@@ -30,35 +30,24 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 #include <time.h>
 #include <sys/stat.h>
 #include "pipeline.h"
+#include "gpio-event.h"
+#include "utils.h"
 
-static int
+static struct gpio_event_src *
 audiomux_setup_input(int gpionum)
 {
-    FILE *fp;
     char path[PATH_MAX];
 
-    /* Export the GPIO, if not already done. */
-    fp = fopen("/sys/class/gpio/export", "w");
-    if (fp) {
-        fprintf(fp, "%d", gpionum);
-        fclose(fp);
-    }
-
-    /* Configure for input. */
-    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/direction", gpionum);
-    fp = fopen(path, "w");
-    if (fp) {
-        fprintf(fp, "in");
-        fclose(fp);
-    }
-
-    /* And finally, open the GPIO file descriptor */
+    /* Watch for changes in either direction on the jack detect GPIO. */
     snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", gpionum);
-    return open(path, O_RDONLY);
+    return gpio_event_open(path, GPIO_EDGE_BOTH);
 }
 
 static int
@@ -93,74 +82,112 @@ audiomux_setup_output(int gpionum, int val)
     return open(path, O_WRONLY | O_NONBLOCK);
 }
 
+static void
+audiomux_select_input(int line_in_val)
+{
+    if (line_in_val) {
+        fprintf(stderr, "Selecting input Mic3\n");
+        system("amixer sset 'Right PGA Mixer Line1L' off");
+        system("amixer sset 'Right PGA Mixer Line1R' off");
+        system("amixer sset 'Right PGA Mixer Mic3L' on");
+        system("amixer sset 'Right PGA Mixer Mic3R' on");
+    } else {
+        fprintf(stderr, "Selecting input Line1\n");
+        system("amixer sset 'Right PGA Mixer Line1L' on");
+        system("amixer sset 'Right PGA Mixer Line1R' on");
+        system("amixer sset 'Right PGA Mixer Mic3L' off");
+        system("amixer sset 'Right PGA Mixer Mic3R' off");
+    }
+}
+
+static void
+audiomux_select_output(int line_out_val)
+{
+    if (line_out_val) {
+        fprintf(stderr, "Selecting output HPLCOM\n");
+        system("amixer sset 'Right HPCOM Mux' 'differential of HPLCOM'");
+    } else {
+        fprintf(stderr, "Selecting output HPLROUT\n");
+        system("amixer sset 'Right HPCOM Mux' 'differential of HPROUT'");
+    }
+}
+
+/* Audio jack detection GPIOs, and how to route the audio when they change. */
+#define AUDIOMUX_NUM_JACKS  2
+
+static const struct {
+    int         gpio;
+    const char  *name;
+    void        (*select)(int value);
+} audiomux_jacks[AUDIOMUX_NUM_JACKS] = {
+    {19,    "line-in",  audiomux_select_input},
+    {9,     "line-out", audiomux_select_output},
+};
+
 static void *
 audiomux_thread(void *arg)
 {
     struct pipeline_state *state = arg;
     /* GPIO File descriptors */ 
     int mic_bias_fd = audiomux_setup_output(15, 1);
-    int line_in_fd = audiomux_setup_input(19);
-    int line_out_fd = audiomux_setup_input(9);
+    struct gpio_event_src *jacks[AUDIOMUX_NUM_JACKS];
+    struct pollfd pfd[AUDIOMUX_NUM_JACKS];
+    int polled[AUDIOMUX_NUM_JACKS];
+    int npoll = 0;
+    int i;
     /* GPIO Values */
-    int line_in_val = -1;
-    int line_out_val = -1;
+    int mic_bias_val = 1;
+
+    /*
+     * Apply the initial jack state, and poll whichever jacks could be opened.
+     * A missing jack only stops its own routing, the mic-bias still follows
+     * the playback state.
+     */
+    for (i = 0; i < AUDIOMUX_NUM_JACKS; i++) {
+        jacks[i] = audiomux_setup_input(audiomux_jacks[i].gpio);
+        if (!jacks[i]) {
+            fprintf(stderr, "Failed to setup audio %s jack GPIO: %s\n", audiomux_jacks[i].name, strerror(errno));
+            continue;
+        }
+        audiomux_jacks[i].select(gpio_event_value(jacks[i]));
+        pfd[npoll].fd = gpio_event_fd(jacks[i]);
+        pfd[npoll].events = gpio_event_pollmask(jacks[i]);
+        polled[npoll++] = i;
+    }
 
-    /* TODO: Make this use the poll system call to reduce CPU usage. */
     while (1) {
-        char buf[2];
-
-        /* Get the line-in value */
-        lseek(line_in_fd, 0, SEEK_SET);
-        read(line_in_fd, buf, sizeof(buf));
-        if ((buf[0] - '0') != line_in_val) {
-            /* Line-in value has changed. */
-            line_in_val = buf[0] - '0';
-            if (line_in_val) {
-                fprintf(stderr, "Selecting input Mic3\n");
-                system("amixer sset 'Right PGA Mixer Line1L' off");
-                system("amixer sset 'Right PGA Mixer Line1R' off");
-                system("amixer sset 'Right PGA Mixer Mic3L' on");
-                system("amixer sset 'Right PGA Mixer Mic3R' on");
-            } else {
-                fprintf(stderr, "Selecting input Line1\n");
-                system("amixer sset 'Right PGA Mixer Line1L' on");
-                system("amixer sset 'Right PGA Mixer Line1R' on");
-                system("amixer sset 'Right PGA Mixer Mic3L' off");
-                system("amixer sset 'Right PGA Mixer Mic3R' off");
-            }
+        struct gpio_event ev;
+        int val;
+
+        /* 1 frame, at 60 fps should keep the mic-bias synched to +/- 1 frame */
+        int ready = poll(pfd, npoll, 1000 / LIVE_MAX_FRAMERATE);
+        if ((ready < 0) && (errno != EINTR)) {
+            fprintf(stderr, "Audio jack poll failed: %s\n", strerror(errno));
+            break;
         }
 
-        /* Get the line-out value. */
-        lseek(line_out_fd, 0, SEEK_SET);
-        read(line_out_fd, buf, sizeof(buf));
-        if ((buf[0] - '0') != line_out_val) {
-            /* Line-Out value has changed. */
-            line_out_val = buf[0] - '0';
-            if (line_out_val) {
-                fprintf(stderr, "Selecting output HPLCOM\n");
-                system("amixer sset 'Right HPCOM Mux' 'differential of HPLCOM'");
-            } else {
-                fprintf(stderr, "Selecting output HPLROUT\n");
-                system("amixer sset 'Right HPCOM Mux' 'differential of HPROUT'");
+        /* Reroute the audio for any jacks that have changed. */
+        for (i = 0; (ready > 0) && (i < npoll); i++) {
+            struct gpio_event_src *src = jacks[polled[i]];
+            if (!pfd[i].revents) continue;
+            val = gpio_event_value(src);
+            if ((gpio_event_read(src, &ev) > 0) && (ev.value != val)) {
+                audiomux_jacks[polled[i]].select(ev.value);
             }
         }
 
-        /* Turn on the mic-bias if we are recording via line-in. */
-        if (state->playstate == PLAYBACK_STATE_LIVE) {
-            /* Turn on mic biasing if we are not capturing line-in */
-            lseek(line_in_fd, 0, SEEK_SET);
-            write(mic_bias_fd, "1", 1);
-        }
-        /* Otherwise, Turn off the mic-bias to reduce input noise */
-        else {
-            lseek(line_in_fd, 0, SEEK_SET);
-            write(mic_bias_fd, "0", 1);
+        /* Turn on mic biasing in live display, otherwise turn it off to reduce input noise. */
+        val = (state->playstate == PLAYBACK_STATE_LIVE);
+        if (val != mic_bias_val) {
+            gpio_write(mic_bias_fd, val);
+            mic_bias_val = val;
         }
-
-        /* 1 frame, at 60 fps should keep us synched to +/- 1 frame */
-        usleep(1000000 / LIVE_MAX_FRAMERATE);
     }
 
+    for (i = 0; i < AUDIOMUX_NUM_JACKS; i++) {
+        gpio_event_close(jacks[i]);
+    }
+    close(mic_bias_fd);
     return NULL;
 }
 
@@ -37,6 +37,7 @@
 #include <linux/ti81xxfb.h>
 
 #include "fpga.h"
+#include "fpga-sensor.h"
 #include "i2c.h"
 #include "pipeline.h"
 
@@ -69,6 +70,63 @@ cam_pipeline_restart(struct pipeline_state *state)
     cam_pipeline_signal(state, SIGHUP);
 }
 
+/*
+ * Create the element that crops, pads and flips the video from the source.
+ * Flipping always needs the neonxform element, which also does any padding
+ * in the same pass over the frame, otherwise the neoncrop element is enough
+ * and passes the video through untouched when there is nothing to do.
+ */
+static GstElement *
+cam_pipeline_xform(struct pipeline_state *state)
+{
+    GstElement *xform;
+
+    if (state->videoflip == GST_NEON_FLIP_METHOD_IDENTITY) {
+        return gst_element_factory_make("neoncrop", "vfcc-crop");
+    }
+    xform = gst_element_factory_make("neonxform", "vfcc-crop");
+    if (xform) {
+        g_object_set(G_OBJECT(xform), "method", state->videoflip, NULL);
+    }
+    return xform;
+}
+
+/* Apply a change to the video flip, restarting the pipeline if the running one can't do it. */
+void
+cam_pipeline_reflip(struct pipeline_state *state)
+{
+    GstElement *xform = NULL;
+
+    if (state->pipeline) {
+        xform = gst_bin_get_by_name(GST_BIN(state->pipeline), "vfcc-crop");
+    }
+    if (xform && GST_IS_NEON_XFORM(xform)) {
+        g_object_set(G_OBJECT(xform), "method", state->videoflip, NULL);
+    }
+    else if (!PIPELINE_IS_SAVING(state->runmode)) {
+        cam_pipeline_restart(state);
+    }
+    if (xform) gst_object_unref(xform);
+}
+
+/*
+ * Create a queue for a branch of the tee that must never hold up the rest of
+ * the pipeline. Only the most recent frame is kept, and older ones are leaked
+ * while the branch is busy.
+ */
+GstElement *
+cam_leaky_queue(const char *name)
+{
+    GstElement *queue = gst_element_factory_make("queue", name);
+    if (queue) {
+        g_object_set(G_OBJECT(queue), "max-size-buffers", (guint)1, NULL);
+        g_object_set(G_OBJECT(queue), "max-size-bytes", (guint)0, NULL);
+        g_object_set(G_OBJECT(queue), "max-size-time", (guint64)0, NULL);
+        g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
+    }
+    return queue;
+}
+
 /* Launch a Gstreamer pipeline to run the camera live video stream */
 static GstElement *
 cam_pipeline(struct pipeline_state *state, struct pipeline_args *args)
@@ -91,7 +149,7 @@ cam_pipeline(struct pipeline_state *state, struct pipeline_args *args)
     /* Build the GStreamer Pipeline */
     state->pipeline = gst_pipeline_new ("pipeline");
     state->vidsrc   = gst_element_factory_make("omx_camera",  "vfcc-source");
-    crop            = gst_element_factory_make("neoncrop",    "vfcc-crop");
+    crop            = cam_pipeline_xform(state);
     tee             = gst_element_factory_make("tee",         "tee");
     if (!state->pipeline || !state->vidsrc || !crop || !tee) {
         return NULL;
@@ -141,6 +199,30 @@ cam_pipeline(struct pipeline_state *state, struct pipeline_args *args)
     gst_pad_link(tpad, sinkpad);
     gst_object_unref(sinkpad);
 
+    /* Create the shared memory frame ring, unless it has been disabled. */
+    sinkpad = cam_frame_ring(state);
+    if (sinkpad) {
+        tpad = gst_element_get_request_pad(tee, "src%d");
+        gst_pad_link(tpad, sinkpad);
+        gst_object_unref(sinkpad);
+    }
+
+    /* Gather live image statistics, unless they have been disabled. */
+    sinkpad = cam_stats(state);
+    if (sinkpad) {
+        tpad = gst_element_get_request_pad(tee, "src%d");
+        gst_pad_link(tpad, sinkpad);
+        gst_object_unref(sinkpad);
+    }
+
+    /* Watch for motion, if the motion trigger is enabled. */
+    sinkpad = cam_motion(state);
+    if (sinkpad) {
+        tpad = gst_element_get_request_pad(tee, "src%d");
+        gst_pad_link(tpad, sinkpad);
+        gst_object_unref(sinkpad);
+    }
+
     /* Create the LCD sink and link it into the pipeline. */
     sinkpad = cam_lcd_sink(state, &state->config);
     if (!sinkpad) {
@@ -300,7 +382,7 @@ cam_filesave(struct pipeline_state *state, struct pipeline_args *args)
     /* Build the GStreamer Pipeline */
     state->pipeline = gst_pipeline_new ("pipeline");
     state->vidsrc   = gst_element_factory_make("omx_camera",  "vfcc-source");
-    crop            = gst_element_factory_make("neoncrop",    "vfcc-crop");
+    crop            = cam_pipeline_xform(state);
     tee             = gst_element_factory_make("tee",         "tee");
     if (!state->pipeline || !state->vidsrc || !tee || !crop) {
         return NULL;
@@ -559,6 +641,16 @@ cam_bus_watch(GstBus *bus, GstMessage *msg, gpointer data)
             /* Silently ignore these messages. */
             break;
 
+        case GST_MESSAGE_ELEMENT:
+            if (gst_structure_has_name(gst_message_get_structure(msg), "neonstats")) {
+                cam_stats_update(state, GST_ELEMENT(GST_MESSAGE_SRC(msg)));
+            } else if (gst_structure_has_name(gst_message_get_structure(msg), "neonmotion")) {
+                cam_motion_update(state, GST_ELEMENT(GST_MESSAGE_SRC(msg)), gst_message_get_structure(msg));
+            } else {
+                fprintf(stderr, "GST message received: %s\n", GST_MESSAGE_TYPE_NAME(msg));
+            }
+            break;
+
         default:
             fprintf(stderr, "GST message received: %s\n", GST_MESSAGE_TYPE_NAME(msg));
             break;
@@ -574,6 +666,21 @@ static void cam_foreach_eos(gpointer element, gpointer user_data)
     gst_element_send_event(GST_ELEMENT(element), event);
 }
 
+/* Report the copy tax paid by each NEON copy element in the pipeline. */
+static void cam_foreach_copy_report(gpointer element, gpointer user_data)
+{
+    if (GST_IS_NEON(element)) {
+        guint64 copies, skipped, bytes, allocations;
+        gchar *name = gst_element_get_name(GST_ELEMENT(element));
+        g_object_get(G_OBJECT(element), "copies", &copies, "skipped", &skipped,
+                     "bytes", &bytes, "allocations", &allocations, NULL);
+        fprintf(stderr, "%s: %llu buffers copied, %llu passed through, %llu bytes copied, %llu buffers allocated\n", name,
+                (unsigned long long)copies, (unsigned long long)skipped,
+                (unsigned long long)bytes, (unsigned long long)allocations);
+        g_free(name);
+    }
+}
+
 /*===============================================
  * Signal Handlers
  *===============================================
@@ -755,6 +862,15 @@ main(int argc, char * argv[])
     if (!gst_element_register(NULL, "neonflip", GST_RANK_NONE, GST_TYPE_NEON_FLIP)) {
         fprintf(stderr, "Failed to register Gstreamer NEON flip element.\n");
     }
+    if (!gst_element_register(NULL, "neonxform", GST_RANK_NONE, GST_TYPE_NEON_XFORM)) {
+        fprintf(stderr, "Failed to register Gstreamer NEON transform element.\n");
+    }
+    if (!gst_element_register(NULL, "neonstats", GST_RANK_NONE, GST_TYPE_NEON_STATS)) {
+        fprintf(stderr, "Failed to register Gstreamer NEON statistics element.\n");
+    }
+    if (!gst_element_register(NULL, "neonmotion", GST_RANK_NONE, GST_TYPE_NEON_MOTION)) {
+        fprintf(stderr, "Failed to register Gstreamer NEON motion detection element.\n");
+    }
     if (!gst_element_register(NULL, "gifsrc", GST_RANK_NONE, GST_TYPE_GIF_SRC)) {
         fprintf(stderr, "Failed to register Gstreamer GIF source element.\n");
     }
@@ -771,6 +887,10 @@ main(int argc, char * argv[])
         return -1;
     }
 
+    /* Attach to the image sensor for auto exposure, leaving its configuration to the control process. */
+    state->sensor = lux1310_attach(state->fpga, state->iops);
+    auto_exposure_init(&state->ae);
+
     /* Launch a separate thread to run the GLib mainloop */
     pthread_create(&state->mainthread, NULL, mainloop_thread, state);
 
@@ -836,7 +956,9 @@ main(int argc, char * argv[])
     state->rtsp = rtsp_server_launch(state);
     hdmi_hotplug_launch(state);
     playback_init(state);
+    proxy_init(state);
     audiomux_init(state);
+    framering_launch(state);
 
     /* Load JSON configuration, if present. */
     dbus_init_params(state, FALSE);
@@ -854,6 +976,7 @@ main(int argc, char * argv[])
         /* Launch the pipeline. */
         struct pipeline_args args;
         GstState current, pending;
+        GstIterator *iter;
         GstEvent *event;
         GstBus *bus;
         guint watchid;
@@ -945,6 +1068,9 @@ main(int argc, char * argv[])
         }
 
         /* Garbage collect the pipeline. */
+        iter = gst_bin_iterate_recurse(GST_BIN(state->pipeline));
+        gst_iterator_foreach(iter, cam_foreach_copy_report, NULL);
+        gst_iterator_free(iter);
         state->vidsrc = NULL;
         rtsp_server_clear_hook(state->rtsp);
         gst_element_set_state(state->pipeline, GST_STATE_READY);
@@ -981,6 +1107,8 @@ main(int argc, char * argv[])
     fprintf(stderr, "Exiting the pipeline...\n");
     state->args.liverecord = FALSE;
     audiomux_cleanup(state);
+    framering_cleanup(state);
+    proxy_cleanup(state);
     playback_cleanup(state);
     rtsp_server_cleanup(state->rtsp);
     dbus_service_cleanup(state->video);
@@ -27,6 +27,8 @@
 
 #include "pipeline.h"
 #include "utils.h"
+#include "tone-curve.h"
+#include "gst/gstneon.h"
 #include "dbus-json.h"
 #include "api/cam-rpc.h"
 
@@ -263,6 +265,35 @@ static const struct pipeline_param cam_video_zoom_param = {
     .setter = cam_video_zoom_setter,
 };
 
+struct enumval video_flip_methods[] = {
+    {GST_NEON_FLIP_METHOD_IDENTITY, "none"},
+    {GST_NEON_FLIP_METHOD_HORIZ,    "horizontal"},
+    {GST_NEON_FLIP_METHOD_VERT,     "vertical"},
+    {GST_NEON_FLIP_METHOD_180,      "rotate180"},
+    { 0, NULL }
+};
+
+static gboolean
+cam_video_flip_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    int flip = g_value_get_int(val);
+    if (flip != state->videoflip) {
+        state->videoflip = flip;
+        cam_pipeline_reflip(state);
+    }
+    return TRUE;
+}
+static const struct pipeline_param cam_video_flip_param = {
+    .name = "videoFlip",
+    .doc = "Flip to apply to the live video and H.264 recordings, raw recordings are always saved as they were captured.",
+    .type = G_TYPE_ENUM,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, videoflip),
+    .defval = GST_NEON_FLIP_METHOD_IDENTITY,
+    .extra = video_flip_methods,
+    .setter = cam_video_flip_setter,
+};
+
 static gboolean
 cam_overlay_enable_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
 {
@@ -384,6 +415,642 @@ static const struct pipeline_param cam_playback_length_param = {
     .setter = cam_generic_setter,
 };
 
+static gboolean
+cam_playback_priority_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    long prio = g_value_get_long(val);
+    if (prio < 0) prio = 0;
+    if (playback_set_priority(state, prio) != 0) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "unable to set playback priority: %s", strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+static const struct pipeline_param cam_playback_priority_param = {
+    .name = "playbackPriority",
+    .doc = "Real-time SCHED_FIFO priority of the playback thread, or zero to use the default scheduler.",
+    .type = G_TYPE_LONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, playprio),
+    .setter = cam_playback_priority_setter,
+};
+
+static gboolean
+cam_playback_memlock_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    gboolean enable = (g_value_get_boolean(val) != FALSE);
+    if (enable == state->memlock) {
+        return TRUE;
+    }
+    if (playback_set_memlock(state, enable) != 0) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "unable to lock memory: %s", strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+static const struct pipeline_param cam_playback_memlock_param = {
+    .name = "playbackMemLock",
+    .doc = "Lock the pipeline memory to prevent page faults from delaying playback.",
+    .type = G_TYPE_BOOLEAN,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, memlock),
+    .setter = cam_playback_memlock_setter,
+};
+static const struct pipeline_param cam_playback_deadline_param = {
+    .name = "playbackDeadline",
+    .doc = "Latency budget in microseconds from the frame sync edge to the playback thread waking, or zero for half of a frame.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, deadline),
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_playback_missed_param = {
+    .name = "playbackMissedDeadlines",
+    .doc = "Number of frame sync edges that were handled after the deadline, write zero to reset.",
+    .type = G_TYPE_ULONG,
+    .flags = 0,
+    .offset = offsetof(struct pipeline_state, missed),
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_playback_latency_param = {
+    .name = "playbackLatency",
+    .doc = "Latency in microseconds from the most recent frame sync edge to the playback thread waking, estimated from the frame period when the GPIO has no edge timestamps.",
+    .type = G_TYPE_ULONG,
+    .flags = 0,
+    .offset = offsetof(struct pipeline_state, latency),
+};
+static const struct pipeline_param cam_playback_max_latency_param = {
+    .name = "playbackMaxLatency",
+    .doc = "Worst case latency in microseconds from a frame sync edge to the playback thread waking, write zero to reset.",
+    .type = G_TYPE_ULONG,
+    .flags = 0,
+    .offset = offsetof(struct pipeline_state, maxlatency),
+    .setter = cam_generic_setter,
+};
+
+static gboolean
+cam_proxy_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long *pvalue = (unsigned long *)(((unsigned char *)state) + p->offset);
+    unsigned long value = g_value_get_ulong(val);
+    if (value == *pvalue) {
+        return TRUE;
+    }
+    /* Changing the proxy geometry invalidates the whole cache. */
+    *pvalue = value;
+    proxy_flush(state);
+    return TRUE;
+}
+static const struct pipeline_param cam_proxy_interval_param = {
+    .name = "proxyInterval",
+    .doc = "Generate a scrubbing proxy for every Nth recorded frame, or zero to disable.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, proxyinterval),
+    .defval = 16,
+    .setter = cam_proxy_setter,
+};
+static const struct pipeline_param cam_proxy_width_param = {
+    .name = "proxyWidth",
+    .doc = "Maximum horizontal resolution of the scrubbing proxy frames.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, proxywidth),
+    .defval = 160,
+    .setter = cam_proxy_setter,
+};
+struct enumval tone_curves[] = {
+    {TONE_CURVE_LINEAR, "linear"},
+    {TONE_CURVE_SRGB,   "srgb"},
+    {TONE_CURVE_REC709, "rec709"},
+    {TONE_CURVE_LOG,    "log"},
+    { 0, NULL }
+};
+
+static gboolean
+cam_tone_curve_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    int curve = g_value_get_int(val);
+    if (curve != state->tonecurve) {
+        /* Proxies rendered with the old curve are no longer any good. */
+        state->tonecurve = curve;
+        proxy_flush(state);
+    }
+    return TRUE;
+}
+static const struct pipeline_param cam_tone_curve_param = {
+    .name = "toneCurve",
+    .doc = "Tone curve used to render raw frames down to 8 bits for the scrubbing proxies.",
+    .type = G_TYPE_ENUM,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, tonecurve),
+    .defval = TONE_CURVE_SRGB,
+    .extra = tone_curves,
+    .setter = cam_tone_curve_setter,
+};
+static const struct pipeline_param cam_proxy_count_param = {
+    .name = "proxyFrames",
+    .doc = "Number of scrubbing proxy frames in the cache.",
+    .type = G_TYPE_ULONG,
+    .flags = 0,
+    .offset = offsetof(struct pipeline_state, proxycount),
+};
+static const struct pipeline_param cam_proxy_bytes_param = {
+    .name = "proxyBytes",
+    .doc = "Memory in bytes used by the scrubbing proxy cache.",
+    .type = G_TYPE_ULONG,
+    .flags = 0,
+    .offset = offsetof(struct pipeline_state, proxybytes),
+};
+
+static const struct pipeline_param cam_screencap_width_param = {
+    .name = "screencapWidth",
+    .doc = "Horizontal resolution of the screencap images, or zero to preserve the aspect ratio.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, capwidth),
+    .defval = 0,
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_screencap_height_param = {
+    .name = "screencapHeight",
+    .doc = "Vertical resolution of the screencap images, or zero to preserve the aspect ratio.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, capheight),
+    .defval = 0,
+    .setter = cam_generic_setter,
+};
+
+/*
+ * Regions of the frame are stored as four consecutive unsigned longs at the
+ * parameter offset, giving the X and Y offsets, width and height, and are
+ * exchanged as a string of the form WIDTHxHEIGHT+X+Y.
+ */
+static gboolean
+cam_region_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long *region = (unsigned long *)(((unsigned char *)state) + p->offset);
+    const char *roi = g_value_get_string(val);
+    unsigned long x, y, width, height;
+    int n = 0;
+
+    /* An empty string selects the whole frame. */
+    if (*roi == '\0') {
+        region[0] = region[1] = 0;
+        region[2] = region[3] = 0;
+        return TRUE;
+    }
+
+    /* Otherwise, parse a geometry of the form WIDTHxHEIGHT+X+Y */
+    if ((sscanf(roi, "%lux%lu+%lu+%lu%n", &width, &height, &x, &y, &n) != 4) || (roi[n] != '\0') || !width || !height) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%s\' is not valid for parameter \'%s\'", roi, p->name);
+        return FALSE;
+    }
+    region[0] = x;
+    region[1] = y;
+    region[2] = width;
+    region[3] = height;
+    return TRUE;
+}
+static GValue *
+cam_region_getter(struct pipeline_state *state, const struct pipeline_param *p)
+{
+    const unsigned long *region = (const unsigned long *)(((unsigned char *)state) + p->offset);
+    GValue *gval = g_new0(GValue, 1);
+    if (!gval) {
+        return NULL;
+    }
+    g_value_init(gval, G_TYPE_STRING);
+    if (region[2] && region[3]) {
+        g_value_take_string(gval, g_strdup_printf("%lux%lu+%lu+%lu", region[2], region[3], region[0], region[1]));
+    } else {
+        g_value_set_string(gval, "");
+    }
+    return gval;
+}
+static const struct pipeline_param cam_screencap_roi_param = {
+    .name = "screencapRoi",
+    .doc = "Region of interest for the screencap and live preview of the form WIDTHxHEIGHT+X+Y, or an empty string for the whole frame.",
+    .type = G_TYPE_STRING,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, roix),
+    .defstr = "",
+    .setter = cam_region_setter,
+    .getter = cam_region_getter,
+};
+
+static const struct pipeline_param cam_preview_rate_param = {
+    .name = "previewRate",
+    .doc = "Rate in frames per second of the live preview stream, or zero to disable.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, previewrate),
+    .defval = 10,
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_preview_width_param = {
+    .name = "previewWidth",
+    .doc = "Horizontal resolution of the live preview stream, or zero to preserve the aspect ratio.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, previewwidth),
+    .defval = 640,
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_preview_height_param = {
+    .name = "previewHeight",
+    .doc = "Vertical resolution of the live preview stream, or zero to preserve the aspect ratio.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, previewheight),
+    .defval = 0,
+    .setter = cam_generic_setter,
+};
+
+static gboolean
+cam_ring_length_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long length = g_value_get_ulong(val);
+    if (length > PIPELINE_MAX_RING_LENGTH) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' exceeds the maximum of %d for parameter \'%s\'", length, PIPELINE_MAX_RING_LENGTH, p->name);
+        return FALSE;
+    }
+    state->ringlength = length;
+    return TRUE;
+}
+
+static const struct pipeline_param cam_ring_length_param = {
+    .name = "frameRingLength",
+    .doc = "Number of live frames kept in the shared memory frame ring, or zero to disable it. The ring is allocated when the first consumer connects, and keeps its size until the pipeline exits.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, ringlength),
+    .defval = 4,
+    .setter = cam_ring_length_setter,
+};
+
+static gboolean
+cam_stats_interval_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long interval = g_value_get_ulong(val);
+    if (interval > PIPELINE_MAX_STATS_INTERVAL) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' exceeds the maximum of %d for parameter \'%s\'", interval, PIPELINE_MAX_STATS_INTERVAL, p->name);
+        return FALSE;
+    }
+    state->statsinterval = interval;
+    cam_stats_reconfig(state);
+    return TRUE;
+}
+
+static gboolean
+cam_stats_budget_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    state->statsbudget = g_value_get_ulong(val);
+    cam_stats_reconfig(state);
+    return TRUE;
+}
+
+static const struct pipeline_param cam_stats_interval_param = {
+    .name = "statsInterval",
+    .doc = "Milliseconds between updates of the live image statistics, or zero to disable them. Enabling or disabling the statistics takes effect when the pipeline is next restarted.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, statsinterval),
+    .defval = 100,
+    .setter = cam_stats_interval_setter,
+};
+static const struct pipeline_param cam_stats_budget_param = {
+    .name = "statsBudget",
+    .doc = "CPU time in microseconds allowed to gather the statistics from a frame, or zero for no limit. Frames are subsampled as necessary to stay within the budget.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, statsbudget),
+    .defval = 2000,
+    .setter = cam_stats_budget_setter,
+};
+
+/* Return an array of statistics as a boxed GArray of unsigned integers. */
+static GValue *
+cam_stats_boxed_array(GArray *array)
+{
+    GValue *vboxed = g_new0(GValue, 1);
+    if (!vboxed) {
+        g_array_free(array, TRUE);
+        return NULL;
+    }
+    g_value_init(vboxed, dbus_g_type_get_collection("GArray", G_TYPE_UINT));
+    g_value_take_boxed(vboxed, array);
+    return vboxed;
+}
+
+static GValue *
+cam_stats_histogram_getter(struct pipeline_state *state, const struct pipeline_param *p)
+{
+    GArray *array = g_array_sized_new(FALSE, FALSE, sizeof(guint), IMAGE_STATS_BINS);
+    g_array_append_vals(array, state->stats.histogram, IMAGE_STATS_BINS);
+    return cam_stats_boxed_array(array);
+}
+
+static GValue *
+cam_stats_waveform_getter(struct pipeline_state *state, const struct pipeline_param *p)
+{
+    const uint8_t *bands = ((unsigned char *)state) + p->offset;
+    GArray *array = g_array_sized_new(FALSE, FALSE, sizeof(guint), IMAGE_STATS_BANDS);
+    int i;
+
+    for (i = 0; i < IMAGE_STATS_BANDS; i++) {
+        guint value = bands[i];
+        g_array_append_val(array, value);
+    }
+    return cam_stats_boxed_array(array);
+}
+
+static GValue *
+cam_stats_step_getter(struct pipeline_state *state, const struct pipeline_param *p)
+{
+    GValue *gval = g_new0(GValue, 1);
+    if (gval) {
+        g_value_init(gval, G_TYPE_UINT);
+        g_value_set_uint(gval, state->stats.step);
+    }
+    return gval;
+}
+
+static const struct pipeline_param cam_stats_histogram_param = {
+    .name = "statsHistogram",
+    .doc = "Histogram of the live luma, as an array of 256 sample counts.",
+    .type = G_TYPE_BOXED,
+    .flags = PARAM_F_NOTIFY,
+    .extra = "au",
+    .getter = cam_stats_histogram_getter,
+};
+static const struct pipeline_param cam_stats_clip_black_param = {
+    .name = "statsClipBlack",
+    .doc = "Percentage of the live luma that is clipped to black.",
+    .type = G_TYPE_DOUBLE,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, stats.clipblack),
+};
+static const struct pipeline_param cam_stats_clip_white_param = {
+    .name = "statsClipWhite",
+    .doc = "Percentage of the live luma that is clipped to white.",
+    .type = G_TYPE_DOUBLE,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, stats.clipwhite),
+};
+static const struct pipeline_param cam_stats_row_waveform_param = {
+    .name = "statsRowWaveform",
+    .doc = "Mean luma of 64 horizontal bands of the live video, from top to bottom.",
+    .type = G_TYPE_BOXED,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, stats.rows),
+    .extra = "au",
+    .getter = cam_stats_waveform_getter,
+};
+static const struct pipeline_param cam_stats_column_waveform_param = {
+    .name = "statsColumnWaveform",
+    .doc = "Mean luma of 64 vertical bands of the live video, from left to right.",
+    .type = G_TYPE_BOXED,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, stats.columns),
+    .extra = "au",
+    .getter = cam_stats_waveform_getter,
+};
+static const struct pipeline_param cam_stats_focus_param = {
+    .name = "statsFocus",
+    .doc = "Focus score of the live video, given by the variance of its Laplacian. Larger values indicate a sharper image.",
+    .type = G_TYPE_DOUBLE,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, stats.focus),
+};
+static const struct pipeline_param cam_stats_step_param = {
+    .name = "statsStep",
+    .doc = "Subsampling step used to gather the statistics within the CPU budget, or zero if no statistics are available.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY,
+    .getter = cam_stats_step_getter,
+};
+
+static gboolean
+cam_ae_target_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long target = g_value_get_ulong(val);
+    if ((target < 1) || (target > 254)) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' is not within the range of 1 to 254 for parameter \'%s\'", target, p->name);
+        return FALSE;
+    }
+    state->aetarget = target;
+    return TRUE;
+}
+
+static gboolean
+cam_ae_damping_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long damping = g_value_get_ulong(val);
+    if (damping > 99) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' exceeds the maximum of 99 for parameter \'%s\'", damping, p->name);
+        return FALSE;
+    }
+    state->aedamping = damping;
+    return TRUE;
+}
+
+static gboolean
+cam_ae_region_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    if (!cam_region_setter(state, p, val, err)) {
+        return FALSE;
+    }
+    cam_stats_reconfig(state);
+    return TRUE;
+}
+
+static const struct pipeline_param cam_ae_enable_param = {
+    .name = "aeEnable",
+    .doc = "Automatically adjust the exposure to follow the live image statistics.",
+    .type = G_TYPE_BOOLEAN,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, aeenable),
+    .defval = FALSE,
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_ae_recording_param = {
+    .name = "aeDuringRecording",
+    .doc = "Continue to adjust the exposure automatically while recording, which is otherwise suspended.",
+    .type = G_TYPE_BOOLEAN,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, aerecord),
+    .defval = FALSE,
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_ae_target_param = {
+    .name = "aeTarget",
+    .doc = "Mean luma from 1 to 254 that the auto exposure aims for within the metering region.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, aetarget),
+    .defval = 118,
+    .setter = cam_ae_target_setter,
+};
+static const struct pipeline_param cam_ae_damping_param = {
+    .name = "aeDamping",
+    .doc = "Percentage of the exposure error left uncorrected by each update of the auto exposure, from 0 for the fastest response up to 99 for the slowest.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, aedamping),
+    .defval = 50,
+    .setter = cam_ae_damping_setter,
+};
+static const struct pipeline_param cam_ae_region_param = {
+    .name = "aeMeteringRegion",
+    .doc = "Region of the live video metered by the auto exposure of the form WIDTHxHEIGHT+X+Y, or an empty string for the whole frame.",
+    .type = G_TYPE_STRING,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, aex),
+    .defstr = "",
+    .setter = cam_ae_region_setter,
+    .getter = cam_region_getter,
+};
+static const struct pipeline_param cam_ae_error_param = {
+    .name = "aeError",
+    .doc = "Exposure error in stops measured by the last update of the auto exposure, with positive values when underexposed.",
+    .type = G_TYPE_DOUBLE,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, ae.error),
+};
+
+static gboolean
+cam_motion_level_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long level = g_value_get_ulong(val);
+    if ((level < 1) || (level > 255)) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' is not within the range of 1 to 255 for parameter \'%s\'", level, p->name);
+        return FALSE;
+    }
+    state->motionlevel = level;
+    cam_motion_reconfig(state);
+    return TRUE;
+}
+
+static gboolean
+cam_motion_threshold_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long threshold = g_value_get_ulong(val);
+    if ((threshold < 1) || (threshold > 100)) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' is not within the range of 1 to 100 for parameter \'%s\'", threshold, p->name);
+        return FALSE;
+    }
+    state->motionthreshold = threshold;
+    cam_motion_reconfig(state);
+    return TRUE;
+}
+
+static gboolean
+cam_motion_frames_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    unsigned long frames = g_value_get_ulong(val);
+    if ((frames < 1) || (frames > PIPELINE_MAX_MOTION_FRAMES)) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "\'%lu\' is not within the range of 1 to %d for parameter \'%s\'", frames, PIPELINE_MAX_MOTION_FRAMES, p->name);
+        return FALSE;
+    }
+    state->motionframes = frames;
+    cam_motion_reconfig(state);
+    return TRUE;
+}
+
+static gboolean
+cam_motion_region_setter(struct pipeline_state *state, const struct pipeline_param *p, GValue *val, char *err)
+{
+    if (!cam_region_setter(state, p, val, err)) {
+        return FALSE;
+    }
+    cam_motion_reconfig(state);
+    return TRUE;
+}
+
+static const struct pipeline_param cam_motion_enable_param = {
+    .name = "motionEnable",
+    .doc = "Fire the recording trigger when motion is detected in the live video. Enabling or disabling the motion trigger takes effect when the pipeline is next restarted.",
+    .type = G_TYPE_BOOLEAN,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, motionenable),
+    .defval = FALSE,
+    .setter = cam_generic_setter,
+};
+static const struct pipeline_param cam_motion_level_param = {
+    .name = "motionLevel",
+    .doc = "Change in the mean luma of a 16x16 block between frames, from 1 to 255, that counts as motion.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, motionlevel),
+    .defval = 12,
+    .setter = cam_motion_level_setter,
+};
+static const struct pipeline_param cam_motion_threshold_param = {
+    .name = "motionThreshold",
+    .doc = "Percentage of the blocks within the motion region that must change for a frame to count as motion.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, motionthreshold),
+    .defval = 2,
+    .setter = cam_motion_threshold_setter,
+};
+static const struct pipeline_param cam_motion_frames_param = {
+    .name = "motionFrames",
+    .doc = "Number of consecutive frames of motion needed to fire the trigger.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, motionframes),
+    .defval = 3,
+    .setter = cam_motion_frames_setter,
+};
+static const struct pipeline_param cam_motion_region_param = {
+    .name = "motionRegion",
+    .doc = "Region of the live video to watch for motion of the form WIDTHxHEIGHT+X+Y, or an empty string for the whole frame.",
+    .type = G_TYPE_STRING,
+    .flags = PARAM_F_NOTIFY | PARAM_F_SAVE,
+    .offset = offsetof(struct pipeline_state, motionx),
+    .defstr = "",
+    .setter = cam_motion_region_setter,
+    .getter = cam_region_getter,
+};
+static const struct pipeline_param cam_motion_score_param = {
+    .name = "motionScore",
+    .doc = "Percentage of the blocks within the motion region that changed in the most recent frame.",
+    .type = G_TYPE_DOUBLE,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, motion.score),
+};
+static const struct pipeline_param cam_motion_detections_param = {
+    .name = "motionDetections",
+    .doc = "Number of times that motion has been detected since the pipeline was started.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, motion.detections),
+};
+static const struct pipeline_param cam_motion_rejected_param = {
+    .name = "motionRejected",
+    .doc = "Number of brief changes which were rejected as false positives for lasting fewer than motionFrames.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, motion.rejected),
+};
+static const struct pipeline_param cam_motion_triggers_param = {
+    .name = "motionTriggers",
+    .doc = "Number of times that motion has fired the recording trigger.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, motiontriggers),
+};
+static const struct pipeline_param cam_motion_latency_param = {
+    .name = "motionLatency",
+    .doc = "Time in microseconds from the first frame of motion until the recording trigger was last fired.",
+    .type = G_TYPE_ULONG,
+    .flags = PARAM_F_NOTIFY,
+    .offset = offsetof(struct pipeline_state, motionlatency),
+};
+
 static GValue *
 cam_video_segments_getter(struct pipeline_state *state, const struct pipeline_param *p)
 {
@@ -493,11 +1160,61 @@ static const struct pipeline_param *cam_dbus_params[] = {
     &cam_overlay_position_param,
     &cam_focus_zebra_level_param,
     &cam_video_zoom_param,
+    &cam_video_flip_param,
     /* Playback position and rate. */
     &cam_playback_position_param,
     &cam_playback_rate_param,
     &cam_playback_start_param,
     &cam_playback_length_param,
+    /* Playback scheduling and latency. */
+    &cam_playback_priority_param,
+    &cam_playback_memlock_param,
+    &cam_playback_deadline_param,
+    &cam_playback_missed_param,
+    &cam_playback_latency_param,
+    &cam_playback_max_latency_param,
+    /* Scrubbing proxy cache. */
+    &cam_proxy_interval_param,
+    &cam_proxy_width_param,
+    &cam_tone_curve_param,
+    &cam_proxy_count_param,
+    &cam_proxy_bytes_param,
+    /* Screencap and live preview stream. */
+    &cam_screencap_width_param,
+    &cam_screencap_height_param,
+    &cam_screencap_roi_param,
+    &cam_preview_rate_param,
+    &cam_preview_width_param,
+    &cam_preview_height_param,
+    &cam_ring_length_param,
+    /* Live image statistics. */
+    &cam_stats_interval_param,
+    &cam_stats_budget_param,
+    &cam_stats_histogram_param,
+    &cam_stats_clip_black_param,
+    &cam_stats_clip_white_param,
+    &cam_stats_row_waveform_param,
+    &cam_stats_column_waveform_param,
+    &cam_stats_focus_param,
+    &cam_stats_step_param,
+    /* Auto exposure. */
+    &cam_ae_enable_param,
+    &cam_ae_recording_param,
+    &cam_ae_target_param,
+    &cam_ae_damping_param,
+    &cam_ae_region_param,
+    &cam_ae_error_param,
+    /* Motion trigger. */
+    &cam_motion_enable_param,
+    &cam_motion_level_param,
+    &cam_motion_threshold_param,
+    &cam_motion_frames_param,
+    &cam_motion_region_param,
+    &cam_motion_score_param,
+    &cam_motion_detections_param,
+    &cam_motion_rejected_param,
+    &cam_motion_triggers_param,
+    &cam_motion_latency_param,
     /* Description of recorded video. */
     &cam_video_total_frames_param,
     &cam_video_total_segments_param,
@@ -643,6 +1360,8 @@ dbus_param_signature(const struct pipeline_param *p)
             return "s";
             
         case G_TYPE_BOXED:
+            /* Arrays of simple types provide their signature as extra data. */
+            if (p->extra) return p->extra;
             /* TODO: This is a bit more complicated to deal with... */
         default:
             return "a{sv}";
@@ -600,6 +600,114 @@ cam_video_overlay(CamVideo *vobj, GHashTable *args, GHashTable **data, GError **
     return (data != NULL);
 }
 
+static gboolean
+cam_video_thumbnail(CamVideo *vobj, GHashTable *args, GHashTable **data, GError **error)
+{
+    struct pipeline_state *state = vobj->state;
+    unsigned long frame = cam_dbus_dict_get_uint(args, "frame", (state->position > 0) ? state->position : 0);
+    unsigned int width, height;
+    GArray *jpeg;
+
+    if (frame >= state->seglist.totalframes) {
+        *error = g_error_new(CAM_ERROR_PARAMETERS, 0, "Invalid frame number");
+        return 0;
+    }
+
+    /* Find the nearest proxy frame from the cache. */
+    jpeg = proxy_lookup(state, &frame, &width, &height);
+    if (!jpeg) {
+        *error = g_error_new(CAM_ERROR_PARAMETERS, 0, "Thumbnail not available");
+        return 0;
+    }
+
+    *data = cam_dbus_dict_new();
+    cam_dbus_dict_add_uint(*data, "frame", frame);
+    cam_dbus_dict_add_uint(*data, "width", width);
+    cam_dbus_dict_add_uint(*data, "height", height);
+    cam_dbus_dict_take_boxed(*data, "jpeg", DBUS_TYPE_G_UCHAR_ARRAY, jpeg);
+    return (*data != NULL);
+}
+
+struct cam_video_grab {
+    DBusGMethodInvocation *context;
+    unsigned long frame;
+    char *format;
+    const char *mimetype;
+};
+
+static void
+cam_video_grabframe_done(GArray *image, unsigned int width, unsigned int height, const char *err, void *closure)
+{
+    struct cam_video_grab *grab = closure;
+    GHashTable *data;
+
+    if (!image) {
+        GError *error = g_error_new(CAM_ERROR_PARAMETERS, 0, "Frame grab failed: %s", err);
+        dbus_g_method_return_error(grab->context, error);
+        g_error_free(error);
+    }
+    else {
+        data = cam_dbus_dict_new();
+        cam_dbus_dict_add_uint(data, "frame", grab->frame);
+        cam_dbus_dict_add_uint(data, "width", width);
+        cam_dbus_dict_add_uint(data, "height", height);
+        cam_dbus_dict_add_string(data, "format", grab->format);
+        cam_dbus_dict_add_string(data, "mimetype", grab->mimetype);
+        cam_dbus_dict_take_boxed(data, "data", DBUS_TYPE_G_UCHAR_ARRAY, image);
+        dbus_g_method_return(grab->context, data);
+        cam_dbus_dict_free(data);
+    }
+    g_free(grab->format);
+    g_free(grab);
+}
+
+static void
+cam_video_grabframe(CamVideo *vobj, GHashTable *args, DBusGMethodInvocation *context)
+{
+    struct pipeline_state *state = vobj->state;
+    unsigned long frame = cam_dbus_dict_get_uint(args, "frame", (state->position > 0) ? state->position : 0);
+    unsigned int scale = cam_dbus_dict_get_uint(args, "scale", 1);
+    const char *format = cam_dbus_dict_get_string(args, "format", "jpeg");
+    char err[PIPELINE_ERROR_MAXLEN] = "";
+    struct cam_video_grab *grab;
+    GError *error;
+    int fmt;
+
+    grab = g_new0(struct cam_video_grab, 1);
+    grab->context = context;
+    grab->frame = frame;
+    grab->format = g_strdup(format);
+    if ((strcasecmp(format, "jpeg") == 0) || (strcasecmp(format, "jpg") == 0)) {
+        fmt = GRAB_FORMAT_JPEG;
+        grab->mimetype = "image/jpeg";
+    }
+    else if (strcasecmp(format, "png") == 0) {
+        fmt = GRAB_FORMAT_PNG;
+        grab->mimetype = "image/png";
+    }
+    else if (strcasecmp(format, "dng") == 0) {
+        fmt = GRAB_FORMAT_DNG;
+        grab->mimetype = "image/x-adobe-dng";
+    }
+    else {
+        error = g_error_new(CAM_ERROR_PARAMETERS, 0, "Invalid image format '%s'", format);
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        g_free(grab->format);
+        g_free(grab);
+        return;
+    }
+
+    /* The reply is sent once the frame has made it through the video pipeline. */
+    if (grab_frame(state, frame, fmt, scale, cam_video_grabframe_done, grab, err) != 0) {
+        error = g_error_new(CAM_ERROR_PARAMETERS, 0, "Frame grab failed: %s", err);
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        g_free(grab->format);
+        g_free(grab);
+    }
+}
+
 #include "api/cam-dbus-video.h"
 
 /*-------------------------------------
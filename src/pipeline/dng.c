@@ -29,9 +29,8 @@
 #include "utils.h"
 #include "tiff.h"
 
-/* Typical kernel page size. */
-#define KPAGE_SIZE          4096
-#define TIFF_HDR_SIZE       KPAGE_SIZE
+/* Pad the headers out to a page so the image data stays aligned. */
+#define TIFF_HDR_SIZE       DNG_HEADER_SIZE
 
 /* Recursive version of mkdir to create an enitre path. */
 static int
@@ -76,25 +75,34 @@ dng_mkdir(const char *path, mode_t mode)
     return mkdir(path, mode);
 }
 
-static gboolean
-dng_probe_greyscale(GstPad *pad, GstBuffer *buf, gpointer cbdata)
+/*
+ * Build the DNG header for a frame of 16-bit raw pixels, with the image data
+ * following immediately after the DNG_HEADER_SIZE bytes of header.
+ */
+void
+dng_build_header(struct pipeline_state *state, void *dest, unsigned long xres, unsigned long yres,
+                 const struct video_segment *seg)
 {
-    struct pipeline_state *state = cbdata;
-    GstCaps *caps = GST_BUFFER_CAPS(buf);
-    GstStructure *gstruct = gst_caps_get_structure(caps, 0);
-    unsigned long xres = g_value_get_int(gst_structure_get_value(gstruct, "width"));
-    unsigned long yres = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+    const uint8_t cfa_pattern[] = {1, 0, 2, 1}; /* GRBG Bayer pattern */
+    const uint16_t cfa_repeat[] = {2, 2};       /* 2x2 Bayer Pattern */
     const uint8_t dng_version[] = {1, 4, 0, 0};
     const uint8_t dng_compatible[] = {1, 0, 0, 0};
     const uint8_t exif_version[] = {'0', '2', '2', '0'};
-    const struct tiff_srational cmatrix[3] = {
+    const struct tiff_rational wbneutral[3] = {
+        {4096, state->fpga->display->wbal[0]},
+        {4096, state->fpga->display->wbal[1]},
+        {4096, state->fpga->display->wbal[2]}
+    };
+    const struct tiff_srational cmatrix[9] = {
+        // this awkward double-casting is used to preserve the proper sign of the number (it's actually just a 16-bit number with leading zeros even if it's negative)
+        {(int32_t)(int16_t)state->fpga->display->ccm_red[0], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_red[1], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_red[2], 4096},
+        {(int32_t)(int16_t)state->fpga->display->ccm_green[0], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_green[1], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_green[2], 4096},
+        {(int32_t)(int16_t)state->fpga->display->ccm_blue[0], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_blue[1], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_blue[2], 4096}
+    };
+    const struct tiff_srational cmatrix_mono[3] = {
         {0, 1}, {1, 1}, {0, 1},
     };
-    char fname[64];
-    int fd;
-    /* HACK! May not actually correlate to the current frame. */
-    struct video_segment *seg = state->seglist.head;
-    
+
     /* The list of EXIF tags. */
     time_t now = time(0);
     struct tm timebuf;
@@ -109,134 +117,93 @@ dng_probe_greyscale(GstPad *pad, GstBuffer *buf, gpointer cbdata)
     };
     struct tiff_ifd exif_ifd = {.tags = exif, sizeof(exif)/sizeof(struct tiff_tag)};
 
-    /* The list of tags we want. */
-    const struct tiff_tag tags[] = {
-        /* TIFF Baseline Tags */
-        TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
-        TIFF_TAG_LONG(256, xres),           /* ImageWidth */
-        TIFF_TAG_LONG(257, yres),           /* ImageLength */
-        TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
-        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
-        TIFF_TAG_SHORT(262, 34892),         /* PhotometricInterpretation = LinearRaw */
-        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
-        TIFF_TAG_STRING(272, (state->board_rev == 0x2100) ? "Chronos 2.1" : "Chronos 1.4"),        /* Model */
-        TIFF_TAG_LONG(273, TIFF_HDR_SIZE),          /* StripOffsets */
-        TIFF_TAG_SHORT(274, 1),                     /* Orientation = Zero is top left */
-        TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
-        TIFF_TAG_LONG(278, yres),           /* RowsPerStrip */
-        TIFF_TAG_LONG(279, GST_BUFFER_SIZE(buf)),   /* StripByteCounts */
-        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
-        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
-        TIFF_TAG_SUBIFD(34665, &exif_ifd),              /* Exif IFD Pointer */
-
-        /* CinemaDNG Tags */
-        TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
-        TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
-        TIFF_TAG_STRING(50708, (state->board_rev == 0x2100) ? "Krontech Chronos 2.1" : "Krontech Chronos 1.4"), /* UniqueCameraModel */
-        TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
-        TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, cmatrix, sizeof(cmatrix)/sizeof(struct tiff_srational)),
-    };
-    struct tiff_ifd image_ifd = {.tags = tags, .count = sizeof(tags)/sizeof(struct tiff_tag)};
-
-    /* Create the next file in the image sequence. */
-    state->dngcount++;
-    sprintf(fname, "frame_%06lu.dng", state->dngcount);
-    fd = openat(state->write_fd, fname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0) {
-        fprintf(stderr, "Failed to create DNG frame (%s)\n", strerror(errno));
-        return TRUE;
+    if (state->source.color) {
+        /* The list of tags we want. */
+        const struct tiff_tag tags[] = {
+            /* TIFF Baseline Tags */
+            TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
+            TIFF_TAG_LONG(256, xres),           /* ImageWidth */
+            TIFF_TAG_LONG(257, yres),           /* ImageLength */
+            TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
+            TIFF_TAG_SHORT(259, 1),             /* Compression = None */
+            TIFF_TAG_SHORT(262, 32803),         /* PhotometricInterpretation = Color Filter Array */
+            TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
+            TIFF_TAG_STRING(272, (state->board_rev == 0x2100) ? "Chronos 2.1" : "Chronos 1.4"),        /* Model */
+            TIFF_TAG_LONG(273, TIFF_HDR_SIZE),          /* StripOffsets */
+            TIFF_TAG_SHORT(274, 1),                     /* Orientation = Zero is top left */
+            TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
+            TIFF_TAG_LONG(278, yres),           /* RowsPerStrip */
+            TIFF_TAG_LONG(279, xres * yres * 2),        /* StripByteCounts */
+            TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
+            TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
+
+            /* TIFF-EP Tags */
+            /* TODO: SubIFD for preview images */
+            TIFF_TAG(33421, TIFF_TYPE_SHORT, cfa_repeat),   /* CFARepeatPatternDim = 2x2 */
+            TIFF_TAG(33422, TIFF_TYPE_BYTE, cfa_pattern),   /* CFAPattern = GRBG */
+            TIFF_TAG_SUBIFD(34665, &exif_ifd),              /* Exif IFD Pointer */
+
+            /* CinemaDNG Tags */
+            TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
+            TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
+            TIFF_TAG_STRING(50708, (state->board_rev == 0x2100) ? "Krontech Chronos 2.1" : "Krontech Chronos 1.4"), /* UniqueCameraModel */
+            TIFF_TAG_SHORT(50711, 1),                       /* CFALayout = square */
+            TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
+            TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, cmatrix, sizeof(cmatrix)/sizeof(struct tiff_srational)),
+            TIFF_TAG_VECTOR(50728, TIFF_TYPE_RATIONAL, wbneutral, sizeof(wbneutral)/sizeof(struct tiff_rational)),
+            TIFF_TAG_SHORT(50778, 20),                      /* CalibrationIlluminant1 = D55 */
+            /* TODO: AsShortNeutral for white balance information. */
+        };
+        struct tiff_ifd image_ifd = {.tags = tags, .count = sizeof(tags)/sizeof(struct tiff_tag)};
+        tiff_build_header(dest, TIFF_HDR_SIZE, &image_ifd);
     }
-
-    /* Write the header and frame data. */
-    tiff_build_header(state->scratchpad, TIFF_HDR_SIZE, &image_ifd);
-    memcpy_neon((unsigned char *)state->scratchpad + TIFF_HDR_SIZE, GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf));
-    write(fd, state->scratchpad, GST_BUFFER_SIZE(buf) + TIFF_HDR_SIZE);
-    close(fd);
-    return TRUE;
-} /* dng_probe_grayscale */
+    else {
+        /* The list of tags we want. */
+        const struct tiff_tag tags[] = {
+            /* TIFF Baseline Tags */
+            TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
+            TIFF_TAG_LONG(256, xres),           /* ImageWidth */
+            TIFF_TAG_LONG(257, yres),           /* ImageLength */
+            TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
+            TIFF_TAG_SHORT(259, 1),             /* Compression = None */
+            TIFF_TAG_SHORT(262, 34892),         /* PhotometricInterpretation = LinearRaw */
+            TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
+            TIFF_TAG_STRING(272, (state->board_rev == 0x2100) ? "Chronos 2.1" : "Chronos 1.4"),        /* Model */
+            TIFF_TAG_LONG(273, TIFF_HDR_SIZE),          /* StripOffsets */
+            TIFF_TAG_SHORT(274, 1),                     /* Orientation = Zero is top left */
+            TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
+            TIFF_TAG_LONG(278, yres),           /* RowsPerStrip */
+            TIFF_TAG_LONG(279, xres * yres * 2),        /* StripByteCounts */
+            TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
+            TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
+            TIFF_TAG_SUBIFD(34665, &exif_ifd),              /* Exif IFD Pointer */
+
+            /* CinemaDNG Tags */
+            TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
+            TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
+            TIFF_TAG_STRING(50708, (state->board_rev == 0x2100) ? "Krontech Chronos 2.1" : "Krontech Chronos 1.4"), /* UniqueCameraModel */
+            TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
+            TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, cmatrix_mono, sizeof(cmatrix_mono)/sizeof(struct tiff_srational)),
+        };
+        struct tiff_ifd image_ifd = {.tags = tags, .count = sizeof(tags)/sizeof(struct tiff_tag)};
+        tiff_build_header(dest, TIFF_HDR_SIZE, &image_ifd);
+    }
+} /* dng_build_header */
 
 static gboolean
-dng_probe_bayer(GstPad *pad, GstBuffer *buf, gpointer cbdata)
+dng_probe(GstPad *pad, GstBuffer *buf, gpointer cbdata)
 {
     struct pipeline_state *state = cbdata;
     GstCaps *caps = GST_BUFFER_CAPS(buf);
     GstStructure *gstruct = gst_caps_get_structure(caps, 0);
     unsigned long xres = g_value_get_int(gst_structure_get_value(gstruct, "width"));
     unsigned long yres = g_value_get_int(gst_structure_get_value(gstruct, "height"));
-    const uint8_t cfa_pattern[] = {1, 0, 2, 1}; /* GRBG Bayer pattern */
-    const uint16_t cfa_repeat[] = {2, 2};       /* 2x2 Bayer Pattern */
-    const uint8_t dng_version[] = {1, 4, 0, 0};
-    const uint8_t dng_compatible[] = {1, 0, 0, 0};
-    const uint8_t exif_version[] = {'0', '2', '2', '0'};
-    const struct tiff_rational wbneutral[3] = {
-        {4096, state->fpga->display->wbal[0]},
-        {4096, state->fpga->display->wbal[1]},
-        {4096, state->fpga->display->wbal[2]}
-    };
-    const struct tiff_srational cmatrix[9] = {
-        // this awkward double-casting is used to preserve the proper sign of the number (it's actually just a 16-bit number with leading zeros even if it's negative)
-        {(int32_t)(int16_t)state->fpga->display->ccm_red[0], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_red[1], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_red[2], 4096},
-        {(int32_t)(int16_t)state->fpga->display->ccm_green[0], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_green[1], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_green[2], 4096},
-        {(int32_t)(int16_t)state->fpga->display->ccm_blue[0], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_blue[1], 4096}, {(int32_t)(int16_t)state->fpga->display->ccm_blue[2], 4096}
-    };
     char fname[64];
     int fd;
 
     /* HACK! May not actually correlate to the current frame. */
     struct video_segment *seg = state->seglist.head;
 
-    /* The list of EXIF tags. */
-    time_t now = time(0);
-    struct tm timebuf;
-    char timestr[64];
-    size_t timelen = strftime(timestr, sizeof(timestr), "%Y:%m:%d %T", gmtime_r(&now, &timebuf));
-    const struct tiff_tag exif[] = {
-        TIFF_TAG_RATIONAL(33434, seg->metadata.exposure, seg->metadata.timebase),   /* ExposureTime */
-        TIFF_TAG(36864, TIFF_TYPE_UNDEFINED, exif_version),                         /* ExifVgersion = 2.2 */
-        TIFF_TAG_VECTOR(36868, TIFF_TYPE_ASCII, timestr, timelen + 1),              /* DateTimeDigitized */
-        TIFF_TAG_STRING(42033, state->serial),                                      /* SerialNumber */
-        TIFF_TAG_SRATIONAL(51044, seg->metadata.timebase, seg->metadata.interval),  /* FrameRate */
-    };
-    struct tiff_ifd exif_ifd = {.tags = exif, sizeof(exif)/sizeof(struct tiff_tag)};
-    
-    /* The list of tags we want. */
-    const struct tiff_tag tags[] = {
-        /* TIFF Baseline Tags */
-        TIFF_TAG_LONG(254, 0),              /* SubFieldType = DNG Highest quality */
-        TIFF_TAG_LONG(256, xres),           /* ImageWidth */
-        TIFF_TAG_LONG(257, yres),           /* ImageLength */
-        TIFF_TAG_SHORT(258, 16),            /* BitsPerSample */
-        TIFF_TAG_SHORT(259, 1),             /* Compression = None */
-        TIFF_TAG_SHORT(262, 32803),         /* PhotometricInterpretation = Color Filter Array */
-        TIFF_TAG_STRING(271, "Kron Technologies"),  /* Make */
-        TIFF_TAG_STRING(272, (state->board_rev == 0x2100) ? "Chronos 2.1" : "Chronos 1.4"),        /* Model */
-        TIFF_TAG_LONG(273, TIFF_HDR_SIZE),          /* StripOffsets */
-        TIFF_TAG_SHORT(274, 1),                     /* Orientation = Zero is top left */
-        TIFF_TAG_SHORT(277, 1),             /* SamplesPerPixel */
-        TIFF_TAG_LONG(278, yres),           /* RowsPerStrip */
-        TIFF_TAG_LONG(279, GST_BUFFER_SIZE(buf)),   /* StripByteCounts */
-        TIFF_TAG_SHORT(284, 1),             /* PlanarConfiguration = Chunky */
-        TIFF_TAG_SHORT(296, 1),             /* ResolutionUnit = None */
-    
-        /* TIFF-EP Tags */
-        /* TODO: SubIFD for preview images */
-        TIFF_TAG(33421, TIFF_TYPE_SHORT, cfa_repeat),   /* CFARepeatPatternDim = 2x2 */
-        TIFF_TAG(33422, TIFF_TYPE_BYTE, cfa_pattern),   /* CFAPattern = GRBG */
-        TIFF_TAG_SUBIFD(34665, &exif_ifd),              /* Exif IFD Pointer */
-    
-        /* CinemaDNG Tags */
-        TIFF_TAG(50706, TIFF_TYPE_BYTE, dng_version),   /* DNGVersion = 1.4.0.0 */
-        TIFF_TAG(50707, TIFF_TYPE_BYTE, dng_compatible),/* DNGBackwardVersion = 1.0.0.0 */
-        TIFF_TAG_STRING(50708, (state->board_rev == 0x2100) ? "Krontech Chronos 2.1" : "Krontech Chronos 1.4"), /* UniqueCameraModel */
-        TIFF_TAG_SHORT(50711, 1),                       /* CFALayout = square */
-        TIFF_TAG_SHORT(50717, 0xfff),                   /* WhiteLevel = 12-bit */
-        TIFF_TAG_VECTOR(50721, TIFF_TYPE_SRATIONAL, cmatrix, sizeof(cmatrix)/sizeof(struct tiff_srational)),
-        TIFF_TAG_VECTOR(50728, TIFF_TYPE_RATIONAL, wbneutral, sizeof(wbneutral)/sizeof(struct tiff_rational)),
-        TIFF_TAG_SHORT(50778, 20),                      /* CalibrationIlluminant1 = D55 */
-        /* TODO: AsShortNeutral for white balance information. */
-    };
-    struct tiff_ifd image_ifd = {.tags = tags, .count = sizeof(tags)/sizeof(struct tiff_tag)};
-
     /* Create the next file in the image sequence. */
     state->dngcount++;
     sprintf(fname, "frame_%06lu.dng", state->dngcount);
@@ -247,12 +214,12 @@ dng_probe_bayer(GstPad *pad, GstBuffer *buf, gpointer cbdata)
     }
 
     /* Write the header and frame data. */
-    tiff_build_header(state->scratchpad, TIFF_HDR_SIZE, &image_ifd);
+    dng_build_header(state, state->scratchpad, xres, yres, seg);
     memcpy_neon((unsigned char *)state->scratchpad + TIFF_HDR_SIZE, GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf));
     write(fd, state->scratchpad, GST_BUFFER_SIZE(buf) + TIFF_HDR_SIZE);
     close(fd);
     return TRUE;
-} /* dng_probe_bayer */
+} /* dng_probe */
 
 GstPad *
 cam_dng_sink(struct pipeline_state *state, struct pipeline_args *args)
@@ -287,11 +254,7 @@ cam_dng_sink(struct pipeline_state *state, struct pipeline_args *args)
 
     /* Install the pad callback to generate DNG frames. */
     pad = gst_element_get_static_pad(queue, "src");
-    if (state->source.color) {
-        gst_pad_add_buffer_probe(pad, G_CALLBACK(dng_probe_bayer), state);
-    } else {
-        gst_pad_add_buffer_probe(pad, G_CALLBACK(dng_probe_greyscale), state);
-    }
+    gst_pad_add_buffer_probe(pad, G_CALLBACK(dng_probe), state);
     gst_object_unref(pad);
 
     gst_bin_add_many(GST_BIN(state->pipeline), queue, sink, NULL);
@@ -0,0 +1,78 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "fpga-sensor.h"
+#include "auto-exposure.h"
+
+/*
+ * Software auto exposure, which runs on the main thread each time the live
+ * statistics are updated. The exposure is read back from the sensor timing
+ * registers before every update so that any manual changes made by other
+ * processes are respected, and the adjusted exposure is written through the
+ * image sensor API so that it remains within the sensor's constraints.
+ */
+static unsigned long long
+cam_auto_exposure_nsec(uint32_t clocks)
+{
+    return ((unsigned long long)clocks * 1000000000ULL) / FPGA_TIMEBASE_HZ;
+}
+
+void
+cam_auto_exposure(struct pipeline_state *state)
+{
+    struct image_geometry g;
+    struct image_constraints c;
+    unsigned long long exposure, period, tmax, next;
+
+    if (!state->aeenable || !state->sensor || !state->stats.step) {
+        return;
+    }
+    /* Only the legacy sensor timing engine can be adjusted from here. */
+    if (state->fpga->timing->version >= 1) {
+        return;
+    }
+    /* Leave the exposure alone while recording, unless asked otherwise. */
+    if (!state->aerecord && (state->args.liverecord || (state->fpga->seq->status & SEQ_STATUS_RECORDING))) {
+        return;
+    }
+
+    g.hres = state->fpga->imager->hres_count;
+    g.vres = state->fpga->imager->vres_count;
+    g.hoffset = 0;
+    g.voffset = 0;
+    if (image_sensor_get_constraints(state->sensor, &g, &c) != 0) {
+        return;
+    }
+    period = cam_auto_exposure_nsec(state->fpga->sensor->frame_period);
+    exposure = cam_auto_exposure_nsec(state->fpga->sensor->int_time);
+    exposure = (exposure > c.t_exposure_delay) ? (exposure - c.t_exposure_delay) : c.t_min_exposure;
+    tmax = image_sensor_max_exposure(&c, period);
+    if (tmax < c.t_min_exposure) {
+        return;
+    }
+
+    state->ae.target = state->aetarget;
+    state->ae.damping = state->aedamping / 100.0;
+    next = auto_exposure_update(&state->ae, state->stats.meter, exposure, c.t_min_exposure, tmax);
+    if (next != exposure) {
+        image_sensor_set_exposure(state->sensor, &g, next);
+    }
+}
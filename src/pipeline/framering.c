@@ -0,0 +1,178 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "frame-ring.h"
+
+#define FRAME_RING_SLOT_SIZE    ((PIPELINE_MAX_HRES * PIPELINE_MAX_VRES * 3) / 2)
+
+/*
+ * Live NV12 frames are copied out of the video pipeline into a ring in
+ * shared memory, where local consumers can read them in place. The ring
+ * is only allocated when the first consumer connects to the socket, and
+ * then lives until the process exits so that every consumer shares the
+ * same memory. A leaky queue in front of the probe ensures that the copy
+ * can never hold up the rest of the pipeline.
+ */
+static struct {
+    struct frame_ring   *ring;
+    pthread_mutex_t     mutex;
+    pthread_t           thread;
+    int                 sock;
+} framering = {
+    .ring = NULL,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .sock = -1,
+};
+
+static gboolean
+framering_probe(GstPad *pad, GstBuffer *buffer, gpointer cbdata)
+{
+    struct pipeline_state *state = cbdata;
+    struct frame_ring *ring = framering.ring;
+    struct frame_ring_slot *slot;
+    GstStructure *gstruct;
+    struct timespec ts;
+    int width, height;
+    size_t length;
+
+    /* Nothing to do until someone has asked for the ring. */
+    if (!ring) {
+        return TRUE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    gstruct = gst_caps_get_structure(GST_BUFFER_CAPS(buffer), 0);
+    width = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+    height = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+    length = (width * height * 3) / 2;
+    if ((length > ring->hdr->slotsize) || (length > GST_BUFFER_SIZE(buffer))) {
+        return TRUE;
+    }
+
+    slot = frame_ring_begin(ring);
+    slot->format = FRAME_RING_FORMAT_NV12;
+    slot->width = width;
+    slot->height = height;
+    slot->stride = width;
+    slot->length = length;
+    slot->position = (state->playstate == PLAYBACK_STATE_PLAY) ? state->position : -1;
+    slot->timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    memcpy(frame_ring_data(slot), GST_BUFFER_DATA(buffer), length);
+    frame_ring_commit(ring, slot);
+    return TRUE;
+}
+
+GstPad *
+cam_frame_ring(struct pipeline_state *state)
+{
+    GstElement *queue, *sink;
+    GstPad *pad;
+
+    if (!state->ringlength) {
+        return NULL;
+    }
+
+    queue = cam_leaky_queue("ringqueue");
+    sink =  gst_element_factory_make("fakesink",    "ringsink");
+    if (!queue || !sink) {
+        return NULL;
+    }
+
+    gst_bin_add_many(GST_BIN(state->pipeline), queue, sink, NULL);
+    gst_element_link_many(queue, sink, NULL);
+
+    pad = gst_element_get_static_pad(queue, "src");
+    gst_pad_add_buffer_probe(pad, G_CALLBACK(framering_probe), state);
+    gst_object_unref(pad);
+
+    return gst_element_get_static_pad(queue, "sink");
+}
+
+/*===============================================
+ * Ring Server Thread
+ *===============================================
+ */
+static void *
+framering_server(void *arg)
+{
+    struct pipeline_state *state = arg;
+
+    while (1) {
+        int conn = accept(framering.sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        /* Allocate the ring on first use. */
+        pthread_mutex_lock(&framering.mutex);
+        if (!framering.ring && state->ringlength) {
+            framering.ring = frame_ring_create(state->ringlength, FRAME_RING_SLOT_SIZE);
+        }
+        if (framering.ring) {
+            frame_ring_send_fd(conn, framering.ring->rdfd);
+        }
+        pthread_mutex_unlock(&framering.mutex);
+        close(conn);
+    }
+    return NULL;
+}
+
+void
+framering_launch(struct pipeline_state *state)
+{
+    struct sockaddr_un addr;
+
+    framering.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (framering.sock < 0) {
+        fprintf(stderr, "Failed to create frame ring socket: %s\n", strerror(errno));
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, FRAME_RING_SOCKET, sizeof(addr.sun_path) - 1);
+    unlink(FRAME_RING_SOCKET);
+    if ((bind(framering.sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(framering.sock, 4) != 0)) {
+        fprintf(stderr, "Failed to bind frame ring socket: %s\n", strerror(errno));
+        close(framering.sock);
+        framering.sock = -1;
+        return;
+    }
+    pthread_create(&framering.thread, NULL, framering_server, state);
+}
+
+void
+framering_cleanup(struct pipeline_state *state)
+{
+    if (framering.sock >= 0) {
+        shutdown(framering.sock, SHUT_RDWR);
+        close(framering.sock);
+        unlink(FRAME_RING_SOCKET);
+        framering.sock = -1;
+    }
+}
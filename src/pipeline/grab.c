@@ -0,0 +1,665 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "jpeg-nv12.h"
+#include "nv12-scale.h"
+#include "utils.h"
+
+#define GRAB_SETTLE_FRAMES  6   /* Frames to wait after the render when buffers are not timestamped. */
+#define GRAB_SETTLE_PERIODS 2   /* Display periods between the render and the capture of a grabbed frame. */
+#define GRAB_TIMEOUT_SEC    2
+#define GRAB_JPEG_QUALITY   90
+#define GRAB_PNG_LEVEL      6
+
+/*
+ * Processed frames are grabbed by seeking the playback thread to the
+ * desired frame, and then waiting for it to reach the screencap probe.
+ * None of this blocks the main loop: the seek is started from the main
+ * loop, the probe copies the frame on the streaming thread, and an idle
+ * callback back on the main loop encodes it and completes the request.
+ * Only one grab is in flight at a time, and the rest wait in a queue.
+ *
+ * The playback position is updated as soon as the seek is requested, but
+ * the video pipeline takes a few frames to catch up. To be sure that the
+ * frame we copy is the one we asked for, the playback thread tags the time
+ * at which the target frame was first sent to the display, and the probe
+ * only accepts buffers that were captured a couple of display periods
+ * after that. If the buffers carry no timestamp, we fall back to letting a
+ * handful of frames go by after the render before copying one out.
+ *
+ * Raw frames bypass the video pipeline altogether, and are read straight
+ * out of video memory instead.
+ */
+struct grab_request {
+    struct grab_request *next;
+    struct pipeline_state *state;
+    unsigned long   frame;
+    int             format;
+    unsigned int    scale;
+    grab_callback_t callback;
+    void            *closure;
+    guint           timeout_id;
+    /* Playback state to restore once the grab is finished. */
+    int             playstate;
+    long            position;
+    long            playrate;
+    unsigned long   playstart;
+    unsigned long   playlength;
+    unsigned int    playloop;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    struct grab_request *active;    /* Request waiting for the probe, or NULL when idle. */
+    unsigned long long rendered;    /* Monotonic time (usec) that the target was first rendered, or zero. */
+    unsigned int    settle;         /* Frames remaining until the pipeline has settled. */
+    uint8_t         *data;          /* NV12 copy of the grabbed frame. */
+    unsigned int    width;
+    unsigned int    height;
+    /* Only accessed from the main loop. */
+    struct grab_request *current;   /* Request in progress. */
+    struct grab_request *head;      /* Queue of requests waiting to start. */
+    struct grab_request *tail;
+} grab = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .active = NULL,
+    .data = NULL,
+};
+
+static void grab_next(void);
+static gboolean grab_complete(gpointer data);
+
+/* Called from the playback thread whenever a frame is sent to the display. */
+void
+grab_rendered(struct pipeline_state *state)
+{
+    /* Nothing to do unless a grab is pending. */
+    if (!grab.active) {
+        return;
+    }
+
+    /* Tag the first render of the target frame, and forget it if playback moves away. */
+    pthread_mutex_lock(&grab.mutex);
+    if (grab.active && (state->position != grab.active->frame)) {
+        grab.rendered = 0;
+    }
+    else if (grab.active && !grab.rendered) {
+        grab.rendered = clock_usec(CLOCK_MONOTONIC);
+        grab.settle = GRAB_SETTLE_FRAMES;
+    }
+    pthread_mutex_unlock(&grab.mutex);
+}
+
+/* Convert a buffer timestamp into the monotonic time it was captured, or zero if unknown. */
+static unsigned long long
+grab_captured(struct pipeline_state *state, GstBuffer *buffer)
+{
+    GstClock *clock;
+    GstClockTime now, when;
+    unsigned long long mono;
+
+    if (!GST_BUFFER_TIMESTAMP_IS_VALID(buffer)) {
+        return 0;
+    }
+    clock = gst_element_get_clock(state->pipeline);
+    if (!clock) {
+        return 0;
+    }
+    mono = clock_usec(CLOCK_MONOTONIC);
+    now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+
+    when = gst_element_get_base_time(state->pipeline) + GST_BUFFER_TIMESTAMP(buffer);
+    if (when >= now) {
+        return mono;
+    }
+    return mono - (now - when) / 1000;
+}
+
+/* Called from the screencap probe for each frame leaving the video pipeline. */
+void
+grab_probe(struct pipeline_state *state, const struct nv12_frame *frame, GstBuffer *buffer)
+{
+    unsigned long long captured;
+    unsigned long period;
+    struct grab_request *req;
+    unsigned int y;
+
+    /* Nothing to do unless a grab is pending. */
+    if (!grab.active) {
+        return;
+    }
+    captured = grab_captured(state, buffer);
+    period = state->fsyncperiod ? (state->fsyncperiod / 1000) : (1000000 / LIVE_MAX_FRAMERATE);
+
+    pthread_mutex_lock(&grab.mutex);
+    req = grab.active;
+    if (!req || !grab.rendered || (state->position != req->frame)) {
+        pthread_mutex_unlock(&grab.mutex);
+        return;
+    }
+    /* Only accept a frame that was captured after the target reached the display. */
+    if (captured) {
+        if (captured < (grab.rendered + GRAB_SETTLE_PERIODS * period)) {
+            pthread_mutex_unlock(&grab.mutex);
+            return;
+        }
+    }
+    else if (grab.settle) {
+        grab.settle--;
+        pthread_mutex_unlock(&grab.mutex);
+        return;
+    }
+
+    /* Copy the frame out of the pipeline buffer. */
+    for (y = 0; y < frame->height; y++) {
+        memcpy(grab.data + y * frame->width, frame->luma + y * frame->stride, frame->width);
+    }
+    for (y = 0; y < (frame->height / 2); y++) {
+        memcpy(grab.data + (frame->height + y) * frame->width, frame->chroma + y * frame->stride, frame->width);
+    }
+    grab.width = frame->width;
+    grab.height = frame->height;
+    grab.active = NULL;
+    pthread_mutex_unlock(&grab.mutex);
+
+    /* Finish the request back on the main loop. */
+    g_idle_add(grab_complete, req);
+}
+
+/* Put playback back the way we found it. */
+static void
+grab_restore(struct grab_request *req)
+{
+    if (req->playstate == PLAYBACK_STATE_LIVE) {
+        playback_live(req->state);
+    }
+    else if (req->position >= 0) {
+        playback_resume(req->state, req->playstart, req->playrate, req->playlength, req->playloop, req->position);
+    }
+}
+
+/* Report the result of a request and start the next one. */
+static void
+grab_finish(struct grab_request *req, GArray *image, unsigned int width, unsigned int height, const char *err)
+{
+    req->callback(image, width, height, err, req->closure);
+    if (grab.current == req) {
+        grab.current = NULL;
+    }
+    free(req);
+    grab_next();
+}
+
+static gboolean
+grab_timeout(gpointer data)
+{
+    struct grab_request *req = data;
+    char err[PIPELINE_ERROR_MAXLEN];
+    int expired;
+
+    pthread_mutex_lock(&grab.mutex);
+    expired = (grab.active == req);
+    if (expired) {
+        grab.active = NULL;
+    }
+    pthread_mutex_unlock(&grab.mutex);
+    req->timeout_id = 0;
+
+    /* Otherwise, the probe got there first and the completion is already on its way. */
+    if (expired) {
+        grab_restore(req);
+        snprintf(err, sizeof(err), "timeout waiting for frame %lu", req->frame);
+        grab_finish(req, NULL, 0, 0, err);
+    }
+    return FALSE;
+}
+
+/*===============================================
+ * PNG Encoding
+ *===============================================
+ */
+static uint32_t png_crc_table[256];
+
+static uint32_t
+png_crc(uint32_t crc, const uint8_t *data, size_t len)
+{
+    size_t i;
+    if (!png_crc_table[1]) {
+        uint32_t n, k, c;
+        for (n = 0; n < 256; n++) {
+            for (c = n, k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+            }
+            png_crc_table[n] = c;
+        }
+    }
+    for (i = 0; i < len; i++) {
+        crc = png_crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void
+png_put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value >> 0;
+}
+
+static void
+png_chunk(GArray *png, const char *type, const uint8_t *data, size_t len)
+{
+    uint8_t hdr[8];
+    uint8_t trailer[4];
+    uint32_t crc;
+
+    png_put32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    crc = png_crc(0xffffffff, hdr + 4, 4);
+    crc = png_crc(crc, data, len);
+    png_put32(trailer, crc ^ 0xffffffff);
+
+    g_array_append_vals(png, hdr, sizeof(hdr));
+    g_array_append_vals(png, data, len);
+    g_array_append_vals(png, trailer, sizeof(trailer));
+}
+
+static inline uint8_t
+png_clamp(int value)
+{
+    return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+/* Convert a row of NV12 into RGB or greyscale, and apply the PNG Sub filter. */
+static void
+png_filter_row(uint8_t *out, const uint8_t *luma, const uint8_t *chroma, unsigned int width, unsigned int bpp)
+{
+    unsigned int x, i;
+
+    *out++ = 1; /* Filter type = Sub */
+    if (bpp == 1) {
+        memcpy(out, luma, width);
+    }
+    else {
+        /* Full-range BT.601 as used by JFIF, in 16-bit fixed point. */
+        for (x = 0; x < width; x++) {
+            int y = luma[x] << 16;
+            int cb = chroma[x & ~1] - 128;
+            int cr = chroma[x | 1] - 128;
+            out[x * 3 + 0] = png_clamp((y + 91881 * cr + 32768) >> 16);
+            out[x * 3 + 1] = png_clamp((y - 22554 * cb - 46802 * cr + 32768) >> 16);
+            out[x * 3 + 2] = png_clamp((y + 116130 * cb + 32768) >> 16);
+        }
+    }
+    for (i = (width * bpp) - 1; i >= bpp; i--) {
+        out[i] -= out[i - bpp];
+    }
+}
+
+static GArray *
+png_encode(const struct nv12_frame *frame, int color)
+{
+    unsigned int bpp = color ? 3 : 1;
+    size_t rowlen = 1 + frame->width * bpp;
+    GConverter *zlib;
+    GArray *png, *idat;
+    uint8_t ihdr[13];
+    uint8_t zbuf[16384];
+    uint8_t *row;
+    unsigned int y;
+
+    row = malloc(rowlen);
+    if (!row) {
+        return NULL;
+    }
+    png = g_array_sized_new(FALSE, FALSE, sizeof(guchar), (frame->width * frame->height * bpp) / 2);
+    idat = g_array_sized_new(FALSE, FALSE, sizeof(guchar), (frame->width * frame->height * bpp) / 2);
+    zlib = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, GRAB_PNG_LEVEL));
+
+    /* Compress the filtered rows into a single IDAT chunk. */
+    for (y = 0; y < frame->height; y++) {
+        GConverterFlags flags = ((y + 1) == frame->height) ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS;
+        GConverterResult result;
+        const uint8_t *in = row;
+        size_t inlen = rowlen;
+
+        png_filter_row(row, frame->luma + y * frame->stride, frame->chroma + (y / 2) * frame->stride, frame->width, bpp);
+        do {
+            GError *error = NULL;
+            gsize nread = 0, nwritten = 0;
+            result = g_converter_convert(zlib, in, inlen, zbuf, sizeof(zbuf), flags, &nread, &nwritten, &error);
+            if (result == G_CONVERTER_ERROR) {
+                fprintf(stderr, "Failed to compress PNG frame: %s\n", error->message);
+                g_error_free(error);
+                g_object_unref(zlib);
+                g_array_free(idat, TRUE);
+                g_array_free(png, TRUE);
+                free(row);
+                return NULL;
+            }
+            g_array_append_vals(idat, zbuf, nwritten);
+            in += nread;
+            inlen -= nread;
+        } while (inlen || ((flags & G_CONVERTER_INPUT_AT_END) && (result != G_CONVERTER_FINISHED)));
+    }
+    g_object_unref(zlib);
+    free(row);
+
+    /* Assemble the file. */
+    g_array_append_vals(png, "\x89PNG\r\n\x1a\n", 8);
+    png_put32(ihdr + 0, frame->width);
+    png_put32(ihdr + 4, frame->height);
+    ihdr[8] = 8;                /* Bit depth */
+    ihdr[9] = color ? 2 : 0;    /* Colour type = Truecolour or Greyscale */
+    ihdr[10] = 0;               /* Compression method = Deflate */
+    ihdr[11] = 0;               /* Filter method = Adaptive */
+    ihdr[12] = 0;               /* Interlace method = None */
+    png_chunk(png, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(png, "IDAT", (const uint8_t *)idat->data, idat->len);
+    png_chunk(png, "IEND", (const uint8_t *)"", 0);
+    g_array_free(idat, TRUE);
+    return png;
+}
+
+/*===============================================
+ * Raw DNG Readout
+ *===============================================
+ */
+static GArray *
+grab_dng(struct pipeline_state *state, unsigned long frame, unsigned int *width, unsigned int *height, char *err)
+{
+    struct fpga *fpga = state->fpga;
+    unsigned int hres = state->source.hframe;
+    unsigned int vres = state->source.vframe;
+    size_t npixels = (size_t)hres * vres;
+    uint32_t nwords = fpga->seq->frame_size;
+    struct video_segment seg, *segp;
+    unsigned long address;
+    uint8_t *raw, *fpnraw;
+    int16_t *fpn;
+    uint16_t *gain, *offset, *curve;
+    uint16_t *out;
+    GArray *dng;
+    size_t pix, col;
+    int threepoint;
+
+    /* Find the frame in video memory. */
+    pthread_mutex_lock(&state->segmutex);
+    segp = video_segment_lookup(&state->seglist, frame, &address);
+    if (segp) seg = *segp;
+    pthread_mutex_unlock(&state->segmutex);
+    if (!segp) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "frame %lu not found in video memory", frame);
+        return NULL;
+    }
+
+    raw = malloc(nwords * FPGA_FRAME_WORD_SIZE);
+    fpnraw = malloc(nwords * FPGA_FRAME_WORD_SIZE);
+    fpn = malloc(npixels * sizeof(int16_t));
+    gain = malloc(hres * sizeof(uint16_t) * 3);
+    dng = g_array_sized_new(FALSE, FALSE, sizeof(guchar), DNG_HEADER_SIZE + npixels * sizeof(uint16_t));
+    if (!raw || !fpnraw || !fpn || !gain || !dng) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "unable to allocate frame memory");
+        free(raw);
+        free(fpnraw);
+        free(fpn);
+        free(gain);
+        if (dng) g_array_free(dng, TRUE);
+        return NULL;
+    }
+    offset = gain + hres;
+    curve = offset + hres;
+    g_array_set_size(dng, DNG_HEADER_SIZE + npixels * sizeof(uint16_t));
+    out = (uint16_t *)(dng->data + DNG_HEADER_SIZE);
+
+    /* Read the frame and its calibration data. */
+    pthread_mutex_lock(&state->vrammutex);
+    fpga_vram_read(fpga, raw, address, nwords);
+    fpga_vram_read(fpga, fpnraw, fpga->display->fpn_address, nwords);
+    pthread_mutex_unlock(&state->vrammutex);
+    threepoint = (fpga->display->gainctl & DISPLAY_GAINCTL_3POINT) != 0;
+    memcpy(gain, (uint8_t *)fpga->reg + FPGA_COL_GAIN_BASE, sizeof(uint16_t) * hres);
+    if (threepoint) {
+        memcpy(offset, (uint8_t *)fpga->reg + FPGA_COL_OFFSET_BASE, sizeof(int16_t) * hres);
+        memcpy(curve, (uint8_t *)fpga->reg + FPGA_COL_CURVE_BASE, sizeof(int16_t) * hres);
+    }
+
+    /* Unpack and calibrate the pixels the same way as the display pipeline would. */
+    for (pix = 0, col = 0; (pix + 16) <= npixels; pix += 16, col += 16) {
+        if (col >= hres) col %= hres;
+        if (threepoint) {
+            neon_be12_unpack_signed(fpn + pix, fpnraw + (pix * 3) / 2);
+            neon_be12_unpack_3point(out + pix, raw + (pix * 3) / 2, fpn + pix, offset + col, gain + col, curve + col);
+        } else {
+            neon_be12_unpack_unsigned(fpn + pix, fpnraw + (pix * 3) / 2);
+            neon_be12_unpack_2point(out + pix, raw + (pix * 3) / 2, fpn + pix, gain + col);
+        }
+    }
+    free(raw);
+    free(fpnraw);
+    free(fpn);
+    free(gain);
+
+    dng_build_header(state, dng->data, hres, vres, &seg);
+    *width = hres;
+    *height = vres;
+    return dng;
+}
+
+/*===============================================
+ * Frame Grabbing
+ *===============================================
+ */
+static GArray *
+grab_encode(struct pipeline_state *state, int format, unsigned int scale, unsigned int *width, unsigned int *height)
+{
+    struct nv12_frame full, scaled;
+    struct jpeg_nv12 *enc;
+    const uint8_t *jpeg;
+    uint8_t *scratch;
+    GArray *result;
+    ssize_t length;
+
+    /* Downscale the frame by the desired factor. */
+    nv12_frame_init(&full, grab.data, grab.width, grab.height);
+    scratch = malloc(NV12_SCALE_SCRATCH(grab.width, grab.height));
+    if (!scratch) {
+        return NULL;
+    }
+    nv12_scale(&scaled, &full, grab.width / scale, grab.height / scale, scratch);
+
+    if (format == GRAB_FORMAT_PNG) {
+        result = png_encode(&scaled, state->source.color);
+    }
+    else {
+        result = NULL;
+        enc = jpeg_nv12_new(scaled.width, GRAB_JPEG_QUALITY);
+        if (enc) {
+            length = jpeg_nv12_encode(enc, scaled.luma, scaled.chroma, scaled.width, scaled.height, scaled.stride, &jpeg);
+            if (length > 0) {
+                result = g_array_sized_new(FALSE, FALSE, sizeof(guchar), length);
+                g_array_append_vals(result, jpeg, length);
+            }
+            jpeg_nv12_free(enc);
+        }
+    }
+    free(scratch);
+    if (result) {
+        *width = scaled.width;
+        *height = scaled.height;
+    }
+    return result;
+}
+
+/* Idle callback to finish a request once the probe has copied its frame. */
+static gboolean
+grab_complete(gpointer data)
+{
+    struct grab_request *req = data;
+    char err[PIPELINE_ERROR_MAXLEN] = "";
+    unsigned int width = 0, height = 0;
+    GArray *image;
+
+    if (req->timeout_id) {
+        g_source_remove(req->timeout_id);
+        req->timeout_id = 0;
+    }
+    grab_restore(req);
+
+    image = grab_encode(req->state, req->format, req->scale, &width, &height);
+    if (!image) {
+        snprintf(err, sizeof(err), "failed to encode frame %lu", req->frame);
+    }
+    grab_finish(req, image, width, height, err);
+    return FALSE;
+}
+
+/* Check if frames can be grabbed from the video pipeline right now. */
+static int
+grab_check(struct pipeline_state *state, unsigned long frame, char *err)
+{
+    if ((state->playstate == PLAYBACK_STATE_FILESAVE) || PIPELINE_IS_SAVING(state->runmode)) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "unable to grab frames while saving");
+        return -1;
+    }
+    if (frame >= state->seglist.totalframes) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "invalid frame number %lu", frame);
+        return -1;
+    }
+    return 0;
+}
+
+/* Start seeking for the next request in the queue. */
+static void
+grab_next(void)
+{
+    char err[PIPELINE_ERROR_MAXLEN];
+
+    while (!grab.current && grab.head) {
+        struct grab_request *req = grab.head;
+        struct pipeline_state *state = req->state;
+
+        grab.head = req->next;
+        if (!grab.head) grab.tail = NULL;
+        grab.current = req;
+
+        /* Things may have changed while the request was queued. */
+        if (grab_check(state, req->frame, err) != 0) {
+            grab_finish(req, NULL, 0, 0, err);
+            return;
+        }
+        if (state->playstate == PLAYBACK_STATE_PAUSE) {
+            grab_finish(req, NULL, 0, 0, "video pipeline is paused");
+            return;
+        }
+        if (!grab.data) {
+            grab.data = malloc((PIPELINE_MAX_HRES * PIPELINE_MAX_VRES * 3) / 2);
+            if (!grab.data) {
+                grab_finish(req, NULL, 0, 0, "unable to allocate frame memory");
+                return;
+            }
+        }
+
+        req->playstate = state->playstate;
+        req->position = state->position;
+        req->playrate = state->playrate;
+        req->playstart = state->playstart;
+        req->playlength = state->playlength;
+        req->playloop = state->playloop;
+
+        pthread_mutex_lock(&grab.mutex);
+        grab.active = req;
+        grab.rendered = 0;
+        grab.settle = GRAB_SETTLE_FRAMES;
+        pthread_mutex_unlock(&grab.mutex);
+
+        /* Pause on the desired frame, and give up if it never arrives. */
+        req->timeout_id = g_timeout_add(GRAB_TIMEOUT_SEC * 1000, grab_timeout, req);
+        playback_play(state, req->frame, 0);
+    }
+}
+
+/*
+ * Start grabbing a frame. Returns zero if the callback has been, or will
+ * later be, invoked with the result, or -1 if the request was rejected.
+ */
+int
+grab_frame(struct pipeline_state *state, unsigned long frame, int format, unsigned int scale,
+           grab_callback_t callback, void *closure, char *err)
+{
+    struct grab_request *req;
+
+    if (grab_check(state, frame, err) != 0) {
+        return -1;
+    }
+    if (scale < 1) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "invalid scale factor %u", scale);
+        return -1;
+    }
+
+    /* Raw frames can be read directly from video memory, but only at full resolution. */
+    if (format == GRAB_FORMAT_DNG) {
+        unsigned int width, height;
+        GArray *dng;
+
+        if (scale != 1) {
+            snprintf(err, PIPELINE_ERROR_MAXLEN, "DNG frames cannot be scaled");
+            return -1;
+        }
+        dng = grab_dng(state, frame, &width, &height, err);
+        if (!dng) {
+            return -1;
+        }
+        callback(dng, width, height, "", closure);
+        return 0;
+    }
+
+    /* Otherwise, we need to get the frame out of the video pipeline. */
+    if (state->playstate == PLAYBACK_STATE_PAUSE) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "video pipeline is paused");
+        return -1;
+    }
+    req = calloc(1, sizeof(struct grab_request));
+    if (!req) {
+        snprintf(err, PIPELINE_ERROR_MAXLEN, "unable to allocate frame memory");
+        return -1;
+    }
+    req->state = state;
+    req->frame = frame;
+    req->format = format;
+    req->scale = scale;
+    req->callback = callback;
+    req->closure = closure;
+
+    /* Queue it up, and start it if nothing else is in progress. */
+    if (grab.tail) grab.tail->next = req;
+    else grab.head = req;
+    grab.tail = req;
+    grab_next();
+    return 0;
+}
@@ -51,10 +51,19 @@
 #include <gst/controller/gstcontroller.h>
 
 #include "gstneon.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_neon_debug);
 #define GST_CAT_DEFAULT gst_neon_debug
 
+#define DEFAULT_POOL_SIZE   4
+#define POOL_ALIGN          64      /* Cortex-A8 cache line size. */
+#define POOL_GRANULE        16384   /* Round allocations up so that varying frame sizes can share blocks. */
+
 /* Filter signals and args */
 enum {
   LAST_SIGNAL
@@ -62,7 +71,15 @@ enum {
 
 enum {
   PROP_0,
-  PROP_SILENT
+  PROP_SILENT,
+  PROP_MODE,
+  PROP_POOL_SIZE,
+  PROP_COPIES,
+  PROP_SKIPPED,
+  PROP_BYTES,
+  PROP_ALLOCATIONS,
+  PROP_COPY_RATE,
+  PROP_BYTE_RATE,
 };
 
 /* Nothing to see here, only the identity transformation. */
@@ -78,6 +95,25 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
     GST_STATIC_CAPS ("ANY")
     );
 
+#define GST_TYPE_NEON_COPY_MODE (gst_neon_copy_mode_get_type())
+
+static const GEnumValue neon_copy_modes[] = {
+  {GST_NEON_COPY_ALWAYS, "Copy every buffer", "copy"},
+  {GST_NEON_COPY_AUTO, "Pass through buffers already in cached memory", "auto"},
+  {0, NULL, NULL},
+};
+
+static GType
+gst_neon_copy_mode_get_type (void)
+{
+  static GType neon_copy_mode_type = 0;
+
+  if (!neon_copy_mode_type) {
+    neon_copy_mode_type = g_enum_register_static("GstNeonCopyMode", neon_copy_modes);
+  }
+  return neon_copy_mode_type;
+}
+
 #define DEBUG_INIT(bla) \
   GST_DEBUG_CATEGORY_INIT (gst_neon_debug, "plugin", 0, "NEON Magic Transformations")
 
@@ -87,9 +123,128 @@ static void gst_neon_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
 static void gst_neon_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
+static void gst_neon_finalize (GObject *object);
 
+static GstFlowReturn gst_neon_prepare_output_buffer (GstBaseTransform *trans, GstBuffer *input,
+    gint size, GstCaps *caps, GstBuffer **buf);
 static GstFlowReturn gst_neon_transform (GstBaseTransform *trans, GstBuffer *src, GstBuffer *dst);
 
+/*=========================================================
+ * Output Buffer Pool
+ *=========================================================
+ */
+/*
+ * Output buffers are allocated from blocks of cache-line aligned memory,
+ * each of which begins with a header that leads back to the pool, so that
+ * the free function of the GstBuffer can return the block to the pool once
+ * downstream is done with it. The pool is reference counted by each block
+ * in use, since buffers can outlive the element that produced them.
+ */
+struct gst_neon_block {
+  struct gst_neon_pool *pool;
+  struct gst_neon_block *next;
+  gsize capacity;
+};
+
+struct gst_neon_pool {
+  pthread_mutex_t mutex;
+  gint refcount;
+  gboolean closed;
+  guint max;                    /* Maximum number of free blocks to keep. */
+  guint count;                  /* Number of free blocks. */
+  struct gst_neon_block *free;
+};
+
+#define GST_NEON_BLOCK_DATA(_blk_)  ((guint8 *)(_blk_) + POOL_ALIGN)
+#define GST_NEON_DATA_BLOCK(_data_) ((struct gst_neon_block *)((guint8 *)(_data_) - POOL_ALIGN))
+
+static struct gst_neon_pool *
+gst_neon_pool_new(guint max)
+{
+  struct gst_neon_pool *pool = g_new0(struct gst_neon_pool, 1);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pool->refcount = 1;
+  pool->max = max;
+  return pool;
+}
+
+static void
+gst_neon_pool_unref(struct gst_neon_pool *pool)
+{
+  if (g_atomic_int_dec_and_test(&pool->refcount)) {
+    pthread_mutex_destroy(&pool->mutex);
+    g_free(pool);
+  }
+}
+
+/* Stop recycling blocks, and release everything on the free list. */
+static void
+gst_neon_pool_close(struct gst_neon_pool *pool)
+{
+  struct gst_neon_block *blk;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->closed = TRUE;
+  while ((blk = pool->free) != NULL) {
+    pool->free = blk->next;
+    free(blk);
+  }
+  pool->count = 0;
+  pthread_mutex_unlock(&pool->mutex);
+  gst_neon_pool_unref(pool);
+}
+
+/* Take a free block of at least the requested size, or allocate one if there is none. */
+static guint8 *
+gst_neon_pool_acquire(struct gst_neon_pool *pool, gsize size, gboolean *fresh)
+{
+  struct gst_neon_block *blk, **prev;
+  void *mem;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (prev = &pool->free; (blk = *prev) != NULL; prev = &blk->next) {
+    if (blk->capacity >= size) {
+      *prev = blk->next;
+      pool->count--;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  *fresh = (blk == NULL);
+  if (!blk) {
+    gsize capacity = (size + POOL_GRANULE - 1) & ~(gsize)(POOL_GRANULE - 1);
+    if (posix_memalign(&mem, POOL_ALIGN, POOL_ALIGN + capacity) != 0) {
+      return NULL;
+    }
+    blk = mem;
+    blk->pool = pool;
+    blk->capacity = capacity;
+  }
+  g_atomic_int_inc(&pool->refcount);
+  return GST_NEON_BLOCK_DATA(blk);
+}
+
+/* GstBuffer free function, which recycles the block unless the pool is full or closed. */
+static void
+gst_neon_pool_release(gpointer data)
+{
+  struct gst_neon_block *blk = GST_NEON_DATA_BLOCK(data);
+  struct gst_neon_pool *pool = blk->pool;
+
+  pthread_mutex_lock(&pool->mutex);
+  if (!pool->closed && (pool->count < pool->max)) {
+    blk->next = pool->free;
+    pool->free = blk;
+    pool->count++;
+    blk = NULL;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  free(blk);
+  gst_neon_pool_unref(pool);
+}
+
 /* GObject vmethod implementations */
 static void
 gst_neon_base_init (gpointer gclass)
@@ -117,11 +272,39 @@ gst_neon_class_init(GstNeonClass *kclass)
   gobject_class = (GObjectClass *)kclass;
   gobject_class->set_property = gst_neon_set_property;
   gobject_class->get_property = gst_neon_get_property;
+  gobject_class->finalize = gst_neon_finalize;
 
   g_object_class_install_property(gobject_class, PROP_SILENT,
       g_param_spec_boolean("silent", "Silent", "Produce verbose output ?",
           TRUE, G_PARAM_READWRITE));
-  
+  g_object_class_install_property(gobject_class, PROP_MODE,
+      g_param_spec_enum("mode", "Mode", "Whether to copy buffers that are already in cached memory",
+          GST_TYPE_NEON_COPY_MODE, GST_NEON_COPY_ALWAYS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(gobject_class, PROP_POOL_SIZE,
+      g_param_spec_uint("pool-size", "Pool size", "Maximum number of free output buffers to keep for reuse",
+          0, G_MAXUINT, DEFAULT_POOL_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_COPIES,
+      g_param_spec_uint64("copies", "Copies", "Number of buffers copied",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_SKIPPED,
+      g_param_spec_uint64("skipped", "Skipped", "Number of buffers passed through without a copy",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_BYTES,
+      g_param_spec_uint64("bytes", "Bytes", "Number of bytes copied",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_ALLOCATIONS,
+      g_param_spec_uint64("allocations", "Allocations", "Number of output buffers that could not be taken from the pool",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_COPY_RATE,
+      g_param_spec_double("copy-rate", "Copy rate", "Buffers copied per second, averaged over the last second",
+          0, G_MAXDOUBLE, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_BYTE_RATE,
+      g_param_spec_double("byte-rate", "Byte rate", "Bytes copied per second, averaged over the last second",
+          0, G_MAXDOUBLE, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  GST_BASE_TRANSFORM_CLASS(kclass)->prepare_output_buffer = GST_DEBUG_FUNCPTR(gst_neon_prepare_output_buffer);
   GST_BASE_TRANSFORM_CLASS(kclass)->transform = GST_DEBUG_FUNCPTR(gst_neon_transform);
 }
 
@@ -134,6 +317,27 @@ static void
 gst_neon_init(GstNeon * filter, GstNeonClass * gclass)
 {
   filter->silent = TRUE;
+  filter->mode = GST_NEON_COPY_ALWAYS;
+  filter->pool = gst_neon_pool_new(DEFAULT_POOL_SIZE);
+  filter->copies = 0;
+  filter->skipped = 0;
+  filter->bytes = 0;
+  filter->allocations = 0;
+  filter->window = 0;
+  filter->wcopies = 0;
+  filter->wbytes = 0;
+  filter->copyrate = 0;
+  filter->byterate = 0;
+}
+
+static void
+gst_neon_finalize(GObject *object)
+{
+  GstNeon *filter = GST_NEON(object);
+
+  /* Buffers still held downstream keep the pool alive until they are freed. */
+  gst_neon_pool_close(filter->pool);
+  G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 static void
@@ -146,6 +350,14 @@ gst_neon_set_property(GObject *object, guint prop_id,
     case PROP_SILENT:
       filter->silent = g_value_get_boolean (value);
       break;
+    case PROP_MODE:
+      filter->mode = g_value_get_enum (value);
+      break;
+    case PROP_POOL_SIZE:
+      pthread_mutex_lock(&filter->pool->mutex);
+      filter->pool->max = g_value_get_uint (value);
+      pthread_mutex_unlock(&filter->pool->mutex);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -158,14 +370,118 @@ gst_neon_get_property(GObject *object, guint prop_id,
 {
   GstNeon *filter = GST_NEON(object);
 
+  GST_OBJECT_LOCK(filter);
   switch (prop_id) {
     case PROP_SILENT:
       g_value_set_boolean(value, filter->silent);
       break;
+    case PROP_MODE:
+      g_value_set_enum(value, filter->mode);
+      break;
+    case PROP_POOL_SIZE:
+      g_value_set_uint(value, filter->pool->max);
+      break;
+    case PROP_COPIES:
+      g_value_set_uint64(value, filter->copies);
+      break;
+    case PROP_SKIPPED:
+      g_value_set_uint64(value, filter->skipped);
+      break;
+    case PROP_BYTES:
+      g_value_set_uint64(value, filter->bytes);
+      break;
+    case PROP_ALLOCATIONS:
+      g_value_set_uint64(value, filter->allocations);
+      break;
+    case PROP_COPY_RATE:
+      g_value_set_double(value, filter->copyrate);
+      break;
+    case PROP_BYTE_RATE:
+      g_value_set_double(value, filter->byterate);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
+  GST_OBJECT_UNLOCK(filter);
+}
+
+/*
+ * Buffers from the OMX components wrap their uncached memory without any
+ * malloc data, whereas anything allocated by GStreamer, including our own
+ * output, comes from the cached heap and is already cheap to read. This is
+ * only a heuristic, and it has not been measured on hardware, so the auto
+ * mode must be selected explicitly.
+ */
+static gboolean
+gst_neon_buffer_is_cached(GstBuffer *buf)
+{
+  return GST_BUFFER_MALLOCDATA(buf) != NULL;
+}
+
+static GstFlowReturn
+gst_neon_prepare_output_buffer(GstBaseTransform *trans, GstBuffer *input,
+    gint size, GstCaps *caps, GstBuffer **buf)
+{
+  GstNeon *filter = GST_NEON(trans);
+  GstBuffer *outbuf;
+  gboolean fresh;
+  guint8 *data;
+
+  /* Hand the input straight back when a copy would gain nothing. */
+  if ((filter->mode == GST_NEON_COPY_AUTO) && gst_neon_buffer_is_cached(input)) {
+    *buf = gst_buffer_ref(input);
+    return GST_FLOW_OK;
+  }
+
+  data = gst_neon_pool_acquire(filter->pool, GST_BUFFER_SIZE(input), &fresh);
+  if (!data) {
+    GST_ELEMENT_ERROR(filter, RESOURCE, NO_SPACE_LEFT, (NULL), ("Failed to allocate %u bytes", GST_BUFFER_SIZE(input)));
+    return GST_FLOW_ERROR;
+  }
+  outbuf = gst_buffer_new();
+  GST_BUFFER_DATA(outbuf) = data;
+  GST_BUFFER_MALLOCDATA(outbuf) = data;
+  GST_BUFFER_FREE_FUNC(outbuf) = gst_neon_pool_release;
+  GST_BUFFER_SIZE(outbuf) = GST_BUFFER_SIZE(input);
+  gst_buffer_copy_metadata(outbuf, input, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+  gst_buffer_set_caps(outbuf, caps);
+
+  if (fresh) {
+    GST_OBJECT_LOCK(filter);
+    filter->allocations++;
+    GST_OBJECT_UNLOCK(filter);
+  }
+  *buf = outbuf;
+  return GST_FLOW_OK;
+}
+
+/* Update the copy counters, and the rates once per second. */
+static void
+gst_neon_account(GstNeon *filter, gboolean copied, guint size)
+{
+  guint64 now = clock_usec(CLOCK_MONOTONIC);
+
+  GST_OBJECT_LOCK(filter);
+  if (copied) {
+    filter->copies++;
+    filter->bytes += size;
+    filter->wcopies++;
+    filter->wbytes += size;
+  } else {
+    filter->skipped++;
+  }
+  if (!filter->window) {
+    filter->window = now;
+  }
+  else if ((now - filter->window) >= 1000000) {
+    filter->copyrate = (filter->wcopies * 1000000.0) / (now - filter->window);
+    filter->byterate = (filter->wbytes * 1000000.0) / (now - filter->window);
+    filter->wcopies = 0;
+    filter->wbytes = 0;
+    filter->window = now;
+  }
+  GST_OBJECT_UNLOCK(filter);
 }
 
 static GstFlowReturn
@@ -176,19 +492,27 @@ gst_neon_transform(GstBaseTransform *base, GstBuffer *src, GstBuffer *dst)
   void *srcdata = GST_BUFFER_DATA(src);
   void *dstdata = GST_BUFFER_DATA(dst);
 
+  /* Passed through by gst_neon_prepare_output_buffer() */
+  if (src == dst) {
+    gst_neon_account(filter, FALSE, 0);
+    return GST_FLOW_OK;
+  }
+
   if (filter->silent == FALSE)
     g_print ("DEBUG(%s): duping %u bytes from %p to %p\n", __func__, size, srcdata, dstdata);
 
+  gst_neon_account(filter, TRUE, size);
+
   /* Copy 64-byte chunks using NEON. */
   if (size >= 64) {
     asm volatile (
         "   subs %[count],%[count], #64 \n"
-      "realloc_memcpy_loop:             \n"
+      "realloc_memcpy_loop%=:           \n"
         "   pld [%[s], #0xc0]           \n"
         "   vldm %[s]!,{d0-d7}          \n"
         "   vstm %[d]!,{d0-d7}          \n"
         "   subs %[count],%[count], #64 \n"
-        "   bge realloc_memcpy_loop     \n"
+        "   bge realloc_memcpy_loop%=   \n"
         "   add %[count],%[count], #64  \n"
         : [d]"+r"(dstdata), [s]"+r"(srcdata), [count]"+r"(size)
         :: "cc", "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7" );
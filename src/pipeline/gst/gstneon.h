@@ -49,6 +49,10 @@
 #include <gst/gst.h>
 #include <gst/base/gstbasetransform.h>
 
+#include "image-stats.h"
+#include "motion.h"
+#include "nv12-scale.h"
+
 G_BEGIN_DECLS
 
 /*=========================================================
@@ -64,10 +68,30 @@ G_BEGIN_DECLS
 typedef struct _GstNeon      GstNeon;
 typedef struct _GstNeonClass GstNeonClass;
 
+typedef enum {
+  GST_NEON_COPY_ALWAYS,
+  GST_NEON_COPY_AUTO
+} GstNeonCopyMode;
+
+struct gst_neon_pool;
+
 struct _GstNeon {
   GstBaseTransform element;
   GstPad *sinkpad, *srcpad;
   gboolean silent;
+  GstNeonCopyMode mode;
+  struct gst_neon_pool *pool; /* Recycled output buffers. */
+
+  /* Copy statistics, protected by the object lock. */
+  guint64 copies;
+  guint64 skipped;
+  guint64 bytes;
+  guint64 allocations;
+  guint64 window;     /* Monotonic time that the current rate window started. */
+  guint64 wcopies;    /* Copies and bytes within the current rate window. */
+  guint64 wbytes;
+  gdouble copyrate;
+  gdouble byterate;
 };
 
 struct _GstNeonClass {
@@ -87,6 +111,11 @@ typedef enum {
   GST_NEON_FLIP_METHOD_180
 } GstNeonFlipMethod;
 
+#define GST_TYPE_NEON_FLIP_METHOD \
+  (gst_neon_flip_method_get_type())
+
+GType gst_neon_flip_method_get_type (void);
+
 #define GST_TYPE_NEON_FLIP \
   (gst_neon_flip_get_type())
 #define GST_NEON_FLIP(obj) \
@@ -145,6 +174,115 @@ struct _GstNeonCropClass {
 
 GType gst_neon_crop_get_type (void);
 
+/*=========================================================
+ * NEON Accelerated Image Statistics Element
+ *=========================================================
+ */
+#define GST_TYPE_NEON_STATS \
+  (gst_neon_stats_get_type())
+#define GST_NEON_STATS(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_NEON_STATS,GstNeonStats))
+#define GST_NEON_STATS_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_NEON_STATS,GstNeonStatsClass))
+#define GST_IS_NEON_STATS(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_NEON_STATS))
+#define GST_IS_NEON_STATS_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_NEON_STATS))
+
+typedef struct _GstNeonStats      GstNeonStats;
+typedef struct _GstNeonStatsClass GstNeonStatsClass;
+
+struct _GstNeonStats {
+  GstBaseTransform element;
+
+  guint interval;     /* Milliseconds between analyzed frames. */
+  guint budget;       /* Microseconds of CPU time per analyzed frame. */
+  guint step;         /* Current subsampling step. */
+  struct image_window meter;
+  guint64 last;       /* Monotonic time of the last analyzed frame. */
+  gpointer scratch;
+  gsize scratchsize;
+
+  /* Most recent results, protected by the object lock. */
+  struct image_stats results;
+};
+
+struct _GstNeonStatsClass {
+  GstBaseTransformClass parent_class;
+};
+
+GType gst_neon_stats_get_type (void);
+gboolean gst_neon_stats_get_results (GstNeonStats *filter, struct image_stats *stats);
+
+/*=========================================================
+ * NEON Accelerated Motion Detection Element
+ *=========================================================
+ */
+#define GST_TYPE_NEON_MOTION \
+  (gst_neon_motion_get_type())
+#define GST_NEON_MOTION(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_NEON_MOTION,GstNeonMotion))
+#define GST_NEON_MOTION_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_NEON_MOTION,GstNeonMotionClass))
+#define GST_IS_NEON_MOTION(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_NEON_MOTION))
+#define GST_IS_NEON_MOTION_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_NEON_MOTION))
+
+typedef struct _GstNeonMotion      GstNeonMotion;
+typedef struct _GstNeonMotionClass GstNeonMotionClass;
+
+struct _GstNeonMotion {
+  GstBaseTransform element;
+
+  guint interval;     /* Milliseconds between score reports. */
+  guint64 last;       /* Monotonic time of the last score report. */
+
+  /* Detector state and results, protected by the object lock. */
+  struct motion_detector detector;
+};
+
+struct _GstNeonMotionClass {
+  GstBaseTransformClass parent_class;
+};
+
+GType gst_neon_motion_get_type (void);
+void gst_neon_motion_get_results (GstNeonMotion *filter, struct motion_results *results);
+
+/*=========================================================
+ * NEON Accelerated Video Crop/Pad/Flip Element
+ *=========================================================
+ */
+#define GST_TYPE_NEON_XFORM \
+  (gst_neon_xform_get_type())
+#define GST_NEON_XFORM(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_NEON_XFORM,GstNeonXform))
+#define GST_NEON_XFORM_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_NEON_XFORM,GstNeonXformClass))
+#define GST_IS_NEON_XFORM(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_NEON_XFORM))
+#define GST_IS_NEON_XFORM_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_NEON_XFORM))
+
+typedef struct _GstNeonXform      GstNeonXform;
+typedef struct _GstNeonXformClass GstNeonXformClass;
+
+struct _GstNeonXform {
+  GstBaseTransform element;
+
+  gint left;          /* Pixels to crop from the left. */
+  gint right;         /* Pixels to crop from the right. */
+  gint top;           /* Pixels to crop from the top, or pad when negative. */
+  gint bottom;        /* Pixels to crop from the bottom, or pad when negative. */
+  GstNeonFlipMethod method;
+};
+
+struct _GstNeonXformClass {
+  GstBaseTransformClass parent_class;
+};
+
+GType gst_neon_xform_get_type (void);
+
 G_END_DECLS
 
 #endif /* __GST_NEON_H__ */
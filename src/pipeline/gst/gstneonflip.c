@@ -60,8 +60,6 @@ static GstStaticPadTemplate src_template =
                 GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
         );
 
-#define GST_TYPE_NEON_FLIP_METHOD (gst_neon_flip_method_get_type())
-
 static const GEnumValue neon_flip_methods[] = {
   {GST_NEON_FLIP_METHOD_IDENTITY, "Identity (no rotation)", "none"},
   {GST_NEON_FLIP_METHOD_HORIZ, "Flip horizontally", "horizontal-flip"},
@@ -70,7 +68,7 @@ static const GEnumValue neon_flip_methods[] = {
   {0, NULL, NULL},
 };
 
-static GType
+GType
 gst_neon_flip_method_get_type (void)
 {
   static GType neon_flip_method_type = 0;
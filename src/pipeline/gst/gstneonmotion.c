@@ -0,0 +1,305 @@
+/*
+ * GStreamer
+ * Copyright (C) 2006 Stefan Kost <ensonic@users.sf.net>
+ * Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/controller/gstcontroller.h>
+#include <gst/video/video.h>
+
+#include "gstneon.h"
+#include "utils.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_neon_motion_debug);
+#define GST_CAT_DEFAULT gst_neon_motion_debug
+
+#define DEFAULT_INTERVAL  100   /* Milliseconds */
+
+/* Filter signals and args */
+enum
+{
+  LAST_SIGNAL
+};
+
+enum
+{
+  PROP_0,
+  PROP_INTERVAL,
+  PROP_LEVEL,
+  PROP_THRESHOLD,
+  PROP_FRAMES,
+  PROP_REGION_X,
+  PROP_REGION_Y,
+  PROP_REGION_WIDTH,
+  PROP_REGION_HEIGHT,
+};
+
+static GstStaticPadTemplate sink_template =
+        GST_STATIC_PAD_TEMPLATE ("sink",
+                GST_PAD_SINK,
+                GST_PAD_ALWAYS,
+                GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
+        );
+
+static GstStaticPadTemplate src_template =
+        GST_STATIC_PAD_TEMPLATE ("src",
+                GST_PAD_SRC,
+                GST_PAD_ALWAYS,
+                GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
+        );
+
+#define DEBUG_INIT(bla) \
+  GST_DEBUG_CATEGORY_INIT (gst_neon_motion_debug, "neonmotion", 0, "NEON motion detection");
+
+GST_BOILERPLATE_FULL (GstNeonMotion, gst_neon_motion, GstBaseTransform,
+    GST_TYPE_BASE_TRANSFORM, DEBUG_INIT);
+
+static void gst_neon_motion_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
+static void gst_neon_motion_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static void gst_neon_motion_finalize(GObject *object);
+static GstFlowReturn gst_neon_motion_transform_ip(GstBaseTransform *base, GstBuffer *outbuf);
+
+/* GObject vmethod implementations */
+static void
+gst_neon_motion_base_init(gpointer klass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+
+  gst_element_class_set_details_simple(element_class,
+    "neonmotion",
+    "Filter/Analyzer/Video",
+    "Motion detection by block differences of the luma",
+    "Kron Technologies Inc <http://www.krontech.ca>");
+
+  gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&src_template));
+  gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&sink_template));
+}
+
+/* initialize the plugin's class */
+static void
+gst_neon_motion_class_init(GstNeonMotionClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gobject_class->set_property = gst_neon_motion_set_property;
+  gobject_class->get_property = gst_neon_motion_get_property;
+  gobject_class->finalize = gst_neon_motion_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_INTERVAL,
+      g_param_spec_uint ("interval", "interval",
+          "Minimum time between reports of the motion score in milliseconds, or zero to report every frame",
+          0, G_MAXUINT, DEFAULT_INTERVAL,
+          GST_PARAM_CONTROLLABLE | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LEVEL,
+      g_param_spec_uint ("level", "level",
+          "Change in the mean luma of a block that counts as motion",
+          0, 255, 12, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THRESHOLD,
+      g_param_spec_double ("threshold", "threshold",
+          "Percentage of the blocks in the region which must change to count as motion",
+          0.0, 100.0, 2.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FRAMES,
+      g_param_spec_uint ("frames", "frames",
+          "Consecutive frames of motion needed to detect motion",
+          1, G_MAXUINT, 3, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_REGION_X,
+      g_param_spec_uint ("region-x", "region-x", "Horizontal offset of the region to watch",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_REGION_Y,
+      g_param_spec_uint ("region-y", "region-y", "Vertical offset of the region to watch",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_REGION_WIDTH,
+      g_param_spec_uint ("region-width", "region-width", "Width of the region to watch, or zero for the whole frame",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_REGION_HEIGHT,
+      g_param_spec_uint ("region-height", "region-height", "Height of the region to watch, or zero for the whole frame",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  GST_BASE_TRANSFORM_CLASS (klass)->transform_ip = GST_DEBUG_FUNCPTR(gst_neon_motion_transform_ip);
+}
+
+/* initialize the new element
+ * initialize instance structure
+ */
+static void
+gst_neon_motion_init (GstNeonMotion *filter, GstNeonMotionClass * klass)
+{
+  filter->interval = DEFAULT_INTERVAL;
+  filter->last = 0;
+  motion_init(&filter->detector);
+
+  /* We only ever read the frames, so never ask for a writable copy of a buffer shared with a tee. */
+  gst_base_transform_set_passthrough(GST_BASE_TRANSFORM_CAST(filter), TRUE);
+}
+
+static void
+gst_neon_motion_finalize(GObject *object)
+{
+  GstNeonMotion *filter = GST_NEON_MOTION(object);
+
+  motion_free(&filter->detector);
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_neon_motion_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+  GstNeonMotion *filter = GST_NEON_MOTION(object);
+  struct motion_detector *md = &filter->detector;
+
+  GST_OBJECT_LOCK(filter);
+  switch (prop_id) {
+    case PROP_INTERVAL:
+      filter->interval = g_value_get_uint(value);
+      break;
+    case PROP_LEVEL:
+      md->level = g_value_get_uint(value);
+      break;
+    case PROP_THRESHOLD:
+      md->threshold = g_value_get_double(value);
+      break;
+    case PROP_FRAMES:
+      md->frames = g_value_get_uint(value);
+      break;
+    case PROP_REGION_X:
+      md->region.x = g_value_get_uint(value);
+      break;
+    case PROP_REGION_Y:
+      md->region.y = g_value_get_uint(value);
+      break;
+    case PROP_REGION_WIDTH:
+      md->region.width = g_value_get_uint(value);
+      break;
+    case PROP_REGION_HEIGHT:
+      md->region.height = g_value_get_uint(value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK(filter);
+}
+
+static void
+gst_neon_motion_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+  GstNeonMotion *filter = GST_NEON_MOTION(object);
+  struct motion_detector *md = &filter->detector;
+
+  GST_OBJECT_LOCK(filter);
+  switch (prop_id) {
+    case PROP_INTERVAL:
+      g_value_set_uint(value, filter->interval);
+      break;
+    case PROP_LEVEL:
+      g_value_set_uint(value, md->level);
+      break;
+    case PROP_THRESHOLD:
+      g_value_set_double(value, md->threshold);
+      break;
+    case PROP_FRAMES:
+      g_value_set_uint(value, md->frames);
+      break;
+    case PROP_REGION_X:
+      g_value_set_uint(value, md->region.x);
+      break;
+    case PROP_REGION_Y:
+      g_value_set_uint(value, md->region.y);
+      break;
+    case PROP_REGION_WIDTH:
+      g_value_set_uint(value, md->region.width);
+      break;
+    case PROP_REGION_HEIGHT:
+      g_value_set_uint(value, md->region.height);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK(filter);
+}
+
+/* Copy out the most recent results. */
+void
+gst_neon_motion_get_results(GstNeonMotion *filter, struct motion_results *results)
+{
+  GST_OBJECT_LOCK(filter);
+  memcpy(results, &filter->detector.results, sizeof(struct motion_results));
+  GST_OBJECT_UNLOCK(filter);
+}
+
+/* GstBaseTransform vmethod implementations */
+static GstFlowReturn
+gst_neon_motion_transform_ip(GstBaseTransform *base, GstBuffer *outbuf)
+{
+  GstNeonMotion *filter = GST_NEON_MOTION(base);
+  GstStructure *gstruct = gst_caps_get_structure(GST_BUFFER_CAPS(outbuf), 0);
+  unsigned int xres = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+  unsigned int yres = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+  struct motion_results results;
+  guint64 now;
+  int detected;
+
+  if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_TIMESTAMP(outbuf)))
+    gst_object_sync_values(G_OBJECT(filter), GST_BUFFER_TIMESTAMP(outbuf));
+
+  if ((GST_BUFFER_SIZE(outbuf) < (xres * yres)) || (xres < 1) || (yres < 1)) {
+    return GST_FLOW_OK;
+  }
+
+  /*
+   * Timestamp the frames by wall time on arrival, since the live source
+   * does not always provide timestamps, and so that the application can
+   * measure its own latency from the onset of the motion.
+   */
+  now = clock_usec(CLOCK_MONOTONIC);
+  GST_OBJECT_LOCK(filter);
+  detected = motion_update(&filter->detector, GST_BUFFER_DATA(outbuf), xres, yres, xres, now);
+  memcpy(&results, &filter->detector.results, sizeof(struct motion_results));
+  GST_OBJECT_UNLOCK(filter);
+
+  /* Report detections immediately, and otherwise rate limit the score updates. */
+  if (!detected && filter->last && ((now - filter->last) < (filter->interval * 1000ULL))) {
+    return GST_FLOW_OK;
+  }
+  filter->last = now;
+  if (detected) {
+    GST_DEBUG_OBJECT(filter, "Motion detected %llu us after onset", (unsigned long long)results.latency);
+  }
+
+  gst_element_post_message(GST_ELEMENT_CAST(filter),
+      gst_message_new_element(GST_OBJECT_CAST(filter),
+          gst_structure_new("neonmotion",
+              "detected", G_TYPE_BOOLEAN, detected ? TRUE : FALSE,
+              "score", G_TYPE_DOUBLE, results.score,
+              "onset", G_TYPE_UINT64, (guint64)results.onset,
+              "latency", G_TYPE_UINT64, (guint64)results.latency,
+              NULL)));
+
+  return GST_FLOW_OK;
+}
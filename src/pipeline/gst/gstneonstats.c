@@ -0,0 +1,326 @@
+/*
+ * GStreamer
+ * Copyright (C) 2006 Stefan Kost <ensonic@users.sf.net>
+ * Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/controller/gstcontroller.h>
+#include <gst/video/video.h>
+
+#include "gstneon.h"
+#include "utils.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_neon_stats_debug);
+#define GST_CAT_DEFAULT gst_neon_stats_debug
+
+#define DEFAULT_INTERVAL  100   /* Milliseconds */
+#define DEFAULT_BUDGET    2000  /* Microseconds */
+#define MAX_STEP          16
+
+/* Filter signals and args */
+enum
+{
+  LAST_SIGNAL
+};
+
+enum
+{
+  PROP_0,
+  PROP_INTERVAL,
+  PROP_BUDGET,
+  PROP_STEP,
+  PROP_METER_X,
+  PROP_METER_Y,
+  PROP_METER_WIDTH,
+  PROP_METER_HEIGHT,
+};
+
+static GstStaticPadTemplate sink_template =
+        GST_STATIC_PAD_TEMPLATE ("sink",
+                GST_PAD_SINK,
+                GST_PAD_ALWAYS,
+                GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
+        );
+
+static GstStaticPadTemplate src_template =
+        GST_STATIC_PAD_TEMPLATE ("src",
+                GST_PAD_SRC,
+                GST_PAD_ALWAYS,
+                GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
+        );
+
+#define DEBUG_INIT(bla) \
+  GST_DEBUG_CATEGORY_INIT (gst_neon_stats_debug, "neonstats", 0, "NEON image statistics");
+
+GST_BOILERPLATE_FULL (GstNeonStats, gst_neon_stats, GstBaseTransform,
+    GST_TYPE_BASE_TRANSFORM, DEBUG_INIT);
+
+static void gst_neon_stats_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
+static void gst_neon_stats_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static void gst_neon_stats_finalize(GObject *object);
+static GstFlowReturn gst_neon_stats_transform_ip(GstBaseTransform *base, GstBuffer *outbuf);
+
+/* GObject vmethod implementations */
+static void
+gst_neon_stats_base_init(gpointer klass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+
+  gst_element_class_set_details_simple(element_class,
+    "neonstats",
+    "Filter/Analyzer/Video",
+    "Luma histogram, waveform and focus statistics",
+    "Kron Technologies Inc <http://www.krontech.ca>");
+
+  gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&src_template));
+  gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&sink_template));
+}
+
+/* initialize the plugin's class */
+static void
+gst_neon_stats_class_init(GstNeonStatsClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gobject_class->set_property = gst_neon_stats_set_property;
+  gobject_class->get_property = gst_neon_stats_get_property;
+  gobject_class->finalize = gst_neon_stats_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_INTERVAL,
+      g_param_spec_uint ("interval", "interval",
+          "Minimum time between analyzed frames in milliseconds, or zero to analyze every frame",
+          0, G_MAXUINT, DEFAULT_INTERVAL,
+          GST_PARAM_CONTROLLABLE | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BUDGET,
+      g_param_spec_uint ("budget", "budget",
+          "CPU time allowed per analyzed frame in microseconds, or zero for no limit",
+          0, G_MAXUINT, DEFAULT_BUDGET,
+          GST_PARAM_CONTROLLABLE | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STEP,
+      g_param_spec_uint ("step", "step",
+          "Subsampling step chosen to fit within the CPU budget",
+          1, MAX_STEP, 1,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_METER_X,
+      g_param_spec_uint ("meter-x", "meter-x", "Horizontal offset of the metering window",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_METER_Y,
+      g_param_spec_uint ("meter-y", "meter-y", "Vertical offset of the metering window",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_METER_WIDTH,
+      g_param_spec_uint ("meter-width", "meter-width", "Width of the metering window, or zero for the whole frame",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_METER_HEIGHT,
+      g_param_spec_uint ("meter-height", "meter-height", "Height of the metering window, or zero for the whole frame",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  GST_BASE_TRANSFORM_CLASS (klass)->transform_ip = GST_DEBUG_FUNCPTR(gst_neon_stats_transform_ip);
+}
+
+/* initialize the new element
+ * initialize instance structure
+ */
+static void
+gst_neon_stats_init (GstNeonStats *filter, GstNeonStatsClass * klass)
+{
+  filter->interval = DEFAULT_INTERVAL;
+  filter->budget = DEFAULT_BUDGET;
+  filter->step = 1;
+  filter->last = 0;
+  filter->scratch = NULL;
+  filter->scratchsize = 0;
+  memset(&filter->meter, 0, sizeof(filter->meter));
+  memset(&filter->results, 0, sizeof(filter->results));
+
+  /* We only ever read the frames, so never ask for a writable copy of a buffer shared with a tee. */
+  gst_base_transform_set_passthrough(GST_BASE_TRANSFORM_CAST(filter), TRUE);
+}
+
+static void
+gst_neon_stats_finalize(GObject *object)
+{
+  GstNeonStats *filter = GST_NEON_STATS(object);
+
+  g_free(filter->scratch);
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_neon_stats_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+  GstNeonStats *filter = GST_NEON_STATS(object);
+
+  switch (prop_id) {
+    case PROP_INTERVAL:
+      filter->interval = g_value_get_uint(value);
+      break;
+    case PROP_BUDGET:
+      filter->budget = g_value_get_uint(value);
+      break;
+    case PROP_METER_X:
+      filter->meter.x = g_value_get_uint(value);
+      break;
+    case PROP_METER_Y:
+      filter->meter.y = g_value_get_uint(value);
+      break;
+    case PROP_METER_WIDTH:
+      filter->meter.width = g_value_get_uint(value);
+      break;
+    case PROP_METER_HEIGHT:
+      filter->meter.height = g_value_get_uint(value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_neon_stats_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+  GstNeonStats *filter = GST_NEON_STATS(object);
+
+  switch (prop_id) {
+    case PROP_INTERVAL:
+      g_value_set_uint(value, filter->interval);
+      break;
+    case PROP_BUDGET:
+      g_value_set_uint(value, filter->budget);
+      break;
+    case PROP_STEP:
+      g_value_set_uint(value, filter->step);
+      break;
+    case PROP_METER_X:
+      g_value_set_uint(value, filter->meter.x);
+      break;
+    case PROP_METER_Y:
+      g_value_set_uint(value, filter->meter.y);
+      break;
+    case PROP_METER_WIDTH:
+      g_value_set_uint(value, filter->meter.width);
+      break;
+    case PROP_METER_HEIGHT:
+      g_value_set_uint(value, filter->meter.height);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+}
+
+/*
+ * Adjust the subsampling step to fit the CPU budget. Halving the step
+ * quadruples the work, so only do so when there is plenty of headroom.
+ */
+static void
+gst_neon_stats_adapt(GstNeonStats *filter, guint64 cputime)
+{
+  if (!filter->budget) {
+    filter->step = 1;
+  }
+  else if ((cputime > filter->budget) && (filter->step < MAX_STEP)) {
+    filter->step *= 2;
+    GST_DEBUG_OBJECT(filter, "Over budget at %llu us, subsampling by %u", (unsigned long long)cputime, filter->step);
+  }
+  else if (((cputime * 16) < (filter->budget * 3ULL)) && (filter->step > 1)) {
+    filter->step /= 2;
+    GST_DEBUG_OBJECT(filter, "Under budget at %llu us, subsampling by %u", (unsigned long long)cputime, filter->step);
+  }
+}
+
+/* Copy out the most recent results, returning FALSE if no frames have been analyzed yet. */
+gboolean
+gst_neon_stats_get_results(GstNeonStats *filter, struct image_stats *stats)
+{
+  gboolean valid;
+
+  GST_OBJECT_LOCK(filter);
+  valid = (filter->results.samples != 0);
+  memcpy(stats, &filter->results, sizeof(struct image_stats));
+  GST_OBJECT_UNLOCK(filter);
+  return valid;
+}
+
+/* GstBaseTransform vmethod implementations */
+static GstFlowReturn
+gst_neon_stats_transform_ip(GstBaseTransform *base, GstBuffer *outbuf)
+{
+  GstNeonStats *filter = GST_NEON_STATS(base);
+  GstStructure *gstruct = gst_caps_get_structure(GST_BUFFER_CAPS(outbuf), 0);
+  unsigned int xres = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+  unsigned int yres = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+  struct image_stats results;
+  guint64 now, cputime;
+  gsize scratchsize;
+
+  if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_TIMESTAMP(outbuf)))
+    gst_object_sync_values(G_OBJECT(filter), GST_BUFFER_TIMESTAMP(outbuf));
+
+  /* Rate limit by wall time, since the live source does not always provide timestamps. */
+  now = clock_usec(CLOCK_MONOTONIC);
+  if (filter->last && ((now - filter->last) < (filter->interval * 1000ULL))) {
+    return GST_FLOW_OK;
+  }
+  if ((GST_BUFFER_SIZE(outbuf) < (xres * yres)) || (xres < 1) || (yres < 1)) {
+    return GST_FLOW_OK;
+  }
+  filter->last = now;
+
+  /* Grow the scratch memory to fit the largest frame seen so far. */
+  scratchsize = IMAGE_STATS_SCRATCH(xres, yres);
+  if (scratchsize > filter->scratchsize) {
+    g_free(filter->scratch);
+    filter->scratch = g_malloc(scratchsize);
+    filter->scratchsize = scratchsize;
+  }
+
+  /* Only the luma plane is needed, which comes first in NV12. */
+  cputime = clock_usec(CLOCK_THREAD_CPUTIME_ID);
+  image_stats(&results, GST_BUFFER_DATA(outbuf), xres, yres, xres, filter->step, &filter->meter, filter->scratch);
+  cputime = clock_usec(CLOCK_THREAD_CPUTIME_ID) - cputime;
+  gst_neon_stats_adapt(filter, cputime);
+
+  GST_OBJECT_LOCK(filter);
+  memcpy(&filter->results, &results, sizeof(struct image_stats));
+  GST_OBJECT_UNLOCK(filter);
+
+  /* Let the application know that new results are available. */
+  gst_element_post_message(GST_ELEMENT_CAST(filter),
+      gst_message_new_element(GST_OBJECT_CAST(filter),
+          gst_structure_new("neonstats",
+              "step", G_TYPE_UINT, results.step,
+              "width", G_TYPE_UINT, results.width,
+              "height", G_TYPE_UINT, results.height,
+              "clip-black", G_TYPE_DOUBLE, results.clipblack,
+              "clip-white", G_TYPE_DOUBLE, results.clipwhite,
+              "focus", G_TYPE_DOUBLE, results.focus,
+              "cpu-time", G_TYPE_UINT64, cputime,
+              NULL)));
+
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,371 @@
+/*
+ * GStreamer
+ * Copyright (C) 2006 Stefan Kost <ensonic@users.sf.net>
+ * Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/controller/gstcontroller.h>
+#include <gst/video/video.h>
+
+#include "gstneon.h"
+#include <stdint.h>
+
+#include <asm/unistd.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_neon_xform_debug);
+#define GST_CAT_DEFAULT gst_neon_xform_debug
+
+/* Filter signals and args */
+enum
+{
+  LAST_SIGNAL
+};
+
+enum
+{
+  PROP_0,
+  PROP_LEFT,
+  PROP_RIGHT,
+  PROP_TOP,
+  PROP_BOTTOM,
+  PROP_METHOD,
+};
+
+static GstStaticPadTemplate sink_template =
+        GST_STATIC_PAD_TEMPLATE ("sink",
+                GST_PAD_SINK,
+                GST_PAD_ALWAYS,
+                GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
+        );
+
+static GstStaticPadTemplate src_template =
+        GST_STATIC_PAD_TEMPLATE ("src",
+                GST_PAD_SRC,
+                GST_PAD_ALWAYS,
+                GST_STATIC_CAPS(GST_VIDEO_CAPS_YUV("{NV12}"))
+        );
+
+#define DEBUG_INIT(bla) \
+  GST_DEBUG_CATEGORY_INIT (gst_neon_xform_debug, "neonxform", 0, "NEON crop, pad and flip");
+
+GST_BOILERPLATE_FULL (GstNeonXform, gst_neon_xform, GstBaseTransform,
+    GST_TYPE_BASE_TRANSFORM, DEBUG_INIT);
+
+/* Caps negotiation */
+static void gst_neon_xform_recalc_transform(GstNeonXform *xform);
+static GstCaps *gst_neon_xform_transform_caps(GstBaseTransform *base, GstPadDirection direction, GstCaps *from);
+static gboolean gst_neon_xform_set_caps(GstBaseTransform *base, GstCaps *in, GstCaps *out);
+static gboolean gst_neon_xform_get_unit_size(GstBaseTransform *base, GstCaps *caps, guint *size);
+
+static void gst_neon_xform_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
+static void gst_neon_xform_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static GstFlowReturn gst_neon_xform_transform(GstBaseTransform *base, GstBuffer *src, GstBuffer *dst);
+
+/* GObject vmethod implementations */
+static void
+gst_neon_xform_base_init(gpointer klass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+
+  gst_element_class_set_details_simple(element_class,
+    "neonxform",
+    "Generic",
+    "NEON Crop, Pad and Flip in a Single Pass",
+    "Kron Technologies Inc <http://www.krontech.ca>");
+
+  gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&src_template));
+  gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&sink_template));
+}
+
+/* initialize the plugin's class */
+static void
+gst_neon_xform_class_init(GstNeonXformClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gobject_class->set_property = gst_neon_xform_set_property;
+  gobject_class->get_property = gst_neon_xform_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_LEFT,
+      g_param_spec_int ("left", "Left", "Pixels to crop from the left",
+          0, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE));
+  g_object_class_install_property (gobject_class, PROP_RIGHT,
+      g_param_spec_int ("right", "Right", "Pixels to crop from the right",
+          0, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE));
+  g_object_class_install_property (gobject_class, PROP_TOP,
+      g_param_spec_int ("top", "Top", "Pixels to crop from the top (<0 to add border)",
+          G_MININT, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE));
+  g_object_class_install_property (gobject_class, PROP_BOTTOM,
+      g_param_spec_int ("bottom", "Bottom", "Pixels to crop from the bottom (<0 to add border)",
+          G_MININT, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE));
+  g_object_class_install_property (gobject_class, PROP_METHOD,
+      g_param_spec_enum ("method", "Method", "Flip to apply to the cropped image",
+          GST_TYPE_NEON_FLIP_METHOD, GST_NEON_FLIP_METHOD_IDENTITY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE | GST_PARAM_MUTABLE_PLAYING));
+
+  GST_BASE_TRANSFORM_CLASS (klass)->transform = GST_DEBUG_FUNCPTR(gst_neon_xform_transform);
+  GST_BASE_TRANSFORM_CLASS (klass)->transform_caps = GST_DEBUG_FUNCPTR(gst_neon_xform_transform_caps);
+  GST_BASE_TRANSFORM_CLASS (klass)->set_caps = GST_DEBUG_FUNCPTR(gst_neon_xform_set_caps);
+  GST_BASE_TRANSFORM_CLASS (klass)->get_unit_size = GST_DEBUG_FUNCPTR(gst_neon_xform_get_unit_size);
+}
+
+/* initialize the new element
+ * initialize instance structure
+ */
+static void
+gst_neon_xform_init(GstNeonXform *filter, GstNeonXformClass * klass)
+{
+  filter->left = 0;
+  filter->right = 0;
+  filter->top = 0;
+  filter->bottom = 0;
+  filter->method = GST_NEON_FLIP_METHOD_IDENTITY;
+}
+
+static void
+gst_neon_xform_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+  GstNeonXform *filter = GST_NEON_XFORM(object);
+
+  /* Keep everything aligned to the chroma subsampling. */
+  GST_OBJECT_LOCK(filter);
+  switch (prop_id) {
+    case PROP_LEFT:
+      filter->left = g_value_get_int(value) & ~1;
+      break;
+    case PROP_RIGHT:
+      filter->right = g_value_get_int(value) & ~1;
+      break;
+    case PROP_TOP:
+      filter->top = g_value_get_int(value) & ~1;
+      break;
+    case PROP_BOTTOM:
+      filter->bottom = g_value_get_int(value) & ~1;
+      break;
+    case PROP_METHOD:
+      filter->method = g_value_get_enum(value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK(filter);
+  gst_neon_xform_recalc_transform(filter);
+}
+
+static void
+gst_neon_xform_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+  GstNeonXform *filter = GST_NEON_XFORM(object);
+
+  switch (prop_id) {
+    case PROP_LEFT:
+      g_value_set_int(value, filter->left);
+      break;
+    case PROP_RIGHT:
+      g_value_set_int(value, filter->right);
+      break;
+    case PROP_TOP:
+      g_value_set_int(value, filter->top);
+      break;
+    case PROP_BOTTOM:
+      g_value_set_int(value, filter->bottom);
+      break;
+    case PROP_METHOD:
+      g_value_set_enum(value, filter->method);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_neon_xform_transform_dimension(const GValue *src, gint delta, GValue *dest)
+{
+  g_value_init(dest, G_VALUE_TYPE(src));
+  if (G_VALUE_HOLDS_INT(src)) {
+    gint ival = g_value_get_int(src) + delta;
+    if (ival <= 0) return FALSE;
+    g_value_set_int(dest, ival);
+  }
+  else if (GST_VALUE_HOLDS_INT_RANGE(src)) {
+    gint imin = gst_value_get_int_range_min(src);
+    gint imax = gst_value_get_int_range_max(src);
+
+    /* Saturate rather than roll over at either end of the range. */
+    imin = (imin < -delta) ? 1 : imin + delta;
+    imax = (imax > (G_MAXINT - delta)) ? G_MAXINT : imax + delta;
+    if (imin < 1) imin = 1;
+    if (imax < imin) return FALSE;
+
+    gst_value_set_int_range(dest, imin, imax);
+  }
+  else {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static GstCaps *
+gst_neon_xform_transform_caps(GstBaseTransform *base, GstPadDirection direction, GstCaps *from)
+{
+  GstNeonXform *xform = GST_NEON_XFORM(base);
+  GstStructure *gstruct;
+  GstPad *other = (direction == GST_PAD_SINK) ? base->srcpad : base->sinkpad;
+  const GstCaps *templ;
+  gint dx = xform->left + xform->right;
+  gint dy = xform->top + xform->bottom;
+  GValue xresval = { 0 };
+  GValue yresval = { 0 };
+  GstCaps *to, *ret;
+
+  /* Duplicate the caps */
+  to = gst_caps_copy(from);
+  gst_caps_truncate(to);
+  gstruct = gst_caps_get_structure(to, 0);
+
+  /* Cropping shrinks the output, and goes the other way when working back from the source pad. */
+  if (direction == GST_PAD_SINK) {
+    dx = -dx;
+    dy = -dy;
+  }
+
+  if (!gst_neon_xform_transform_dimension(gst_structure_get_value(gstruct, "width"), dx, &xresval) ||
+      !gst_neon_xform_transform_dimension(gst_structure_get_value(gstruct, "height"), dy, &yresval)) {
+    GST_WARNING_OBJECT(xform, "could not transform resolution with dx=%d dy=%d and caps=%" GST_PTR_FORMAT, dx, dy, gstruct);
+    if (G_IS_VALUE(&xresval)) g_value_unset(&xresval);
+    if (G_IS_VALUE(&yresval)) g_value_unset(&yresval);
+    gst_caps_unref(to);
+    return gst_caps_new_empty();
+  }
+  gst_structure_set_value(gstruct, "width", &xresval);
+  gst_structure_set_value(gstruct, "height", &yresval);
+  g_value_unset(&xresval);
+  g_value_unset(&yresval);
+
+  /* Filter the resulting caps against the template.  */
+  templ = gst_pad_get_pad_template_caps(other);
+  ret = gst_caps_intersect(to, templ);
+  gst_caps_unref(to);
+
+  GST_DEBUG_OBJECT (xform, "direction %d, transformed %" GST_PTR_FORMAT
+      " to %" GST_PTR_FORMAT, direction, from, ret);
+
+  return ret;
+}
+
+static gboolean
+gst_neon_xform_get_unit_size(GstBaseTransform *base, GstCaps *caps, guint *size)
+{
+  GstStructure *gstruct = gst_caps_get_structure(caps, 0);
+  unsigned long xres = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+  unsigned long yres = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+
+  g_assert (size);
+  *size = (xres * yres * 12) / 8; /* NV12 is 12-bits per pixel */
+
+  return TRUE;
+}
+
+static void
+gst_neon_xform_recalc_transform(GstNeonXform *xform)
+{
+  if ((xform->left == 0) && (xform->right == 0) && (xform->top == 0) && (xform->bottom == 0) &&
+      (xform->method == GST_NEON_FLIP_METHOD_IDENTITY)) {
+    GST_INFO_OBJECT(xform, "Using Passthrough Mode");
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM_CAST(xform), TRUE);
+  } else {
+    GST_INFO_OBJECT(xform, "Using Non-Passthrough Mode");
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM_CAST(xform), FALSE);
+  }
+}
+
+static gboolean
+gst_neon_xform_set_caps(GstBaseTransform *base, GstCaps *in, GstCaps *out)
+{
+  gst_neon_xform_recalc_transform(GST_NEON_XFORM(base));
+  return TRUE;
+}
+
+/*
+ * The cacheflush syscall is not exposed for most architectures,
+ * including ARM, so we have to call it manually to avoid frame
+ * corruption when the pipeline includes hardware accelerators.
+ */
+static void arm_clearcache(char *ptr, size_t len)
+{
+  const int syscall = __ARM_NR_BASE + 2;
+  asm volatile (
+    "mov   r0, %[start]   \n"
+    "mov   r1, %[end]     \n"
+    "mov   r7, %[syscall] \n"
+    "mov   r2, #0x0       \n"
+    "svc   0x00000000     \n"
+    :: [start]"r"(ptr), [end]"r"(ptr + len), [syscall]"r"(syscall) : "r0", "r1", "r2", "r7" );
+}
+
+static GstFlowReturn
+gst_neon_xform_transform(GstBaseTransform *base, GstBuffer *src, GstBuffer *dst)
+{
+  GstNeonXform *xform = GST_NEON_XFORM(base);
+  GstCaps *caps = GST_BUFFER_CAPS(src);
+  GstStructure *gstruct = gst_caps_get_structure(caps, 0);
+  unsigned long xres = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+  unsigned long yres = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+  struct nv12_frame srcframe, view, dstframe;
+  unsigned int x, y, width, height, pad;
+  unsigned int flags = 0;
+
+  GST_OBJECT_LOCK(xform);
+  x = xform->left;
+  y = (xform->top > 0) ? xform->top : 0;
+  width = xres - xform->left - xform->right;
+  height = yres - y - ((xform->bottom > 0) ? xform->bottom : 0);
+  pad = (xform->top < 0) ? -xform->top : 0;
+  if ((xform->method == GST_NEON_FLIP_METHOD_HORIZ) || (xform->method == GST_NEON_FLIP_METHOD_180)) {
+    flags |= NV12_FLIP_HORIZ;
+  }
+  if ((xform->method == GST_NEON_FLIP_METHOD_VERT) || (xform->method == GST_NEON_FLIP_METHOD_180)) {
+    flags |= NV12_FLIP_VERT;
+  }
+  GST_OBJECT_UNLOCK(xform);
+
+  /* Crop by narrowing the view of the source, then copy, flip and pad in a single pass. */
+  nv12_frame_init(&srcframe, GST_BUFFER_DATA(src), xres, yres);
+  nv12_crop(&view, &srcframe, x, y, width, height);
+  nv12_frame_init(&dstframe, GST_BUFFER_DATA(dst), view.width, (GST_BUFFER_SIZE(dst) * 2) / (view.width * 3));
+  nv12_transform(&dstframe, &view, pad, flags);
+
+  /* Ensure the cache is cleared */
+  arm_clearcache((char *)GST_BUFFER_DATA(dst), GST_BUFFER_SIZE(dst));
+
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,118 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "gst/gstneon.h"
+#include "utils.h"
+
+/*
+ * Motion is detected on a branch of the tee behind a leaky queue, so that
+ * the analysis can never hold up the rest of the pipeline. The neonmotion
+ * element posts a message on the bus as soon as motion is detected, which
+ * arrives on the main thread and fires the recording trigger if a recording
+ * is in progress. The score is also posted periodically, and forwarded to
+ * D-Bus clients as a parameter update.
+ */
+static const char *cam_motion_names[] = {
+    "motionScore",
+    "motionDetections",
+    "motionRejected",
+    "motionTriggers",
+    "motionLatency",
+    NULL
+};
+
+/* Apply the detection settings and region to the motion element. */
+static void
+cam_motion_configure(struct pipeline_state *state, GstElement *motion)
+{
+    g_object_set(G_OBJECT(motion), "level", (guint)state->motionlevel, NULL);
+    g_object_set(G_OBJECT(motion), "threshold", (gdouble)state->motionthreshold, NULL);
+    g_object_set(G_OBJECT(motion), "frames", (guint)state->motionframes, NULL);
+    g_object_set(G_OBJECT(motion), "region-x", (guint)state->motionx, NULL);
+    g_object_set(G_OBJECT(motion), "region-y", (guint)state->motiony, NULL);
+    g_object_set(G_OBJECT(motion), "region-width", (guint)state->motionwidth, NULL);
+    g_object_set(G_OBJECT(motion), "region-height", (guint)state->motionheight, NULL);
+}
+
+GstPad *
+cam_motion(struct pipeline_state *state)
+{
+    GstElement *queue, *motion, *sink;
+
+    memset(&state->motion, 0, sizeof(state->motion));
+    if (!state->motionenable) {
+        return NULL;
+    }
+
+    queue = cam_leaky_queue("motionqueue");
+    motion = gst_element_factory_make("neonmotion", "motion");
+    sink =   gst_element_factory_make("fakesink",   "motionsink");
+    if (!queue || !motion || !sink) {
+        return NULL;
+    }
+
+    cam_motion_configure(state, motion);
+
+    gst_bin_add_many(GST_BIN(state->pipeline), queue, motion, sink, NULL);
+    gst_element_link_many(queue, motion, sink, NULL);
+
+    return gst_element_get_static_pad(queue, "sink");
+}
+
+/* Apply changes to the motion settings to a running element. */
+void
+cam_motion_reconfig(struct pipeline_state *state)
+{
+    GstElement *motion;
+
+    if (!state->pipeline || !state->motionenable) {
+        return;
+    }
+    motion = gst_bin_get_by_name(GST_BIN(state->pipeline), "motion");
+    if (motion) {
+        cam_motion_configure(state, motion);
+        gst_object_unref(motion);
+    }
+}
+
+/* Collect new results from the motion element, and fire the recording trigger when motion was detected. */
+void
+cam_motion_update(struct pipeline_state *state, GstElement *element, const GstStructure *result)
+{
+    gboolean detected = FALSE;
+
+    if (!GST_IS_NEON_MOTION(element)) {
+        return;
+    }
+    gst_neon_motion_get_results(GST_NEON_MOTION(element), &state->motion);
+    gst_structure_get_boolean(result, "detected", &detected);
+
+    /* Pulse the software trigger of the recording sequencer, the same as the trigger API. */
+    if (detected && (state->fpga->seq->status & SEQ_STATUS_RECORDING)) {
+        state->fpga->seq->control |= SEQ_CTL_SOFTWARE_TRIG;
+        state->fpga->seq->control &= ~SEQ_CTL_SOFTWARE_TRIG;
+        state->motionlatency = clock_usec(CLOCK_MONOTONIC) - state->motion.onset;
+        state->motiontriggers++;
+        fprintf(stderr, "Motion trigger fired after %lu us\n", state->motionlatency);
+    }
+    dbus_signal_update(state->video, cam_motion_names);
+}
@@ -24,6 +24,9 @@
 #include "ioport.h"
 #include "segment.h"
 #include "fpga.h"
+#include "image-stats.h"
+#include "auto-exposure.h"
+#include "motion.h"
 
 #define SCREENCAP_PATH      "/tmp/cam-screencap.jpg"
 
@@ -40,11 +43,17 @@
 #define PIPELINE_MAX_VRES   1080
 #define PIPELINE_MIN_VRES   96
 #define PIPELINE_SCRATCHPAD_SIZE (PIPELINE_MAX_HRES * PIPELINE_MAX_VRES * 4)
+#define PIPELINE_MAX_RING_LENGTH 16
+#define PIPELINE_MAX_STATS_INTERVAL 60000
+#define PIPELINE_MAX_MOTION_FRAMES 1000
 
 #define NETWORK_STREAM_PORT 5000
 
+#define DNG_HEADER_SIZE     4096    /* Typical kernel page size. */
+
 struct CamVideo;
 struct rtsp_ctx;
+struct nv12_frame;
 
 /* Only enable RTSP for sufficiently "new" versions of GStreamer. */
 #define ENABLE_RTSP_SERVER  GST_CHECK_VERSION(0,10,36)
@@ -148,6 +157,7 @@ struct pipeline_state {
     struct rtsp_ctx     *rtsp;
     struct fpga         *fpga;
     const struct ioport *iops;
+    struct image_sensor *sensor;
     int                 runmode;
     int                 board_rev;
     int                 pipe_rfd;
@@ -161,10 +171,12 @@ struct pipeline_state {
 
     /* Display control config */
     uint32_t            control;
+    int                 videoflip;  /* One of GST_NEON_FLIP_METHOD_xxx, applied to the video from the source. */
 
     /* Frame information */
     struct video_seglist seglist;   /* List of segments captured from the recording sequencer. */
     pthread_mutex_t segmutex;       /* Lock access to the segment list. */
+    pthread_mutex_t vrammutex;      /* Serialize use of the video memory readout registers. */
     long            position;       /* Last played frame number, or negative for live display. */
 
     /* Playback Mode */
@@ -175,8 +187,71 @@ struct pipeline_state {
     unsigned long   playlength;     /* Length of video to play from when in playback mode. */
     unsigned int    playloop;       /* Loop playback or return to live display. */
     pthread_t       playthread;     /* Thread handle for the playback frame manager. */
+    void            *playstack;     /* Preallocated stack of the playback thread, or NULL for the default. */
     pthread_t       audiothread;    /* Thread handle for the ALSA line mux manager. */
 
+    /* Playback Scheduling */
+    long            playprio;       /* SCHED_FIFO priority of the playback thread, or zero for SCHED_OTHER. */
+    gboolean        memlock;        /* Lock all pipeline memory to avoid page faults. */
+    unsigned long   deadline;       /* Latency budget (usec) from fsync edge to wakeup, or zero for half a frame. */
+    unsigned long   missed;         /* Number of fsync edges handled after the deadline. */
+    unsigned long   latency;        /* Latency (usec) of the most recent fsync edge. */
+    unsigned long   maxlatency;     /* Worst case latency (usec) of fsync edges. */
+    unsigned long   fsyncperiod;    /* Display frame period (nsec) from the display timing. */
+    struct timespec fsyncphase;     /* Estimated time of the last fsync edge, for GPIOs without edge timestamps. */
+
+    /* Scrubbing Proxies */
+    unsigned long   proxyinterval;  /* Generate a proxy of every Nth recorded frame, or zero to disable. */
+    unsigned long   proxywidth;     /* Maximum width of the proxy frames. */
+    unsigned long   proxycount;     /* Number of proxy frames in the cache. */
+    unsigned long   proxybytes;     /* Memory used by the proxy frames. */
+    int             tonecurve;      /* One of TONE_CURVE_xxx, used to render raw frames to 8 bits. */
+
+    /* Screencap */
+    unsigned long   capwidth;       /* Horizontal resolution of the screencap, or zero to match the height. */
+    unsigned long   capheight;      /* Vertical resolution of the screencap, or zero to match the width. */
+    unsigned long   roix;           /* Region of interest for the screencap and live preview. */
+    unsigned long   roiy;
+    unsigned long   roiwidth;       /* Width of the region of interest, or zero for the whole frame. */
+    unsigned long   roiheight;      /* Height of the region of interest, or zero for the whole frame. */
+
+    /* Live Preview */
+    unsigned long   previewrate;    /* Rate of live preview frames published to shared memory, or zero to disable. */
+    unsigned long   previewwidth;   /* Horizontal resolution of the live preview, or zero to match the height. */
+    unsigned long   previewheight;  /* Vertical resolution of the live preview, or zero to match the width. */
+
+    /* Shared Memory Frame Ring */
+    unsigned long   ringlength;     /* Number of frames in the ring, or zero to disable. */
+
+    /* Live Image Statistics */
+    unsigned long   statsinterval;  /* Milliseconds between statistics updates, or zero to disable. */
+    unsigned long   statsbudget;    /* CPU time (usec) allowed to gather the statistics from a frame. */
+    struct image_stats stats;       /* Most recent statistics. */
+
+    /* Auto Exposure */
+    gboolean        aeenable;       /* Adjust the exposure to follow the live image statistics. */
+    gboolean        aerecord;       /* Continue adjusting the exposure while recording. */
+    unsigned long   aetarget;       /* Mean luma to aim for within the metering region. */
+    unsigned long   aedamping;      /* Percentage of the exposure error left uncorrected by each update. */
+    unsigned long   aex;            /* Metering region for the auto exposure. */
+    unsigned long   aey;
+    unsigned long   aewidth;        /* Width of the metering region, or zero for the whole frame. */
+    unsigned long   aeheight;       /* Height of the metering region, or zero for the whole frame. */
+    struct auto_exposure ae;        /* Auto exposure controller state. */
+
+    /* Motion Trigger */
+    gboolean        motionenable;   /* Fire the recording trigger when motion is detected in the live video. */
+    unsigned long   motionlevel;    /* Change in the mean luma of a block that counts as motion. */
+    unsigned long   motionthreshold; /* Percentage of the region which must change to count as motion. */
+    unsigned long   motionframes;   /* Consecutive frames of motion needed to fire the trigger. */
+    unsigned long   motionx;        /* Region to watch for motion. */
+    unsigned long   motiony;
+    unsigned long   motionwidth;    /* Width of the region, or zero for the whole frame. */
+    unsigned long   motionheight;   /* Height of the region, or zero for the whole frame. */
+    struct motion_results motion;   /* Most recent motion detection results. */
+    unsigned long   motiontriggers; /* Number of times motion has fired the recording trigger. */
+    unsigned long   motionlatency;  /* Time (usec) from the onset of motion until the last trigger was fired. */
+
     /* Recording Mode */
     unsigned int    phantom;        /* OMX buffering workaround */
     gint            buflevel;       /* OMX buffer level (for frame drop avoidance) */
@@ -186,6 +261,7 @@ struct pipeline_state {
 
     /* Framerate estimation */
     struct timespec frametime;      /* Timestamp of last frame. */
+    struct timespec fsynctime;      /* Timestamp of the last frame sync edge. */
     unsigned int    frameidx;
     unsigned long   frameival[FRAMERATE_IVAL_BUCKETS]; /* track microseconds between frames. */
     unsigned long long frameisum;   /* Rolling sum of frameival */
@@ -206,9 +282,19 @@ gboolean parse_resolution(const char *resxy, unsigned long *x, unsigned long *y)
 
 struct pipeline_state *cam_pipeline_state(void);
 void cam_pipeline_restart(struct pipeline_state *state);
+GstElement *cam_leaky_queue(const char *name);
+void cam_pipeline_reflip(struct pipeline_state *state);
 
 /* Allocate pipeline segments, returning the first pad to be linked. */
 GstPad *cam_screencap(struct pipeline_state *state);
+GstPad *cam_frame_ring(struct pipeline_state *state);
+GstPad *cam_stats(struct pipeline_state *state);
+void    cam_stats_reconfig(struct pipeline_state *state);
+void    cam_stats_update(struct pipeline_state *state, GstElement *element);
+void    cam_auto_exposure(struct pipeline_state *state);
+GstPad *cam_motion(struct pipeline_state *state);
+void    cam_motion_reconfig(struct pipeline_state *state);
+void    cam_motion_update(struct pipeline_state *state, GstElement *element, const GstStructure *result);
 GstPad *cam_lcd_sink(struct pipeline_state *state, const struct display_config *config);
 void    cam_lcd_reconfig(struct pipeline_state *state, const struct display_config *config);
 GstPad *cam_hdmi_sink(struct pipeline_state *state);
@@ -218,6 +304,8 @@ GstPad *cam_raw_sink(struct pipeline_state *state, struct pipeline_args *args);
 GstPad *cam_dng_sink(struct pipeline_state *state, struct pipeline_args *args);
 GstPad *cam_tiff_sink(struct pipeline_state *state, struct pipeline_args *args);
 GstPad *cam_tiffraw_sink(struct pipeline_state *state, struct pipeline_args *args);
+void    dng_build_header(struct pipeline_state *state, void *dest, unsigned long xres, unsigned long yres,
+                         const struct video_segment *seg);
 
 /* Some background elements. */
 struct CamVideo *dbus_service_launch(struct pipeline_state *state);
@@ -233,6 +321,10 @@ int dbus_init_params(struct pipeline_state *state, int update);
 int dbus_save_params(struct pipeline_state *state, FILE *fp);
 int dbus_load_params(struct pipeline_state *state, FILE *fp);
 
+/* Local consumers of the shared memory frame ring. */
+void framering_launch(struct pipeline_state *state);
+void framering_cleanup(struct pipeline_state *state);
+
 /* HDMI Hotplug watcher needs to be in its own thread. */
 void hdmi_hotplug_launch(struct pipeline_state *state);
 
@@ -246,9 +338,31 @@ void playback_live(struct pipeline_state *state);
 void playback_play(struct pipeline_state *state, unsigned long frame, int framerate);
 void playback_play_once(struct pipeline_state *state, unsigned long start, int framerate, unsigned long count);
 void playback_loop(struct pipeline_state *state, unsigned long start, int framerate, unsigned long count);
+void playback_resume(struct pipeline_state *state, unsigned long start, int framerate, unsigned long count, unsigned int loop, unsigned long position);
 void playback_flush(struct pipeline_state *state);
+int  playback_set_priority(struct pipeline_state *state, int prio);
+int  playback_set_memlock(struct pipeline_state *state, int enable);
 void playback_cleanup(struct pipeline_state *state);
 
+/* Scrubbing proxy cache. */
+void proxy_init(struct pipeline_state *state);
+void proxy_flush(struct pipeline_state *state);
+GArray *proxy_lookup(struct pipeline_state *state, unsigned long *frame, unsigned int *width, unsigned int *height);
+void proxy_cleanup(struct pipeline_state *state);
+
+/* Single frame grabs from recorded video. */
+#define GRAB_FORMAT_JPEG    0
+#define GRAB_FORMAT_PNG     1
+#define GRAB_FORMAT_DNG     2
+
+/* Invoked from the main loop with the image, or NULL and an error message on failure. */
+typedef void (*grab_callback_t)(GArray *image, unsigned int width, unsigned int height, const char *err, void *closure);
+
+void grab_rendered(struct pipeline_state *state);
+void grab_probe(struct pipeline_state *state, const struct nv12_frame *frame, GstBuffer *buffer);
+int  grab_frame(struct pipeline_state *state, unsigned long frame, int format, unsigned int scale,
+                grab_callback_t callback, void *closure, char *err);
+
 /* ALSA line mux control. */
 void audiomux_init(struct pipeline_state *state);
 void audiomux_cleanup(struct pipeline_state *state);
@@ -23,9 +23,12 @@
 #include <unistd.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 #include "pipeline.h"
+#include "gpio-event.h"
 
 /* Some special commands that can be passed through the pipe. */
 #define PLAYBACK_PIPE_EXIT      (INT_MIN + 0)   /* Terminate and cleanup the playback thread. */
@@ -36,6 +39,9 @@
 
 #define PLAYBACK_POLL_INTERVAL 100
 #define PLAYBACK_WATCHDOG_COUNT (5000 / PLAYBACK_POLL_INTERVAL)
+#define PLAYBACK_STACK_SIZE     (256 * 1024)
+#define PLAYBACK_RESYNC_FRAMES  4       /* Resynchronize the estimated fsync phase after this many frames without an edge. */
+#define PLAYBACK_PHASE_FILTER   64      /* Rate at which the estimated fsync phase follows late wakeups. */
 
 static int playback_pipe = -1;
 static void playback_rate_init(struct pipeline_state *state);
@@ -86,6 +92,7 @@ playback_setup_timing(struct pipeline_state *state, unsigned int maxfps)
 
     /* Calculate the actual FPS. */
     state->source.rate = pxClock / (vPeriod * hPeriod);
+    state->fsyncperiod = ((unsigned long long)(vPeriod * hPeriod) * 1000000000ULL) / pxClock;
     fprintf(stderr, "Setup display timing: %d*%d@%d (%u*%u max: %u)\n",
            (hPeriod - hBackPorch - hSync - hFrontPorch),
            (vPeriod - vBackPorch - vSync - vFrontPorch),
@@ -182,6 +189,7 @@ playback_frame_render(struct pipeline_state *state)
     /* Play the frame */
     state->fpga->display->frame_address = address;
     state->fpga->display->manual_sync = 1;
+    grab_rendered(state);
 }
 
 /* Signal handler for the playback timer. */
@@ -290,9 +298,9 @@ playback_region_add(struct pipeline_state *state)
     struct video_segment *seg;
 
     /* Read the FIFO to extract the new region info. */
-    uint32_t start = state->fpga->seq->md_fifo_read;
-    uint32_t end = state->fpga->seq->md_fifo_read;
-    uint32_t last = state->fpga->seq->md_fifo_read;
+    uint32_t start = fpga_md_fifo_read(state->fpga);
+    uint32_t end = fpga_md_fifo_read(state->fpga);
+    uint32_t last = fpga_md_fifo_read(state->fpga);
 
     /* Ignore recording events within the live display or calibration regions. */
     if (start == state->fpga->display->fpn_address) return 0;
@@ -433,6 +441,24 @@ playback_play_once(struct pipeline_state *state, unsigned long start, int framer
     write(playback_pipe, &delta, sizeof(delta));
 }
 
+/* Resume playback of a subset of frames from a position within it, such as after a frame grab. */
+void
+playback_resume(struct pipeline_state *state, unsigned long start, int framerate, unsigned long count, unsigned int loop, unsigned long position)
+{
+    int delta = 0;
+    if (count > state->seglist.totalframes) count = state->seglist.totalframes;
+    if ((position < start) || (position >= (start + count))) position = start;
+
+    /* Update the frame position and then seek zero frames forward. */
+    state->playrate = framerate;
+    state->playcounter = 0;
+    state->playstart = start;
+    state->playlength = count;
+    state->playloop = loop;
+    state->position = position;
+    write(playback_pipe, &delta, sizeof(delta));
+}
+
 /* Pass a command to the playback thread to discard all recorded segments. */
 void
 playback_flush(struct pipeline_state *state)
@@ -463,9 +489,9 @@ playback_rate_update(struct pipeline_state *state)
     struct timespec prev;
     long usec;
     
-    /* Calculate how much time elapsed from the last frame. */
+    /* Calculate how much time elapsed from the last frame sync edge. */
     memcpy(&prev, &state->frametime, sizeof(struct timespec));
-    clock_gettime(CLOCK_MONOTONIC, &state->frametime);
+    memcpy(&state->frametime, &state->fsynctime, sizeof(struct timespec));
     usec = (state->frametime.tv_sec - prev.tv_sec) * 1000000;
     usec += (state->frametime.tv_nsec - prev.tv_nsec) / 1000;
     if (usec < 0) usec = 0;
@@ -477,6 +503,123 @@ playback_rate_update(struct pipeline_state *state)
     state->frameidx = (state->frameidx + 1) % FRAMERATE_IVAL_BUCKETS;
 }
 
+/*===============================================
+ * Real-Time Scheduling and Deadlines
+ *===============================================
+ */
+/* Change the scheduling policy of the playback thread, zero for SCHED_OTHER. */
+int
+playback_set_priority(struct pipeline_state *state, int prio)
+{
+    struct sched_param param;
+    int policy = (prio > 0) ? SCHED_FIFO : SCHED_OTHER;
+    int err;
+
+    memset(&param, 0, sizeof(param));
+    if (prio > 0) {
+        int pmin = sched_get_priority_min(SCHED_FIFO);
+        int pmax = sched_get_priority_max(SCHED_FIFO);
+        param.sched_priority = (prio < pmin) ? pmin : (prio > pmax) ? pmax : prio;
+    }
+    err = pthread_setschedparam(state->playthread, policy, &param);
+    if (err != 0) {
+        fprintf(stderr, "Failed to set playback priority: %s\n", strerror(err));
+        errno = err;
+        return -1;
+    }
+    state->playprio = param.sched_priority;
+    return 0;
+}
+
+/* Lock all current and future memory to avoid page faults on the frame sync path. */
+int
+playback_set_memlock(struct pipeline_state *state, int enable)
+{
+    int err = enable ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall();
+    if (err != 0) {
+        fprintf(stderr, "Failed to %s pipeline memory: %s\n", enable ? "lock" : "unlock", strerror(errno));
+        return -1;
+    }
+    state->memlock = (enable != 0);
+    return 0;
+}
+
+/*
+ * The sysfs GPIO interface has no edge timestamps, so estimate the time of the
+ * edge by advancing the previous one by the display frame period. The phase is
+ * anchored to the earliest wakeup, and slowly follows later ones to absorb any
+ * clock drift, so this measures the jitter on top of the best case latency.
+ *
+ * Returns the estimated latency in microseconds, or less than zero if the phase
+ * had to be resynchronized and no estimate is available for this edge.
+ */
+static long
+playback_deadline_estimate(struct pipeline_state *state, const struct timespec *wake, unsigned int *edges)
+{
+    long long period = state->fsyncperiod;
+    long long elapsed;
+    long long nsec;
+
+    elapsed = (long long)(wake->tv_sec - state->fsyncphase.tv_sec) * 1000000000LL;
+    elapsed += (wake->tv_nsec - state->fsyncphase.tv_nsec);
+
+    /* Resynchronize on the first edge, or after frame sync was inhibited. */
+    if (!period || (elapsed < (period / 2)) || (elapsed > (period * PLAYBACK_RESYNC_FRAMES))) {
+        state->fsyncphase = *wake;
+        return -1;
+    }
+
+    /* Count the edges since the phase, and if we woke up earlier than expected, this becomes the new phase. */
+    *edges = (elapsed > period) ? (elapsed / period) : 1;
+    nsec = elapsed - (*edges * period);
+    if (nsec < 0) {
+        state->fsyncphase = *wake;
+        return 0;
+    }
+
+    /* Advance the phase to the estimated edge. */
+    elapsed = (*edges * period) + (nsec / PLAYBACK_PHASE_FILTER);
+    state->fsyncphase.tv_sec += elapsed / 1000000000LL;
+    state->fsyncphase.tv_nsec += elapsed % 1000000000LL;
+    if (state->fsyncphase.tv_nsec >= 1000000000) {
+        state->fsyncphase.tv_nsec -= 1000000000;
+        state->fsyncphase.tv_sec++;
+    }
+    return nsec / 1000;
+}
+
+/*
+ * Compare the frame sync edge timestamp against the time that the playback
+ * thread woke up to handle it. Edges that are handled late, or that never
+ * got handled at all because another edge arrived first, are missed.
+ */
+static void
+playback_deadline_check(struct pipeline_state *state, const struct gpio_event *ev, const struct timespec *wake)
+{
+    unsigned long budget = state->deadline;
+    unsigned int edges = ev->count;
+    long usec;
+
+    if (!budget) {
+        unsigned int rate = state->source.rate ? state->source.rate : LIVE_MAX_FRAMERATE;
+        budget = 500000 / rate;
+    }
+
+    if (ev->exact) {
+        usec = (wake->tv_sec - ev->timestamp.tv_sec) * 1000000;
+        usec += (wake->tv_nsec - ev->timestamp.tv_nsec) / 1000;
+    }
+    else {
+        usec = playback_deadline_estimate(state, wake, &edges);
+        if (usec < 0) return;
+    }
+
+    state->latency = usec;
+    if (state->latency > state->maxlatency) state->maxlatency = state->latency;
+    if (state->latency > budget) state->missed++;
+    state->missed += (edges - 1);
+}
+
 /*===============================================
  * Playback Module Threading
  *===============================================
@@ -508,48 +651,6 @@ playback_signal_state(struct pipeline_state *state)
     dbus_signal_update(state->video, names);
 }
 
-/*
- * Configure the frame sync GPIO for bi-directional edge detection, either
- * returns a correctly configured file descriptor, or less than zero on
- * error.
- */
-static int
-playback_setup_fsync(const char *value)
-{
-    FILE *fp;
-    char path[PATH_MAX];
-    int dirlen;
-
-    /* Get the length of the directory name for the GPIO value. */
-    dirlen = strlen(value);
-    if (dirlen > sizeof(path)) {
-        errno = EINVAL;
-        return -1;
-    }
-    while ((dirlen > 0) && (value[dirlen] != '/')) dirlen--;
-
-    /* Configure direction. */
-    memcpy(path, value, dirlen);
-    strcpy(path+dirlen, "direction");
-    fp = fopen(path, "w");
-    if (fp) {
-        fputs("in", fp);
-        fclose(fp);
-    }
-
-    /* Configure Edge detection */
-    memcpy(path, value, dirlen);
-    strcpy(path+dirlen, "edge");
-    fp = fopen(path, "w");
-    if (fp) {
-        fputs("rising", fp);
-        fclose(fp);
-    }
-
-    /* And finally, open the GPIO file descriptor */
-    return open(value, O_RDONLY | O_NONBLOCK);
-}
-
 /* Thread for managing the playback frames, this *MUST* run from a separate thread or
  * the GST/OMX elements are likely to get stuck in a deadlock. */
 static void *
@@ -560,22 +661,23 @@ playback_thread(void *arg)
     int seekfds[2];
     struct pipeline_state *state = (struct pipeline_state *)arg;
     struct pollfd pfd[2];
+    struct gpio_event_src *fsync;
     sigset_t mask;
     int newsegs;
     int flags;
-    int fsync;
 
     /* Open the frame sync GPIO or give up and fail. */
-    fsync = playback_setup_fsync(ioport_find_by_name(state->iops, "frame-irq"));
-    if (fsync < 0) {
+    fsync = gpio_event_open(ioport_find_by_name(state->iops, "frame-irq"), GPIO_EDGE_RISING);
+    if (!fsync) {
         fprintf(stderr, "Failed to setup frame sync GPIO: %s\n", strerror(errno));
         return NULL;
     }
+    fprintf(stderr, "Frame sync using %s GPIO events\n", gpio_event_backend(fsync));
 
     /* Setup a pipe for playback commands and seeking. */
     if (pipe(seekfds) != 0) {
         fprintf(stderr, "Failed to create playback pipe: %s\n", strerror(errno));
-        close(fsync);
+        gpio_event_close(fsync);
         return NULL;
     }
     flags = fcntl(seekfds[0], F_GETFL);
@@ -591,8 +693,8 @@ playback_thread(void *arg)
     pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
 
     /* Wait for frame sync when rendering frames. */
-    pfd[0].fd = fsync;
-    pfd[0].events = POLLPRI | POLLERR;
+    pfd[0].fd = gpio_event_fd(fsync);
+    pfd[0].events = gpio_event_pollmask(fsync);
     pfd[0].revents = 0;
 
     /* Wait for seek events to navigate through recordings. */
@@ -601,7 +703,9 @@ playback_thread(void *arg)
     pfd[1].revents = 0;
 
     while (1) {
+        struct timespec wake;
         int ready = poll(pfd, 2, PLAYBACK_POLL_INTERVAL);
+        clock_gettime(CLOCK_MONOTONIC, &wake);
         if (ready == 0) {
             watchdog--;
         }
@@ -670,11 +774,13 @@ playback_thread(void *arg)
                 overlay_setup(state);
 
                 /* Start playback by faking a fsync edge. */
-                pfd[0].revents |= POLLPRI;
+                pfd[0].revents |= pfd[0].events;
             }
             else if (delta == PLAYBACK_PIPE_FLUSH) {
                 /* Drop all recording segments. */
+                pthread_mutex_lock(&state->segmutex);
                 video_segment_flush(&state->seglist);
+                pthread_mutex_unlock(&state->segmutex);
             }
             else if (delta == PLAYBACK_PIPE_LIVE) {
                 /* Update the display timing if not already live. */
@@ -711,7 +817,7 @@ playback_thread(void *arg)
                     }
 
                     /* Start playback by faking a fsync edge. */
-                    pfd[0].revents |= POLLPRI;
+                    pfd[0].revents |= pfd[0].events;
 
                     /* Signal a state change. */
                     state->playstate = PLAYBACK_STATE_PLAY;
@@ -733,9 +839,15 @@ playback_thread(void *arg)
          *===============================================
          */
         if (pfd[0].revents) {
-            char buf[2];
-            lseek(fsync, 0, SEEK_SET);
-            read(fsync, buf, sizeof(buf));
+            struct gpio_event ev;
+
+            /* Faked edges have no event pending, so timestamp them now. */
+            if (gpio_event_read(fsync, &ev) > 0) {
+                state->fsynctime = ev.timestamp;
+                playback_deadline_check(state, &ev, &wake);
+            } else {
+                clock_gettime(CLOCK_MONOTONIC, &state->fsynctime);
+            }
 
             /* Reset the watchdog on fsync. */
             watchdog = PLAYBACK_WATCHDOG_COUNT;
@@ -756,7 +868,8 @@ playback_thread(void *arg)
     video_segment_flush(&state->seglist);
     close(seekfds[0]);
     close(seekfds[1]);
-    close(fsync);
+    gpio_event_close(fsync);
+    return NULL;
 }
 
 /*===============================================
@@ -768,6 +881,7 @@ playback_init(struct pipeline_state *state)
 {
     struct sigevent sigev;
     struct sigaction sigact;
+    pthread_attr_t attr;
 
     /*
      * TODO: Should be made private to the playback thread
@@ -776,6 +890,7 @@ playback_init(struct pipeline_state *state)
      */
     video_segments_init(&state->seglist, 0, 0, state->fpga->seq->frame_size);
     pthread_mutex_init(&state->segmutex, NULL);
+    pthread_mutex_init(&state->vrammutex, NULL);
 
     /* Install the desired signal handlers. */
     sigemptyset(&sigact.sa_mask);
@@ -795,16 +910,40 @@ playback_init(struct pipeline_state *state)
     state->control = (state->source.color) ? DISPLAY_CTL_COLOR_MODE : 0;
     state->fpga->display->control = (state->control | DISPLAY_CTL_ADDRESS_SELECT | DISPLAY_CTL_SYNC_INHIBIT);
 
+    /* Preallocate and fault in the stack so that the playback thread never takes a page fault on it. */
+    pthread_attr_init(&attr);
+    state->playstack = mmap(NULL, PLAYBACK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_STACK, -1, 0);
+    if (state->playstack != MAP_FAILED) {
+        pthread_attr_setstack(&attr, state->playstack, PLAYBACK_STACK_SIZE);
+    } else {
+        fprintf(stderr, "Failed to allocate playback stack: %s\n", strerror(errno));
+        state->playstack = NULL;
+    }
+
     /* Start the playback thread. */
-    pthread_create(&state->playthread, NULL, playback_thread, state);
+    state->missed = 0;
+    state->latency = 0;
+    state->maxlatency = 0;
+    state->fsyncphase.tv_sec = 0;
+    state->fsyncphase.tv_nsec = 0;
+    pthread_create(&state->playthread, &attr, playback_thread, state);
+    pthread_attr_destroy(&attr);
 }
 
 void
 playback_cleanup(struct pipeline_state *state)
 {
     int command = PLAYBACK_PIPE_EXIT;
-    struct timespec ts = {1, 0};
+    struct timespec ts;
     write(playback_pipe, &command, sizeof(command));
-    pthread_timedjoin_np(state->playthread, NULL, &ts);
+
+    /* The stack can only be released once the thread has actually exited. */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec++;
+    if ((pthread_timedjoin_np(state->playthread, NULL, &ts) == 0) && state->playstack) {
+        munmap(state->playstack, PLAYBACK_STACK_SIZE);
+        state->playstack = NULL;
+    }
     pthread_mutex_destroy(&state->segmutex);
+    pthread_mutex_destroy(&state->vrammutex);
 }
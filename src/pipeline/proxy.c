@@ -0,0 +1,509 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#include "pipeline.h"
+#include "bayer-bin.h"
+#include "demosaic.h"
+#include "tone-curve.h"
+
+/*
+ * The proxy cache holds small JPEG renderings of every Nth frame of the
+ * recording, so that the UI can scrub through a long recording without
+ * having to wait on the display readout for each full resolution frame.
+ * The cache is generated by a background thread, which only runs when
+ * the video system would otherwise be idle, and is stored per segment so
+ * that it can be discarded when the sequencer overwrites old frames.
+ */
+#define PROXY_IDLE_MSEC     500     /* Time to wait when there is nothing to do. */
+#define PROXY_JPEG_QUALITY  75
+
+struct proxy_frame {
+    void            *jpeg;
+    size_t          length;
+};
+
+struct proxy_segment {
+    unsigned int    hres;       /* Resolution of the recorded frames. */
+    unsigned int    vres;
+    unsigned int    scale;      /* Downscaling factor - always a multiple of two for Bayer data. */
+    unsigned int    width;      /* Resolution of the proxy frames. */
+    unsigned int    height;
+    unsigned long   interval;   /* Number of recorded frames per proxy frame. */
+    unsigned long   count;      /* Number of proxy frames in the segment. */
+    unsigned long   next;       /* Next proxy frame to be generated. */
+    struct proxy_frame frames[];
+};
+
+/* Work item to render a proxy frame. */
+struct proxy_work {
+    struct video_segment *seg;
+    unsigned long   index;
+    unsigned long   address;
+    unsigned long   generation;
+    unsigned int    hres;
+    unsigned int    scale;
+    unsigned int    width;
+    unsigned int    height;
+};
+
+static pthread_t        proxy_thread_handle;
+static pthread_mutex_t  proxy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   proxy_cond = PTHREAD_COND_INITIALIZER;
+static int              proxy_running = 0;
+static unsigned long    proxy_generation = 0;   /* Incremented whenever cached frames are discarded. */
+
+struct proxy_jpeg_err {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp_abort;
+};
+
+static void
+proxy_jpeg_abort(j_common_ptr cinfo)
+{
+    struct proxy_jpeg_err *err = (struct proxy_jpeg_err *)cinfo->err;
+    longjmp(err->jmp_abort, 1);
+}
+
+/*===============================================
+ * Proxy Cache Management
+ *===============================================
+ */
+/* Free the proxy frames of a segment - must be called with the proxy mutex held. */
+static void
+proxy_segment_free(struct pipeline_state *state, struct proxy_segment *pseg)
+{
+    unsigned long i;
+    for (i = 0; i < pseg->count; i++) {
+        if (!pseg->frames[i].jpeg) continue;
+        state->proxycount--;
+        state->proxybytes -= pseg->frames[i].length;
+        free(pseg->frames[i].jpeg);
+    }
+    free(pseg);
+}
+
+/* Allocate the proxy frames of a segment using the current configuration. */
+static struct proxy_segment *
+proxy_segment_alloc(struct pipeline_state *state, struct video_segment *seg)
+{
+    struct proxy_segment *pseg;
+    unsigned int hres = state->source.hframe;
+    unsigned int vres = state->source.vframe;
+    unsigned long interval = state->proxyinterval;
+    unsigned long width = state->proxywidth ? state->proxywidth : hres;
+    unsigned long count;
+
+    if (!interval) {
+        return NULL;
+    }
+    count = (seg->nframes + interval - 1) / interval;
+
+    /* Don't bother generating proxies if the frame size doesn't make sense. */
+    if ((hres > PIPELINE_MAX_HRES) || ((hres * vres * 3) / 2) > (seg->framesz * FPGA_FRAME_WORD_SIZE)) {
+        count = 0;
+    }
+
+    pseg = calloc(1, sizeof(struct proxy_segment) + count * sizeof(struct proxy_frame));
+    if (!pseg) {
+        return NULL;
+    }
+    pseg->hres = hres;
+    pseg->vres = vres;
+    pseg->interval = interval;
+    pseg->count = count;
+    pseg->next = 0;
+
+    /* Pick an even scaling factor so that every proxy pixel covers whole Bayer cells. */
+    pseg->scale = (hres + width - 1) / width;
+    pseg->scale = (pseg->scale + 1) & ~1;
+    if (pseg->scale < 2) pseg->scale = 2;
+    pseg->width = hres / pseg->scale;
+    pseg->height = vres / pseg->scale;
+    if (!pseg->width || !pseg->height) pseg->count = 0;
+    return pseg;
+}
+
+/* Segment list callback when a segment is deleted. */
+static void
+proxy_segment_release(struct video_seglist *list, struct video_segment *seg)
+{
+    pthread_mutex_lock(&proxy_mutex);
+    if (seg->priv) {
+        proxy_segment_free(cam_pipeline_state(), seg->priv);
+        seg->priv = NULL;
+    }
+    proxy_generation++;
+    pthread_mutex_unlock(&proxy_mutex);
+}
+
+/* Find the next proxy frame to generate - must be called with the segment and proxy mutexes held. */
+static int
+proxy_find_work(struct pipeline_state *state, struct proxy_work *work)
+{
+    struct video_segment *seg;
+
+    /* Wait until the video system has figured out the frame size. */
+    if (!state->source.hframe || !state->source.vframe) {
+        return 0;
+    }
+
+    for (seg = state->seglist.head; seg; seg = seg->next) {
+        struct proxy_segment *pseg = seg->priv;
+        if (!pseg) {
+            pseg = seg->priv = proxy_segment_alloc(state, seg);
+            if (!pseg) return 0;
+        }
+        if (pseg->next >= pseg->count) continue;
+
+        work->seg = seg;
+        work->index = pseg->next++;
+        work->generation = proxy_generation;
+        work->hres = pseg->hres;
+        work->scale = pseg->scale;
+        work->width = pseg->width;
+        work->height = pseg->height;
+        if (!video_segment_lookup(&state->seglist, seg->frameno + work->index * pseg->interval, &work->address)) {
+            continue;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Discard all cached proxy frames. */
+void
+proxy_flush(struct pipeline_state *state)
+{
+    struct video_segment *seg;
+
+    pthread_mutex_lock(&state->segmutex);
+    pthread_mutex_lock(&proxy_mutex);
+    for (seg = state->seglist.head; seg; seg = seg->next) {
+        if (seg->priv) {
+            proxy_segment_free(state, seg->priv);
+            seg->priv = NULL;
+        }
+    }
+    proxy_generation++;
+    pthread_cond_signal(&proxy_cond);
+    pthread_mutex_unlock(&proxy_mutex);
+    pthread_mutex_unlock(&state->segmutex);
+}
+
+/*
+ * Lookup the cached proxy frame nearest to the requested frame number. On
+ * success, the frame number is updated to that of the proxy frame and a
+ * copy of the JPEG data is returned.
+ */
+GArray *
+proxy_lookup(struct pipeline_state *state, unsigned long *frame, unsigned int *width, unsigned int *height)
+{
+    struct video_segment *seg;
+    struct proxy_segment *pseg;
+    GArray *array = NULL;
+
+    pthread_mutex_lock(&state->segmutex);
+    pthread_mutex_lock(&proxy_mutex);
+    seg = video_segment_lookup(&state->seglist, *frame, NULL);
+    pseg = seg ? seg->priv : NULL;
+    if (pseg && pseg->count) {
+        unsigned long index = ((*frame - seg->frameno) + pseg->interval / 2) / pseg->interval;
+        unsigned long dist;
+        long found = -1;
+
+        /* Search outwards for the nearest proxy frame that has been generated. */
+        if (index >= pseg->count) index = pseg->count - 1;
+        for (dist = 0; (dist < pseg->count) && (found < 0); dist++) {
+            if ((index >= dist) && pseg->frames[index - dist].jpeg) found = index - dist;
+            else if (((index + dist) < pseg->count) && pseg->frames[index + dist].jpeg) found = index + dist;
+        }
+        if (found >= 0) {
+            struct proxy_frame *pf = &pseg->frames[found];
+            array = g_array_sized_new(FALSE, FALSE, sizeof(guchar), pf->length);
+            if (array) g_array_append_vals(array, pf->jpeg, pf->length);
+            *frame = seg->frameno + found * pseg->interval;
+            *width = pseg->width;
+            *height = pseg->height;
+        }
+    }
+    pthread_mutex_unlock(&proxy_mutex);
+    pthread_mutex_unlock(&state->segmutex);
+    return array;
+}
+
+/*===============================================
+ * Proxy Frame Rendering
+ *===============================================
+ */
+/*
+ * Render a proxy frame from video memory, reading only the pair of rows
+ * needed for each row of the proxy and binning each Bayer cell down to a
+ * single linear pixel. The binned row is decimated down to the proxy width
+ * in place, and then mapped through the tone curve. Returns a JPEG image
+ * allocated with malloc(), or NULL on failure.
+ */
+static void *
+proxy_render(struct pipeline_state *state, const struct proxy_work *work, uint8_t *rowbuf, uint16_t *linbuf,
+             const uint8_t *lut, JSAMPLE *outbuf, size_t *length)
+{
+    struct jpeg_compress_struct cinfo;
+    struct proxy_jpeg_err jerr;
+    JSAMPROW rowptr[1] = { outbuf };
+    unsigned long rowbytes = (work->hres * 3) / 2;
+    unsigned int channels = state->source.color ? 3 : 1;
+    unsigned int step = (work->scale / 2) * channels;
+    uint16_t wbal[3];
+    unsigned int x, y, c;
+    char *jpeg = NULL;
+    size_t jpeglen = 0;
+    FILE *fp;
+
+    fp = open_memstream(&jpeg, &jpeglen);
+    if (!fp) {
+        return NULL;
+    }
+
+    /* Grab the white balance so we can render the color channels. */
+    for (c = 0; c < 3; c++) {
+        uint32_t gain = state->fpga->display->wbal[c];
+        wbal[c] = (gain > UINT16_MAX) ? UINT16_MAX : gain;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = proxy_jpeg_abort;
+    jpeg_create_compress(&cinfo);
+    if (setjmp(jerr.jmp_abort) != 0) {
+        jpeg_destroy_compress(&cinfo);
+        fclose(fp);
+        free(jpeg);
+        return NULL;
+    }
+    jpeg_stdio_dest(&cinfo, fp);
+    cinfo.image_width = work->width;
+    cinfo.image_height = work->height;
+    cinfo.input_components = state->source.color ? 3 : 1;
+    cinfo.in_color_space = state->source.color ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_set_quality(&cinfo, PROXY_JPEG_QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    for (y = 0; y < work->height; y++) {
+        unsigned long offset = (unsigned long)y * work->scale * rowbytes;
+        unsigned long skip = offset % FPGA_FRAME_WORD_SIZE;
+        unsigned long nwords = (skip + 2 * rowbytes + FPGA_FRAME_WORD_SIZE - 1) / FPGA_FRAME_WORD_SIZE;
+        const uint8_t *r0 = rowbuf + skip;
+        const uint8_t *r1 = r0 + rowbytes;
+        uint16_t *lin = linbuf;
+
+        /* Read the top two rows of this row of Bayer cells. */
+        pthread_mutex_lock(&state->vrammutex);
+        fpga_vram_read(state->fpga, rowbuf, work->address + offset / FPGA_FRAME_WORD_SIZE, nwords);
+        pthread_mutex_unlock(&state->vrammutex);
+
+        /* GRBG Bayer pattern. */
+        if (state->source.color) {
+            bayer_bin_rgb(linbuf, r0, r1, work->hres / 2, DEMOSAIC_CFA_GRBG, wbal);
+        } else {
+            bayer_bin_luma(linbuf, r0, r1, work->hres / 2);
+        }
+        for (x = 0; x < work->width; x++) {
+            for (c = 0; c < channels; c++) *lin++ = linbuf[x * step + c];
+        }
+        tone_map(outbuf, linbuf, lin - linbuf, 0, lut);
+        jpeg_write_scanlines(&cinfo, rowptr, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    if (fclose(fp) != 0) {
+        free(jpeg);
+        return NULL;
+    }
+    *length = jpeglen;
+    return jpeg;
+}
+
+/*===============================================
+ * Proxy Generator Thread
+ *===============================================
+ */
+/* Proxies should only be generated while nothing else is happening with video memory. */
+static int
+proxy_is_idle(struct pipeline_state *state)
+{
+    if (!state->proxyinterval) return 0;
+    if (PIPELINE_IS_SAVING(state->runmode)) return 0;
+    if (state->playstate == PLAYBACK_STATE_FILESAVE) return 0;
+    if ((state->playstate == PLAYBACK_STATE_PLAY) && (state->playrate != 0)) return 0;
+    if (state->fpga->seq->status & SEQ_STATUS_RECORDING) return 0;
+    return 1;
+}
+
+/* Sleep for up to msec milliseconds, returning zero if the thread should exit. */
+static int
+proxy_wait(unsigned long msec)
+{
+    int running;
+
+    pthread_mutex_lock(&proxy_mutex);
+    if (proxy_running && msec) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += msec / 1000;
+        ts.tv_nsec += (msec % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&proxy_cond, &proxy_mutex, &ts);
+    }
+    running = proxy_running;
+    pthread_mutex_unlock(&proxy_mutex);
+    return running;
+}
+
+static void *
+proxy_thread(void *arg)
+{
+    struct pipeline_state *state = arg;
+    uint8_t *rowbuf = malloc(PIPELINE_MAX_HRES * 3 + FPGA_FRAME_WORD_SIZE * 2);
+    uint16_t *linbuf = malloc(PIPELINE_MAX_HRES * 3 * sizeof(uint16_t));
+    JSAMPLE *outbuf = malloc(PIPELINE_MAX_HRES * 3);
+    uint8_t lut[TONE_CURVE_SIZE];
+    int curve = -1;
+    unsigned long delay = 0;
+
+    if (!rowbuf || !linbuf || !outbuf) {
+        fprintf(stderr, "Failed to allocate proxy working memory: %s\n", strerror(errno));
+        free(rowbuf);
+        free(linbuf);
+        free(outbuf);
+        return NULL;
+    }
+
+    while (proxy_wait(delay)) {
+        struct proxy_work work;
+        int found = 0;
+        size_t length;
+        void *jpeg;
+
+        delay = PROXY_IDLE_MSEC;
+        if (!proxy_is_idle(state)) continue;
+
+        /* Find the next proxy frame to generate. */
+        pthread_mutex_lock(&state->segmutex);
+        pthread_mutex_lock(&proxy_mutex);
+        found = proxy_find_work(state, &work);
+        pthread_mutex_unlock(&proxy_mutex);
+        pthread_mutex_unlock(&state->segmutex);
+        if (!found) continue;
+
+        /* Render the frame, and only keep it if its segment wasn't released meanwhile. */
+        if (curve != state->tonecurve) {
+            curve = state->tonecurve;
+            tone_curve_init(lut, curve);
+        }
+        jpeg = proxy_render(state, &work, rowbuf, linbuf, lut, outbuf, &length);
+        pthread_mutex_lock(&proxy_mutex);
+        if (jpeg && (work.generation == proxy_generation)) {
+            struct proxy_segment *pseg = work.seg->priv;
+            pseg->frames[work.index].jpeg = jpeg;
+            pseg->frames[work.index].length = length;
+            state->proxycount++;
+            state->proxybytes += length;
+            jpeg = NULL;
+        }
+        pthread_mutex_unlock(&proxy_mutex);
+        free(jpeg);
+        delay = 0;
+    }
+
+    free(rowbuf);
+    free(linbuf);
+    free(outbuf);
+    return NULL;
+}
+
+/*===============================================
+ * Proxy Module Setup
+ *===============================================
+ */
+void
+proxy_init(struct pipeline_state *state)
+{
+    pthread_attr_t attr;
+
+    /* Release proxy frames whenever a segment is removed from the recording. */
+    pthread_mutex_lock(&state->segmutex);
+    state->seglist.release = proxy_segment_release;
+    state->proxycount = 0;
+    state->proxybytes = 0;
+    pthread_mutex_unlock(&state->segmutex);
+
+    /* The proxy generator should only get leftover CPU time. */
+    pthread_attr_init(&attr);
+#ifdef SCHED_IDLE
+    {
+        struct sched_param param = { .sched_priority = 0 };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+#endif
+    proxy_running = 1;
+    if (pthread_create(&proxy_thread_handle, &attr, proxy_thread, state) != 0) {
+        /* Try again with the default scheduling policy. */
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        if (pthread_create(&proxy_thread_handle, &attr, proxy_thread, state) != 0) {
+            fprintf(stderr, "Failed to start proxy generator: %s\n", strerror(errno));
+            proxy_running = 0;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void
+proxy_cleanup(struct pipeline_state *state)
+{
+    int running;
+
+    pthread_mutex_lock(&proxy_mutex);
+    running = proxy_running;
+    proxy_running = 0;
+    pthread_cond_signal(&proxy_cond);
+    pthread_mutex_unlock(&proxy_mutex);
+    if (running) {
+        pthread_join(proxy_thread_handle, NULL);
+    }
+
+    /* Drop the cache and detach from the segment list. */
+    proxy_flush(state);
+    pthread_mutex_lock(&state->segmutex);
+    state->seglist.release = NULL;
+    pthread_mutex_unlock(&state->segmutex);
+}
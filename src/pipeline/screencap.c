@@ -20,152 +20,220 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <setjmp.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include <gst/gst.h>
-#include <jpeglib.h>
 
 #include "pipeline.h"
+#include "jpeg-nv12.h"
+#include "nv12-scale.h"
+#include "shm-frame.h"
 #include "utils.h"
 
-struct jpeg_err_jmpbuf {
-    struct jpeg_error_mgr pub;
-    jmp_buf jmp_abort;
+#define SCREENCAP_JPEG_QUALITY  85
+#define PREVIEW_JPEG_QUALITY    75
+#define PREVIEW_TIMEOUT_SEC     2   /* Stop encoding previews when nobody has read one for this long. */
+
+/*
+ * The screencap encoder and its buffers live for the lifetime of the
+ * process, and are reused across pipeline restarts. Encoded frames are
+ * handed off to a writer thread so that a slow reader on the FIFO can
+ * never stall the video pipeline, and any frames that arrive while the
+ * writer is still busy are dropped.
+ *
+ * The live preview is a second, rate-limited and optionally downscaled
+ * JPEG stream that gets published into shared memory for cam-scgi to
+ * serve to any number of web clients.
+ *
+ * Both outputs are cropped to the region of interest, which costs nothing
+ * as the encoder just walks a window of the buffer, and then downscaled
+ * to their configured resolutions before encoding.
+ */
+struct screencap_ctx {
+    struct pipeline_state *state;
+    struct jpeg_nv12    *enc;
+    pthread_t           thread;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+
+    /* Frame waiting to be written, or fd < 0 when the writer is idle. */
+    int                 fd;
+    const uint8_t       *data;
+    size_t              length;
+
+    /* Live preview publishing. */
+    struct jpeg_nv12    *preview;
+    struct shm_frame    *shm;
+    uint8_t             *scratch;
+    unsigned long long  lastpreview;
+
+    /* Statistics */
+    unsigned long       grabs;
+    unsigned long       drops;
 };
 
+static struct screencap_ctx screencap = {
+    .enc = NULL,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+static void *
+screencap_writer(void *arg)
+{
+    struct screencap_ctx *sc = arg;
+
+    while (1) {
+        const uint8_t *data;
+        size_t length;
+        int fd, flags;
+
+        /* Wait for a frame to be encoded. */
+        pthread_mutex_lock(&sc->mutex);
+        while (sc->fd < 0) {
+            pthread_cond_wait(&sc->cond, &sc->mutex);
+        }
+        fd = sc->fd;
+        data = sc->data;
+        length = sc->length;
+        pthread_mutex_unlock(&sc->mutex);
+
+        /* Write the whole frame at the reader's pace. */
+        flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        while (length) {
+            ssize_t ret = write(fd, data, length);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            data += ret;
+            length -= ret;
+        }
+        close(fd);
+
+        /* Ready for the next frame. */
+        pthread_mutex_lock(&sc->mutex);
+        sc->fd = -1;
+        pthread_mutex_unlock(&sc->mutex);
+    }
+    return NULL;
+}
+
+/* Determine an output resolution, preserving the aspect ratio if only one dimension is given. */
 static void
-jpeg_error_abort(j_common_ptr cinfo)
+screencap_fit(unsigned long width, unsigned long height, const struct nv12_frame *src,
+              unsigned int *pwidth, unsigned int *pheight)
 {
-    struct jpeg_err_jmpbuf *err = (struct jpeg_err_jmpbuf *)cinfo->err;
-    longjmp(err->jmp_abort, 1);
+    if (!width && !height) {
+        width = src->width;
+        height = src->height;
+    }
+    else if (!height) {
+        height = (src->height * width) / src->width;
+    }
+    else if (!width) {
+        width = (src->width * height) / src->height;
+    }
+    *pwidth = (width < 16) ? 16 : width;
+    *pheight = (height < 16) ? 16 : height;
 }
 
-/* Convert NV12 semiplanar chroma data into YUV planar data. */
-static inline void
-jpeg_copy_chroma_nv12(JSAMPLE *u, JSAMPLE *v, JSAMPLE *chroma, unsigned int num)
+static void
+screencap_preview(struct screencap_ctx *sc, const struct nv12_frame *frame)
 {
-#ifdef __ARM_NEON
-    asm volatile (
-        "jpeg_chroma_nv12_loop:         \n"
-        "   vld2.8   {d0,d1}, [%[s]]!   \n" /* Read and split the U/V planes. */
-        "   vmovl.u8 q1, d0             \n" /* Widen U plane to 16-bits. */
-        "   vmovl.u8 q2, d1             \n" /* Widen V plane to 16-bits. */
-        "   vsli.16  q1, q1, #8         \n" /* Horizontal upsample the U plane. */
-        "   vsli.16  q2, q2, #8         \n" /* Horizontal upsample the V plane. */
-        "   vstm %[udst]!,{q1}          \n" /* Output the U plane. */
-        "   vstm %[vdst]!,{q2}          \n" /* Output the V plane. */
-        "   subs %[count],%[count], #16 \n"
-        "   bgt jpeg_chroma_nv12_loop   \n"
-        : [udst]"+r"(u), [vdst]"+r"(v), [s]"+r"(chroma), [count]"+r"(num) :: "cc" );
-#else
-    unsigned int i;
-    for (i = 0; i < num; i++) {
-        u[i] = chroma[i & ~1];
-        v[i] = chroma[i | 1];
+    struct pipeline_state *state = sc->state;
+    struct nv12_frame scaled;
+    unsigned int pwidth, pheight;
+    unsigned long long now;
+    const uint8_t *jpeg;
+    ssize_t length;
+
+    /* Only publish previews at the desired rate, and while someone is watching. */
+    if (!sc->shm || !state->previewrate || !shm_frame_watched(sc->shm, PREVIEW_TIMEOUT_SEC)) {
+        return;
+    }
+    now = clock_usec(CLOCK_MONOTONIC);
+    if ((now - sc->lastpreview) < (1000000 / state->previewrate)) {
+        return;
+    }
+    sc->lastpreview = now;
+
+    /* Downscale and encode the frame. */
+    screencap_fit(state->previewwidth, state->previewheight, frame, &pwidth, &pheight);
+    nv12_scale(&scaled, frame, pwidth, pheight, sc->scratch);
+    length = jpeg_nv12_encode(sc->preview, scaled.luma, scaled.chroma, scaled.width, scaled.height, scaled.stride, &jpeg);
+    if (length > 0) {
+        shm_frame_publish(sc->shm, jpeg, length, scaled.width, scaled.height);
     }
-#endif
 }
 
 static gboolean
 buffer_framegrab(GstPad *pad, GstBuffer *buffer, gpointer cbdata)
 {
+    struct screencap_ctx *sc = cbdata;
+    struct pipeline_state *state = sc->state;
     GstCaps *caps = GST_BUFFER_CAPS(buffer);
     GstStructure *gstruct;
-    struct pipeline_state *state = (struct pipeline_state *)cbdata;
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_err_jmpbuf jerr;
-    /* Planar data to the JPEG encoder. */
-    JSAMPROW yrow[DCTSIZE];
-    JSAMPROW urow[DCTSIZE];
-    JSAMPROW vrow[DCTSIZE];
-    JSAMPARRAY data[3] = { yrow, urow, vrow };
-    JSAMPLE *planar;
-    /* Input semiplanar data from gstreamer. */
-    unsigned int i, row;
-    FILE *fp;
+    struct nv12_frame frame, roi, scaled;
+    unsigned int swidth, sheight;
+    const uint8_t *jpeg;
+    ssize_t length;
+    int width, height;
+    int busy;
+    int fd;
 
-    /* Check if the FIFO has been opened. */
-    int fd = open(SCREENCAP_PATH, O_WRONLY | O_NONBLOCK);
-    if (fd < 0) {
-        return TRUE;
+    /* Parse the frame's resolution from the buffer's caps. */
+    gstruct = gst_caps_get_structure(caps, 0);
+    width = g_value_get_int(gst_structure_get_value(gstruct, "width"));
+    height = g_value_get_int(gst_structure_get_value(gstruct, "height"));
+    nv12_frame_init(&frame, GST_BUFFER_DATA(buffer), width, height);
+
+    /* Let a pending frame grab take a copy of the whole frame. */
+    grab_probe(state, &frame, buffer);
+
+    /* Crop to the region of interest. */
+    if (state->roiwidth && state->roiheight) {
+        nv12_crop(&roi, &frame, state->roix, state->roiy, state->roiwidth, state->roiheight);
+    } else {
+        roi = frame;
     }
-    fp = fdopen(fd, "wb");
-    if (!fp) {
-        fprintf(stderr, "Failed to open frame grabber output pipe: %s\n", strerror(errno));
-        close(fd);
+
+    /* Publish the live preview. */
+    screencap_preview(sc, &roi);
+
+    /* Drop the frame if the writer is still busy with the last one. */
+    pthread_mutex_lock(&sc->mutex);
+    busy = (sc->fd >= 0);
+    pthread_mutex_unlock(&sc->mutex);
+    if (busy) {
+        sc->drops++;
         return TRUE;
     }
-    jpeg_create_compress(&cinfo);
-    jpeg_stdio_dest(&cinfo, fp);
 
-    /* Parse the frame's resolution from the buffer's caps. */
-    gstruct = gst_caps_get_structure(caps, 0);
-    cinfo.image_width = g_value_get_int(gst_structure_get_value(gstruct, "width"));
-    cinfo.image_height = g_value_get_int(gst_structure_get_value(gstruct, "height"));
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_YCbCr;
-
-    /* Allocate working memory for the JPEG encoder's chroma data. */
-    planar = malloc(sizeof(JSAMPLE) * cinfo.image_width * DCTSIZE);
-    if (!planar) {
-        fprintf(stderr, "Failed to allocate working memory for JPEG encoder: %s\n", strerror(errno));
-        fclose(fp);
-        close(fd);
+    /* Check if the FIFO has been opened. */
+    fd = open(SCREENCAP_PATH, O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
         return TRUE;
     }
-    
-    /* Point even and odd row pairs to the same memory to upscale the vertical chroma. */
-    for (i = 0; i < DCTSIZE; i++) {
-        urow[i] = planar + cinfo.image_width * (i & ~1);
-        vrow[i] = planar + cinfo.image_width * (i | 1);
-    }
 
-    cinfo.err = jpeg_std_error(&jerr.pub);
-    jerr.pub.error_exit = jpeg_error_abort;
-    if (setjmp(jerr.jmp_abort) == 0) {
-        uint8_t *nv12luma = GST_BUFFER_DATA(buffer);
-        uint8_t *nv12chroma = nv12luma + (cinfo.image_width * cinfo.image_height);
-        JSAMPLE *luma = state->scratchpad;
-        JSAMPLE *uplane = luma + (cinfo.image_width * cinfo.image_height);
-        JSAMPLE *vplane = uplane + (cinfo.image_width * cinfo.image_height) / 2;
-
-        /* Copy and upsample the buffer into cacheable memory. */
-        memcpy_neon(luma, GST_BUFFER_DATA(buffer), (cinfo.image_width * cinfo.image_height));
-        jpeg_copy_chroma_nv12(uplane, vplane, nv12chroma, (cinfo.image_width * cinfo.image_height) / 2);
-
-        /* Prepare for raw encoding of NV12 data. */
-        jpeg_set_defaults(&cinfo);
-        cinfo.dct_method = JDCT_IFAST;
-        cinfo.raw_data_in = TRUE;
-        cinfo.comp_info[0].h_samp_factor = 1;
-        cinfo.comp_info[0].v_samp_factor = 1;
-        cinfo.comp_info[1].h_samp_factor = 1;
-        cinfo.comp_info[1].v_samp_factor = 1;
-        cinfo.comp_info[2].h_samp_factor = 1;
-        cinfo.comp_info[2].v_samp_factor = 1;
-
-        jpeg_set_quality(&cinfo, 85, TRUE);
-        jpeg_start_compress(&cinfo, TRUE);
-        for (row = 0; row < cinfo.image_height; row += DCTSIZE) {
-            for (i = 0; i < DCTSIZE; i++) {
-                yrow[i] = luma;
-                urow[i] = uplane;
-                vrow[i] = vplane;
-                if ((row + i) < cinfo.image_height) {
-                    luma += cinfo.image_width;
-                    if (i & 1) {
-                        uplane += cinfo.image_width;
-                        vplane += cinfo.image_width;
-                    }
-                }
-            }
-            jpeg_write_raw_data(&cinfo, data, DCTSIZE);
-        }
-        jpeg_finish_compress(&cinfo);
+    /* Scale and encode the frame and hand it off to the writer. */
+    screencap_fit(state->capwidth, state->capheight, &roi, &swidth, &sheight);
+    nv12_scale(&scaled, &roi, swidth, sheight, sc->scratch);
+    length = jpeg_nv12_encode(sc->enc, scaled.luma, scaled.chroma, scaled.width, scaled.height, scaled.stride, &jpeg);
+    if (length < 0) {
+        close(fd);
+        return TRUE;
     }
-    jpeg_destroy_compress(&cinfo);
-    free(planar);
-    fclose(fp);
-    close(fd);
+    pthread_mutex_lock(&sc->mutex);
+    sc->fd = fd;
+    sc->data = jpeg;
+    sc->length = length;
+    sc->grabs++;
+    pthread_cond_signal(&sc->cond);
+    pthread_mutex_unlock(&sc->mutex);
     return TRUE;
 }
 
@@ -175,18 +243,48 @@ cam_screencap(struct pipeline_state *state)
     GstElement *queue, *sink;
     GstPad *pad;
 
+    /* Setup the encoder and writer thread on first use. */
+    if (!screencap.enc) {
+        screencap.scratch = malloc(NV12_SCALE_SCRATCH(PIPELINE_MAX_HRES, PIPELINE_MAX_VRES));
+        screencap.enc = jpeg_nv12_new(PIPELINE_MAX_HRES, SCREENCAP_JPEG_QUALITY);
+        if (!screencap.enc || !screencap.scratch) {
+            fprintf(stderr, "Failed to allocate screencap JPEG encoder\n");
+            if (screencap.enc) jpeg_nv12_free(screencap.enc);
+            free(screencap.scratch);
+            screencap.enc = NULL;
+            screencap.scratch = NULL;
+            return NULL;
+        }
+        if (pthread_create(&screencap.thread, NULL, screencap_writer, &screencap) != 0) {
+            fprintf(stderr, "Failed to start screencap writer: %s\n", strerror(errno));
+            jpeg_nv12_free(screencap.enc);
+            free(screencap.scratch);
+            screencap.enc = NULL;
+            screencap.scratch = NULL;
+            return NULL;
+        }
+        screencap.state = state;
+
+        /* The live preview is optional, so carry on without it if it fails. */
+        screencap.preview = jpeg_nv12_new(PIPELINE_MAX_HRES, PREVIEW_JPEG_QUALITY);
+        if (screencap.preview) {
+            screencap.shm = shm_frame_create(SHM_FRAME_PREVIEW, SHM_FRAME_PREVIEW_SIZE);
+        }
+    }
+
     /* Create a queue followed by a fakesink to throw away the frames. */
-    queue = gst_element_factory_make("queue",       "jpegqueue");
+    queue = cam_leaky_queue("jpegqueue");
     sink =  gst_element_factory_make("fakesink",    "jpegsink");
     if (!queue || !sink) {
         return NULL;
     }
+
     gst_bin_add_many(GST_BIN(state->pipeline), queue, sink, NULL);
     gst_element_link_many(queue, sink, NULL);
 
     /* Grab frames from the queue */
     pad = gst_element_get_static_pad(queue, "src");
-    gst_pad_add_buffer_probe(pad, G_CALLBACK(buffer_framegrab), state);
+    gst_pad_add_buffer_probe(pad, G_CALLBACK(buffer_framegrab), &screencap);
     gst_object_unref(pad);
 
     return gst_element_get_static_pad(queue, "sink");
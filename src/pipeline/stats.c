@@ -0,0 +1,107 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "gst/gstneon.h"
+
+/* Apply the interval, budget and metering region to the statistics element. */
+static void
+cam_stats_configure(struct pipeline_state *state, GstElement *stats)
+{
+    g_object_set(G_OBJECT(stats), "interval", (guint)state->statsinterval, NULL);
+    g_object_set(G_OBJECT(stats), "budget", (guint)state->statsbudget, NULL);
+    g_object_set(G_OBJECT(stats), "meter-x", (guint)state->aex, NULL);
+    g_object_set(G_OBJECT(stats), "meter-y", (guint)state->aey, NULL);
+    g_object_set(G_OBJECT(stats), "meter-width", (guint)state->aewidth, NULL);
+    g_object_set(G_OBJECT(stats), "meter-height", (guint)state->aeheight, NULL);
+}
+
+/*
+ * Live exposure and focus statistics are gathered from the luma plane on a
+ * branch of the tee, behind a leaky queue so that the analysis can never
+ * hold up the rest of the pipeline. The neonstats element posts a message
+ * on the bus whenever it has new results, which arrives on the main thread
+ * and is forwarded to D-Bus clients as a parameter update.
+ */
+GstPad *
+cam_stats(struct pipeline_state *state)
+{
+    GstElement *queue, *stats, *sink;
+
+    memset(&state->stats, 0, sizeof(state->stats));
+    if (!state->statsinterval) {
+        return NULL;
+    }
+
+    queue = cam_leaky_queue("statsqueue");
+    stats = gst_element_factory_make("neonstats",   "stats");
+    sink =  gst_element_factory_make("fakesink",    "statssink");
+    if (!queue || !stats || !sink) {
+        return NULL;
+    }
+
+    cam_stats_configure(state, stats);
+
+    gst_bin_add_many(GST_BIN(state->pipeline), queue, stats, sink, NULL);
+    gst_element_link_many(queue, stats, sink, NULL);
+
+    return gst_element_get_static_pad(queue, "sink");
+}
+
+/* Apply changes to the statistics configuration to a running element. */
+void
+cam_stats_reconfig(struct pipeline_state *state)
+{
+    GstElement *stats;
+
+    if (!state->pipeline || !state->statsinterval) {
+        return;
+    }
+    stats = gst_bin_get_by_name(GST_BIN(state->pipeline), "stats");
+    if (stats) {
+        cam_stats_configure(state, stats);
+        gst_object_unref(stats);
+    }
+}
+
+/* Collect new results from the statistics element, update the exposure, and notify D-Bus clients. */
+void
+cam_stats_update(struct pipeline_state *state, GstElement *element)
+{
+    const char *names[] = {
+        "statsHistogram",
+        "statsClipBlack",
+        "statsClipWhite",
+        "statsRowWaveform",
+        "statsColumnWaveform",
+        "statsFocus",
+        "statsStep",
+        "aeError",
+        NULL
+    };
+
+    if (!GST_IS_NEON_STATS(element)) {
+        return;
+    }
+    if (gst_neon_stats_get_results(GST_NEON_STATS(element), &state->stats)) {
+        cam_auto_exposure(state);
+        dbus_signal_update(state->video, names);
+    }
+}
@@ -0,0 +1,635 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <dbus/dbus-glib.h>
+
+#include "scgi.h"
+#include "dbus-json.h"
+#include "api/cam-rpc.h"
+
+/*
+ * Batch requests let a web client make several get, set and method calls in
+ * one HTTP request, rather than paying for a round trip over the network to
+ * make each one. The request body is a JSON array of operations:
+ *
+ *   [
+ *      {"op": "get", "interface": "video", "names": ["videoZoom", "overlayEnable"]},
+ *      {"op": "set", "interface": "control", "values": {"exposurePeriod": 1000000}},
+ *      {"op": "call", "interface": "video", "method": "flush", "args": {}}
+ *   ]
+ *
+ * The interface defaults to the one that cam-scgi serves. Operations on
+ * different interfaces are independent, and run concurrently. On the same
+ * interface, consecutive gets run concurrently, but a set or call waits for
+ * the operations before it to finish, and holds up those after it, so that
+ * reads observe the effects of earlier writes.
+ *
+ * The response is an array of results in the same order as the operations,
+ * each with an HTTP status code, and either the D-Bus reply or an error.
+ *
+ * With ?atomic=true the sets are all-or-nothing. The parameters they touch
+ * are read before applying any of them, and should any set fail, those that
+ * succeeded are reverted to their prior values and the sets that have yet to
+ * start are skipped. There is no undoing a method call, so calls are run
+ * regardless.
+ */
+#define SCGI_BATCH_MAX_OPS  64
+
+/* Operation types */
+#define SCGI_BATCH_GET      0
+#define SCGI_BATCH_SET      1
+#define SCGI_BATCH_CALL     2
+
+/* Operation states */
+#define SCGI_BATCH_WAITING  0
+#define SCGI_BATCH_RUNNING  1
+#define SCGI_BATCH_DONE     2
+
+/* Batch phases */
+#define SCGI_BATCH_SNAPSHOT 0   /* Reading the parameters to be set, in atomic mode. */
+#define SCGI_BATCH_RUN      1   /* Running the operations. */
+#define SCGI_BATCH_ROLLBACK 2   /* Reverting the sets after one failed, in atomic mode. */
+
+struct scgi_batch;
+
+struct scgi_batch_op {
+    int             type;
+    int             state;
+    int             iface;      /* Index into the batch interfaces. */
+    const char      *method;    /* D-Bus method name. */
+    const GValue    *args;      /* Borrowed from the request, or NULL for no arguments. */
+    GHashTable      *result;    /* Result object for the response. */
+    gboolean        applied;    /* Whether a set changed any parameters. */
+};
+
+struct scgi_batch_target {
+    const struct scgi_batch_iface *iface;
+    GHashTable      *names;     /* Names of the parameters set through this interface. */
+    GHashTable      *snapshot;  /* Their values before the batch, in atomic mode. */
+    GHashTable      *revert;    /* Prior values of the parameters that were changed, borrowed from the snapshot. */
+    gboolean        applied;    /* Whether any sets were applied. */
+    gchar           *undo;      /* Error message if the rollback failed. */
+};
+
+struct scgi_batch {
+    struct scgi_conn        *conn;
+    GValue                  *request;   /* Parsed request, which the operations borrow from. */
+    struct scgi_batch_op    *ops;
+    guint                   count;
+    int                     phase;
+    int                     pending;    /* D-Bus calls in flight. */
+    gboolean                atomic;
+    gboolean                failed;     /* Whether any set has failed. */
+    struct scgi_batch_target targets[SCGI_BATCH_IFACES];
+};
+
+/* A D-Bus call made by a batch, and what to do with its reply. */
+typedef void (*scgi_batch_done_t)(struct scgi_batch *batch, void *target, GHashTable *reply, GError *error);
+
+struct scgi_batch_call {
+    struct scgi_batch   *batch;
+    scgi_batch_done_t   done;
+    void                *target;
+};
+
+static gboolean scgi_batch_step(struct scgi_batch *batch);
+
+static void
+scgi_batch_notify(DBusGProxy *proxy, DBusGProxyCall *call, void *user_data)
+{
+    struct scgi_batch_call *pending = user_data;
+    struct scgi_batch *batch = pending->batch;
+    GError *error = NULL;
+    GHashTable *h = NULL;
+
+    if (!dbus_g_proxy_end_call(proxy, call, &error, CAM_DBUS_HASH_MAP, &h, G_TYPE_INVALID)) {
+        h = NULL;
+    }
+    batch->pending--;
+    pending->done(batch, pending->target, h, error);
+    if (error) g_error_free(error);
+    scgi_batch_step(batch);
+}
+
+/*
+ * Start a D-Bus call on behalf of the batch. The done handler takes ownership
+ * of the reply, and is called right away with an error if the call could not
+ * be started.
+ */
+static void
+scgi_batch_begin(struct scgi_batch *batch, DBusGProxy *proxy, const char *method,
+                 GType argtype, gconstpointer arg, scgi_batch_done_t done, void *target)
+{
+    struct scgi_batch_call *pending = g_new0(struct scgi_batch_call, 1);
+    DBusGProxyCall *call;
+    GError *error = NULL;
+
+    pending->batch = batch;
+    pending->done = done;
+    pending->target = target;
+    call = dbus_g_proxy_begin_call_with_timeout(proxy, method, scgi_batch_notify, pending, g_free,
+            batch->conn->ctx->timeout, argtype, arg, G_TYPE_INVALID);
+    if (!call) {
+        g_free(pending);
+        g_set_error(&error, DBUS_GERROR, DBUS_GERROR_FAILED, "Failed to call %s", method);
+        done(batch, target, NULL, error);
+        g_error_free(error);
+        return;
+    }
+    batch->pending++;
+}
+
+/* Fill in an operation's result with an error. */
+static void
+scgi_batch_error(struct scgi_batch_op *op, int code, const char *reason, const char *fmt, ...)
+{
+    va_list ap;
+    gchar *message;
+
+    va_start(ap, fmt);
+    message = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    if (op->result) cam_dbus_dict_free(op->result);
+    op->result = cam_dbus_dict_new();
+    cam_dbus_dict_add_int(op->result, "status", code);
+    cam_dbus_dict_add_string(op->result, "error", reason);
+    cam_dbus_dict_add_string(op->result, "message", message);
+    g_free(message);
+    op->state = SCGI_BATCH_DONE;
+}
+
+static void
+scgi_batch_op_done(struct scgi_batch *batch, void *target, GHashTable *reply, GError *error)
+{
+    struct scgi_batch_op *op = target;
+    const struct scgi_batch_iface *iface = batch->targets[op->iface].iface;
+
+    if (error) {
+        const char *reason;
+        int code = scgi_error_status(error, &reason);
+        scgi_batch_error(op, code, reason, "%s", error->message);
+        if (op->type == SCGI_BATCH_SET) batch->failed = TRUE;
+        return;
+    }
+
+    op->state = SCGI_BATCH_DONE;
+    op->result = cam_dbus_dict_new();
+    if (op->type == SCGI_BATCH_GET) {
+        if (iface->cache) scgi_cache_store(iface->cache, reply, FALSE);
+    }
+    else if (op->type == SCGI_BATCH_SET) {
+        /* The reply holds the values that were set, and an error dict for those that couldn't be. */
+        if (cam_dbus_dict_exists(reply, "error")) {
+            cam_dbus_dict_add_int(op->result, "status", 400);
+            cam_dbus_dict_add_string(op->result, "error", "Bad Request");
+            op->applied = (g_hash_table_size(reply) > 1);
+            batch->failed = TRUE;
+        }
+        else {
+            op->applied = TRUE;
+        }
+        if (op->applied) batch->targets[op->iface].applied = TRUE;
+    }
+    if (!cam_dbus_dict_exists(op->result, "status")) {
+        cam_dbus_dict_add_int(op->result, "status", 200);
+    }
+    cam_dbus_dict_take_boxed(op->result, "result", CAM_DBUS_HASH_MAP, reply);
+}
+
+static void
+scgi_batch_start(struct scgi_batch *batch, struct scgi_batch_op *op)
+{
+    const struct scgi_batch_iface *iface = batch->targets[op->iface].iface;
+
+    /* In atomic mode, a failed set cancels the sets that have yet to start. */
+    if ((op->type == SCGI_BATCH_SET) && batch->atomic && batch->failed) {
+        scgi_batch_error(op, 409, "Conflict", "Skipped because another set in the batch failed");
+        return;
+    }
+    if ((op->type == SCGI_BATCH_SET) && iface->cache) {
+        scgi_cache_invalidate(iface->cache, g_value_get_boxed(op->args));
+    }
+
+    op->state = SCGI_BATCH_RUNNING;
+    scgi_batch_begin(batch, iface->proxy, op->method,
+            op->args ? G_VALUE_TYPE(op->args) : G_TYPE_INVALID, op->args ? g_value_peek_pointer(op->args) : NULL,
+            scgi_batch_op_done, op);
+}
+
+/* Start every operation that isn't waiting on an earlier one. */
+static void
+scgi_batch_dispatch(struct scgi_batch *batch)
+{
+    gboolean reading[SCGI_BATCH_IFACES];
+    gboolean blocked[SCGI_BATCH_IFACES];
+    guint i;
+
+restart:
+    memset(reading, 0, sizeof(reading));
+    memset(blocked, 0, sizeof(blocked));
+    for (i = 0; i < batch->count; i++) {
+        struct scgi_batch_op *op = &batch->ops[i];
+        gboolean write = (op->type != SCGI_BATCH_GET);
+
+        if (op->state == SCGI_BATCH_DONE) continue;
+        if (op->state == SCGI_BATCH_WAITING) {
+            /* Everything waits on a write, and writes wait on everything. */
+            if (blocked[op->iface]) continue;
+            if (write && reading[op->iface]) {
+                blocked[op->iface] = TRUE;
+                continue;
+            }
+            scgi_batch_start(batch, op);
+
+            /* Finishing right away may have unblocked the operations after it. */
+            if (op->state == SCGI_BATCH_DONE) goto restart;
+        }
+        if (write) blocked[op->iface] = TRUE;
+        else reading[op->iface] = TRUE;
+    }
+}
+
+static void
+scgi_batch_snapshot_done(struct scgi_batch *batch, void *target, GHashTable *reply, GError *error)
+{
+    struct scgi_batch_target *t = target;
+    guint i;
+
+    if (!error) {
+        /* Unknown names are left for the sets to report, they cannot be restored. */
+        g_hash_table_remove(reply, "error");
+        t->snapshot = reply;
+        return;
+    }
+
+    /* Without the prior values, no sets can be made safely. */
+    batch->failed = TRUE;
+    for (i = 0; i < batch->count; i++) {
+        struct scgi_batch_op *op = &batch->ops[i];
+        if ((op->type == SCGI_BATCH_SET) && (op->state == SCGI_BATCH_WAITING)) {
+            scgi_batch_error(op, 409, "Conflict", "Failed to read the parameters before setting them: %s", error->message);
+        }
+    }
+}
+
+static void
+scgi_batch_rollback_done(struct scgi_batch *batch, void *target, GHashTable *reply, GError *error)
+{
+    struct scgi_batch_target *t = target;
+
+    if (error) {
+        t->undo = g_strdup(error->message);
+    }
+    else if (cam_dbus_dict_exists(reply, "error")) {
+        t->undo = g_strdup("Some parameters could not be restored");
+    }
+    if (reply) cam_dbus_dict_free(reply);
+}
+
+/* Write out the array of results, and release the batch. */
+static void
+scgi_batch_finish(struct scgi_batch *batch)
+{
+    struct scgi_conn *conn = batch->conn;
+    gboolean reverted = FALSE;
+    FILE *fp;
+    char *json;
+    size_t jslen;
+    guint i;
+
+    /* Report the sets that were reverted, only snapshots in atomic mode allow it. */
+    for (i = 0; batch->failed && (i < batch->count); i++) {
+        struct scgi_batch_op *op = &batch->ops[i];
+        struct scgi_batch_target *t;
+
+        if (!op->applied) continue;
+        t = &batch->targets[op->iface];
+        if (!t->snapshot) continue;
+        reverted = TRUE;
+
+        /* Sets that succeeded on their own become conflicts, those that failed keep their error. */
+        if (t->undo) {
+            g_hash_table_remove(op->result, "status");
+            g_hash_table_remove(op->result, "error");
+            cam_dbus_dict_add_int(op->result, "status", 500);
+            cam_dbus_dict_add_string(op->result, "error", "Internal Server Error");
+            cam_dbus_dict_add_printf(op->result, "message", "Failed to revert the batch: %s", t->undo);
+        }
+        else if (cam_dbus_dict_get_int(op->result, "status", 0) == 200) {
+            g_hash_table_remove(op->result, "status");
+            cam_dbus_dict_add_int(op->result, "status", 409);
+            cam_dbus_dict_add_string(op->result, "error", "Conflict");
+            cam_dbus_dict_add_string(op->result, "message", "Reverted because another set in the batch failed");
+        }
+        else {
+            cam_dbus_dict_add_string(op->result, "message", "Reverted the parameters that were set");
+        }
+    }
+
+    /* Render the results into a JSON array. */
+    if ((fp = open_memstream(&json, &jslen)) == NULL) {
+        scgi_client_error(conn, 500, "Internal Server Error");
+    }
+    else {
+        json_newline = "\r\n";
+        fputs("[", fp);
+        for (i = 0; i < batch->count; i++) {
+            fprintf(fp, "%s%s%*s", i ? "," : "", json_newline, JSON_TAB_SIZE, "");
+            json_printf_dict(fp, batch->ops[i].result, 1);
+        }
+        fprintf(fp, "%s]\r\n", batch->count ? json_newline : "");
+        fclose(fp);
+
+        scgi_start_response(conn, reverted ? 409 : 200, reverted ? "Conflict" : "OK");
+        scgi_write_xorigin(conn, "POST, OPTION");
+        scgi_write_header(conn, "Content-type: application/json");
+        scgi_write_header(conn, "Cache-control: no-cache");
+        scgi_write_header(conn, "");
+        scgi_take_payload(conn, json, jslen);
+    }
+
+    /* Send the response, unless we are still within the request handler. */
+    if (conn->state == SCGI_STATE_PENDING) {
+        scgi_finish_response(conn);
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        if (batch->ops[i].result) cam_dbus_dict_free(batch->ops[i].result);
+    }
+    for (i = 0; i < SCGI_BATCH_IFACES; i++) {
+        struct scgi_batch_target *t = &batch->targets[i];
+        if (t->names) g_hash_table_destroy(t->names);
+        if (t->revert) g_hash_table_destroy(t->revert);
+        if (t->snapshot) cam_dbus_dict_free(t->snapshot);
+        g_free(t->undo);
+    }
+    g_value_unset(batch->request);
+    g_free(batch->request);
+    g_free(batch->ops);
+    g_free(batch);
+}
+
+/*
+ * Gather the prior values of the parameters that the applied sets on an
+ * interface reported changing. Parameters that were rejected, or that were
+ * only named by sets that never ran, are left alone.
+ */
+static GHashTable *
+scgi_batch_revert_values(struct scgi_batch *batch, int iface)
+{
+    struct scgi_batch_target *t = &batch->targets[iface];
+    GHashTable *values = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    gpointer key, value;
+    guint i;
+
+    for (i = 0; i < batch->count; i++) {
+        struct scgi_batch_op *op = &batch->ops[i];
+        GValue *gval;
+
+        if ((op->iface != iface) || !op->applied) continue;
+        gval = g_hash_table_lookup(op->result, "result");
+        if (!gval || (G_VALUE_TYPE(gval) != CAM_DBUS_HASH_MAP)) continue;
+
+        g_hash_table_iter_init(&iter, g_value_get_boxed(gval));
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            gpointer prior = g_hash_table_lookup(t->snapshot, key);
+            if ((strcmp(key, "error") == 0) || !prior) continue;
+            g_hash_table_insert(values, key, prior);
+        }
+    }
+    return values;
+}
+
+/* Move the batch through its phases as the D-Bus calls complete, returning TRUE once it has finished. */
+static gboolean
+scgi_batch_step(struct scgi_batch *batch)
+{
+    guint i;
+
+    if (batch->phase == SCGI_BATCH_SNAPSHOT) {
+        if (batch->pending) return FALSE;
+        batch->phase = SCGI_BATCH_RUN;
+    }
+    if (batch->phase == SCGI_BATCH_RUN) {
+        scgi_batch_dispatch(batch);
+        if (batch->pending) return FALSE;
+
+        /* All operations are done, revert the sets if any of them failed. */
+        batch->phase = SCGI_BATCH_ROLLBACK;
+        for (i = 0; batch->atomic && batch->failed && (i < SCGI_BATCH_IFACES); i++) {
+            struct scgi_batch_target *t = &batch->targets[i];
+            if (!t->applied || !t->snapshot) continue;
+            t->revert = scgi_batch_revert_values(batch, i);
+            if (!g_hash_table_size(t->revert)) continue;
+            if (t->iface->cache) scgi_cache_invalidate(t->iface->cache, t->revert);
+            scgi_batch_begin(batch, t->iface->proxy, "set", CAM_DBUS_HASH_MAP, t->revert,
+                             scgi_batch_rollback_done, t);
+        }
+    }
+    if (batch->pending) return FALSE;
+
+    /* The batch is freed once the results are written. */
+    scgi_batch_finish(batch);
+    return TRUE;
+}
+
+/* Parse one operation from the request, returning FALSE with an error result if it is malformed. */
+static gboolean
+scgi_batch_parse_op(struct scgi_batch *batch, struct scgi_batch_op *op, GHashTable *h,
+                    const struct scgi_batch_iface *ifaces)
+{
+    const char *type = cam_dbus_dict_get_string(h, "op", NULL);
+    const char *name = cam_dbus_dict_get_string(h, "interface", NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    int i;
+
+    /* Find the interface by its short or full name, or default to the first. */
+    for (i = 0; name && (i < SCGI_BATCH_IFACES); i++) {
+        if (!ifaces[i].proxy) continue;
+        if (strcmp(name, ifaces[i].name) == 0) break;
+        if (strcmp(name, dbus_g_proxy_get_interface(ifaces[i].proxy)) == 0) break;
+    }
+    if (i >= SCGI_BATCH_IFACES) {
+        scgi_batch_error(op, 404, "Not Found", "Unknown interface: %s", name);
+        return FALSE;
+    }
+    op->iface = name ? i : 0;
+
+    if (!type) {
+        scgi_batch_error(op, 400, "Bad Request", "Missing operation type");
+        return FALSE;
+    }
+    if (strcmp(type, "get") == 0) {
+        op->type = SCGI_BATCH_GET;
+        op->method = "get";
+        op->args = g_hash_table_lookup(h, "names");
+        if (!op->args || (G_VALUE_TYPE(op->args) != dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING))) {
+            scgi_batch_error(op, 400, "Bad Request", "Expected an array of parameter names");
+            return FALSE;
+        }
+    }
+    else if (strcmp(type, "set") == 0) {
+        op->type = SCGI_BATCH_SET;
+        op->method = "set";
+        op->args = g_hash_table_lookup(h, "values");
+        if (!op->args || (G_VALUE_TYPE(op->args) != CAM_DBUS_HASH_MAP)) {
+            scgi_batch_error(op, 400, "Bad Request", "Expected a dictionary of parameter values");
+            return FALSE;
+        }
+
+        /* Remember the names being set, for the snapshot in atomic mode. */
+        if (!batch->targets[op->iface].names) {
+            batch->targets[op->iface].names = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+        g_hash_table_iter_init(&iter, g_value_get_boxed(op->args));
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_hash_table_insert(batch->targets[op->iface].names, key, NULL);
+        }
+    }
+    else if (strcmp(type, "call") == 0) {
+        op->type = SCGI_BATCH_CALL;
+        op->method = cam_dbus_dict_get_string(h, "method", NULL);
+        op->args = g_hash_table_lookup(h, "args");
+        if (!op->method) {
+            scgi_batch_error(op, 400, "Bad Request", "Missing method name");
+            return FALSE;
+        }
+        if (op->args && (G_VALUE_TYPE(op->args) != CAM_DBUS_HASH_MAP)) {
+            scgi_batch_error(op, 400, "Bad Request", "Expected a dictionary of method arguments");
+            return FALSE;
+        }
+    }
+    else {
+        scgi_batch_error(op, 400, "Bad Request", "Unknown operation: %s", type);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void
+scgi_batch(struct scgi_conn *conn, const char *method, void *user_data)
+{
+    const struct scgi_batch_iface *ifaces = user_data;
+    struct scgi_batch *batch;
+    GType optype = dbus_g_type_get_collection("GPtrArray", CAM_DBUS_HASH_MAP);
+    GValue *request;
+    GValue *query;
+    GPtrArray *array = NULL;
+    guint i;
+
+    /* Boilerplate to allow cross-origin requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        scgi_start_response(conn, 200, "OK");
+        scgi_write_xorigin(conn, "POST, OPTION");
+        scgi_write_header(conn, "Access-Control-Allow-Headers: Content-Type");
+        scgi_write_header(conn, "Content-Type: application/json");
+        scgi_write_header(conn, "");
+        return;
+    }
+    else if (strcmp(method, "POST") != 0) {
+        scgi_start_response(conn, 405, "Method Not Allowed");
+        scgi_write_header(conn, "Accept: POST, OPTION");
+        scgi_write_header(conn, "");
+        return;
+    }
+
+    /*
+     * The request body must be an array of operations, an empty array parses
+     * as one of strings. Objects and form data parse as a dictionary instead.
+     */
+    request = scgi_parse_params(conn, method);
+    if (request && (G_VALUE_TYPE(request) == optype)) {
+        array = g_value_get_boxed(request);
+    }
+    else if (request && (G_VALUE_TYPE(request) == dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING))) {
+        array = g_value_get_boxed(request);
+        if (array->len) array = NULL;
+    }
+    if (!array) {
+        if (request) {
+            g_value_unset(request);
+            g_free(request);
+        }
+        scgi_client_error(conn, 400, "Bad Request");
+        return;
+    }
+    if (array->len > SCGI_BATCH_MAX_OPS) {
+        g_value_unset(request);
+        g_free(request);
+        scgi_client_error(conn, 413, "Request Entity Too Large");
+        return;
+    }
+
+    batch = g_new0(struct scgi_batch, 1);
+    batch->conn = conn;
+    batch->request = request;
+    batch->count = array->len;
+    batch->ops = g_new0(struct scgi_batch_op, array->len ? array->len : 1);
+    for (i = 0; i < SCGI_BATCH_IFACES; i++) {
+        batch->targets[i].iface = &ifaces[i];
+    }
+
+    /* Options are given in the query string. */
+    query = scgi_parse_params(conn, "GET");
+    if (query) {
+        batch->atomic = cam_dbus_dict_get_boolean(g_value_get_boxed(query), "atomic", FALSE);
+        g_value_unset(query);
+        g_free(query);
+    }
+
+    /* Parse the operations, any that are malformed fail without affecting the others. */
+    for (i = 0; i < array->len; i++) {
+        struct scgi_batch_op *op = &batch->ops[i];
+        GHashTable *h = g_ptr_array_index(array, i);
+        if (!scgi_batch_parse_op(batch, op, h, ifaces)) {
+            if (g_strcmp0(cam_dbus_dict_get_string(h, "op", NULL), "set") == 0) batch->failed = TRUE;
+        }
+    }
+
+    /* In atomic mode, read the parameters to be set so they can be reverted. */
+    batch->phase = SCGI_BATCH_SNAPSHOT;
+    for (i = 0; batch->atomic && !batch->failed && (i < SCGI_BATCH_IFACES); i++) {
+        struct scgi_batch_target *t = &batch->targets[i];
+        GPtrArray *names;
+        GHashTableIter iter;
+        gpointer key, value;
+
+        if (!t->names) continue;
+        names = g_ptr_array_sized_new(g_hash_table_size(t->names));
+        g_hash_table_iter_init(&iter, t->names);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_ptr_array_add(names, key);
+        }
+        scgi_batch_begin(batch, t->iface->proxy, "get", dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING), names,
+                         scgi_batch_snapshot_done, t);
+        g_ptr_array_free(names, TRUE);
+    }
+
+    /* Run the batch, and wait for it to finish if it has calls in flight. */
+    if (batch->pending || !scgi_batch_step(batch)) {
+        scgi_defer_response(conn);
+    }
+}
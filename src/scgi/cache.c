@@ -0,0 +1,198 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <dbus/dbus-glib.h>
+
+#include "scgi.h"
+#include "api/cam-rpc.h"
+
+/*
+ * Cache of the parameter values, so that the dashboards polling the parameter
+ * paths several times a second can be answered from memory rather than a
+ * round trip through D-Bus. Values are stored from the replies to get calls,
+ * and kept current by the update signals, which carry the new values of any
+ * parameters that changed.
+ *
+ * Not every change is guaranteed to generate an update signal, so values also
+ * expire once they reach the maximum age, after which they are fetched again
+ * on the next request. The whole cache is flushed if the daemon restarts.
+ */
+struct scgi_cache_entry {
+    GValue  value;
+    gint64  stamp;      /* Monotonic time of the last fetch or update, in microseconds. */
+};
+
+static void
+scgi_cache_entry_free(gpointer ptr)
+{
+    struct scgi_cache_entry *entry = ptr;
+    g_value_unset(&entry->value);
+    g_free(entry);
+}
+
+struct scgi_cache *
+scgi_cache_new(int maxage)
+{
+    struct scgi_cache *cache = g_new0(struct scgi_cache, 1);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, scgi_cache_entry_free);
+    cache->maxage = (gint64)maxage * 1000;
+    return cache;
+}
+
+/* Forget all the parameters, and their names. */
+void
+scgi_cache_flush(struct scgi_cache *cache)
+{
+    g_hash_table_remove_all(cache->entries);
+    if (cache->keys) {
+        g_ptr_array_free(cache->keys, TRUE);
+        cache->keys = NULL;
+    }
+    cache->stats.flushes++;
+}
+
+/* Store the values from a get reply or an update signal. */
+void
+scgi_cache_store(struct scgi_cache *cache, GHashTable *values, gboolean signalled)
+{
+    gint64 now = g_get_monotonic_time();
+    GHashTableIter iter;
+    gpointer key, value;
+
+    if (!cache->maxage) return;
+    g_hash_table_iter_init(&iter, values);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct scgi_cache_entry *entry = g_new0(struct scgi_cache_entry, 1);
+        g_value_init(&entry->value, G_VALUE_TYPE(value));
+        g_value_copy(value, &entry->value);
+        entry->stamp = now;
+        g_hash_table_replace(cache->entries, g_strdup(key), entry);
+        if (signalled) cache->stats.updates++;
+        else cache->stats.fetched++;
+    }
+}
+
+/* Drop the parameters named in a dictionary, such as those about to be set. */
+void
+scgi_cache_invalidate(struct scgi_cache *cache, GHashTable *values)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, values);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (g_hash_table_remove(cache->entries, key)) cache->stats.invalidated++;
+    }
+}
+
+/*
+ * Copy the values of the named parameters that are in the cache and not yet
+ * expired into a new dictionary, and add the names of the rest to missing.
+ * When missing is given, the lookup counts towards the metrics as a hit if
+ * every parameter was found, or as a miss otherwise.
+ */
+GHashTable *
+scgi_cache_lookup(struct scgi_cache *cache, GPtrArray *names, GPtrArray *missing)
+{
+    GHashTable *h = cam_dbus_dict_new();
+    gint64 now = g_get_monotonic_time();
+    gint64 oldest = 0;
+    guint i;
+
+    for (i = 0; i < names->len; i++) {
+        const char *name = g_ptr_array_index(names, i);
+        struct scgi_cache_entry *entry = g_hash_table_lookup(cache->entries, name);
+        GValue *gval;
+
+        if (entry && ((now - entry->stamp) >= cache->maxage)) {
+            g_hash_table_remove(cache->entries, name);
+            cache->stats.expired++;
+            entry = NULL;
+        }
+        if (!entry) {
+            if (missing) g_ptr_array_add(missing, (gpointer)name);
+            continue;
+        }
+        if ((now - entry->stamp) > oldest) oldest = now - entry->stamp;
+
+        gval = g_new0(GValue, 1);
+        g_value_init(gval, G_VALUE_TYPE(&entry->value));
+        g_value_copy(&entry->value, gval);
+        cam_dbus_dict_add(h, name, gval);
+    }
+
+    if (!missing) return h;
+    if (missing->len) {
+        cache->stats.misses++;
+    }
+    else {
+        /* The staleness of a response is the age of its oldest value. */
+        cache->stats.hits++;
+        cache->stats.agesum += oldest;
+        if (oldest > cache->stats.agemax) cache->stats.agemax = oldest;
+    }
+    return h;
+}
+
+/* The names of all parameters in the API, if known. */
+GPtrArray *
+scgi_cache_keys(struct scgi_cache *cache)
+{
+    return cache->maxage ? cache->keys : NULL;
+}
+
+/* Remember the names of all parameters from an availableKeys reply. */
+void
+scgi_cache_store_keys(struct scgi_cache *cache, GHashTable *available)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    if (!cache->maxage) return;
+    if (cache->keys) g_ptr_array_free(cache->keys, TRUE);
+    cache->keys = g_ptr_array_new_with_free_func(g_free);
+    g_hash_table_iter_init(&iter, available);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_ptr_array_add(cache->keys, g_strdup(key));
+    }
+}
+
+/* Report the hit rate and staleness of the cache, with ages in milliseconds. */
+GHashTable *
+scgi_cache_metrics(struct scgi_cache *cache)
+{
+    GHashTable *h = cam_dbus_dict_new();
+    unsigned long lookups = cache->stats.hits + cache->stats.misses;
+
+    cam_dbus_dict_add_boolean(h, "enabled", cache->maxage != 0);
+    cam_dbus_dict_add_uint(h, "maxAge", cache->maxage / 1000);
+    cam_dbus_dict_add_uint(h, "entries", g_hash_table_size(cache->entries));
+    cam_dbus_dict_add_uint(h, "hits", cache->stats.hits);
+    cam_dbus_dict_add_uint(h, "misses", cache->stats.misses);
+    cam_dbus_dict_add_float(h, "hitRate", lookups ? (double)cache->stats.hits / lookups : 0.0);
+    cam_dbus_dict_add_uint(h, "fetched", cache->stats.fetched);
+    cam_dbus_dict_add_uint(h, "updates", cache->stats.updates);
+    cam_dbus_dict_add_uint(h, "expired", cache->stats.expired);
+    cam_dbus_dict_add_uint(h, "invalidated", cache->stats.invalidated);
+    cam_dbus_dict_add_uint(h, "flushes", cache->stats.flushes);
+    cam_dbus_dict_add_float(h, "meanAge", cache->stats.hits ? (double)cache->stats.agesum / cache->stats.hits / 1000 : 0.0);
+    cam_dbus_dict_add_float(h, "worstAge", (double)cache->stats.agemax / 1000);
+    return h;
+}
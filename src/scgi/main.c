@@ -31,6 +31,8 @@
 #include "api/cam-rpc.h"
 
 static struct scgi_ctx *ctx = NULL;
+static struct scgi_cache *cache = NULL;
+static struct scgi_batch_iface batch[SCGI_BATCH_IFACES];
 
 static void
 sse_handler(struct scgi_conn *conn, const char *method, void *closure)
@@ -46,7 +48,13 @@ scgi_signal_handler(DBusGProxy* proxy, GHashTable *args, const char *name)
 {
     char *json;
     size_t jslen;
-    FILE *fp = open_memstream(&json, &jslen);
+    FILE *fp;
+
+    /* Keep the parameter cache current with any values that changed. */
+    if (strcmp(name, "update") == 0) {
+        scgi_cache_store(cache, args, TRUE);
+    }
+    fp = open_memstream(&json, &jslen);
     
     /* Write the JSON blob into a string. */
     json_newline = "\ndata:";
@@ -60,6 +68,16 @@ scgi_signal_handler(DBusGProxy* proxy, GHashTable *args, const char *name)
     free(json);
 } /* dbus_handler */
 
+/* Flush the parameter cache when the daemon restarts, since its parameters start afresh. */
+static void
+scgi_owner_handler(DBusGProxy *proxy, const char *name, const char *prev, const char *next, gpointer closure)
+{
+    const char *service = closure;
+    if (strcmp(name, service) == 0) {
+        scgi_cache_flush(cache);
+    }
+}
+
 
 static void
 scgi_subscribe(struct scgi_conn *conn, const char *method, void *user_data)
@@ -87,18 +105,20 @@ scgi_subscribe(struct scgi_conn *conn, const char *method, void *user_data)
     conn->state = SCGI_STATE_SUBSCRIBE;
 }
 
+/* Store the parameters from a get reply in the cache on their way through. */
+static void
+scgi_property_reply(struct scgi_conn *conn, GHashTable *reply, void *closure)
+{
+    scgi_cache_store(cache, reply, FALSE);
+    scgi_json_reply(conn, reply, closure);
+}
+
 static void
 scgi_property(struct scgi_conn *conn, const char *method, void *user_data)
 {
     DBusGProxy* proxy = user_data;
     const char *path = scgi_header_find(conn, "PATH_INFO");
     const char *name;
-    GError *error = NULL;
-    GHashTable *h;
-    gboolean okay;
-    FILE *fp;
-    char *json;
-    size_t jslen;
 
     /* parse the path info for the property name */
     while (*path == '/') path++;
@@ -120,61 +140,118 @@ scgi_property(struct scgi_conn *conn, const char *method, void *user_data)
     /* Handle the requests by method. */
     if (strcmp(method, "GET") == 0) {
         GPtrArray *array = g_ptr_array_sized_new(1);
-        if (!array) {
+        GPtrArray *missing = g_ptr_array_sized_new(1);
+        GHashTable *h;
+        if (!array || !missing) {
+            if (array) g_ptr_array_free(array, TRUE);
+            if (missing) g_ptr_array_free(missing, TRUE);
             scgi_client_error(conn, 500, "Internal Server Error");
             return;
         }
         g_ptr_array_add(array, (gpointer)name);
 
-        /* Execute the D-Bus get call. */
-        okay = dbus_g_proxy_call(proxy, "get", &error,
-                dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING), array, G_TYPE_INVALID,
-                CAM_DBUS_HASH_MAP, &h, G_TYPE_INVALID);
-        g_ptr_array_free(array, TRUE);
-        if (!okay) {
-            scgi_client_error(conn, 500, "Internal Server Error");
-            return;
+        /* Serve the parameter from the cache if we can, otherwise execute the D-Bus get call. */
+        h = scgi_cache_lookup(cache, array, missing);
+        if (!missing->len) {
+            scgi_json_reply(conn, h, (void *)"GET, OPTION");
         }
+        else {
+            scgi_call_begin(conn, proxy, "get", dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING), array,
+                            scgi_property_reply, (void *)"GET, OPTION");
+        }
+        cam_dbus_dict_free(h);
+        g_ptr_array_free(missing, TRUE);
+        g_ptr_array_free(array, TRUE);
     }
     /* TODO: Other Methods... PUT and POST seem obvious */
     else {
         scgi_write_header(conn, "Status: 405 Method Not Allowed");
         scgi_write_header(conn, "Allow: GET");
         scgi_write_header(conn, "");
+    }
+}
+
+/* Combine the parameters from a get reply with those that were already cached. */
+static void
+scgi_property_merge(struct scgi_conn *conn, GHashTable *reply, void *closure)
+{
+    GPtrArray *keys = scgi_cache_keys(cache);
+    GHashTable *h;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    scgi_cache_store(cache, reply, FALSE);
+    if (!keys) {
+        /* Either the cache is disabled, or it was flushed during the call. */
+        scgi_json_reply(conn, reply, closure);
         return;
     }
 
-    /* Render the D-Bus reply into JSON */
-    if ((fp = open_memstream(&json, &jslen)) == NULL) {
-        g_hash_table_destroy(h);
+    h = scgi_cache_lookup(cache, keys, NULL);
+    g_hash_table_iter_init(&iter, reply);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        GValue *gval = g_new0(GValue, 1);
+        g_value_init(gval, G_VALUE_TYPE(value));
+        g_value_copy(value, gval);
+        g_hash_table_replace(h, g_strdup(key), gval);
+    }
+    scgi_json_reply(conn, h, closure);
+    cam_dbus_dict_free(h);
+}
+
+/* Serve a set of parameters from the cache, and request any that are missing from the API. */
+static void
+scgi_property_fetch(struct scgi_conn *conn, DBusGProxy *proxy, GPtrArray *keys)
+{
+    GPtrArray *missing = g_ptr_array_sized_new(keys->len);
+    GHashTable *h;
+
+    if (!missing) {
         scgi_client_error(conn, 500, "Internal Server Error");
         return;
     }
-    json_newline = "\r\n";
-    json_printf_dict(fp, h, 0);
-    fputs("\r\n", fp);
-    fclose(fp);
-    g_hash_table_destroy(h);
-    
-    /* Otherwise, keep testing... */
-    scgi_start_response(conn, 200, "OK");
-    scgi_write_xorigin(conn, "GET, OPTION");
-    scgi_write_header(conn, "Content-type: application/json");
-    scgi_write_header(conn, "Cache-Control: no-cache");
-    scgi_write_header(conn, "");
-    scgi_take_payload(conn, json, jslen);
+    h = scgi_cache_lookup(cache, keys, missing);
+    if (!missing->len) {
+        scgi_json_reply(conn, h, NULL);
+    }
+    else {
+        scgi_call_begin(conn, proxy, "get", dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING), missing,
+                        scgi_property_merge, NULL);
+    }
+    cam_dbus_dict_free(h);
+    g_ptr_array_free(missing, TRUE);
+}
+
+/* Once we know the list of parameters in the API, request them all. */
+static void
+scgi_property_keys(struct scgi_conn *conn, GHashTable *available, void *closure)
+{
+    DBusGProxy* proxy = closure;
+    GPtrArray *array;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    /* Build a string array of all the keys */
+    array = g_ptr_array_sized_new(g_hash_table_size(available));
+    if (!array) {
+        scgi_client_error(conn, 500, "Internal Server Error");
+        return;
+    }
+    g_hash_table_iter_init(&iter, available);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_ptr_array_add(array, key);
+    }
+
+    /* Request the parameters from the API. */
+    scgi_cache_store_keys(cache, available);
+    scgi_property_fetch(conn, proxy, array);
+    g_ptr_array_free(array, TRUE);
 }
 
 static void
 scgi_property_group(struct scgi_conn *conn, const char *method, void *user_data)
 {
     DBusGProxy* proxy = user_data;
-    GError *error = NULL;
-    GHashTable *result;
-    gboolean okay;
-    FILE *fp;
-    char *json;
-    size_t jslen;
 
     /* Boilerplate to allow cross-origin requests */
     if (strcmp(method, "OPTIONS") == 0) {
@@ -187,33 +264,15 @@ scgi_property_group(struct scgi_conn *conn, const char *method, void *user_data)
 
     /* When processing a GET - generate the entire parameter set */
     if (strcmp(method, "GET") == 0) {
-        GPtrArray *array;
-        GHashTable *available;
-        GHashTableIter iter;
-        gpointer key, value;
-
-        /* Request the list of parameters in the API */
-        okay = dbus_g_proxy_call(proxy, "availableKeys", &error, G_TYPE_INVALID,
-                CAM_DBUS_HASH_MAP, &available, G_TYPE_INVALID);
-        if (!okay) {
-            scgi_error_handler(conn, error);
-            g_error_free(error);
-            return;
-        }
+        GPtrArray *keys = scgi_cache_keys(cache);
 
-        /* Build a string array of all the keys */
-        array = g_ptr_array_sized_new(g_hash_table_size(available));
-        g_hash_table_iter_init(&iter, available);
-        while (array && g_hash_table_iter_next(&iter, &key, &value)) {
-            g_ptr_array_add(array, key);
+        /* Request the list of parameters in the API, unless it was cached. */
+        if (keys) {
+            scgi_property_fetch(conn, proxy, keys);
+        }
+        else {
+            scgi_call_begin(conn, proxy, "availableKeys", G_TYPE_INVALID, NULL, scgi_property_keys, proxy);
         }
-
-        /* Request the parameters from the API. */
-        okay = dbus_g_proxy_call(proxy, "get", &error,
-                dbus_g_type_get_collection("GPtrArray", G_TYPE_STRING), array, G_TYPE_INVALID,
-                CAM_DBUS_HASH_MAP, &result, G_TYPE_INVALID);
-        cam_dbus_dict_free(available);
-        g_ptr_array_free(array, TRUE);
     }
     /* When processing a POST - take a dictionary of parameters and their new values */
     else if (strcmp(method, "POST") == 0) {
@@ -223,10 +282,10 @@ scgi_property_group(struct scgi_conn *conn, const char *method, void *user_data)
             return;
         }
 
-        /* PATH_INFO should be the D-Bus method name */
-        okay = dbus_g_proxy_call(proxy, "set", &error,
-                G_VALUE_TYPE(params), g_value_peek_pointer(params), G_TYPE_INVALID,
-                CAM_DBUS_HASH_MAP, &result, G_TYPE_INVALID);
+        /* Drop the cached values being set, the update signal will bring back the new ones. */
+        scgi_cache_invalidate(cache, g_value_get_boxed(params));
+        scgi_call_begin(conn, proxy, "set", G_VALUE_TYPE(params), g_value_peek_pointer(params),
+                        scgi_json_reply, NULL);
         g_free(params);
     }
     /* Otherwise, this method is not allowed. */
@@ -234,83 +293,161 @@ scgi_property_group(struct scgi_conn *conn, const char *method, void *user_data)
         scgi_start_response(conn, 405, "Method Not Allowed");
         scgi_write_header(conn, "Allowed: GET, OPTION");
         scgi_write_header(conn, "");
+    }
+}
+
+static void
+scgi_describe(struct scgi_conn *conn, const char *method, void *user_data)
+{
+    DBusGProxy* proxy = user_data;
+
+    /* Boilerplate to allow cross-origin requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        scgi_start_response(conn, 200, "OK");
+        scgi_write_xorigin(conn, "GET");
+        scgi_write_header(conn, "Content-Type: application/json");
+        scgi_write_header(conn, "");
         return;
     }
 
-    /* Check if the call succeeded */
-    if (!okay) {
-        scgi_error_handler(conn, error);
-        g_error_free(error);
+    /* Request the list of parameters in the API */
+    /* TODO: Use D-Bus introspection on the API to get the list of calls */
+    scgi_call_begin(conn, proxy, "availableKeys", G_TYPE_INVALID, NULL, scgi_json_reply, NULL);
+}
+
+/* Report the parameter cache metrics. */
+static void
+scgi_cache_status(struct scgi_conn *conn, const char *method, void *user_data)
+{
+    GHashTable *h;
+
+    /* Boilerplate to allow cross-origin requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        scgi_start_response(conn, 200, "OK");
+        scgi_write_xorigin(conn, "GET");
+        scgi_write_header(conn, "Content-Type: application/json");
+        scgi_write_header(conn, "");
         return;
     }
+    else if (strcmp(method, "GET") != 0) {
+        scgi_start_response(conn, 405, "Method Not Allowed");
+        scgi_write_header(conn, "Accept: GET, OPTION");
+        scgi_write_header(conn, "");
+        return;
+    }
+
+    h = scgi_cache_metrics(cache);
+    scgi_json_reply(conn, h, (void *)"GET, OPTION");
+    cam_dbus_dict_free(h);
+}
 
-    /* Render the D-Bus reply into JSON */
-    if ((fp = open_memstream(&json, &jslen)) == NULL) {
-        g_hash_table_destroy(result);
+/* Send the binary image data from a D-Bus reply. */
+static void
+scgi_image_reply(struct scgi_conn *conn, GHashTable *h, const char *key, const char *mimetype)
+{
+    GValue *gval;
+    GArray *image;
+    void *payload;
+
+    gval = g_hash_table_lookup(h, key);
+    if (!gval || !G_VALUE_HOLDS(gval, DBUS_TYPE_G_UCHAR_ARRAY)) {
         scgi_client_error(conn, 500, "Internal Server Error");
         return;
     }
-    json_newline = "\r\n";
-    json_printf_dict(fp, result, 0);
-    fputs("\r\n", fp);
-    fclose(fp);
-    g_hash_table_destroy(result);
-    
-    /* Otherwise, keep testing... */
+    image = g_value_get_boxed(gval);
+    payload = malloc(image->len);
+    if (!payload) {
+        scgi_client_error(conn, 500, "Internal Server Error");
+        return;
+    }
+    memcpy(payload, image->data, image->len);
+
     scgi_start_response(conn, 200, "OK");
-    scgi_write_header(conn, "Content-type: application/json");
+    scgi_write_xorigin(conn, "GET, OPTION");
+    scgi_write_header(conn, "Content-Type: %s", mimetype);
+    scgi_write_header(conn, "Content-Length: %u", image->len);
+    scgi_write_header(conn, "X-Frame-Number: %lu", cam_dbus_dict_get_uint(h, "frame", 0));
     scgi_write_header(conn, "Cache-Control: no-cache");
     scgi_write_header(conn, "");
-    scgi_take_payload(conn, json, jslen);
+    scgi_take_payload(conn, payload, image->len);
 }
 
 static void
-scgi_describe(struct scgi_conn *conn, const char *method, void *user_data)
+scgi_thumbnail_reply(struct scgi_conn *conn, GHashTable *h, void *closure)
+{
+    scgi_image_reply(conn, h, "jpeg", "image/jpeg");
+}
+
+/* Serve scrubbing proxy frames as JPEG images rather than JSON. */
+static void
+scgi_thumbnail(struct scgi_conn *conn, const char *method, void *user_data)
 {
     DBusGProxy* proxy = user_data;
-    GError *error = NULL;
-    GHashTable *h;
-    gboolean okay;
-    FILE *fp;
-    char *json;
-    size_t jslen;
+    GValue *params;
 
     /* Boilerplate to allow cross-origin requests */
     if (strcmp(method, "OPTIONS") == 0) {
         scgi_start_response(conn, 200, "OK");
         scgi_write_xorigin(conn, "GET");
-        scgi_write_header(conn, "Content-Type: application/json");
+        scgi_write_header(conn, "Content-Type: image/jpeg");
+        scgi_write_header(conn, "");
+        return;
+    }
+    else if (strcmp(method, "GET") != 0) {
+        scgi_start_response(conn, 405, "Method Not Allowed");
+        scgi_write_header(conn, "Accept: GET, OPTION");
         scgi_write_header(conn, "");
         return;
     }
 
-    /* Request the list of parameters in the API */
-    okay = dbus_g_proxy_call(proxy, "availableKeys", &error, G_TYPE_INVALID,
-            CAM_DBUS_HASH_MAP, &h, G_TYPE_INVALID);
-    if (!okay) {
-        scgi_client_error(conn, 500, "Internal Server Error");
+    /* The frame number is passed via the query string. */
+    params = scgi_parse_params(conn, method);
+    if (!params) {
+        scgi_client_error(conn, 400, "Bad Request");
         return;
     }
+    scgi_call_begin(conn, proxy, "thumbnail", G_VALUE_TYPE(params), g_value_peek_pointer(params),
+                    scgi_thumbnail_reply, NULL);
+    g_value_unset(params);
+    g_free(params);
+}
 
-    /* TODO: Use D-Bus introspection on the API to get the list of calls */
+static void
+scgi_grabframe_reply(struct scgi_conn *conn, GHashTable *h, void *closure)
+{
+    scgi_image_reply(conn, h, "data", cam_dbus_dict_get_string(h, "mimetype", "application/octet-stream"));
+}
 
-    /* Render the D-Bus reply into JSON */
-    if ((fp = open_memstream(&json, &jslen)) == NULL) {
-        g_hash_table_destroy(h);
-        scgi_client_error(conn, 500, "Internal Server Error");
+static void
+scgi_grabframe(struct scgi_conn *conn, const char *method, void *user_data)
+{
+    DBusGProxy* proxy = user_data;
+    GValue *params;
+
+    /* Boilerplate to allow cross-origin requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        scgi_start_response(conn, 200, "OK");
+        scgi_write_xorigin(conn, "GET");
+        scgi_write_header(conn, "");
         return;
     }
-    json_newline = "\r\n";
-    json_printf_dict(fp, h, 0);
-    fputs("\r\n", fp);
-    fclose(fp);
-    g_hash_table_destroy(h);
-    
-    /* Otherwise, keep testing... */
-    scgi_start_response(conn, 200, "OK");
-    scgi_write_header(conn, "Content-type: application/json");
-    scgi_write_header(conn, "");
-    scgi_take_payload(conn, json, jslen);
+    else if (strcmp(method, "GET") != 0) {
+        scgi_start_response(conn, 405, "Method Not Allowed");
+        scgi_write_header(conn, "Accept: GET, OPTION");
+        scgi_write_header(conn, "");
+        return;
+    }
+
+    /* The frame number, format and scale are passed via the query string. */
+    params = scgi_parse_params(conn, method);
+    if (!params) {
+        scgi_client_error(conn, 400, "Bad Request");
+        return;
+    }
+    scgi_call_begin(conn, proxy, "grabframe", G_VALUE_TYPE(params), g_value_peek_pointer(params),
+                    scgi_grabframe_reply, NULL);
+    g_value_unset(params);
+    g_free(params);
 }
 
 static void
@@ -330,8 +467,34 @@ usage(FILE *fp, int argc, char * const argv[])
     fprintf(fp, "an HTML5 Server-Sent-Event stream with the asynchronos signals from\n");
     fprintf(fp, "the D-Bus interface.\n\n");
 
+    fprintf(fp, "When connected to the video interface, \'/thumbnail?frame=N\' returns\n");
+    fprintf(fp, "the cached scrubbing proxy nearest to frame N as a JPEG image, and\n");
+    fprintf(fp, "\'/grabframe?frame=N&format=FMT&scale=S\' returns exactly frame N as a\n");
+    fprintf(fp, "JPEG or PNG image downscaled by a factor of S, or as a full resolution\n");
+    fprintf(fp, "DNG image, for which S must be 1.\n\n");
+
+    fprintf(fp, "The \'/mjpeg\' path streams the live preview from the video pipeline\n");
+    fprintf(fp, "as a multipart/x-mixed-replace sequence of JPEG images.\n\n");
+
+    fprintf(fp, "D-Bus calls are made asynchronously, and a request whose call gets\n");
+    fprintf(fp, "no reply within the timeout fails with 504 Gateway Timeout.\n\n");
+
+    fprintf(fp, "Parameters read through the \'/p\' paths are cached, and kept up to\n");
+    fprintf(fp, "date by the update signals, until they reach the maximum age. The\n");
+    fprintf(fp, "\'/cache\' path reports the hit rate and staleness of the cache.\n\n");
+
+    fprintf(fp, "A POST to \'/batch\' runs a JSON array of get, set and call operations\n");
+    fprintf(fp, "on either the video or control interface, concurrently where they\n");
+    fprintf(fp, "are independent, and returns an array of their results in order.\n");
+    fprintf(fp, "With \'/batch?atomic=true\' the sets are reverted if any of them fail.\n\n");
+
     fprintf(fp, "options:\n");
     fprintf(fp, "\t-p, --port NUM list on TCP port NUM for SCGI requests\n");
+    fprintf(fp, "\t-t, --timeout MSEC\n");
+    fprintf(fp, "\t               time out D-Bus calls after MSEC milliseconds (default: %d)\n", SCGI_DEFAULT_TIMEOUT);
+    fprintf(fp, "\t-c, --cache MSEC\n");
+    fprintf(fp, "\t               cache parameters for up to MSEC milliseconds, or 0 to\n");
+    fprintf(fp, "\t               disable the cache (default: %d)\n", SCGI_DEFAULT_CACHE_AGE);
     fprintf(fp, "\t-n, --control  connect to the control DBus interface\n");
     fprintf(fp, "\t-v, --video    connect to the video DBus interface\n");
     fprintf(fp, "\t-h, --help     display this help and exit\n");
@@ -342,20 +505,25 @@ main(int argc, char * const argv[])
 {
     DBusGConnection* bus;
     DBusGProxy* proxy;
+    DBusGProxy* owner;
     GMainLoop* mainloop;
     GSocketService *scgi_service;
     GError* error = NULL;
     gboolean okay;
     unsigned int scgi_port = 8111;
+    int timeout = SCGI_DEFAULT_TIMEOUT;
+    int maxage = SCGI_DEFAULT_CACHE_AGE;
     const char *service = CAM_DBUS_CONTROL_SERVICE;
     const char *path = CAM_DBUS_CONTROL_PATH;
     const char *iface = CAM_DBUS_CONTROL_INTERFACE;
     const char *method;
     
     /* Option Parsing */
-    const char *short_options = "p:nvh";
+    const char *short_options = "p:t:c:nvh";
     const struct option long_options[] = {
         {"port",    required_argument, 0, 'p'},
+        {"timeout", required_argument, 0, 't'},
+        {"cache",   required_argument, 0, 'c'},
         {"control", no_argument,       0, 'n'},
         {"video",   no_argument,       0, 'v'},
         {"help",    no_argument,       0, 'h'},
@@ -374,6 +542,22 @@ main(int argc, char * const argv[])
                 }
                 break;
 
+            case 't':
+                timeout = strtol(optarg, &end, 10);
+                if ((timeout <= 0) || (*end != '\0')) {
+                    fprintf(stderr, "Invalid timeout given: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'c':
+                maxage = strtol(optarg, &end, 10);
+                if ((maxage < 0) || (*end != '\0')) {
+                    fprintf(stderr, "Invalid cache age given: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
             case 'v':
                 service = CAM_DBUS_VIDEO_SERVICE;
                 path = CAM_DBUS_VIDEO_PATH;
@@ -409,6 +593,28 @@ main(int argc, char * const argv[])
         exit(EXIT_FAILURE);
     }
 
+    /* Watch for the daemon restarting, so that the parameter cache can be flushed. */
+    cache = scgi_cache_new(maxage);
+    owner = dbus_g_proxy_new_for_name(bus, DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS);
+    if (owner) {
+        dbus_g_proxy_add_signal(owner, "NameOwnerChanged", G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INVALID);
+        dbus_g_proxy_connect_signal(owner, "NameOwnerChanged", G_CALLBACK(scgi_owner_handler), (gpointer)service, NULL);
+    }
+
+    /* Batch requests can reach both interfaces, starting with the one we serve. */
+    batch[0].proxy = proxy;
+    batch[0].cache = cache;
+    if (strcmp(service, CAM_DBUS_VIDEO_SERVICE) == 0) {
+        batch[0].name = "video";
+        batch[1].name = "control";
+        batch[1].proxy = dbus_g_proxy_new_for_name(bus, CAM_DBUS_CONTROL_SERVICE, CAM_DBUS_CONTROL_PATH, CAM_DBUS_CONTROL_INTERFACE);
+    }
+    else {
+        batch[0].name = "control";
+        batch[1].name = "video";
+        batch[1].proxy = dbus_g_proxy_new_for_name(bus, CAM_DBUS_VIDEO_SERVICE, CAM_DBUS_VIDEO_PATH, CAM_DBUS_VIDEO_INTERFACE);
+    }
+
     /* Initialize the GLib socket handler. */
     scgi_service = g_socket_service_new();
     g_socket_listener_add_inet_port((GSocketListener *)scgi_service, 8111, NULL, &error);
@@ -419,6 +625,7 @@ main(int argc, char * const argv[])
 
     /* Listen for incomming connections */
     ctx = scgi_server_ctx(scgi_service, NULL, NULL);
+    ctx->timeout = timeout;
     g_socket_service_start(scgi_service);
 
     /* Register the special SCGI path handlers */
@@ -426,6 +633,11 @@ main(int argc, char * const argv[])
     scgi_ctx_register(ctx, "describe", scgi_describe, proxy);
     scgi_ctx_register(ctx, "p/[a-z]*", scgi_property, proxy);
     scgi_ctx_register(ctx, "p$", scgi_property_group, proxy);
+    scgi_ctx_register(ctx, "cache$", scgi_cache_status, NULL);
+    scgi_ctx_register(ctx, "batch$", scgi_batch, batch);
+    scgi_ctx_register(ctx, "thumbnail", scgi_thumbnail, proxy);
+    scgi_ctx_register(ctx, "grabframe", scgi_grabframe, proxy);
+    scgi_ctx_register(ctx, "mjpeg$", scgi_mjpeg, NULL);
 
     /* Add signal and call handlers by introspecting */
     scgi_introspect(ctx, bus, proxy);
@@ -126,36 +126,34 @@ scgi_parse_params(struct scgi_conn *conn, const char *method)
     return NULL;
 }
 
-void
-scgi_error_handler(struct scgi_conn *conn, GError *err)
+/* Turn a D-Bus error into an HTTP status code, and its reason phrase. */
+int
+scgi_error_status(GError *err, const char **reason)
 {
-    const char *name;
-
     /* The only error we are actually expecting here is a DBusError */
     if (err->domain != dbus_g_error_quark()) {
-        scgi_client_error(conn, 500, "Internal Server Error");
-        return;
+        *reason = "Internal Server Error";
+        return 500;
     }
 
-    /* Turn the D-Bus error code into an HTTP error code */
     switch (err->code) {
         case DBUS_GERROR_INVALID_ARGS:
-            scgi_start_response(conn, 400, "Bad Request");
-            break;
+            *reason = "Bad Request";
+            return 400;
 
         case DBUS_GERROR_UNKNOWN_METHOD:
-            scgi_start_response(conn, 404, "File Not Found");
-            break;
+            *reason = "File Not Found";
+            return 404;
 
         case DBUS_GERROR_SERVICE_UNKNOWN:
-            scgi_start_response(conn, 503, "Service Unavailable");
-            break;
+            *reason = "Service Unavailable";
+            return 503;
 
         case DBUS_GERROR_NO_REPLY:
         case DBUS_GERROR_TIMEOUT:
         case DBUS_GERROR_TIMED_OUT:
-            scgi_start_response(conn, 504, "Gateway Timeout");
-            break;
+            *reason = "Gateway Timeout";
+            return 504;
 
         case DBUS_GERROR_FAILED:
         case DBUS_GERROR_NO_MEMORY:
@@ -185,55 +183,104 @@ scgi_error_handler(struct scgi_conn *conn, GError *err)
         case DBUS_GERROR_SELINUX_SECURITY_CONTEXT_UNKNOWN:
         case DBUS_GERROR_REMOTE_EXCEPTION:
         default:
-            scgi_start_response(conn, 500, "Internal Server Error");
-            break;
+            *reason = "Internal Server Error";
+            return 500;
+    }
+}
+
+void
+scgi_error_handler(struct scgi_conn *conn, GError *err)
+{
+    const char *reason;
+    int code = scgi_error_status(err, &reason);
+
+    /* Anything other than a DBusError has no more detail to offer. */
+    if (err->domain != dbus_g_error_quark()) {
+        scgi_client_error(conn, code, reason);
+        return;
     }
 
+    scgi_start_response(conn, code, reason);
     scgi_write_header(conn, "Content-Type: text/plain");
     scgi_write_header(conn, "X-Debug-Code: %d", err->code);
     scgi_write_header(conn, "");
     scgi_write_payload(conn, "%s", err->message);
 }
 
-void
-scgi_call_void(struct scgi_conn *conn, const char *method, void *user_data)
+/*
+ * D-Bus calls are made asynchronously, so that one slow call to the camera
+ * daemons doesn't hold up the main loop, and with it every other request and
+ * event stream. The request's response is deferred until the reply arrives,
+ * or the call times out, at which point the reply handler writes it out.
+ */
+struct scgi_call {
+    struct scgi_conn    *conn;
+    scgi_reply_t        reply;
+    void                *closure;
+};
+
+static void
+scgi_call_notify(DBusGProxy *proxy, DBusGProxyCall *call, void *user_data)
 {
-    const char *path = scgi_header_find(conn, "PATH_INFO");
-    DBusGProxy* proxy = user_data;
+    struct scgi_call *pending = user_data;
+    struct scgi_conn *conn = pending->conn;
     GError *error = NULL;
     GHashTable *h;
-    gboolean okay;
-    FILE *fp;
-    char *json;
-    size_t jslen;
 
-    if (!path) {
-        scgi_client_error(conn, 500, "Internal Server Error");
-        return;
+    conn->state = SCGI_STATE_RESPONSE;
+    if (!dbus_g_proxy_end_call(proxy, call, &error, CAM_DBUS_HASH_MAP, &h, G_TYPE_INVALID)) {
+        scgi_error_handler(conn, error);
+        g_error_free(error);
+    }
+    else {
+        pending->reply(conn, h, pending->closure);
+        g_hash_table_destroy(h);
     }
-    if (*path == '/') path++;
 
-    /* Boilerplate to allow cross-origin requests */
-    if (strcmp(method, "OPTIONS") == 0) {
-        scgi_start_response(conn, 200, "OK");
-        scgi_write_xorigin(conn, "GET, POST, OPTION");
-        scgi_write_header(conn, "Content-Type: application/json");
-        scgi_write_header(conn, "");
-        return;
+    /* Send the response, unless the reply handler went on to make another call. */
+    if (conn->state != SCGI_STATE_PENDING) {
+        scgi_finish_response(conn);
     }
+}
 
-    /* PATH_INFO should be the D-Bus method name */
-    okay = dbus_g_proxy_call(proxy, path, &error, G_TYPE_INVALID,
-            CAM_DBUS_HASH_MAP, &h, G_TYPE_INVALID);
-    if (!okay) {
-        scgi_error_handler(conn, error);
-        g_error_free(error);
-        return;
+/*
+ * Start a D-Bus call that returns a dictionary, taking a single argument, or
+ * none if argtype is G_TYPE_INVALID. The arguments are marshalled before this
+ * returns, so the caller may free them right away.
+ */
+int
+scgi_call_begin(struct scgi_conn *conn, DBusGProxy *proxy, const char *method,
+                GType argtype, gconstpointer arg, scgi_reply_t reply, void *closure)
+{
+    struct scgi_call *pending = g_new0(struct scgi_call, 1);
+    DBusGProxyCall *call;
+
+    pending->conn = conn;
+    pending->reply = reply;
+    pending->closure = closure;
+
+    /* With no arguments, the G_TYPE_INVALID argtype terminates the list. */
+    call = dbus_g_proxy_begin_call_with_timeout(proxy, method, scgi_call_notify, pending, g_free,
+            conn->ctx->timeout, argtype, arg, G_TYPE_INVALID);
+    if (!call) {
+        g_free(pending);
+        scgi_client_error(conn, 500, "Internal Server Error");
+        return -1;
     }
+    scgi_defer_response(conn);
+    return 0;
+}
+
+/* Render a D-Bus reply into the JSON response, with the closure giving the cross-origin methods, if any. */
+void
+scgi_json_reply(struct scgi_conn *conn, GHashTable *h, void *closure)
+{
+    const char *allowed = closure;
+    FILE *fp;
+    char *json;
+    size_t jslen;
 
-    /* Render the D-Bus reply into JSON */
     if ((fp = open_memstream(&json, &jslen)) == NULL) {
-        g_hash_table_destroy(h);
         scgi_client_error(conn, 500, "Internal Server Error");
         return;
     }
@@ -241,29 +288,46 @@ scgi_call_void(struct scgi_conn *conn, const char *method, void *user_data)
     json_printf_dict(fp, h, 0);
     fputs("\r\n", fp);
     fclose(fp);
-    g_hash_table_destroy(h);
-    
-    /* Otherwise, keep testing... */
+
     scgi_start_response(conn, 200, "OK");
-    scgi_write_xorigin(conn, "GET, POST, OPTION");
+    if (allowed) scgi_write_xorigin(conn, allowed);
     scgi_write_header(conn, "Content-type: application/json");
     scgi_write_header(conn, "Cache-control: no-cache");
     scgi_write_header(conn, "");
     scgi_take_payload(conn, json, jslen);
 }
 
+void
+scgi_call_void(struct scgi_conn *conn, const char *method, void *user_data)
+{
+    const char *path = scgi_header_find(conn, "PATH_INFO");
+    DBusGProxy* proxy = user_data;
+
+    if (!path) {
+        scgi_client_error(conn, 500, "Internal Server Error");
+        return;
+    }
+    if (*path == '/') path++;
+
+    /* Boilerplate to allow cross-origin requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        scgi_start_response(conn, 200, "OK");
+        scgi_write_xorigin(conn, "GET, POST, OPTION");
+        scgi_write_header(conn, "Content-Type: application/json");
+        scgi_write_header(conn, "");
+        return;
+    }
+
+    /* PATH_INFO should be the D-Bus method name */
+    scgi_call_begin(conn, proxy, path, G_TYPE_INVALID, NULL, scgi_json_reply, (void *)"GET, POST, OPTION");
+}
+
 void
 scgi_call_args(struct scgi_conn *conn, const char *method, void *user_data)
 {
     const char *path = scgi_header_find(conn, "PATH_INFO");
     DBusGProxy* proxy = user_data;
-    GError *error = NULL;
     GValue *params;
-    GHashTable *h;
-    gboolean okay;
-    FILE *fp;
-    char *json;
-    size_t jslen;
 
     if (!path) {
         scgi_client_error(conn, 500, "Internal Server Error");
@@ -289,33 +353,7 @@ scgi_call_args(struct scgi_conn *conn, const char *method, void *user_data)
     }
 
     /* PATH_INFO should be the D-Bus method name */
-    okay = dbus_g_proxy_call(proxy, path, &error,
-            G_VALUE_TYPE(params), g_value_peek_pointer(params), G_TYPE_INVALID,
-            CAM_DBUS_HASH_MAP, &h, G_TYPE_INVALID);
+    scgi_call_begin(conn, proxy, path, G_VALUE_TYPE(params), g_value_peek_pointer(params),
+                    scgi_json_reply, (void *)"GET, POST, OPTION");
     g_free(params);
-    if (!okay) {
-        scgi_error_handler(conn, error);
-        g_error_free(error);
-        return;
-    }
-
-    /* Render the D-Bus reply into JSON */
-    if ((fp = open_memstream(&json, &jslen)) == NULL) {
-        g_hash_table_destroy(h);
-        scgi_client_error(conn, 500, "Internal Server Error");
-        return;
-    }
-    json_newline = "\r\n";
-    json_printf_dict(fp, h, 0);
-    fputs("\r\n", fp);
-    fclose(fp);
-    g_hash_table_destroy(h);
-    
-    /* Otherwise, keep testing... */
-    scgi_start_response(conn, 200, "OK");
-    scgi_write_xorigin(conn, "GET, POST, OPTION");
-    scgi_write_header(conn, "Content-type: application/json");
-    scgi_write_header(conn, "Cache-control: no-cache");
-    scgi_write_header(conn, "");
-    scgi_take_payload(conn, json, jslen);
 }
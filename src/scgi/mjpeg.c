@@ -0,0 +1,223 @@
+/****************************************************************************
+ *  Copyright (C) 2020 Kron Technologies Inc <http://www.krontech.ca>.      *
+ *                                                                          *
+ *  This program is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by    *
+ *  the Free Software Foundation, either version 3 of the License, or       *
+ *  (at your option) any later version.                                     *
+ *                                                                          *
+ *  This program is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU General Public License for more details.                            *
+ *                                                                          *
+ *  You should have received a copy of the GNU General Public License       *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <dbus/dbus-glib.h>
+
+#include "scgi.h"
+#include "shm-frame.h"
+
+#define MJPEG_BOUNDARY      "chronosframe"
+#define MJPEG_POLL_MSEC     10
+
+/*
+ * The live preview frames are JPEG encoded once by the video pipeline and
+ * published into shared memory. We poll for new frames while there are
+ * clients connected, and every client that is ready for more data gets a
+ * reference to the latest frame. Clients that are still busy sending the
+ * previous frame simply skip the new one, so a slow client never holds up
+ * the others.
+ */
+struct mjpeg_frame {
+    int             refcount;
+    uint32_t        sequence;
+    size_t          length;
+    unsigned int    width;
+    unsigned int    height;
+    uint8_t         data[];
+};
+
+struct mjpeg_client {
+    struct mjpeg_client *next;
+    struct scgi_conn    *conn;
+    struct mjpeg_frame  *frame;     /* Frame currently being sent. */
+    uint32_t            sequence;   /* Sequence of the last frame sent. */
+    unsigned long       sent;
+    unsigned long       dropped;    /* Frames skipped while busy sending. */
+};
+
+static struct {
+    struct shm_frame    *shm;
+    struct mjpeg_client *clients;
+    struct mjpeg_frame  *latest;
+    uint32_t            sequence;
+    uint8_t             *scratch;
+    size_t              scratchsize;
+    guint               timer;
+} mjpeg = {
+    .shm = NULL,
+    .clients = NULL,
+    .latest = NULL,
+    .timer = 0,
+};
+
+static void
+mjpeg_frame_unref(struct mjpeg_frame *frame)
+{
+    if (frame && (--frame->refcount == 0)) {
+        g_free(frame);
+    }
+}
+
+static void
+mjpeg_client_send(struct mjpeg_client *client, struct mjpeg_frame *frame)
+{
+    struct scgi_conn *conn = client->conn;
+
+    /* Swap the reference to the frame being sent. */
+    frame->refcount++;
+    mjpeg_frame_unref(client->frame);
+    client->frame = frame;
+    client->sequence = frame->sequence;
+    client->sent++;
+
+    /* Write the part headers inline, and lend out the frame data. */
+    conn->tx.length = 0;
+    conn->tx.offset = 0;
+    scgi_write_header(conn, "");
+    scgi_write_header(conn, "--%s", MJPEG_BOUNDARY);
+    scgi_write_header(conn, "Content-Type: image/jpeg");
+    scgi_write_header(conn, "Content-Length: %zu", frame->length);
+    scgi_write_header(conn, "X-Resolution: %ux%u", frame->width, frame->height);
+    scgi_write_header(conn, "");
+    scgi_stream_send(conn, frame->data, frame->length);
+}
+
+/* The client has finished sending - catch up with the latest frame if we missed it. */
+static void
+mjpeg_client_ready(struct scgi_conn *conn, void *closure)
+{
+    struct mjpeg_client *client = closure;
+    mjpeg_frame_unref(client->frame);
+    client->frame = NULL;
+    if (mjpeg.latest && (mjpeg.latest->sequence != client->sequence)) {
+        mjpeg_client_send(client, mjpeg.latest);
+    }
+}
+
+static void
+mjpeg_client_close(struct scgi_conn *conn, void *closure)
+{
+    struct mjpeg_client *client = closure;
+    struct mjpeg_client **pp;
+
+    for (pp = &mjpeg.clients; *pp; pp = &(*pp)->next) {
+        if (*pp == client) {
+            *pp = client->next;
+            break;
+        }
+    }
+#ifdef DEBUG
+    fprintf(stderr, "DEBUG: MJPEG client closed after %lu frames (%lu dropped)\n", client->sent, client->dropped);
+#endif
+    mjpeg_frame_unref(client->frame);
+    g_free(client);
+
+    /* Stop polling and release the last frame when nobody is watching. */
+    if (!mjpeg.clients) {
+        if (mjpeg.timer) g_source_remove(mjpeg.timer);
+        mjpeg.timer = 0;
+        mjpeg_frame_unref(mjpeg.latest);
+        mjpeg.latest = NULL;
+    }
+}
+
+static gboolean
+mjpeg_poll(gpointer user_data)
+{
+    struct mjpeg_frame *frame;
+    struct mjpeg_client *client;
+    unsigned int width, height;
+    ssize_t length;
+
+    /* Connect to the shared memory once the video pipeline has created it. */
+    if (!mjpeg.shm) {
+        mjpeg.shm = shm_frame_open(SHM_FRAME_PREVIEW);
+        if (!mjpeg.shm) {
+            return TRUE;
+        }
+        mjpeg.scratchsize = mjpeg.shm->hdr->size;
+        mjpeg.scratch = g_malloc(mjpeg.scratchsize);
+    }
+
+    /* Check for a new frame. */
+    length = shm_frame_read(mjpeg.shm, &mjpeg.sequence, mjpeg.scratch, mjpeg.scratchsize, &width, &height);
+    if (length <= 0) {
+        return TRUE;
+    }
+    frame = g_malloc(sizeof(struct mjpeg_frame) + length);
+    frame->refcount = 1;
+    frame->sequence = mjpeg.sequence;
+    frame->length = length;
+    frame->width = width;
+    frame->height = height;
+    memcpy(frame->data, mjpeg.scratch, length);
+    mjpeg_frame_unref(mjpeg.latest);
+    mjpeg.latest = frame;
+
+    /* Hand it out to the idle clients, and drop it for the busy ones. */
+    for (client = mjpeg.clients; client; client = client->next) {
+        if (scgi_stream_busy(client->conn)) {
+            client->dropped++;
+            continue;
+        }
+        mjpeg_client_send(client, frame);
+    }
+    return TRUE;
+}
+
+/* Serve the live preview as a multipart/x-mixed-replace stream of JPEG images. */
+void
+scgi_mjpeg(struct scgi_conn *conn, const char *method, void *user_data)
+{
+    struct mjpeg_client *client;
+
+    /* Boilerplate to allow cross-origin requests */
+    if (strcmp(method, "OPTIONS") == 0) {
+        scgi_start_response(conn, 200, "OK");
+        scgi_write_xorigin(conn, "GET, OPTION");
+        scgi_write_header(conn, "Content-Type: multipart/x-mixed-replace; boundary=%s", MJPEG_BOUNDARY);
+        scgi_write_header(conn, "");
+        return;
+    }
+    else if (strcmp(method, "GET") != 0) {
+        scgi_start_response(conn, 405, "Method Not Allowed");
+        scgi_write_header(conn, "Accept: GET, OPTION");
+        scgi_write_header(conn, "");
+        return;
+    }
+
+    client = g_malloc0(sizeof(struct mjpeg_client));
+    client->conn = conn;
+    client->sequence = 1; /* Stable sequence numbers are even, so the latest frame is always new. */
+    client->next = mjpeg.clients;
+    mjpeg.clients = client;
+    if (!mjpeg.timer) {
+        mjpeg.timer = g_timeout_add(MJPEG_POLL_MSEC, mjpeg_poll, NULL);
+    }
+
+    scgi_start_response(conn, 200, "OK");
+    scgi_write_xorigin(conn, "GET, OPTION");
+    scgi_write_header(conn, "Content-Type: multipart/x-mixed-replace; boundary=%s", MJPEG_BOUNDARY);
+    scgi_write_header(conn, "Cache-Control: no-cache");
+    scgi_write_header(conn, "X-Accel-Buffering: no");
+    /* The blank line ending the headers is written at the start of each part. */
+    scgi_start_stream(conn, mjpeg_client_ready, mjpeg_client_close, client);
+}
@@ -87,6 +87,15 @@ scgi_send_more(struct scgi_conn *conn)
             length = conn->tx.length - conn->tx.offset;
             break;
 
+        case SCGI_STATE_STREAM:
+            buffer = conn->tx.buffer + conn->tx.offset;
+            length = conn->tx.length - conn->tx.offset;
+            if (length > 0) break;
+            /* Send the borrowed data once the inline data is done. */
+            buffer = (char *)conn->tx.ref + conn->tx.refoffset;
+            length = conn->tx.reflen - conn->tx.refoffset;
+            break;
+
         default:
             /* don't send anything */
             return 0;
@@ -118,7 +127,12 @@ scgi_send_done(GObject *obj, GAsyncResult *result, gpointer user_data)
         return;
     }
 
-    conn->tx.offset += count;
+    /* Streams may be sending the borrowed data. */
+    if ((conn->state == SCGI_STATE_STREAM) && (conn->tx.offset >= conn->tx.length)) {
+        conn->tx.refoffset += count;
+    } else {
+        conn->tx.offset += count;
+    }
     switch (conn->state) {
         case SCGI_STATE_RESPONSE:
         case SCGI_STATE_EXTRA:
@@ -139,6 +153,18 @@ scgi_send_done(GObject *obj, GAsyncResult *result, gpointer user_data)
             scgi_send_more(conn);
             break;
 
+        case SCGI_STATE_STREAM:
+            if (scgi_send_more(conn) == 0) {
+                /* Everything has been sent, release the borrowed data and ask for more. */
+                conn->tx.length = 0;
+                conn->tx.offset = 0;
+                conn->tx.ref = NULL;
+                conn->tx.reflen = 0;
+                conn->tx.refoffset = 0;
+                if (conn->stream_ready) conn->stream_ready(conn, conn->stream_closure);
+            }
+            break;
+
         default:
             break;
     }
@@ -282,6 +308,11 @@ scgi_conn_destroy(struct scgi_conn *conn)
     if (conn->prev) conn->prev->next = conn->next;
     else conn->ctx->head = conn->next;
 
+    /* Let the stream owner release anything it lent us. */
+    if (conn->stream_close) {
+        conn->stream_close(conn, conn->stream_closure);
+    }
+
     /* If the body points outside of the inline buffer, free it. */
     if (conn->rx.body) {
         char *bufend = &conn->rx.buffer[sizeof(conn->rx.buffer)];
@@ -385,6 +416,7 @@ scgi_server_ctx(GSocketService *service, scgi_request_t hook, void *closure)
     ctx->hook = hook;
     ctx->closure = closure;
     ctx->service = service;
+    ctx->timeout = SCGI_DEFAULT_TIMEOUT;
     g_signal_connect(ctx->service, "incoming", G_CALLBACK(scgi_accept), ctx);
     return ctx;
 }
@@ -467,6 +499,68 @@ scgi_take_payload(struct scgi_conn *conn, void *data, size_t len)
     conn->tx.extralen = len;
 }
 
+/*
+ * Hold off on sending the response while the request waits on an asynchronous
+ * operation, such as a D-Bus call, so the main loop can carry on serving other
+ * connections in the meantime. Once the response has been written, it must be
+ * sent by calling scgi_finish_response().
+ */
+void
+scgi_defer_response(struct scgi_conn *conn)
+{
+    conn->state = SCGI_STATE_PENDING;
+}
+
+/* Send the response to a deferred request, and close the connection when done. */
+void
+scgi_finish_response(struct scgi_conn *conn)
+{
+    GError *error = NULL;
+
+    conn->state = SCGI_STATE_RESPONSE;
+    if (scgi_send_more(conn) == 0) {
+        /* Nothing to send - cleanup */
+        g_io_stream_close(G_IO_STREAM(conn->sock), NULL, &error);
+        scgi_conn_destroy(conn);
+    }
+}
+
+/*
+ * Switch the connection into a long-lived stream once the response headers
+ * have been written. The ready hook is called whenever the connection has
+ * finished sending and can accept more data.
+ */
+void
+scgi_start_stream(struct scgi_conn *conn, scgi_stream_t ready, scgi_stream_t close, void *closure)
+{
+    conn->state = SCGI_STATE_STREAM;
+    conn->stream_ready = ready;
+    conn->stream_close = close;
+    conn->stream_closure = closure;
+}
+
+/*
+ * Send the inline data, followed by data borrowed from the caller, which must
+ * remain valid until the ready or close hook is called. The caller should reset
+ * tx.length before writing any inline data, and only send when not busy.
+ */
+void
+scgi_stream_send(struct scgi_conn *conn, const void *data, size_t len)
+{
+    conn->tx.ref = data;
+    conn->tx.reflen = len;
+    conn->tx.refoffset = 0;
+    scgi_send_more(conn);
+}
+
+int
+scgi_stream_busy(struct scgi_conn *conn)
+{
+    if (conn->tx.offset < conn->tx.length) return 1;
+    if (conn->tx.refoffset < conn->tx.reflen) return 1;
+    return g_output_stream_has_pending(conn->ostream);
+}
+
 const char *
 scgi_header_find(struct scgi_conn *conn, const char *name)
 {
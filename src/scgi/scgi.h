@@ -27,6 +27,14 @@
 #define SCGI_STATE_RESPONSE     3   /* Sending the inline SCGI response data and closing when empty. */
 #define SCGI_STATE_EXTRA        4   /* Sending extra body data after the inline response data. */
 #define SCGI_STATE_SUBSCRIBE    5   /* Subscribed an SSE event stream */
+#define SCGI_STATE_STREAM       6   /* Streaming borrowed data after the inline data, without closing. */
+#define SCGI_STATE_PENDING      7   /* Waiting on an asynchronous call before sending the response. */
+
+#define SCGI_DEFAULT_TIMEOUT    10000   /* D-Bus call timeout in milliseconds. */
+#define SCGI_DEFAULT_CACHE_AGE  1000    /* Maximum age of cached parameters in milliseconds. */
+
+struct scgi_conn;
+typedef void (*scgi_stream_t)(struct scgi_conn *conn, void *closure);
 
 struct scgi_header {
     const char *name;
@@ -66,7 +74,15 @@ struct scgi_conn {
         char buffer[1024];  /* Inline data to be sent directly */
         char *extra;        /* Extra data allocated for the response body */
         size_t extralen;    /* Length of extra data for the response body */
+        const void *ref;    /* Borrowed data to send after the inline data when streaming */
+        size_t reflen;      /* Length of the borrowed data */
+        size_t refoffset;   /* Offset of sent borrowed data */
     } tx;
+
+    /* Streaming response hooks. */
+    scgi_stream_t   stream_ready;   /* Called when all stream data has been sent. */
+    scgi_stream_t   stream_close;   /* Called when the connection is destroyed. */
+    void            *stream_closure;
 };
 
 typedef void (*scgi_request_t)(struct scgi_conn *conn, const char *method, void *closure);
@@ -88,6 +104,7 @@ struct scgi_ctx {
     scgi_request_t  hook;
     void            *closure;
     GSocketService  *service;
+    int             timeout;    /* D-Bus call timeout in milliseconds. */
 };
 
 struct scgi_ctx *scgi_server_ctx(GSocketService *service, scgi_request_t hook, void *closure);
@@ -102,16 +119,71 @@ void scgi_write_payload(struct scgi_conn *conn, const char *fmt, ...);
 void scgi_take_payload(struct scgi_conn *conn, void *data, size_t len);
 void scgi_write_xorigin(struct scgi_conn *conn, const char *allowed);
 
+void scgi_defer_response(struct scgi_conn *conn);
+void scgi_finish_response(struct scgi_conn *conn);
+
+void scgi_start_stream(struct scgi_conn *conn, scgi_stream_t ready, scgi_stream_t close, void *closure);
+void scgi_stream_send(struct scgi_conn *conn, const void *data, size_t len);
+int scgi_stream_busy(struct scgi_conn *conn);
+
 const char *scgi_header_find(struct scgi_conn *conn, const char *name);
 
 char *scgi_urldecode(char *input);
 
 /* D-Bus Methods and Signal Handlers */
+typedef void (*scgi_reply_t)(struct scgi_conn *conn, GHashTable *reply, void *closure);
+
 void scgi_introspect(struct scgi_ctx *ctx, DBusGConnection* bus, DBusGProxy *proxy);
 void scgi_signal_handler(DBusGProxy* proxy, GHashTable *args, const char *name);
+int scgi_error_status(GError *error, const char **reason);
 void scgi_error_handler(struct scgi_conn *conn, GError *error);
 GValue *scgi_parse_params(struct scgi_conn *conn, const char *method);
+int scgi_call_begin(struct scgi_conn *conn, DBusGProxy *proxy, const char *method,
+                    GType argtype, gconstpointer arg, scgi_reply_t reply, void *closure);
+void scgi_json_reply(struct scgi_conn *conn, GHashTable *reply, void *closure);
 void scgi_call_void(struct scgi_conn *conn, const char *method, void *user_data);
 void scgi_call_args(struct scgi_conn *conn, const char *method, void *user_data);
 
+/* Parameter cache */
+struct scgi_cache {
+    GHashTable  *entries;   /* Parameter values by name. */
+    GPtrArray   *keys;      /* Names of all parameters in the API, or NULL if not yet known. */
+    gint64      maxage;     /* Maximum age of a value in microseconds, or zero if disabled. */
+
+    struct {
+        unsigned long   hits;       /* Requests served entirely from the cache. */
+        unsigned long   misses;     /* Requests that needed a D-Bus call. */
+        unsigned long   fetched;    /* Values stored from get replies. */
+        unsigned long   updates;    /* Values stored from update signals. */
+        unsigned long   expired;    /* Values dropped for reaching the maximum age. */
+        unsigned long   invalidated;/* Values dropped because they were being set. */
+        unsigned long   flushes;    /* Times the daemon restarted. */
+        gint64          agesum;     /* Total age of the oldest value served by each hit. */
+        gint64          agemax;     /* Oldest value ever served. */
+    } stats;
+};
+
+struct scgi_cache *scgi_cache_new(int maxage);
+void scgi_cache_flush(struct scgi_cache *cache);
+void scgi_cache_store(struct scgi_cache *cache, GHashTable *values, gboolean signalled);
+void scgi_cache_invalidate(struct scgi_cache *cache, GHashTable *values);
+GHashTable *scgi_cache_lookup(struct scgi_cache *cache, GPtrArray *names, GPtrArray *missing);
+GPtrArray *scgi_cache_keys(struct scgi_cache *cache);
+void scgi_cache_store_keys(struct scgi_cache *cache, GHashTable *available);
+GHashTable *scgi_cache_metrics(struct scgi_cache *cache);
+
+/* Batch requests */
+#define SCGI_BATCH_IFACES   2
+
+struct scgi_batch_iface {
+    const char          *name;      /* Short name of the interface in batch operations. */
+    DBusGProxy          *proxy;
+    struct scgi_cache   *cache;     /* Parameter cache for the interface, or NULL for none. */
+};
+
+void scgi_batch(struct scgi_conn *conn, const char *method, void *user_data);
+
+/* Live preview streaming */
+void scgi_mjpeg(struct scgi_conn *conn, const char *method, void *user_data);
+
 #endif /* __SCGI_H */